@@ -0,0 +1,192 @@
+#!/usr/bin/perl
+
+# Benchmark for dyups updates: 5000 upstreams of 32 servers, updated at
+# 100 per second, with and without dyups_shared_peers.
+#
+# The time of the update requests, the time for the last update to reach all
+# the workers and the CPU time spent by the workers are reported with
+# diag().
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+use Time::HiRes qw/ time sleep /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib '../../tests/nginx-tests/nginx-tests/lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $upstreams = $ENV{TEST_NGINX_BENCH_UPSTREAMS} || 5000;
+my $servers = $ENV{TEST_NGINX_BENCH_SERVERS} || 32;
+my $rate = 100;
+my $seconds = 10;
+
+my $t = Test::Nginx->new()->has(qw/http proxy upstream_zone dyups/)->plan(2);
+
+###############################################################################
+
+for my $shared ('off', 'on') {
+	$t->write_file_expand('nginx.conf', <<"EOF");
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+worker_processes 8;
+
+events {
+    accept_mutex off;
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    dyups_shared_peers $shared;
+    dyups_shm_zone_size 128m;
+    dyups_read_msg_timeout 100ms;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass http://\$host;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+            dyups_interface;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8082;
+        listen       127.0.0.1:8083;
+        server_name  localhost;
+
+        location / {
+            return 200 \$server_port;
+        }
+    }
+}
+
+EOF
+
+	$t->run();
+
+	my $failed = 0;
+
+	for my $n (1 .. $upstreams) {
+		$failed++ unless update("u$n", 8082) =~ /success/;
+	}
+
+	# updates at a fixed rate, each one rewriting a random upstream
+
+	my ($spent, $max, $count) = (0, 0, 0);
+	my $start = time();
+
+	while (time() - $start < $seconds) {
+		my $begin = time();
+
+		$failed++ unless update('u' . (1 + int(rand($upstreams))), 8083)
+			=~ /success/;
+
+		my $d = time() - $begin;
+		$spent += $d;
+		$max = $d if $d > $max;
+		$count++;
+
+		my $next = $start + $count / $rate;
+		sleep($next - time()) if $next > time();
+	}
+
+	# the time until every worker serves the last update
+
+	update("u$upstreams", 8083);
+	my $sync = time();
+
+	for (1 .. 200) {
+		my $ok = grep { get_body("u$upstreams") eq '8083' } 1 .. 16;
+		last if $ok == 16;
+		sleep(0.05);
+	}
+
+	$sync = time() - $sync;
+
+	diag(sprintf("shared %s: %d upstreams, %d servers, %d updates, "
+		. "update avg %.2fms max %.2fms, sync %.2fs, workers cpu %.2fs",
+		$shared, $upstreams, $servers, $count, $spent / $count * 1000,
+		$max * 1000, $sync, workers_cpu($t->read_file('nginx.pid'))));
+
+	is($failed, 0, "updates, shared $shared");
+
+	$t->stop();
+}
+
+###############################################################################
+
+sub update {
+	my ($name, $port) = @_;
+	my $body = join ' ', map { "server 127.0.0.1:$port weight=$_;" }
+		1 .. $servers;
+	my $len = length($body);
+
+	return http(<<EOF, socket => IO::Socket::INET->new('127.0.0.1:8081'))
+POST /upstream/$name HTTP/1.0
+Host: localhost
+Content-Length: $len
+
+$body
+EOF
+		|| '';
+}
+
+# user and system time of all the workers, in seconds
+
+sub workers_cpu {
+	my ($master) = @_;
+	my $ticks = 0;
+
+	chomp $master;
+
+	for my $stat (glob('/proc/[0-9]*/stat')) {
+		open my $fh, '<', $stat or next;
+		my @f = split / /, (<$fh> =~ s/^.*\) //r);
+		close $fh;
+
+		# fields after the command: state, ppid, ..., utime (12), stime (13)
+
+		$ticks += $f[11] + $f[12] if $f[1] == $master;
+	}
+
+	return $ticks / 100;
+}
+
+sub get_body {
+	my ($host) = @_;
+
+	my $r = http(<<EOF) || '';
+GET / HTTP/1.0
+Host: $host
+
+EOF
+
+	$r =~ /\x0d\x0a\x0d\x0a(.*)/ms;
+
+	return $1 || '';
+}
+
+###############################################################################
@@ -0,0 +1,178 @@
+#!/usr/bin/perl
+
+# Benchmark for the io_uring event module against epoll: small responses
+# over many short connections, and large files read with "aio on".
+#
+# The requests per second and the CPU time spent by the workers are reported
+# with diag().  The page cache is dropped before the large file runs, if
+# permitted.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+use POSIX qw/ _exit /;
+use Time::HiRes qw/ time /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib '../../tests/nginx-tests/nginx-tests/lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $clients = $ENV{TEST_NGINX_BENCH_CLIENTS} || 16;
+my $seconds = $ENV{TEST_NGINX_BENCH_SECONDS} || 5;
+my $files = 64;
+
+my $t = Test::Nginx->new()->has(qw/http/)->plan(4);
+
+# the pid and the error log are set in the configuration, so the debug log
+# of the test globals is not used
+
+$t->test_globals();
+
+$t->write_file('small', 'x' x 128);
+$t->write_file("large$_", 'x' x (4 * 1024 * 1024)) for 1 .. $files;
+
+###############################################################################
+
+for my $use ('epoll', 'io_uring') {
+	$t->write_file_expand('nginx.conf', <<"EOF");
+
+pid %%TESTDIR%%/nginx.pid;
+error_log %%TESTDIR%%/error.log notice;
+
+daemon off;
+
+worker_processes 4;
+
+events {
+    use $use;
+    worker_connections 4096;
+    accept_mutex off;
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    access_log off;
+
+    server {
+        listen       127.0.0.1:8080 backlog=4096;
+        server_name  localhost;
+
+        location / {
+            aio on;
+            sendfile off;
+            output_buffers 2 256k;
+        }
+    }
+}
+
+EOF
+
+	$t->run();
+
+	my ($count, $failed) = bench(sub { '/small' });
+
+	diag(sprintf("%s small: %d requests, %.0f r/s, workers cpu %.2fs",
+		$use, $count, $count / $seconds, workers_cpu($t)));
+
+	is($failed, 0, "small, $use");
+
+	system('sync; echo 1 > /proc/sys/vm/drop_caches 2> /dev/null');
+
+	my $cpu = workers_cpu($t);
+
+	($count, $failed) = bench(sub { '/large' . (1 + int(rand($files))) });
+
+	diag(sprintf("%s large: %d requests, %.1f MB/s, workers cpu %.2fs",
+		$use, $count, $count * 4 / $seconds, workers_cpu($t) - $cpu));
+
+	is($failed, 0, "large, $use");
+
+	$t->stop();
+}
+
+###############################################################################
+
+# requests from forked clients for the given time, each client reports
+# its counts through a pipe
+
+sub bench {
+	my ($uri) = @_;
+	my (@pipes, @pids);
+
+	for (1 .. $clients) {
+		pipe(my $r, my $w) or die "Can't create pipe: $!\n";
+
+		my $pid = fork();
+		die "Can't fork: $!\n" unless defined $pid;
+
+		if ($pid == 0) {
+			close $r;
+
+			my ($count, $failed) = (0, 0);
+			my $end = time() + $seconds;
+
+			while (time() < $end) {
+				my $res = http_get($uri->()) || '';
+				$res =~ /200 OK/ ? $count++ : $failed++;
+			}
+
+			print $w "$count $failed\n";
+			close $w;
+
+			# no destructors, they would stop nginx
+
+			_exit(0);
+		}
+
+		close $w;
+		push @pipes, $r;
+		push @pids, $pid;
+	}
+
+	my ($count, $failed) = (0, 0);
+
+	for my $r (@pipes) {
+		my ($c, $f) = split ' ', (<$r> || '0 1');
+		$count += $c;
+		$failed += $f;
+		close $r;
+	}
+
+	waitpid($_, 0) for @pids;
+
+	return ($count, $failed);
+}
+
+# user and system time of all the workers, in seconds
+
+sub workers_cpu {
+	my ($t) = @_;
+	my $ticks = 0;
+	my $master = $t->read_file('nginx.pid');
+
+	chomp $master;
+
+	for my $stat (glob('/proc/[0-9]*/stat')) {
+		open my $fh, '<', $stat or next;
+		my @f = split / /, (<$fh> =~ s/^.*\) //r);
+		close $fh;
+
+		# fields after the command: state, ppid, ..., utime (12), stime (13)
+
+		$ticks += $f[11] + $f[12] if $f[1] == $master;
+	}
+
+	return $ticks / 100;
+}
+
+###############################################################################
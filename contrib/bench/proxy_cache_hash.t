@@ -0,0 +1,143 @@
+#!/usr/bin/perl
+
+# Benchmark for cache keys lookups, with and without the "keys_hash"
+# parameter of proxy_cache_path.
+#
+# The cache is loaded from an index of TEST_NGINX_BENCH_KEYS keys (1000000
+# by default, 10000000 needs about 2G of memory, 100000000 about 16G).  The
+# keys are added once, and then added again, to measure the time of lookups
+# alone; the times are reported with diag().
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+use Digest::MD5 qw/ md5 /;
+use Time::HiRes qw/ time sleep /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib '../../tests/nginx-tests/nginx-tests/lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $keys = $ENV{TEST_NGINX_BENCH_KEYS} || 1000000;
+my $zone = int($keys * 160 / 1048576) + 16;
+
+my $t = Test::Nginx->new()->has(qw/http proxy cache/)->plan(2);
+
+###############################################################################
+
+# the index header written by nginx, with the file system block size
+
+write_conf($t, 'off');
+
+$t->run();
+
+for (1 .. 500) {
+	last if -s $t->testdir() . '/cache/index';
+	sleep(0.01);
+}
+
+$t->stop();
+
+my $header = substr($t->read_file('cache/index'), 0, 40);
+
+for my $hash ('off', 'on') {
+	write_conf($t, $hash);
+
+	my $add = load($t, $header, 1);
+	my $all = load($t, $header, 2);
+
+	ok($add && $all, "loaded, keys_hash $hash");
+
+	diag(sprintf("keys_hash %s: %d keys, add %.2fs, lookup %.2fs, "
+		. "%.0fns per lookup", $hash, $keys, $add, $all - $add,
+		($all - $add) / $keys * 1e9));
+}
+
+###############################################################################
+
+sub write_conf {
+	my ($t, $hash) = @_;
+
+	$t->write_file_expand('nginx.conf', <<"EOF");
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    proxy_cache_path   %%TESTDIR%%/cache  keys_zone=NAME:${zone}m
+                       index=%%TESTDIR%%/cache/index  keys_hash=$hash
+                       manager_sleep=1ms  manager_threshold=60s;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+        }
+    }
+}
+
+EOF
+}
+
+# the cache is loaded from an index with each key added "passes" times,
+# the time until the cache is loaded is returned
+
+sub load {
+	my ($t, $header, $passes) = @_;
+
+	my $expire = time() + 3600;
+
+	open my $fh, '>', $t->testdir() . '/cache/index' or die "index: $!";
+	binmode $fh;
+	print $fh $header;
+
+	for (1 .. $passes) {
+		for my $n (1 .. $keys) {
+			print $fh pack('a16 Q q q q S S C x3',
+				md5("k$n"), $n, 4096, $expire, $expire, 0, 0, 1);
+		}
+	}
+
+	print $fh pack('a16 Q q q q S S C x3', '', 0, 0, 0, 0, 0, 0, 3);
+	close $fh;
+
+	$t->write_file('error.log', '');
+
+	my $start = time();
+	my $loaded;
+
+	$t->run();
+
+	for (1 .. 60000) {
+		if ($t->read_file('error.log') =~ /index: "/) {
+			$loaded = time() - $start;
+			last;
+		}
+
+		sleep(0.01);
+	}
+
+	$t->stop();
+
+	return $loaded;
+}
+
+###############################################################################
@@ -0,0 +1,251 @@
+#!/usr/bin/perl
+
+# Benchmark for send_zerocopy: large proxied responses sent to the clients
+# with and without MSG_ZEROCOPY.
+#
+# The throughput and the CPU time spent by the worker per gigabyte sent are
+# reported with diag() for each response size, with send_zerocopy on and
+# off.
+#
+# Note that the kernel copies the data delivered to the local sockets
+# anyway, and reports it with the completions, then zero-copy sends are
+# stopped on the connection.  So with the clients on the same host the
+# numbers show the cost of the first sends and of the completions only,
+# the copying saved is seen with a network device between them.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+use POSIX qw/ _exit /;
+use Time::HiRes qw/ time /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib '../../tests/nginx-tests/nginx-tests/lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $clients = $ENV{TEST_NGINX_BENCH_CLIENTS} || 4;
+my $seconds = $ENV{TEST_NGINX_BENCH_SECONDS} || 5;
+my @sizes = (1, 4, 16);
+
+my $t = Test::Nginx->new()->has(qw/http proxy/)->plan(2 * @sizes);
+
+# the pid and the error log are set in the configuration, so the debug log
+# of the test globals is not used
+
+$t->test_globals();
+
+$t->write_file_expand('nginx.conf', <<"EOF");
+
+pid %%TESTDIR%%/nginx.pid;
+error_log %%TESTDIR%%/error.log notice;
+
+daemon off;
+
+worker_processes 1;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    access_log off;
+
+    keepalive_requests 1000000;
+
+    proxy_http_version 1.1;
+    proxy_set_header Connection "";
+    proxy_buffers 32 64k;
+    proxy_max_temp_file_size 0;
+
+    upstream backend {
+        server 127.0.0.1:8081;
+        keepalive 16;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        send_zerocopy on;
+
+        location / {
+            proxy_pass http://backend;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8082;
+        server_name  localhost;
+
+        send_zerocopy off;
+
+        location / {
+            proxy_pass http://backend;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        sendfile on;
+
+        location / {
+        }
+    }
+}
+
+EOF
+
+for my $size (@sizes) {
+	$t->write_file("${size}m.bin", 'x' x ($size * 1024 * 1024));
+}
+
+$t->run();
+
+###############################################################################
+
+for my $size (@sizes) {
+	for my $port (8080, 8082) {
+		my $mode = $port == 8080 ? 'on' : 'off';
+		my $uri = "/${size}m.bin";
+
+		my $cpu = workers_cpu($t);
+		my ($count, $failed) = bench($port, $uri, $size * 1024 * 1024);
+		$cpu = workers_cpu($t) - $cpu;
+
+		my $gb = $count * $size / 1024;
+
+		diag(sprintf("%dm responses, send_zerocopy %s: %d requests, "
+			. "%.0f MB/s, worker cpu %.3fs per GB",
+			$size, $mode, $count, $count * $size / $seconds,
+			$gb ? $cpu / $gb : 0));
+
+		is($failed, 0, "${size}m, send_zerocopy $mode");
+	}
+}
+
+###############################################################################
+
+# keepalive requests from forked clients for the given time, each client
+# reports its counts through a pipe
+
+sub bench {
+	my ($port, $uri, $length) = @_;
+	my (@pipes, @pids);
+
+	for my $n (1 .. $clients) {
+		pipe(my $r, my $w) or die "Can't create pipe: $!\n";
+
+		my $pid = fork();
+		die "Can't fork: $!\n" unless defined $pid;
+
+		if ($pid == 0) {
+			close $r;
+
+			my ($count, $failed) = (0, 0);
+			my $end = time() + $seconds;
+
+			my $s = IO::Socket::INET->new('127.0.0.1:' . port($port));
+
+			while ($s && time() < $end) {
+				$s->syswrite("GET $uri HTTP/1.1\r\nHost: localhost\r\n\r\n");
+
+				my ($buf, $got, $header) = ('', 0);
+
+				while (!defined $header || $got < $length) {
+					$s->sysread($buf, 1024 * 1024) or last;
+
+					if (!defined $header) {
+						$header = $buf =~ s/^.*?\x0d\x0a\x0d\x0a//s
+							? 1 : undef;
+						next unless $header;
+					}
+
+					$got += length $buf;
+				}
+
+				if ($got == $length) {
+					$count++;
+					next;
+				}
+
+				$failed++;
+				last;
+			}
+
+			print $w "$count $failed\n";
+			close $w;
+
+			# no destructors, they would stop nginx
+
+			_exit(0);
+		}
+
+		close $w;
+		push @pipes, $r;
+		push @pids, $pid;
+	}
+
+	my ($count, $failed) = (0, 0);
+
+	for my $r (@pipes) {
+		my ($c, $f) = split ' ', (<$r> || '0 1');
+		$count += $c;
+		$failed += $f;
+		close $r;
+	}
+
+	waitpid($_, 0) for @pids;
+
+	return ($count, $failed);
+}
+
+# user and system time of all the workers, in seconds
+
+sub workers_cpu {
+	my ($t) = @_;
+	my $ticks = 0;
+
+	for my $pid (workers($t)) {
+		open my $fh, '<', "/proc/$pid/stat" or next;
+		my @f = split / /, (<$fh> =~ s/^.*\) //r);
+		close $fh;
+
+		# fields after the command: state, ppid, ..., utime (12), stime (13)
+
+		$ticks += $f[11] + $f[12];
+	}
+
+	return $ticks / 100;
+}
+
+sub workers {
+	my ($t) = @_;
+	my @pids;
+	my $master = $t->read_file('nginx.pid');
+
+	chomp $master;
+
+	for my $stat (glob('/proc/[0-9]*/stat')) {
+		open my $fh, '<', $stat or next;
+		my @f = split / /, (<$fh> =~ s/^.*\) //r);
+		close $fh;
+
+		push @pids, $stat =~ m!/proc/(\d+)/! if $f[1] == $master;
+	}
+
+	return @pids;
+}
+
+###############################################################################
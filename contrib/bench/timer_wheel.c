@@ -0,0 +1,174 @@
+
+/*
+ * Copyright (C) 2010-2026 Alibaba Group Holding Limited
+ */
+
+
+/*
+ * Benchmark of the event timers with the timer wheel and without it: the
+ * timers of many events are added, re-armed, deleted and expired, in the
+ * process, without sockets.  The number of events is the first argument,
+ * one million by default.
+ *
+ * It is built after ./configure from the top directory, e.g.
+ *
+ *     cc -O2 -I src/core -I src/event -I src/event/modules -I src/os/unix \
+ *        -I src/proc -I objs -o timer_wheel contrib/bench/timer_wheel.c \
+ *        src/core/ngx_rbtree.c src/event/ngx_event_timer.c
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+#define NGX_BENCH_TIMEOUT  60000
+#define NGX_BENCH_SPREAD   10000
+#define NGX_BENCH_STEP     10
+
+
+volatile ngx_msec_t  ngx_current_msec;
+
+static ngx_log_t     ngx_bench_log;
+static ngx_cycle_t   ngx_bench_cycle;
+static ngx_uint_t    ngx_bench_expired;
+
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+static void
+ngx_bench_handler(ngx_event_t *ev)
+{
+    ngx_bench_expired++;
+}
+
+
+static double
+ngx_bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static void
+ngx_bench_report(const char *mode, const char *op, double start, ngx_uint_t n)
+{
+    printf("%-10s %-8s %8.1f ns/op\n", mode, op,
+           (ngx_bench_now() - start) / n);
+}
+
+
+static void
+ngx_bench_run(const char *mode, ngx_event_t *events, ngx_uint_t n)
+{
+    double      start;
+    ngx_uint_t  i;
+
+    ngx_current_msec = 1000000;
+
+    /* keepalive timeouts, spread over NGX_BENCH_SPREAD ms */
+
+    start = ngx_bench_now();
+
+    for (i = 0; i < n; i++) {
+        ngx_add_timer(&events[i],
+                      NGX_BENCH_TIMEOUT + i * 7919 % NGX_BENCH_SPREAD);
+    }
+
+    ngx_bench_report(mode, "add", start, n);
+
+    /* each timer is moved farther than NGX_TIMER_LAZY_DELAY, a del and add */
+
+    ngx_current_msec += 2 * NGX_TIMER_LAZY_DELAY;
+
+    start = ngx_bench_now();
+
+    for (i = 0; i < n; i++) {
+        ngx_add_timer(&events[i],
+                      NGX_BENCH_TIMEOUT + i * 7919 % NGX_BENCH_SPREAD);
+    }
+
+    ngx_bench_report(mode, "re-arm", start, n);
+
+    start = ngx_bench_now();
+
+    for (i = 0; i < n; i++) {
+        ngx_del_timer(&events[i]);
+    }
+
+    ngx_bench_report(mode, "del", start, n);
+
+    /* all the timers expire while the time goes by NGX_BENCH_STEP ms */
+
+    for (i = 0; i < n; i++) {
+        ngx_add_timer(&events[i],
+                      NGX_BENCH_TIMEOUT + i * 7919 % NGX_BENCH_SPREAD);
+    }
+
+    ngx_bench_expired = 0;
+
+    start = ngx_bench_now();
+
+    while (ngx_bench_expired < n) {
+        ngx_current_msec += NGX_BENCH_STEP;
+
+        (void) ngx_event_find_timer();
+        ngx_event_expire_timers();
+    }
+
+    ngx_bench_report(mode, "expire", start, n);
+}
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    ngx_uint_t    i, n;
+    ngx_event_t  *events;
+
+    n = (argc > 1) ? (ngx_uint_t) atoi(argv[1]) : 1000000;
+
+    if (n == 0) {
+        fprintf(stderr, "usage: %s [events]\n", argv[0]);
+        return 1;
+    }
+
+    events = calloc(n, sizeof(ngx_event_t));
+    if (events == NULL) {
+        fprintf(stderr, "calloc() failed\n");
+        return 1;
+    }
+
+    ngx_bench_log.log_level = NGX_LOG_NOTICE;
+    ngx_bench_cycle.log = &ngx_bench_log;
+
+    for (i = 0; i < n; i++) {
+        events[i].handler = ngx_bench_handler;
+        events[i].log = &ngx_bench_log;
+    }
+
+    ngx_event_timer_init(&ngx_bench_log);
+
+    printf("%lu events\n", (unsigned long) n);
+
+    ngx_bench_run("rbtree", events, n);
+
+#if (T_NGX_TIMER_WHEEL)
+    ngx_event_timer_wheel_init(&ngx_bench_cycle);
+    ngx_bench_run("wheel", events, n);
+#endif
+
+    free(events);
+
+    return 0;
+}
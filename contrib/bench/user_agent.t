@@ -0,0 +1,283 @@
+#!/usr/bin/perl
+
+# Benchmark for the user_agent module with a large set of keywords: the
+# User-Agent strings of browsers, crawlers and mobile applications matched
+# against thousands of keywords of applications.
+#
+# The requests per second, the CPU time spent by the worker per 100k
+# requests and the memory of the worker are reported with diag().  Set
+# TEST_NGINX_BENCH_BASELINE to another nginx binary, e.g. one built with
+# "-DT_NGX_TRIE_COMPACT=0", to compare.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+use POSIX qw/ _exit /;
+use Time::HiRes qw/ time /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib '../../tests/nginx-tests/nginx-tests/lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $keywords = $ENV{TEST_NGINX_BENCH_KEYWORDS} || 20000;
+my $clients = $ENV{TEST_NGINX_BENCH_CLIENTS} || 4;
+my $seconds = $ENV{TEST_NGINX_BENCH_SECONDS} || 5;
+my $pipeline = 32;
+
+my @binaries = ($Test::Nginx::NGINX);
+unshift @binaries, $ENV{TEST_NGINX_BENCH_BASELINE}
+	if $ENV{TEST_NGINX_BENCH_BASELINE};
+
+my $t = Test::Nginx->new()->has(qw/http/)->plan(scalar @binaries);
+
+# the pid and the error log are set in the configuration, so the debug log
+# of the test globals is not used
+
+$t->test_globals();
+
+###############################################################################
+
+# the names of the applications, the same for every run
+
+srand(1);
+
+my @apps = map {
+	my $name = join '', map { ('a' .. 'z')[rand 26] } 1 .. 4 + rand 8;
+	ucfirst($name) . ('', 'App', 'Browser', 'Client', 'SDK')[rand 5]
+} 1 .. $keywords;
+
+my %seen;
+@apps = grep { !$seen{$_}++ } @apps;
+
+my $rules = join "\n", map {
+	sprintf "        %-24s %d.0+  app%d;", $apps[$_], $_ % 10, $_
+} 0 .. $#apps;
+
+my @corpus = (
+	'Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 '
+	. '(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36',
+	'Mozilla/5.0 (X11; Linux x86_64; rv:121.0) Gecko/20100101 Firefox/121.0',
+	'Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 '
+	. '(KHTML, like Gecko) Version/17.2 Safari/605.1.15',
+	'Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 '
+	. '(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36 Edg/120.0.2210.91',
+	'Mozilla/5.0 (compatible; Googlebot/2.1; +http://www.google.com/bot.html)',
+	'Mozilla/5.0 (compatible; bingbot/2.0; +http://www.bing.com/bingbot.htm)',
+	'curl/8.4.0',
+	(map {
+		'Mozilla/5.0 (iPhone; CPU iPhone OS 17_2 like Mac OS X) '
+		. 'AppleWebKit/605.1.15 (KHTML, like Gecko) Mobile/15E148 '
+		. $apps[rand @apps] . '/' . int(rand 10) . '.' . int(rand 100)
+	} 1 .. 16),
+	(map {
+		'Mozilla/5.0 (Linux; Android 14; Pixel 8) AppleWebKit/537.36 '
+		. '(KHTML, like Gecko) Chrome/120.0.6099.144 Mobile Safari/537.36 '
+		. $apps[rand @apps] . '/' . int(rand 10) . '.' . int(rand 100)
+	} 1 .. 16),
+);
+
+my @requests = map { "GET / HTTP/1.1\r\nHost: localhost\r\n"
+	. "User-Agent: $_\r\n\r\n" } @corpus;
+
+for my $binary (@binaries) {
+	$Test::Nginx::NGINX = $binary;
+
+	$t->write_file_expand('nginx.conf', <<"EOF");
+
+pid %%TESTDIR%%/nginx.pid;
+error_log %%TESTDIR%%/error.log notice;
+
+daemon off;
+
+worker_processes 1;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    access_log off;
+
+    keepalive_requests 1000000;
+
+    user_agent \$browser {
+        default                  unknown;
+
+        greedy                   Safari;
+        greedy                   Mobile;
+
+        Chrome                   100.0+  chrome;
+        Firefox                  100.0+  firefox;
+        Version                  15.0+   safari;
+        Edg                      100.0+  edge;
+        Googlebot                2.0+    crawler;
+        bingbot                  2.0+    crawler;
+        curl                     0.0+    curl;
+
+$rules
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            return 200 \$browser;
+        }
+    }
+}
+
+EOF
+
+	$t->run();
+
+	my $cpu = workers_cpu($t);
+	my ($count, $failed) = bench();
+	$cpu = workers_cpu($t) - $cpu;
+
+	diag(sprintf("%s: %d keywords, %d requests, %.0f r/s, "
+		. "worker cpu %.3fs per 100k, %s",
+		$binary, scalar @apps, $count, $count / $seconds,
+		$count ? $cpu * 100000 / $count : 0, workers_memory($t)));
+
+	is($failed, 0, "requests, $binary");
+
+	$t->stop();
+}
+
+###############################################################################
+
+# pipelined keepalive requests from forked clients for the given time, each
+# client reports its counts through a pipe
+
+sub bench {
+	my (@pipes, @pids);
+
+	for my $n (1 .. $clients) {
+		pipe(my $r, my $w) or die "Can't create pipe: $!\n";
+
+		my $pid = fork();
+		die "Can't fork: $!\n" unless defined $pid;
+
+		if ($pid == 0) {
+			close $r;
+
+			my ($count, $failed) = (0, 0);
+			my $end = time() + $seconds;
+
+			my $batch = join '', map { $requests[($n + $_) % @requests] }
+				1 .. $pipeline;
+
+			my $s = IO::Socket::INET->new('127.0.0.1:' . port(8080));
+
+			while ($s && time() < $end) {
+				$s->syswrite($batch);
+
+				my ($buf, $got) = ('', 0);
+
+				while ($got < $pipeline) {
+					$s->sysread($buf, 65536, length $buf) or last;
+					$got = () = $buf =~ /200 OK/g;
+				}
+
+				$count += $got;
+				$failed += $pipeline - $got;
+				last if $got < $pipeline;
+			}
+
+			print $w "$count $failed\n";
+			close $w;
+
+			# no destructors, they would stop nginx
+
+			_exit(0);
+		}
+
+		close $w;
+		push @pipes, $r;
+		push @pids, $pid;
+	}
+
+	my ($count, $failed) = (0, 0);
+
+	for my $r (@pipes) {
+		my ($c, $f) = split ' ', (<$r> || '0 1');
+		$count += $c;
+		$failed += $f;
+		close $r;
+	}
+
+	waitpid($_, 0) for @pids;
+
+	return ($count, $failed);
+}
+
+# user and system time of all the workers, in seconds
+
+sub workers_cpu {
+	my ($t) = @_;
+	my $ticks = 0;
+
+	for my $pid (workers($t)) {
+		open my $fh, '<', "/proc/$pid/stat" or next;
+		my @f = split / /, (<$fh> =~ s/^.*\) //r);
+		close $fh;
+
+		# fields after the command: state, ppid, ..., utime (12), stime (13)
+
+		$ticks += $f[11] + $f[12];
+	}
+
+	return $ticks / 100;
+}
+
+# resident and private memory of the worker, the pages of the master which
+# are not written by the worker are shared with it
+
+sub workers_memory {
+	my ($t) = @_;
+	my %kb;
+
+	for my $pid (workers($t)) {
+		open my $fh, '<', "/proc/$pid/smaps_rollup" or next;
+
+		while (<$fh>) {
+			$kb{$1} += $2 if /^(Rss|Private_Clean|Private_Dirty):\s+(\d+)/;
+		}
+
+		close $fh;
+	}
+
+	return sprintf("worker rss %dk, private %dk", $kb{Rss} || 0,
+		($kb{Private_Clean} || 0) + ($kb{Private_Dirty} || 0));
+}
+
+sub workers {
+	my ($t) = @_;
+	my @pids;
+	my $master = $t->read_file('nginx.pid');
+
+	chomp $master;
+
+	for my $stat (glob('/proc/[0-9]*/stat')) {
+		open my $fh, '<', $stat or next;
+		my @f = split / /, (<$fh> =~ s/^.*\) //r);
+		close $fh;
+
+		push @pids, $stat =~ m!/proc/(\d+)/! if $f[1] == $master;
+	}
+
+	return @pids;
+}
+
+###############################################################################
@@ -143,6 +143,10 @@ ngx_http_debug_timer_buf(ngx_pool_t *pool, ngx_buf_t *b)
                                 "  handler: %p\n"           \
                                 "   action: %s\n"
 
+#if (T_NGX_TIMER_WHEEL)
+    ngx_event_timer_wheel_flush();
+#endif
+
     root = ngx_event_timer_rbtree.root;
 
     array = ngx_array_create(pool, 10, sizeof(ngx_rbtree_node_t **));
@@ -28,6 +28,10 @@ struct ngx_http_reqstat_rbnode_s {
     ngx_queue_t                  queue;
     ngx_queue_t                  visit;
 
+    /* per worker counters, see NGX_HTTP_REQSTAT_SHARD() */
+    ngx_uint_t                   shards;
+    u_char                      *shard;
+
     ngx_atomic_t                 bytes_in;
     ngx_atomic_t                 bytes_out;
     ngx_atomic_t                 conn_total;
@@ -86,6 +90,14 @@ typedef struct {
 } ngx_http_reqstat_shctx_t;
 
 
+/* the worker's own index of the nodes, looked up without the zone lock */
+
+typedef struct {
+    uint32_t                     hash;
+    ngx_http_reqstat_rbnode_t   *node;
+} ngx_http_reqstat_cache_t;
+
+
 typedef struct {
     ngx_str_t                   *val;
     ngx_slab_pool_t             *shpool;
@@ -95,6 +107,10 @@ typedef struct {
     ngx_int_t                    key_len;
     ngx_uint_t                   recycle_rate;
     ngx_int_t                    alloc_already_fail;
+    ngx_flag_t                   per_worker;
+    ngx_uint_t                   shards;
+    ngx_cycle_t                 *cycle;
+    ngx_http_reqstat_cache_t    *cache;
 } ngx_http_reqstat_ctx_t;
 
 
@@ -202,6 +218,26 @@ typedef struct {
 #define NGX_HTTP_REQSTAT_REQ_FIELD(node, offset)                        \
     ((ngx_atomic_t *) ((char *) node + offset))
 
+#define NGX_HTTP_REQSTAT_COUNTERS                                       \
+    (offsetof(ngx_http_reqstat_rbnode_t, excess)                        \
+         - offsetof(ngx_http_reqstat_rbnode_t, bytes_in))
+
+#define NGX_HTTP_REQSTAT_SHARD_SIZE                                     \
+    ngx_align(NGX_HTTP_REQSTAT_COUNTERS, NGX_CPU_CACHE_LINE)
+
+/*
+ * The counters of a worker, laid out as the counters of the node, so that
+ * NGX_HTTP_REQSTAT_REQ_FIELD() works on it with the same offsets.
+ */
+
+#define NGX_HTTP_REQSTAT_SHARD(node, slot)                              \
+    ((node)->shard + (slot) * NGX_HTTP_REQSTAT_SHARD_SIZE               \
+         - NGX_HTTP_REQSTAT_BYTES_IN)
+
+#define NGX_HTTP_REQSTAT_CACHE_SIZE  4096
+
 
 ngx_http_reqstat_rbnode_t *
     ngx_http_reqstat_rbtree_lookup(ngx_shm_zone_t *shm_zone, ngx_str_t *val);
+ngx_atomic_uint_t ngx_http_reqstat_value(ngx_http_reqstat_rbnode_t *node,
+    off_t offset);
@@ -98,6 +98,8 @@ static char *ngx_http_reqstat_zone_key_length(ngx_conf_t *cf,
     ngx_command_t *cmd, void *conf);
 static char *ngx_http_reqstat_zone_recycle(ngx_conf_t *cf,
     ngx_command_t *cmd, void *conf);
+static char *ngx_http_reqstat_zone_per_worker(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 static char *ngx_http_reqstat(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static void ngx_http_reqstat_count(void *data, off_t offset,
@@ -111,6 +113,8 @@ static ngx_int_t ngx_http_reqstat_show_handler(ngx_http_request_t *r);
 
 static void ngx_http_reqstat_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_http_reqstat_rbnode_t *ngx_http_reqstat_rbtree_search(
+    ngx_shm_zone_t *shm_zone, ngx_str_t *val, uint32_t hash, ngx_msec_t now);
 static ngx_http_reqstat_store_t *
     ngx_http_reqstat_create_store(ngx_http_request_t *r,
     ngx_http_reqstat_conf_t *rlcf);
@@ -188,6 +192,13 @@ static ngx_command_t   ngx_http_reqstat_commands[] = {
       0,
       NULL },
 
+    { ngx_string("req_status_zone_per_worker"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_reqstat_zone_per_worker,
+      0,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -607,6 +618,41 @@ ngx_http_reqstat_zone_recycle(ngx_conf_t *cf, ngx_command_t *cmd,
 }
 
 
+static char *
+ngx_http_reqstat_zone_per_worker(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_str_t                         *value;
+    ngx_shm_zone_t                    *shm_zone;
+    ngx_http_reqstat_ctx_t            *ctx;
+
+    value = cf->args->elts;
+
+    shm_zone = ngx_shared_memory_add(cf, &value[1], 0,
+                                     &ngx_http_reqstat_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" should be defined first",
+                           &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    ctx = shm_zone->data;
+
+    if (ctx->per_worker) {
+        return "is duplicate";
+    }
+
+    ctx->per_worker = 1;
+
+    return NGX_CONF_OK;
+}
+
+
 static char *
 ngx_http_reqstat_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -662,6 +708,7 @@ ngx_http_reqstat_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ctx->key_len = 152;          /* now an item is 640B at length. */
     ctx->recycle_rate = 167;     /* rate threshold is 10r/min */
     ctx->alloc_already_fail = 0;
+    ctx->cycle = cf->cycle;
 
     shm_zone = ngx_shared_memory_add(cf, &value[1], size,
                                      &ngx_http_reqstat_module);
@@ -1155,7 +1202,9 @@ ngx_http_reqstat_show_handler(ngx_http_request_t *r)
         {
             node = ngx_queue_data(q, ngx_http_reqstat_rbnode_t, queue);
 
-            if (node->conn_total == 0) {
+            if (ngx_http_reqstat_value(node, NGX_HTTP_REQSTAT_CONN_TOTAL)
+                == 0)
+            {
                 continue;
             }
 
@@ -1187,13 +1236,13 @@ ngx_http_reqstat_show_handler(ngx_http_request_t *r)
                     if (user[j] < NGX_HTTP_REQSTAT_RSRV) {
                         index = user[j];
                         b->last = ngx_slprintf(b->last, b->end, "%uA,",
-                                        *NGX_HTTP_REQSTAT_REQ_FIELD(node,
+                                        ngx_http_reqstat_value(node,
                                               ngx_http_reqstat_fields[index]));
 
                     } else {
                         index = user[j] - NGX_HTTP_REQSTAT_RSRV;
                         b->last = ngx_slprintf(b->last, b->end, "%uA,",
-                                        *NGX_HTTP_REQSTAT_REQ_FIELD(node,
+                                        ngx_http_reqstat_value(node,
                                                NGX_HTTP_REQSTAT_EXTRA(index)));
                     }
                 }
@@ -1202,14 +1251,14 @@ ngx_http_reqstat_show_handler(ngx_http_request_t *r)
 
                 for (j = 0; j < NGX_HTTP_REQSTAT_RSRV; j++) {
                     b->last = ngx_slprintf(b->last, b->end, "%uA,",
-                                       *NGX_HTTP_REQSTAT_REQ_FIELD(node,
+                                       ngx_http_reqstat_value(node,
                                                   ngx_http_reqstat_fields[j]));
                 }
 
                 if (ctx->user_defined) {
                     for (j = 0; j < ctx->user_defined->nelts; j++) {
                         b->last = ngx_slprintf(b->last, b->end, "%uA,",
-                                           *NGX_HTTP_REQSTAT_REQ_FIELD(node,
+                                           ngx_http_reqstat_value(node,
                                                    NGX_HTTP_REQSTAT_EXTRA(j)));
                     }
                 }
@@ -1241,23 +1290,113 @@ ngx_http_reqstat_show_handler(ngx_http_request_t *r)
 }
 
 
+/*
+ * With per worker counters a worker only adds to its own cache line; the
+ * add stays atomic, as the old and the new workers share the slot during
+ * a reload.
+ */
+
 void
 ngx_http_reqstat_count(void *data, off_t offset, ngx_int_t incr)
 {
     ngx_http_reqstat_rbnode_t    *node = data;
 
+    u_char                       *p;
+
+    if (node->shards) {
+        p = NGX_HTTP_REQSTAT_SHARD(node, ngx_worker % node->shards);
+
+        (void) ngx_atomic_fetch_add(NGX_HTTP_REQSTAT_REQ_FIELD(p, offset),
+                                    incr);
+        return;
+    }
+
     (void) ngx_atomic_fetch_add(NGX_HTTP_REQSTAT_REQ_FIELD(node, offset), incr);
 }
 
 
+ngx_atomic_uint_t
+ngx_http_reqstat_value(ngx_http_reqstat_rbnode_t *node, off_t offset)
+{
+    ngx_uint_t                    i;
+    ngx_atomic_uint_t             value;
+
+    value = *NGX_HTTP_REQSTAT_REQ_FIELD(node, offset);
+
+    for (i = 0; i < node->shards; i++) {
+        value += *NGX_HTTP_REQSTAT_REQ_FIELD(NGX_HTTP_REQSTAT_SHARD(node, i),
+                                             offset);
+    }
+
+    return value;
+}
+
+
 ngx_http_reqstat_rbnode_t *
 ngx_http_reqstat_rbtree_lookup(ngx_shm_zone_t *shm_zone, ngx_str_t *val)
 {
-    size_t                        size, len;
+    size_t                        len;
     uint32_t                      hash;
-    ngx_int_t                     rc, excess;
     ngx_time_t                   *tp;
     ngx_msec_t                    now;
+    ngx_http_reqstat_ctx_t       *ctx;
+    ngx_http_reqstat_cache_t     *c;
+    ngx_http_reqstat_rbnode_t    *rs;
+
+    ctx = shm_zone->data;
+
+    hash = ngx_murmur_hash2(val->data, val->len);
+
+    tp = ngx_timeofday();
+    now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+
+    if (ctx->cache == NULL) {
+        ctx->cache = ngx_calloc(NGX_HTTP_REQSTAT_CACHE_SIZE
+                                * sizeof(ngx_http_reqstat_cache_t),
+                                shm_zone->shm.log);
+        if (ctx->cache == NULL) {
+            return ngx_http_reqstat_rbtree_search(shm_zone, val, hash, now);
+        }
+    }
+
+    /*
+     * A node found in the index of the worker is used without the zone
+     * lock as long as it still holds the key, that is, it is not recycled
+     * for another one.  The visit is recorded under the lock at most once
+     * a second, often enough for the recycle threshold.
+     */
+
+    c = &ctx->cache[hash % NGX_HTTP_REQSTAT_CACHE_SIZE];
+    rs = c->node;
+
+    len = ngx_min((size_t) ctx->key_len, val->len);
+
+    if (rs
+        && c->hash == hash
+        && rs->len == len
+        && ngx_memcmp(rs->data, val->data, len) == 0
+        && now - rs->last_visit < 1000)
+    {
+        return rs;
+    }
+
+    rs = ngx_http_reqstat_rbtree_search(shm_zone, val, hash, now);
+
+    if (rs) {
+        c->hash = hash;
+        c->node = rs;
+    }
+
+    return rs;
+}
+
+
+static ngx_http_reqstat_rbnode_t *
+ngx_http_reqstat_rbtree_search(ngx_shm_zone_t *shm_zone, ngx_str_t *val,
+    uint32_t hash, ngx_msec_t now)
+{
+    size_t                        size, len;
+    ngx_int_t                     rc, excess;
     ngx_queue_t                  *q;
     ngx_msec_int_t                ms;
     ngx_rbtree_node_t            *node, *sentinel;
@@ -1266,14 +1405,9 @@ ngx_http_reqstat_rbtree_lookup(ngx_shm_zone_t *shm_zone, ngx_str_t *val)
 
     ctx = shm_zone->data;
 
-    hash = ngx_murmur_hash2(val->data, val->len);
-
     node = ctx->sh->rbtree.root;
     sentinel = ctx->sh->rbtree.sentinel;
 
-    tp = ngx_timeofday();
-    now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
-
     ngx_shmtx_lock(&ctx->shpool->mutex);
 
     while (node != sentinel) {
@@ -1332,8 +1466,13 @@ ngx_http_reqstat_rbtree_lookup(ngx_shm_zone_t *shm_zone, ngx_str_t *val)
          + offsetof(ngx_http_reqstat_rbnode_t, data)
          + ctx->key_len;
 
+    if (ctx->shards) {
+        size = ngx_align(size, NGX_CPU_CACHE_LINE)
+               + ctx->shards * NGX_HTTP_REQSTAT_SHARD_SIZE;
+    }
+
     if (ctx->alloc_already_fail == 0) {
-        node = ngx_slab_alloc_locked(ctx->shpool, size);
+        node = ngx_slab_calloc_locked(ctx->shpool, size);
         if (node == NULL) {
             ctx->alloc_already_fail = 1;
         }
@@ -1352,7 +1491,9 @@ ngx_http_reqstat_rbtree_lookup(ngx_shm_zone_t *shm_zone, ngx_str_t *val)
         ngx_log_debug3(NGX_LOG_DEBUG_CORE, shm_zone->shm.log, 0,
                        "reqstat lookup try recycle: %*s, %d", rs->len, rs->data, excess);
 
-        if (excess < 0) {
+        /* the nodes of the previous layout do not fit, see init_zone */
+
+        if (excess < 0 && rs->shards == ctx->shards) {
 
             rc = 1;
 
@@ -1379,6 +1520,15 @@ ngx_http_reqstat_rbtree_lookup(ngx_shm_zone_t *shm_zone, ngx_str_t *val)
 
     rs = (ngx_http_reqstat_rbnode_t *) &node->color;
 
+    rs->shards = ctx->shards;
+
+    if (ctx->shards) {
+        rs->shard = (u_char *) node
+                    + ngx_align(offsetof(ngx_rbtree_node_t, color)
+                                + offsetof(ngx_http_reqstat_rbnode_t, data)
+                                + ctx->key_len, NGX_CPU_CACHE_LINE);
+    }
+
     len = ngx_min(ctx->key_len, (ssize_t) val->len);
     ngx_memcpy(rs->data, val->data, len);
     rs->len = len;
@@ -1404,11 +1554,24 @@ static ngx_int_t
 ngx_http_reqstat_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
     size_t                        n;
+    ngx_core_conf_t              *ccf;
     ngx_http_reqstat_ctx_t       *ctx, *octx;
 
     octx = data;
     ctx = shm_zone->data;
 
+    if (ctx->per_worker) {
+        ccf = (ngx_core_conf_t *) ngx_get_conf(ctx->cycle->conf_ctx,
+                                               ngx_core_module);
+
+        /*
+         * Nodes made before a reload keep their layout, and are only
+         * recycled for nodes of the same number of workers.
+         */
+
+        ctx->shards = ngx_max(ccf->worker_processes, 1);
+    }
+
     if (octx != NULL) {
         if (ngx_strcmp(ctx->val->data, octx->val->data) != 0) {
             ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
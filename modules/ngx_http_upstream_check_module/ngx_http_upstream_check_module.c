@@ -7,6 +7,7 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 #include <ngx_config.h>
+#include <ngx_proc.h>
 
 #include "ngx_http_upstream_check_http_parse.h"
 
@@ -101,12 +102,21 @@ typedef struct {
 } ngx_http_upstream_check_ctx_t;
 
 
+#define NGX_HTTP_CHECK_LATENCY_BUCKETS       9
+
+/* the probes left over from a batch are started this much later */
+#define NGX_HTTP_CHECK_BATCH_DELAY           10
+
+
 typedef struct {
     ngx_shmtx_t                              mutex;
     ngx_shmtx_sh_t                           lock;
 
     ngx_pid_t                                owner;
 
+    /* the process which keeps an idle check connection to the peer */
+    ngx_pid_t                                keeper;
+
     ngx_msec_t                               access_time;
 
     ngx_uint_t                               fall_count;
@@ -125,6 +135,12 @@ typedef struct {
 
     ngx_atomic_t                             down;
 
+    /* probe statistics, the latency histogram is not cumulative */
+    ngx_uint_t                               probe_count;
+    ngx_atomic_t                             probe_connects;
+    ngx_msec_t                               probe_latency_sum;
+    ngx_uint_t                               probe_latency[NGX_HTTP_CHECK_LATENCY_BUCKETS];
+
     u_char                                   padding[64];
 } ngx_http_upstream_check_peer_shm_t;
 
@@ -164,6 +180,8 @@ struct ngx_http_upstream_check_peer_s {
     ngx_event_t                              check_ev;
     ngx_event_t                              check_timeout_ev;
     ngx_peer_connection_t                    pc;
+    ngx_msec_t                               probe_start;
+    ngx_queue_t                              batch;
 
     void                                    *check_data;
     ngx_event_handler_pt                     send_handler;
@@ -188,6 +206,7 @@ struct ngx_http_upstream_check_peer_s {
     ngx_uint_t                               recv_chunk_state;
     unsigned                                 recv_body_chunked:1;
     unsigned                                 recv_body_pending:1;
+    unsigned                                 batched:1;
 
     unsigned                                 delete;
 };
@@ -198,6 +217,7 @@ typedef struct {
     ngx_uint_t                               checksum;
     ngx_array_t                              peers;
     ngx_slab_pool_t                         *shpool;
+    ngx_uint_t                               batch;
 
     ngx_http_upstream_check_peers_shm_t     *peers_shm;
 } ngx_http_upstream_check_peers_t;
@@ -247,6 +267,9 @@ typedef struct {
     ngx_str_t                                content_type;
 
     ngx_http_upstream_check_status_format_pt output;
+
+    /* in 1/4 pagesize for each record */
+    ngx_uint_t                               record_size;
 } ngx_check_status_conf_t;
 
 
@@ -270,6 +293,7 @@ typedef struct {
 
 typedef struct {
     ngx_uint_t                               check_shm_size;
+    ngx_uint_t                               check_batch;
     ngx_http_upstream_check_peers_t         *peers;
 } ngx_http_upstream_check_main_conf_t;
 
@@ -413,6 +437,7 @@ static ngx_int_t ngx_http_upstream_check_add_timer(
 static ngx_int_t ngx_http_upstream_check_peek_one_byte(ngx_connection_t *c);
 
 static void ngx_http_upstream_check_begin_handler(ngx_event_t *event);
+static void ngx_http_upstream_check_batch_handler(ngx_event_t *event);
 static void ngx_http_upstream_check_connect_handler(ngx_event_t *event);
 
 static void ngx_http_upstream_check_peek_handler(ngx_event_t *event);
@@ -566,6 +591,9 @@ static ngx_int_t ngx_http_upstream_check_init_shm_zone(
 
 static ngx_int_t ngx_http_upstream_check_init_process(ngx_cycle_t *cycle);
 
+static ngx_flag_t ngx_http_upstream_check_proc_enabled(ngx_cycle_t *cycle);
+static ngx_int_t ngx_proc_upstream_check_init(ngx_cycle_t *cycle);
+
 
 static ngx_conf_bitmask_t  ngx_check_http_expect_alive_masks[] = {
     { ngx_string("http_1xx"), NGX_CHECK_HTTP_1XX },
@@ -621,6 +649,13 @@ static ngx_command_t  ngx_http_upstream_check_commands[] = {
       0,
       NULL },
 
+    { ngx_string("check_batch"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_upstream_check_main_conf_t, check_batch),
+      NULL },
+
     { ngx_string("check_status"),
       NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1|NGX_CONF_NOARGS,
       ngx_http_upstream_check_status,
@@ -663,6 +698,40 @@ ngx_module_t  ngx_http_upstream_check_module = {
 };
 
 
+/*
+ * "processes { process upstream_check { ... } }" moves the static peers'
+ * check timers out of the workers into this helper process, the workers
+ * only read the results from the shared peer array.
+ */
+static ngx_proc_module_t  ngx_proc_upstream_check_module_ctx = {
+    ngx_string("upstream_check"),            /* name */
+    NULL,                                    /* create main configuration */
+    NULL,                                    /* init main configuration */
+    NULL,                                    /* create proc configuration */
+    NULL,                                    /* merge proc configuration */
+    NULL,                                    /* prepare */
+    ngx_proc_upstream_check_init,            /* init */
+    NULL,                                    /* loop */
+    NULL                                     /* exit */
+};
+
+
+ngx_module_t  ngx_proc_upstream_check_module = {
+    NGX_MODULE_V1,
+    &ngx_proc_upstream_check_module_ctx,   /* module context */
+    NULL,                                  /* module directives */
+    NGX_PROC_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
 static ngx_str_t fastcgi_default_request;
 static ngx_str_t fastcgi_default_params[] = {
     ngx_string("REQUEST_METHOD"), ngx_string("GET"),
@@ -814,21 +883,27 @@ static ngx_check_status_conf_t  ngx_check_status_formats[] = {
 
     { ngx_string("html"),
       ngx_string("text/html"),
-      ngx_http_upstream_check_status_html_format },
+      ngx_http_upstream_check_status_html_format, 1 },
 
     { ngx_string("csv"),
       ngx_string("text/plain"),
-      ngx_http_upstream_check_status_csv_format },
+      ngx_http_upstream_check_status_csv_format, 1 },
 
     { ngx_string("json"),
       ngx_string("application/json"), /* RFC 4627 */
-      ngx_http_upstream_check_status_json_format },
+      ngx_http_upstream_check_status_json_format, 2 },
 
     { ngx_string("prometheus"),
       ngx_string("text/plain"),
-      ngx_http_upstream_check_status_prometheus_format },
+      ngx_http_upstream_check_status_prometheus_format, 4 },
 
-    { ngx_null_string, ngx_null_string, NULL }
+    { ngx_null_string, ngx_null_string, NULL, 0 }
+};
+
+
+/* upper bounds of the probe latency buckets, the last one is +Inf */
+static ngx_msec_t  ngx_http_upstream_check_latency_bounds[] = {
+    1, 5, 10, 50, 100, 500, 1000, 5000
 };
 
 
@@ -847,6 +922,10 @@ static ngx_check_status_command_t ngx_check_status_commands[] =  {
 static ngx_uint_t ngx_http_upstream_check_shm_generation = 0;
 static ngx_http_upstream_check_peers_t *check_peers_ctx = NULL;
 
+/* the peers of this process due for a probe */
+static ngx_queue_t  ngx_http_upstream_check_batch_queue;
+static ngx_event_t  ngx_http_upstream_check_batch_event;
+
 
 ngx_uint_t
 ngx_http_upstream_check_add_dynamic_peer(ngx_pool_t *pool,
@@ -1246,6 +1325,10 @@ ngx_http_upstream_check_delete_dynamic_peer(ngx_str_t *name,
         chosen->shm->owner = NGX_INVALID_PID;
     }
 
+    if (chosen->shm->keeper == ngx_pid) {
+        chosen->shm->keeper = NGX_INVALID_PID;
+    }
+
     chosen->shm->ref--;
     if (chosen->shm->ref <= 0 && chosen->shm->delete != PEER_DELETED) {
         ngx_http_upstream_check_clear_dynamic_peer_shm(chosen->shm);
@@ -1522,6 +1605,12 @@ ngx_http_upstream_check_add_timers(ngx_cycle_t *cycle)
 
     srandom(ngx_pid);
 
+    ngx_queue_init(&ngx_http_upstream_check_batch_queue);
+
+    ngx_http_upstream_check_batch_event.handler =
+        ngx_http_upstream_check_batch_handler;
+    ngx_http_upstream_check_batch_event.log = cycle->log;
+
     peer = peers->peers.elts;
     peer_shm = peers_shm->peers;
 
@@ -1604,7 +1693,12 @@ ngx_http_upstream_check_begin_handler(ngx_event_t *event)
     peer = event->data;
     ucscf = peer->conf;
 
-    ngx_add_timer(event, ucscf->check_interval / 2);
+    /*
+     * Spread the wakeups of the peers a little on every round instead of
+     * only at start, so that they do not drift back into bursts.
+     */
+    ngx_add_timer(event, ucscf->check_interval / 2
+                         + ngx_random() % (ucscf->check_interval / 8 + 1));
 
     /* This process is processing this peer now. */
     if (peer->shm->owner == ngx_pid ||
@@ -1639,9 +1733,17 @@ ngx_http_upstream_check_begin_handler(ngx_event_t *event)
         return;
     }
 
-    if ((interval >= ucscf->check_interval)
-         && (peer->shm->owner == NGX_INVALID_PID)) {
+    /*
+     * The process which keeps an idle connection to the peer probes it
+     * over that connection, the others only step in when it is late.
+     */
 
+    if ((interval >= ucscf->check_interval)
+         && (peer->shm->owner == NGX_INVALID_PID)
+         && (peer->shm->keeper == NGX_INVALID_PID
+             || peer->shm->keeper == ngx_pid
+             || interval >= (ucscf->check_interval << 1)))
+    {
         peer->shm->owner = ngx_pid;
 
     } else if (interval >= (ucscf->check_interval << 4)) {
@@ -1659,8 +1761,64 @@ ngx_http_upstream_check_begin_handler(ngx_event_t *event)
 
     ngx_shmtx_unlock(&peer->shm->mutex);
 
-    if (peer->shm->owner == ngx_pid) {
-        ngx_http_upstream_check_connect_handler(event);
+    if (peer->shm->owner != ngx_pid) {
+        return;
+    }
+
+    /* the probes due are started together by the batch handler */
+
+    ngx_queue_insert_tail(&ngx_http_upstream_check_batch_queue, &peer->batch);
+    peer->batched = 1;
+
+    if (!ngx_http_upstream_check_batch_event.posted
+        && !ngx_http_upstream_check_batch_event.timer_set)
+    {
+        ngx_post_event(&ngx_http_upstream_check_batch_event,
+                       &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_http_upstream_check_batch_handler(ngx_event_t *event)
+{
+    ngx_uint_t                       n;
+    ngx_queue_t                     *q;
+    ngx_http_upstream_check_peer_t  *peer;
+
+    if (ngx_http_upstream_check_need_exit()) {
+        return;
+    }
+
+    /*
+     * At most "check_batch" check connections are opened at once,
+     * the probes over idle keepalive connections are not limited.
+     */
+
+    n = 0;
+
+    while (!ngx_queue_empty(&ngx_http_upstream_check_batch_queue)) {
+
+        q = ngx_queue_head(&ngx_http_upstream_check_batch_queue);
+        peer = ngx_queue_data(q, ngx_http_upstream_check_peer_t, batch);
+
+        if (peer->pc.connection == NULL) {
+
+            if (check_peers_ctx->batch && n == check_peers_ctx->batch) {
+                ngx_add_timer(event, NGX_HTTP_CHECK_BATCH_DELAY);
+                return;
+            }
+
+            n++;
+        }
+
+        ngx_queue_remove(q);
+        peer->batched = 0;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, event->log, 0,
+                       "http check batch index: %ui", peer->index);
+
+        ngx_http_upstream_check_connect_handler(&peer->check_ev);
     }
 }
 
@@ -1680,6 +1838,8 @@ ngx_http_upstream_check_connect_handler(ngx_event_t *event)
     peer = event->data;
     ucscf = peer->conf;
 
+    peer->probe_start = ngx_current_msec;
+
     if (peer->pc.connection != NULL) {
         c = peer->pc.connection;
 
@@ -1712,6 +1872,8 @@ ngx_http_upstream_check_connect_handler(ngx_event_t *event)
     peer->pc.cached = 0;
     peer->pc.connection = NULL;
 
+    (void) ngx_atomic_fetch_add(&peer->shm->probe_connects, 1);
+
     rc = ngx_event_connect_peer(&peer->pc);
 
     if (rc == NGX_ERROR || rc == NGX_DECLINED) {
@@ -3235,6 +3397,8 @@ static void
 ngx_http_upstream_check_status_update(ngx_http_upstream_check_peer_t *peer,
     ngx_int_t result)
 {
+    ngx_uint_t                           i;
+    ngx_msec_t                           latency;
     ngx_http_upstream_check_srv_conf_t  *ucscf;
 
     ucscf = peer->conf;
@@ -3267,6 +3431,18 @@ ngx_http_upstream_check_status_update(ngx_http_upstream_check_peer_t *peer,
         }
     }
 
+    latency = ngx_current_msec - peer->probe_start;
+
+    for (i = 0; i < NGX_HTTP_CHECK_LATENCY_BUCKETS - 1; i++) {
+        if (latency <= ngx_http_upstream_check_latency_bounds[i]) {
+            break;
+        }
+    }
+
+    peer->shm->probe_count++;
+    peer->shm->probe_latency[i]++;
+    peer->shm->probe_latency_sum += latency;
+
     peer->shm->access_time = ngx_current_msec;
 
     ngx_shmtx_unlock(&peer->shm->mutex);
@@ -3294,12 +3470,17 @@ ngx_http_upstream_check_clean_event(ngx_http_upstream_check_peer_t *peer)
         {
             c->write->handler = ngx_http_upstream_check_dummy_handler;
             c->read->handler = ngx_http_upstream_check_discard_handler;
+            peer->shm->keeper = ngx_pid;
         } else {
             ngx_close_connection(c);
             peer->pc.connection = NULL;
         }
     }
 
+    if (peer->pc.connection == NULL && peer->shm->keeper == ngx_pid) {
+        peer->shm->keeper = NGX_INVALID_PID;
+    }
+
     if (peer->check_timeout_ev.timer_set) {
         ngx_del_timer(&peer->check_timeout_ev);
     }
@@ -3384,6 +3565,14 @@ ngx_http_upstream_check_clear_all_events()
 
         ngx_http_upstream_check_clear_peer(&peer[i]);
     }
+
+    if (ngx_http_upstream_check_batch_event.timer_set) {
+        ngx_del_timer(&ngx_http_upstream_check_batch_event);
+    }
+
+    if (ngx_http_upstream_check_batch_event.posted) {
+        ngx_delete_posted_event(&ngx_http_upstream_check_batch_event);
+    }
 }
 
 
@@ -3409,6 +3598,10 @@ ngx_http_upstream_check_clear_peer(ngx_http_upstream_check_peer_t  *peer)
         ngx_del_timer(&peer->check_timeout_ev);
     }
 
+    if (peer->batched) {
+        ngx_queue_remove(&peer->batch);
+    }
+
     if (peer->pool != NULL) {
         ngx_destroy_pool(peer->pool);
         peer->pool = NULL;
@@ -3477,8 +3670,8 @@ ngx_http_upstream_check_status_handler(ngx_http_request_t *r)
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    /* 1/4 pagesize for each record */
-    buffer_size = peers->peers.nelts * ngx_pagesize / 4;
+    buffer_size = peers->peers.nelts * ctx->format->record_size
+                  * ngx_pagesize / 4;
     buffer_size = ngx_align(buffer_size, ngx_pagesize) + ngx_pagesize;
 
     b = ngx_create_temp_buf(r->pool, buffer_size);
@@ -3734,6 +3927,7 @@ ngx_http_upstream_check_status_json_format(ngx_buf_t *b,
     ngx_http_upstream_check_peers_t *peers, ngx_uint_t flag)
 {
     ngx_uint_t                       count, upCount, downCount, i, last;
+    ngx_uint_t                       n, cumulative;
     ngx_http_upstream_check_peer_t  *peer;
 
     peer = peers->peers.elts;
@@ -3811,8 +4005,11 @@ ngx_http_upstream_check_status_json_format(ngx_buf_t *b,
                 "\"rise\": %ui, "
                 "\"fall\": %ui, "
                 "\"type\": \"%V\", "
-                "\"port\": %ui}"
-                "%s\n",
+                "\"port\": %ui, "
+                "\"probes\": %ui, "
+                "\"connects\": %uA, "
+                "\"latency_sum\": %M, "
+                "\"latency\": {",
                 i,
                 peer[i].upstream_name,
                 &peer[i].peer_addr->name,
@@ -3821,7 +4018,26 @@ ngx_http_upstream_check_status_json_format(ngx_buf_t *b,
                 peer[i].shm->fall_count,
                 &peer[i].conf->check_type_conf->name,
                 peer[i].conf->port,
-                (last == count) ? "" : ",");
+                peer[i].shm->probe_count,
+                peer[i].shm->probe_connects,
+                peer[i].shm->probe_latency_sum);
+
+        cumulative = 0;
+
+        for (n = 0; n < NGX_HTTP_CHECK_LATENCY_BUCKETS - 1; n++) {
+            cumulative += peer[i].shm->probe_latency[n];
+
+            b->last = ngx_snprintf(b->last, b->end - b->last,
+                                   "\"%M\": %ui, ",
+                                   ngx_http_upstream_check_latency_bounds[n],
+                                   cumulative);
+        }
+
+        cumulative += peer[i].shm->probe_latency[n];
+
+        b->last = ngx_snprintf(b->last, b->end - b->last,
+                               "\"+Inf\": %ui}}%s\n",
+                               cumulative, (last == count) ? "" : ",");
     }
 
     b->last = ngx_snprintf(b->last, b->end - b->last,
@@ -3837,6 +4053,7 @@ ngx_http_upstream_check_status_prometheus_format(ngx_buf_t *b,
     ngx_http_upstream_check_peers_t *peers, ngx_uint_t flag)
 {
     ngx_uint_t                       count, upCount, downCount, i;
+    ngx_uint_t                       n, cumulative;
     ngx_http_upstream_check_peer_t  *peer;
 
     peer = peers->peers.elts;
@@ -3990,6 +4207,90 @@ ngx_http_upstream_check_status_prometheus_format(ngx_buf_t *b,
                 peer[i].conf->port,
                 peer[i].shm->down ? 0 : 1);
     }
+
+    b->last = ngx_snprintf(b->last, b->end - b->last,
+            "# HELP nginx_upstream_server_probe_connects Nginx check connections opened, the rest of the probes reused one\n"
+            "# TYPE nginx_upstream_server_probe_connects counter\n");
+
+    for (i = 0; i < peers->peers.nelts; i++) {
+
+        if (peer[i].delete) {
+            continue;
+        }
+
+        if (flag & NGX_CHECK_STATUS_DOWN) {
+
+            if (!peer[i].shm->down) {
+                continue;
+            }
+
+        } else if (flag & NGX_CHECK_STATUS_UP) {
+
+            if (peer[i].shm->down) {
+                continue;
+            }
+        }
+
+        b->last = ngx_snprintf(b->last, b->end - b->last,
+                "nginx_upstream_server_probe_connects{index=\"%ui\",upstream=\"%V\",name=\"%V\",type=\"%V\",port=\"%ui\"} %uA\n",
+                i,
+                peer[i].upstream_name,
+                &peer[i].peer_addr->name,
+                &peer[i].conf->check_type_conf->name,
+                peer[i].conf->port,
+                peer[i].shm->probe_connects);
+    }
+
+    b->last = ngx_snprintf(b->last, b->end - b->last,
+            "# HELP nginx_upstream_server_probe_latency_ms Nginx check probe latency in milliseconds\n"
+            "# TYPE nginx_upstream_server_probe_latency_ms histogram\n");
+
+    for (i = 0; i < peers->peers.nelts; i++) {
+
+        if (peer[i].delete) {
+            continue;
+        }
+
+        if (flag & NGX_CHECK_STATUS_DOWN) {
+
+            if (!peer[i].shm->down) {
+                continue;
+            }
+
+        } else if (flag & NGX_CHECK_STATUS_UP) {
+
+            if (peer[i].shm->down) {
+                continue;
+            }
+        }
+
+        cumulative = 0;
+
+        for (n = 0; n < NGX_HTTP_CHECK_LATENCY_BUCKETS - 1; n++) {
+            cumulative += peer[i].shm->probe_latency[n];
+
+            b->last = ngx_snprintf(b->last, b->end - b->last,
+                    "nginx_upstream_server_probe_latency_ms_bucket{index=\"%ui\",upstream=\"%V\",name=\"%V\",le=\"%M\"} %ui\n",
+                    i,
+                    peer[i].upstream_name,
+                    &peer[i].peer_addr->name,
+                    ngx_http_upstream_check_latency_bounds[n],
+                    cumulative);
+        }
+
+        cumulative += peer[i].shm->probe_latency[n];
+
+        b->last = ngx_snprintf(b->last, b->end - b->last,
+                "nginx_upstream_server_probe_latency_ms_bucket{index=\"%ui\",upstream=\"%V\",name=\"%V\",le=\"+Inf\"} %ui\n"
+                "nginx_upstream_server_probe_latency_ms_sum{index=\"%ui\",upstream=\"%V\",name=\"%V\"} %M\n"
+                "nginx_upstream_server_probe_latency_ms_count{index=\"%ui\",upstream=\"%V\",name=\"%V\"} %ui\n",
+                i, peer[i].upstream_name, &peer[i].peer_addr->name,
+                cumulative,
+                i, peer[i].upstream_name, &peer[i].peer_addr->name,
+                peer[i].shm->probe_latency_sum,
+                i, peer[i].upstream_name, &peer[i].peer_addr->name,
+                peer[i].shm->probe_count);
+    }
 }
 
 
@@ -4431,6 +4732,8 @@ ngx_http_upstream_check_create_main_conf(ngx_conf_t *cf)
 
     ucmcf->peers->checksum = 0;
 
+    ucmcf->check_batch = NGX_CONF_UNSET_UINT;
+
 #if (NGX_DEBUG)
 
     if (ngx_array_init(&ucmcf->peers->peers, cf->pool, 1,
@@ -4560,6 +4863,8 @@ ngx_http_upstream_check_create_fastcgi_request(ngx_pool_t *pool,
 static char *
 ngx_http_upstream_check_init_main_conf(ngx_conf_t *cf, void *conf)
 {
+    ngx_http_upstream_check_main_conf_t  *ucmcf = conf;
+
     ngx_buf_t                      *b;
     ngx_uint_t                      i;
     ngx_http_upstream_srv_conf_t  **uscfp;
@@ -4578,6 +4883,10 @@ ngx_http_upstream_check_init_main_conf(ngx_conf_t *cf, void *conf)
     fastcgi_default_request.data = b->pos;
     fastcgi_default_request.len = b->last - b->pos;
 
+    ngx_conf_init_uint_value(ucmcf->check_batch, 0);
+
+    ucmcf->peers->batch = ucmcf->check_batch;
+
     uscfp = umcf->upstreams.elts;
 
     for (i = 0; i < umcf->upstreams.nelts; i++) {
@@ -4745,8 +5054,15 @@ ngx_http_upstream_check_init_shm(ngx_conf_t *cf, void *conf)
     ngx_http_upstream_check_get_shm_name(shm_name, cf->pool,
                                 ngx_http_upstream_check_shm_generation);
 
-    /* The default check shared memory size is 1M */
-    shm_size = 1 * 1024 * 1024;
+    /*
+     * The default check shared memory size is 1M, or what the peer array
+     * and the peers' addresses need if that is larger.
+     */
+    shm_size = (ucmcf->peers->peers.nelts + MAX_DYNAMIC_PEER)
+               * (sizeof(ngx_http_upstream_check_peer_shm_t) + NGX_SOCKADDRLEN);
+    shm_size = ngx_align(shm_size + shm_size / 4, ngx_pagesize);
+
+    shm_size = shm_size < 1 * 1024 * 1024 ? 1 * 1024 * 1024 : shm_size;
 
     shm_size = shm_size < ucmcf->check_shm_size ?
                           ucmcf->check_shm_size : shm_size;
@@ -5029,6 +5345,7 @@ ngx_http_upstream_check_init_shm_peer(ngx_http_upstream_check_peer_shm_t *psh,
     }
 
     psh->owner = NGX_INVALID_PID;
+    psh->keeper = NGX_INVALID_PID;
 
 #if (NGX_HAVE_ATOMIC_OPS)
 
@@ -5056,6 +5373,9 @@ ngx_http_upstream_check_init_shm_peer(ngx_http_upstream_check_peer_shm_t *psh,
 static ngx_int_t
 ngx_http_upstream_check_init_process(ngx_cycle_t *cycle)
 {
+    ngx_uint_t                           i;
+    ngx_http_upstream_check_peer_t      *peer;
+    ngx_http_upstream_check_peer_shm_t  *peer_shm;
     ngx_http_upstream_check_main_conf_t *ucmcf;
 
     ucmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_check_module);
@@ -5063,5 +5383,73 @@ ngx_http_upstream_check_init_process(ngx_cycle_t *cycle)
         return NGX_OK;
     }
 
+    if (ngx_process == NGX_PROCESS_WORKER
+        && ngx_http_upstream_check_proc_enabled(cycle))
+    {
+        ngx_log_error(NGX_LOG_INFO, cycle->log, 0,
+                      "http upstream check is done by the \"%V\" process",
+                      &ngx_proc_upstream_check_module_ctx.name);
+
+        /* only read the status, no check timer in the worker */
+
+        if (check_peers_ctx == NULL || check_peers_ctx->peers_shm == NULL) {
+            return NGX_OK;
+        }
+
+        peer = check_peers_ctx->peers.elts;
+        peer_shm = check_peers_ctx->peers_shm->peers;
+
+        for (i = 0; i < check_peers_ctx->peers.nelts; i++) {
+            peer[i].shm = &peer_shm[i];
+        }
+
+        return NGX_OK;
+    }
+
+    return ngx_http_upstream_check_add_timers(cycle);
+}
+
+
+static ngx_flag_t
+ngx_http_upstream_check_proc_enabled(ngx_cycle_t *cycle)
+{
+    ngx_uint_t              i;
+    ngx_proc_conf_t       **cpcfp;
+    ngx_proc_main_conf_t   *cmcf;
+
+    cmcf = ngx_proc_get_main_conf(cycle->conf_ctx, ngx_proc_core_module);
+    if (cmcf == NULL) {
+        return 0;
+    }
+
+    cpcfp = cmcf->processes.elts;
+
+    for (i = 0; i < cmcf->processes.nelts; i++) {
+        if (cpcfp[i]->count > 0
+            && ngx_strcmp(cpcfp[i]->name.data,
+                          ngx_proc_upstream_check_module_ctx.name.data) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_proc_upstream_check_init(ngx_cycle_t *cycle)
+{
+    ngx_http_upstream_check_main_conf_t *ucmcf;
+
+    ucmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_check_module);
+    if (ucmcf == NULL) {
+        return NGX_OK;
+    }
+
+    /*
+     * With several helper processes, the shm owner field still makes sure
+     * a peer is only checked by one of them at a time.
+     */
     return ngx_http_upstream_check_add_timers(cycle);
 }
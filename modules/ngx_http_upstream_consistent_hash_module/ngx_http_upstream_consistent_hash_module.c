@@ -32,8 +32,26 @@ typedef struct {
     ngx_http_upstream_rr_peer_t            *peer;
 } ngx_http_upstream_chash_server_t;
 
+/*
+ * In-flight requests per real node, for the bounded load: in the shared
+ * memory for upstreams from the configuration, per worker for the ones
+ * added at runtime.
+ */
+
+typedef struct {
+    ngx_atomic_t                            total;
+    ngx_atomic_t                           *conns;
+} ngx_http_upstream_chash_load_t;
+
 typedef struct {
     ngx_uint_t                              number;
+    ngx_uint_t                              real_number;
+    ngx_uint_t                              total_weight;
+    ngx_uint_t                              bounded;     /* factor * 100 */
+    ngx_flag_t                              maglev;
+    uint32_t                               *table;
+    uint32_t                                table_size;
+    ngx_http_upstream_chash_load_t         *load;
     ngx_queue_t                             down_servers;
     ngx_array_t                            *values;
     ngx_array_t                            *lengths;
@@ -52,6 +70,7 @@ typedef struct {
 
     ngx_http_upstream_chash_server_t       *server;
     ngx_http_upstream_chash_srv_conf_t     *ucscf;
+    unsigned                                loaded:1;
 } ngx_http_upstream_chash_peer_data_t;
 
 
@@ -72,6 +91,19 @@ static uint32_t ngx_http_upstream_chash_get_server_index(
 static void ngx_http_upstream_chash_delete_node(
     ngx_http_upstream_chash_srv_conf_t *ucscf,
     ngx_http_upstream_chash_server_t *server);
+static ngx_int_t ngx_http_upstream_chash_init_maglev(ngx_conf_t *cf,
+    ngx_http_upstream_chash_srv_conf_t *ucscf,
+    ngx_http_upstream_rr_peers_t *peers, uint32_t *ids);
+static ngx_int_t ngx_http_upstream_chash_init_load(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us,
+    ngx_http_upstream_chash_srv_conf_t *ucscf);
+static ngx_int_t ngx_http_upstream_chash_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_http_upstream_chash_server_t *ngx_http_upstream_chash_bounded(
+    ngx_http_upstream_chash_srv_conf_t *ucscf,
+    ngx_http_upstream_chash_server_t *server);
+static ngx_int_t ngx_http_upstream_chash_peer_down(
+    ngx_http_upstream_rr_peer_t *peer);
 
 #if (NGX_HTTP_SSL)
 static ngx_int_t ngx_http_upstream_chash_set_peer_session(
@@ -84,7 +116,7 @@ static void ngx_http_upstream_chash_save_peer_session(ngx_peer_connection_t *pc,
 static ngx_command_t ngx_http_upstream_chash_commands[] = {
 
     { ngx_string("consistent_hash"),
-      NGX_HTTP_UPS_CONF | NGX_CONF_TAKE1,
+      NGX_HTTP_UPS_CONF | NGX_CONF_TAKE123,
       ngx_http_upstream_chash,
       0,
       0,
@@ -148,6 +180,7 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
     ngx_int_t                            j, weight;
     ngx_uint_t                           sid, id, hash_len;
     ngx_uint_t                           i, n, *number, rnindex;
+    uint32_t                            *ids;
     ngx_http_upstream_rr_peer_t         *peer;
     ngx_http_upstream_rr_peers_t        *peers;
     ngx_http_upstream_chash_server_t    *server;
@@ -172,6 +205,8 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 
     n = peers->number;
     ucscf->number = 0;
+    ucscf->real_number = n;
+    ucscf->total_weight = 0;
     ucscf->real_node = ngx_pcalloc(cf->pool, n *
                                    sizeof(ngx_http_upstream_chash_server_t**));
     if (ucscf->real_node == NULL) {
@@ -204,6 +239,11 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
         return NGX_ERROR;
     }
 
+    ids = ngx_calloc(n * sizeof(uint32_t), cf->log);
+    if (ids == NULL) {
+        return NGX_ERROR;
+    }
+
     ucscf->number = 0;
     for (i = 0; i < n; i++) {
 
@@ -219,6 +259,9 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
             sid = ngx_murmur_hash2(hash_buf, hash_len);
         }
 
+        ids[i] = (uint32_t) sid;
+        ucscf->total_weight += peer->weight;
+
         weight = peer->weight * NGX_CHASH_VIRTUAL_NODE_NUMBER;
 
         if (weight >= 1 << 14) {
@@ -268,6 +311,155 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 
     ngx_queue_init(&ucscf->down_servers);
 
+    if (ucscf->maglev
+        && ngx_http_upstream_chash_init_maglev(cf, ucscf, peers, ids)
+           != NGX_OK)
+    {
+        ngx_free(ids);
+        return NGX_ERROR;
+    }
+
+    ngx_free(ids);
+
+    if (ucscf->bounded) {
+        return ngx_http_upstream_chash_init_load(cf, us, ucscf);
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * The maglev lookup table of the real nodes, with the permutations
+ * derived from their ids, see ngx_maglev.h.
+ */
+
+static ngx_int_t
+ngx_http_upstream_chash_init_maglev(ngx_conf_t *cf,
+    ngx_http_upstream_chash_srv_conf_t *ucscf,
+    ngx_http_upstream_rr_peers_t *peers, uint32_t *ids)
+{
+    uint32_t       m;
+    ngx_uint_t     i, n;
+    ngx_maglev_t  *mg;
+
+    static uint32_t  sizes[] = { 65537, 655373, 6553577 };
+
+    n = ucscf->real_number;
+
+    /* a prime several times larger than the number of nodes */
+
+    for (i = 0; i < sizeof(sizes) / sizeof(uint32_t) - 1; i++) {
+        if (sizes[i] >= n * 100) {
+            break;
+        }
+    }
+
+    m = sizes[i];
+
+    mg = ngx_maglev_create(cf->pool, n, m, 0);
+    if (mg == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < n; i++) {
+        ngx_maglev_set(mg, i, &peers->peer[i],
+                       ngx_murmur_hash2((u_char *) &ids[i], 4),
+                       ngx_crc32_short((u_char *) &ids[i], 4),
+                       peers->peer[i].weight);
+    }
+
+    if (ngx_maglev_populate(mg) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ucscf->table_size = m;
+    ucscf->table = mg->table;
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t ngx_http_upstream_chash_generation = 0;
+
+
+static ngx_int_t
+ngx_http_upstream_chash_init_load(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us, ngx_http_upstream_chash_srv_conf_t *ucscf)
+{
+    size_t           size;
+    ngx_str_t        name;
+    ngx_shm_zone_t  *shm_zone;
+
+    if (ngx_process == NGX_PROCESS_WORKER) {
+
+        /* upstream added at runtime, e.g. by dyups, counts in this worker */
+
+        ucscf->load = ngx_pcalloc(cf->pool,
+                                  sizeof(ngx_http_upstream_chash_load_t));
+        if (ucscf->load == NULL) {
+            return NGX_ERROR;
+        }
+
+        ucscf->load->conns = ngx_pcalloc(cf->pool,
+                                   ucscf->real_number * sizeof(ngx_atomic_t));
+        if (ucscf->load->conns == NULL) {
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+    size = sizeof(ngx_http_upstream_chash_load_t)
+           + ucscf->real_number * sizeof(ngx_atomic_t);
+
+    size = ngx_align(size, ngx_pagesize) + 8 * ngx_pagesize;
+
+    /* a new zone for every configuration, the old workers keep theirs */
+
+    name.len = sizeof("chash_#") - 1 + us->host.len + NGX_INT_T_LEN;
+    name.data = ngx_pnalloc(cf->pool, name.len);
+    if (name.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    name.len = ngx_sprintf(name.data, "chash_%V#%ui", &us->host,
+                           ngx_http_upstream_chash_generation++)
+               - name.data;
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_upstream_consistent_hash_module);
+    if (shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    shm_zone->init = ngx_http_upstream_chash_init_zone;
+    shm_zone->data = ucscf;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_chash_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    u_char                              *p;
+    ngx_slab_pool_t                     *shpool;
+    ngx_http_upstream_chash_srv_conf_t  *ucscf;
+
+    ucscf = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    p = ngx_slab_calloc(shpool, sizeof(ngx_http_upstream_chash_load_t)
+                                + ucscf->real_number * sizeof(ngx_atomic_t));
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ucscf->load = (ngx_http_upstream_chash_load_t *) p;
+    ucscf->load->conns = (ngx_atomic_t *)
+                             (p + sizeof(ngx_http_upstream_chash_load_t));
+
     return NGX_OK;
 }
 
@@ -381,10 +573,17 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
     pc->cached = 0;
     pc->connection = NULL;
 
-    index = ngx_http_upstream_chash_get_server_index(ucscf->servers,
-                                                     ucscf->number,
-                                                     uchpd->hash);
-    server = &ucscf->servers[index];
+    if (ucscf->table) {
+        server = ucscf->real_node[ucscf->table[uchpd->hash
+                                               % ucscf->table_size]][0];
+        index = server->index;
+
+    } else {
+        index = ngx_http_upstream_chash_get_server_index(ucscf->servers,
+                                                         ucscf->number,
+                                                         uchpd->hash);
+        server = &ucscf->servers[index];
+    }
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "consistent hash [peer name]:%V %ud",
@@ -468,6 +667,14 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
         return NGX_BUSY;
     }
 
+    if (ucscf->load) {
+        server = ngx_http_upstream_chash_bounded(ucscf, server);
+
+        (void) ngx_atomic_fetch_add(&ucscf->load->conns[server->rnindex], 1);
+        (void) ngx_atomic_fetch_add(&ucscf->load->total, 1);
+        uchpd->loaded = 1;
+    }
+
     uchpd->server = server;
     peer = server->peer;
 
@@ -500,6 +707,57 @@ ngx_http_upstream_chash_delete_node(ngx_http_upstream_chash_srv_conf_t *ucscf,
 }
 
 
+/*
+ * Bounded load: a real node takes at most factor times its share of the
+ * requests in flight, this one included; otherwise the request goes on
+ * clockwise to the first node on the ring with room left.
+ */
+
+static ngx_http_upstream_chash_server_t *
+ngx_http_upstream_chash_bounded(ngx_http_upstream_chash_srv_conf_t *ucscf,
+    ngx_http_upstream_chash_server_t *server)
+{
+    ngx_uint_t                         i, index, total, limit;
+    ngx_http_upstream_chash_server_t  *s;
+
+    total = ucscf->load->total + 1;
+    index = server->index;
+
+    for (i = 0; i < ucscf->number; i++) {
+
+        s = &ucscf->servers[index];
+
+        if (!s->down && !ngx_http_upstream_chash_peer_down(s->peer)) {
+
+            limit = (ucscf->bounded * total * s->peer->weight
+                     + ucscf->total_weight * 100 - 1)
+                    / (ucscf->total_weight * 100);
+
+            if (ucscf->load->conns[s->rnindex] < limit) {
+                return s;
+            }
+        }
+
+        index = (index == ucscf->number) ? 1 : index + 1;
+    }
+
+    return server;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_chash_peer_down(ngx_http_upstream_rr_peer_t *peer)
+{
+#if (NGX_HTTP_UPSTREAM_CHECK)
+    if (ngx_http_upstream_check_peer_down(peer->check_index)) {
+        return 1;
+    }
+#endif
+
+    return peer->fails > peer->max_fails || peer->down;
+}
+
+
 static uint32_t
 ngx_http_upstream_chash_get_server_index(
     ngx_http_upstream_chash_server_t *servers, uint32_t n, uint32_t hash)
@@ -542,6 +800,14 @@ ngx_http_upstream_free_chash_peer(ngx_peer_connection_t *pc, void *data,
         return;
     }
 
+    if (uchpd->loaded) {
+        uchpd->loaded = 0;
+
+        (void) ngx_atomic_fetch_add(
+                  &uchpd->ucscf->load->conns[uchpd->server->rnindex], -1);
+        (void) ngx_atomic_fetch_add(&uchpd->ucscf->load->total, -1);
+    }
+
     if (state & NGX_PEER_FAILED) {
         uchpd->server->peer->fails++;
     }
@@ -551,7 +817,9 @@ ngx_http_upstream_free_chash_peer(ngx_peer_connection_t *pc, void *data,
 static char *
 ngx_http_upstream_chash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
+    ngx_int_t                            factor;
     ngx_str_t                           *value;
+    ngx_uint_t                           i;
     ngx_http_script_compile_t            sc;
     ngx_http_upstream_srv_conf_t        *uscf;
     ngx_http_upstream_chash_srv_conf_t  *ucscf;
@@ -585,6 +853,33 @@ ngx_http_upstream_chash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "bounded=", 8) == 0) {
+
+            factor = ngx_atofp(value[i].data + 8, value[i].len - 8, 2);
+
+            if (factor == NGX_ERROR || factor < 100) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid load factor \"%V\", "
+                                   "it must be at least 1", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            ucscf->bounded = factor;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "maglev") == 0) {
+            ucscf->maglev = 1;
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
     uscf->peer.init_upstream = ngx_http_upstream_init_chash;
 
     uscf->flags = NGX_HTTP_UPSTREAM_CREATE
@@ -17,11 +17,15 @@
 
 #define NGX_DYUPS_DELETE       1
 #define NGX_DYUPS_ADD          2
+#define NGX_DYUPS_BATCH        3
 
 #define ngx_dyups_add_timer(ev, timeout)                                      \
     if (!ngx_exiting && !ngx_quit) ngx_add_timer(ev, (timeout))
 
 
+typedef struct ngx_dyups_shm_peers_s  ngx_dyups_shm_peers_t;
+
+
 typedef struct {
     ngx_uint_t                     idx;
     ngx_uint_t                    *ref;
@@ -30,12 +34,14 @@ typedef struct {
     ngx_pool_t                    *pool;
     ngx_http_conf_ctx_t           *ctx;
     ngx_http_upstream_srv_conf_t  *upstream;
+    ngx_dyups_shm_peers_t         *shm_peers;
 } ngx_http_dyups_srv_conf_t;
 
 
 typedef struct {
     ngx_flag_t                     enable;
     ngx_flag_t                     trylock;
+    ngx_flag_t                     shared_peers;
     ngx_array_t                    dy_upstreams;/* ngx_http_dyups_srv_conf_t */
     ngx_str_t                      shm_name;
     ngx_uint_t                     shm_size;
@@ -68,10 +74,33 @@ typedef struct ngx_dyups_status_s {
 } ngx_dyups_status_t;
 
 
+/*
+ * A peer set built once by the process that took the update and shared
+ * by all workers.  Every worker using it, and every message still
+ * carrying it, holds a reference; it is freed under the zone mutex once
+ * the last reference is dropped.  The workers holding a reference are
+ * listed, so that the references of a worker which exited abnormally
+ * are dropped when another one takes its place.  There is a slot for
+ * every process the master may run, old workers of a reload included,
+ * and no reference is taken without a slot.
+ */
+
+struct ngx_dyups_shm_peers_s {
+    ngx_queue_t                          queue;
+    ngx_atomic_t                         refs;
+    ngx_uint_t                           version;
+    ngx_http_upstream_rr_peers_t        *peers;
+    ngx_pid_t                           *pids;
+    ngx_uint_t                           npids;
+};
+
+
 typedef struct ngx_dyups_shctx_s {
     ngx_queue_t                          msg_queue;
     ngx_uint_t                           version;
     ngx_dyups_status_t                  *status;
+    ngx_queue_t                          peers_queue;
+    ngx_uint_t                           peers_version;
 } ngx_dyups_shctx_t;
 
 
@@ -89,9 +118,21 @@ typedef struct ngx_dyups_msg_s {
     ngx_int_t                            count;
     ngx_uint_t                           flag;
     ngx_pid_t                           *pid;
+    ngx_dyups_shm_peers_t              **peers;
+    ngx_uint_t                           npeers;
 } ngx_dyups_msg_t;
 
 
+typedef struct {
+    ngx_str_t                            name;
+    ngx_uint_t                           flag;
+    ngx_buf_t                            body;
+    ngx_int_t                            status;
+    ngx_str_t                            rv;
+    ngx_dyups_shm_peers_t               *peers;
+} ngx_dyups_batch_entry_t;
+
+
 static ngx_int_t ngx_http_dyups_pre_conf(ngx_conf_t *cf);
 static ngx_int_t ngx_http_dyups_init(ngx_conf_t *cf);
 static void *ngx_http_dyups_create_main_conf(ngx_conf_t *cf);
@@ -138,17 +179,44 @@ static void ngx_http_dyups_exit_process(ngx_cycle_t *cycle);
 static void ngx_http_dyups_read_msg(ngx_event_t *ev);
 static void ngx_http_dyups_read_msg_locked(ngx_event_t *ev);
 static ngx_int_t ngx_http_dyups_send_msg(ngx_str_t *name, ngx_buf_t *body,
-    ngx_uint_t flag);
+    ngx_uint_t flag, ngx_dyups_shm_peers_t **peers, ngx_uint_t npeers);
 static void ngx_dyups_destroy_msg(ngx_slab_pool_t *shpool,
     ngx_dyups_msg_t *msg);
 static ngx_int_t ngx_dyups_sync_cmd(ngx_pool_t *pool, ngx_str_t *name,
-    ngx_str_t *content, ngx_uint_t flag);
+    ngx_str_t *content, ngx_uint_t flag, ngx_dyups_shm_peers_t **peers,
+    ngx_uint_t npeers);
+static ngx_int_t ngx_dyups_sync_batch(ngx_pool_t *pool, ngx_str_t *content,
+    ngx_dyups_shm_peers_t **peers, ngx_uint_t npeers);
+static ngx_array_t *ngx_dyups_parse_batch(ngx_pool_t *pool, ngx_buf_t *buf,
+    ngx_str_t *rv);
+static u_char *ngx_dyups_batch_word(u_char *p, u_char *last,
+    ngx_str_t *word);
+static ngx_int_t ngx_dyups_batch_update(ngx_pool_t *pool, ngx_buf_t *buf,
+    ngx_str_t *rv);
 static ngx_array_t *ngx_dyups_parse_path(ngx_pool_t *pool, ngx_str_t *path);
 static ngx_int_t ngx_dyups_do_delete(ngx_str_t *name, ngx_str_t *rv);
+static ngx_http_dyups_srv_conf_t *ngx_dyups_new_upstream(ngx_str_t *name,
+    ngx_str_t *rv);
 static ngx_int_t ngx_dyups_do_update(ngx_str_t *name, ngx_buf_t *buf,
     ngx_str_t *rv);
+static void ngx_dyups_free_upstream(ngx_http_dyups_srv_conf_t *duscf);
+#if (NGX_HTTP_UPSTREAM_ZONE)
+static ngx_buf_t *ngx_http_dyups_show_shared_peers(ngx_http_request_t *r,
+    ngx_http_upstream_rr_peers_t *peers);
+static ngx_dyups_shm_peers_t *ngx_dyups_share_peers(ngx_str_t *name);
+static ngx_http_upstream_rr_peers_t *ngx_dyups_copy_peers_locked(
+    ngx_slab_pool_t *shpool, ngx_http_upstream_rr_peers_t *src,
+    ngx_str_t *name, ngx_uint_t *config);
+static void ngx_dyups_free_peers_locked(ngx_slab_pool_t *shpool,
+    ngx_http_upstream_rr_peers_t *peers);
+static ngx_int_t ngx_dyups_do_flip(ngx_str_t *name,
+    ngx_dyups_shm_peers_t *peers, ngx_str_t *rv);
+static ngx_int_t ngx_dyups_hold_peers_locked(ngx_dyups_shm_peers_t *speers);
+static void ngx_dyups_reap_peers_locked(void);
+#endif
 static ngx_int_t ngx_dyups_sandbox_update(ngx_buf_t *buf, ngx_str_t *rv);
 static void ngx_dyups_purge_msg(ngx_pid_t opid, ngx_pid_t npid);
+static void ngx_dyups_release_peers(ngx_dyups_shm_peers_t *speers);
 static void ngx_http_dyups_clean_request(void *data);
 
 
@@ -217,6 +285,13 @@ static ngx_command_t  ngx_http_dyups_commands[] = {
       offsetof(ngx_http_dyups_main_conf_t, trylock),
       NULL },
 
+    { ngx_string("dyups_shared_peers"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_dyups_main_conf_t, shared_peers),
+      NULL },
+
       ngx_null_command
 };
 
@@ -318,6 +393,7 @@ ngx_http_dyups_create_main_conf(ngx_conf_t *cf)
     dmcf->read_msg_timeout = NGX_CONF_UNSET_MSEC;
     dmcf->read_msg_log = NGX_CONF_UNSET;
     dmcf->trylock = NGX_CONF_UNSET;
+    dmcf->shared_peers = NGX_CONF_UNSET;
 
     return dmcf;
 }
@@ -338,6 +414,19 @@ ngx_http_dyups_init_main_conf(ngx_conf_t *cf, void *conf)
         dmcf->trylock = 0;
     }
 
+    if (dmcf->shared_peers == NGX_CONF_UNSET) {
+        dmcf->shared_peers = 0;
+    }
+
+#if !(NGX_HTTP_UPSTREAM_ZONE)
+    if (dmcf->shared_peers) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "\"dyups_shared_peers\" requires "
+                           "ngx_http_upstream_zone_module, ignored");
+        dmcf->shared_peers = 0;
+    }
+#endif
+
     if (!dmcf->enable) {
         return NGX_CONF_OK;
     }
@@ -424,9 +513,11 @@ ngx_http_dyups_init_shm_zone(ngx_shm_zone_t *shm_zone, void *data)
     ngx_dyups_global_ctx.shpool = shpool;
 
     ngx_queue_init(&sh->msg_queue);
+    ngx_queue_init(&sh->peers_queue);
 
     sh->version = 0;
     sh->status = NULL;
+    sh->peers_version = 0;
 
     return NGX_OK;
 }
@@ -648,10 +739,14 @@ ngx_http_dyups_init_process(ngx_cycle_t *cycle)
 static void
 ngx_dyups_purge_msg(ngx_pid_t opid, ngx_pid_t npid)
 {
-    ngx_int_t            i;
-    ngx_queue_t         *q;
-    ngx_dyups_msg_t     *msg;
-    ngx_dyups_shctx_t   *sh;
+    ngx_int_t               i;
+    ngx_queue_t            *q;
+    ngx_dyups_msg_t        *msg;
+    ngx_dyups_shctx_t      *sh;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t              j;
+    ngx_dyups_shm_peers_t  *speers;
+#endif
 
     sh = ngx_dyups_global_ctx.sh;
 
@@ -671,6 +766,39 @@ ngx_dyups_purge_msg(ngx_pid_t opid, ngx_pid_t npid)
             }
         }
     }
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    /* the shared peer sets used by the exited process are released */
+
+    if (opid == 0 || opid == npid
+        || kill(opid, 0) == 0 || ngx_errno != NGX_ESRCH)
+    {
+        return;
+    }
+
+    for (q = ngx_queue_head(&sh->peers_queue);
+         q != ngx_queue_sentinel(&sh->peers_queue);
+         q = ngx_queue_next(q))
+    {
+        speers = ngx_queue_data(q, ngx_dyups_shm_peers_t, queue);
+
+        for (j = 0; j < speers->npids; j++) {
+            if (speers->pids[j] == opid) {
+
+                ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                              "[dyups] release shared peers version %ui"
+                              " of exited process %P", speers->version, opid);
+
+                speers->pids[j] = 0;
+                (void) ngx_atomic_fetch_add(&speers->refs, -1);
+            }
+        }
+    }
+
+    ngx_dyups_reap_peers_locked();
+
+#endif
 }
 
 
@@ -692,10 +820,7 @@ ngx_http_dyups_exit_process(ngx_cycle_t *cycle)
 
         duscf = &duscfs[i];
 
-        if (duscf->pool) {
-            ngx_destroy_pool(duscf->pool);
-            duscf->pool = NULL;
-        }
+        ngx_dyups_free_upstream(duscf);
     }
 }
 
@@ -763,7 +888,7 @@ ngx_dyups_delete_upstream(ngx_str_t *name, ngx_str_t *rv)
         goto finish;
     }
 
-    rc = ngx_http_dyups_send_msg(name, NULL, NGX_DYUPS_DELETE);
+    rc = ngx_http_dyups_send_msg(name, NULL, NGX_DYUPS_DELETE, NULL, 0);
     if (rc != NGX_OK) {
         ngx_str_set(rv, "alert: delte success but not sync to other process");
         ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "[dyups] %V", &rv);
@@ -929,12 +1054,16 @@ ngx_http_dyups_show_list(ngx_http_request_t *r)
 static ngx_buf_t *
 ngx_http_dyups_show_detail(ngx_http_request_t *r)
 {
-    ngx_uint_t                   i, j, len;
-    ngx_str_t                    host;
-    ngx_buf_t                   *buf;
-    ngx_http_dyups_srv_conf_t   *duscfs, *duscf;
-    ngx_http_dyups_main_conf_t  *dumcf;
-    ngx_http_upstream_server_t  *us;
+    ngx_uint_t                     i, j, len;
+    ngx_str_t                      host;
+    ngx_buf_t                     *buf;
+    ngx_http_dyups_srv_conf_t     *duscfs, *duscf;
+    ngx_http_dyups_main_conf_t    *dumcf;
+    ngx_http_upstream_server_t    *us;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
+#endif
 
     dumcf = ngx_http_get_module_main_conf(r, ngx_http_dyups_module);
 
@@ -954,6 +1083,15 @@ ngx_http_dyups_show_detail(ngx_http_request_t *r)
 
         len += duscf->upstream->host.len + 1;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (duscf->shm_peers) {
+            peers = duscf->shm_peers->peers;
+            j = peers->number + (peers->next ? peers->next->number : 0);
+            len += j * (sizeof("server ") + 256) + 1;
+            continue;
+        }
+#endif
+
         for (j = 0; j < duscf->upstream->servers->nelts; j++) {
             len += sizeof("server ") + 256;
         }
@@ -979,6 +1117,34 @@ ngx_http_dyups_show_detail(ngx_http_request_t *r)
         host = duscf->upstream->host;
         buf->last = ngx_sprintf(buf->last, "%V\n", &host);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (duscf->shm_peers) {
+            for (peers = duscf->shm_peers->peers; peers; peers = peers->next) {
+                for (peer = peers->peer; peer; peer = peer->next) {
+                    buf->last = ngx_sprintf(buf->last,
+                                    "server %V weight=%i "
+#ifdef NGX_HTTP_UPSTREAM_MAX_CONNS
+                                    "max_conns=%ui "
+#endif
+                                    "max_fails=%ui "
+                                    "fail_timeout=%T backup=%d down=%ui\n",
+                                    &peer->name,
+                                    peer->weight,
+#ifdef NGX_HTTP_UPSTREAM_MAX_CONNS
+                                    peer->max_conns,
+#endif
+                                    peer->max_fails,
+                                    peer->fail_timeout,
+                                    peers != duscf->shm_peers->peers,
+                                    peer->down);
+                }
+            }
+
+            buf->last = ngx_sprintf(buf->last, "\n");
+            continue;
+        }
+#endif
+
         us = duscf->upstream->servers->elts;
         for (j = 0; j < duscf->upstream->servers->nelts; j++) {
             buf->last = ngx_sprintf(buf->last,
@@ -1013,6 +1179,12 @@ ngx_http_dyups_show_upstream(ngx_http_request_t *r,
     ngx_buf_t                   *buf;
     ngx_http_upstream_server_t  *us;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (duscf->shm_peers) {
+        return ngx_http_dyups_show_shared_peers(r, duscf->shm_peers->peers);
+    }
+#endif
+
     len = 0;
     for (i = 0; i < duscf->upstream->servers->nelts; i++) {
         len += sizeof("server ") + 81;
@@ -1033,6 +1205,41 @@ ngx_http_dyups_show_upstream(ngx_http_request_t *r,
 }
 
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static ngx_buf_t *
+ngx_http_dyups_show_shared_peers(ngx_http_request_t *r,
+    ngx_http_upstream_rr_peers_t *peers)
+{
+    size_t                         len;
+    ngx_buf_t                     *buf;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *p;
+
+    len = 0;
+    for (p = peers; p; p = p->next) {
+        for (peer = p->peer; peer; peer = peer->next) {
+            len += sizeof("server ") + peer->name.len;
+        }
+    }
+
+    buf = ngx_create_temp_buf(r->pool, len);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    for (p = peers; p; p = p->next) {
+        for (peer = p->peer; peer; peer = peer->next) {
+            buf->last = ngx_sprintf(buf->last, "server %V\n", &peer->name);
+        }
+    }
+
+    return buf;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_dyups_do_delete(ngx_str_t *name, ngx_str_t *rv)
 {
@@ -1180,6 +1387,21 @@ ngx_http_dyups_body_handler(ngx_http_request_t *r)
         goto finish;
     }
 
+    value = res->elts;
+
+    /*
+      url: /batch
+      body: upstream name { server ip:port weight; } delete name;
+    */
+
+    if (res->nelts == 1
+        && value[0].len == 5
+        && ngx_strncasecmp(value[0].data, (u_char *) "batch", 5) == 0)
+    {
+        status = ngx_dyups_batch_update(r->pool, body, &rv);
+        goto finish;
+    }
+
     if (res->nelts != 2) {
         ngx_str_set(&rv, "not support this interface");
         status = NGX_HTTP_NOT_FOUND;
@@ -1191,8 +1413,6 @@ ngx_http_dyups_body_handler(ngx_http_request_t *r)
       body: server ip:port weight
     */
 
-    value = res->elts;
-
     if (value[0].len != 8
         || ngx_strncasecmp(value[0].data, (u_char *) "upstream", 8) != 0)
     {
@@ -1220,6 +1440,7 @@ ngx_dyups_update_upstream(ngx_str_t *name, ngx_buf_t *buf, ngx_str_t *rv)
     ngx_int_t                    status;
     ngx_event_t                 *timer;
     ngx_slab_pool_t             *shpool;
+    ngx_dyups_shm_peers_t       *peers;
     ngx_http_dyups_main_conf_t  *dmcf;
 
     dmcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
@@ -1254,7 +1475,17 @@ ngx_dyups_update_upstream(ngx_str_t *name, ngx_buf_t *buf, ngx_str_t *rv)
     status = ngx_dyups_do_update(name, buf, rv);
     if (status == NGX_HTTP_OK) {
 
-        if (ngx_http_dyups_send_msg(name, buf, NGX_DYUPS_ADD)) {
+        peers = NULL;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (dmcf->shared_peers) {
+            peers = ngx_dyups_share_peers(name);
+        }
+#endif
+
+        if (ngx_http_dyups_send_msg(name, buf, NGX_DYUPS_ADD, &peers,
+                                    peers ? 1 : 0))
+        {
             ngx_str_set(rv, "alert: update success "
                         "but not sync to other process");
             status = NGX_HTTP_INTERNAL_SERVER_ERROR;
@@ -1269,8 +1500,8 @@ ngx_dyups_update_upstream(ngx_str_t *name, ngx_buf_t *buf, ngx_str_t *rv)
 }
 
 
-static ngx_int_t
-ngx_dyups_do_update(ngx_str_t *name, ngx_buf_t *buf, ngx_str_t *rv)
+static ngx_http_dyups_srv_conf_t *
+ngx_dyups_new_upstream(ngx_str_t *name, ngx_str_t *rv)
 {
     ngx_int_t                       rc, idx;
     ngx_http_dyups_srv_conf_t      *duscf;
@@ -1309,13 +1540,13 @@ ngx_dyups_do_update(ngx_str_t *name, ngx_buf_t *buf, ngx_str_t *rv)
         duscf = ngx_array_push(&dumcf->dy_upstreams);
         if (duscf == NULL) {
             ngx_str_set(rv, "out of memory");
-            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            return NULL;
         }
 
         uscfp = ngx_array_push(&umcf->upstreams);
         if (uscfp == NULL) {
             ngx_str_set(rv, "out of memory");
-            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            return NULL;
         }
 
         ngx_memzero(duscf, sizeof(ngx_http_dyups_srv_conf_t));
@@ -1327,6 +1558,21 @@ ngx_dyups_do_update(ngx_str_t *name, ngx_buf_t *buf, ngx_str_t *rv)
 
     if (rc != NGX_OK) {
         ngx_str_set(rv, "init upstream failed");
+        return NULL;
+    }
+
+    return duscf;
+}
+
+
+static ngx_int_t
+ngx_dyups_do_update(ngx_str_t *name, ngx_buf_t *buf, ngx_str_t *rv)
+{
+    ngx_int_t                   rc;
+    ngx_http_dyups_srv_conf_t  *duscf;
+
+    duscf = ngx_dyups_new_upstream(name, rv);
+    if (duscf == NULL) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
@@ -1343,1034 +1589,2035 @@ ngx_dyups_do_update(ngx_str_t *name, ngx_buf_t *buf, ngx_str_t *rv)
 }
 
 
-static ngx_int_t
-ngx_dyups_sandbox_update(ngx_buf_t *buf, ngx_str_t *rv)
+static void
+ngx_dyups_free_upstream(ngx_http_dyups_srv_conf_t *duscf)
 {
-    ngx_int_t  rc;
-    ngx_str_t  dumy;
+    if (duscf->shm_peers) {
+        ngx_dyups_release_peers(duscf->shm_peers);
+        duscf->shm_peers = NULL;
+    }
 
-    ngx_str_t  sandbox = ngx_string("_dyups_upstream_sandbox_");
+    if (duscf->pool) {
+        ngx_destroy_pool(duscf->pool);
+        duscf->pool = NULL;
+    }
+}
 
-    rc = ngx_dyups_do_update(&sandbox, buf, rv);
 
-    (void) ngx_dyups_do_delete(&sandbox, &dumy);
+static void
+ngx_dyups_release_peers(ngx_dyups_shm_peers_t *speers)
+{
+    ngx_uint_t  i;
 
-    return rc;
-}
+    /*
+     * the zone mutex may be held here, the set is freed by the reaper;
+     * only this process clears its own entry while it is alive
+     */
 
+    for (i = 0; i < speers->npids; i++) {
+        if (speers->pids[i] == ngx_pid) {
+            speers->pids[i] = 0;
+            break;
+        }
+    }
 
-static char *
-ngx_dyups_parse_upstream(ngx_conf_t *cf, ngx_buf_t *buf)
-{
-    char                       *rc;
-    ngx_buf_t                   b;
-    ngx_str_t                   s;
-    ngx_uint_t                  i;
-    ngx_hash_t                  vh, vh_prev;
-    ngx_array_t                 va, va_prev;
-    ngx_conf_file_t             conf_file;
-    ngx_http_variable_t        *v;
-    ngx_hash_keys_arrays_t      vk;
-    ngx_http_core_main_conf_t  *cmcf;
+    (void) ngx_atomic_fetch_add(&speers->refs, -1);
+}
 
-    b = *buf;   /* avoid modifying @buf */
 
-    ngx_memzero(&conf_file, sizeof(ngx_conf_file_t));
-    conf_file.file.fd = NGX_INVALID_FILE;
-    conf_file.buffer = &b;
+#if (NGX_HTTP_UPSTREAM_ZONE)
 
-    cf->conf_file = &conf_file;
+static ngx_dyups_shm_peers_t *
+ngx_dyups_share_peers(ngx_str_t *name)
+{
+    ngx_int_t                      idx;
+    ngx_str_t                     *pname;
+    ngx_uint_t                    *config;
+    ngx_slab_pool_t               *shpool;
+    ngx_dyups_shctx_t             *sh;
+    ngx_dyups_shm_peers_t         *speers;
+    ngx_http_dyups_srv_conf_t     *duscf;
+    ngx_http_upstream_rr_peers_t  *peers, *src;
+    ngx_http_upstream_srv_conf_t  *uscf;
 
-    rc = ngx_conf_parse(cf, NULL);
-    if (rc != NGX_CONF_OK) {
-        return rc;
-    }
+    sh = ngx_dyups_global_ctx.sh;
+    shpool = ngx_dyups_global_ctx.shpool;
 
-    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+    speers = NULL;
+    config = NULL;
 
-    va_prev = cmcf->variables;
-    vh_prev = cmcf->variables_hash;
+    duscf = ngx_dyups_find_upstream(name, &idx);
+    if (duscf == NULL || duscf->deleted) {
+        return NULL;
+    }
 
-    ngx_memzero(&va, sizeof(va));
-    ngx_memzero(&vh, sizeof(vh));
-    ngx_memzero(&vk, sizeof(vk));
+    uscf = duscf->upstream;
+    src = uscf->peer.data;
 
-    cmcf->variables      = va;
-    cmcf->variables_hash = vh;
-    cmcf->variables_keys = &vk;
+    /* only plain round robin peer sets can be used from any process */
 
-    v = va_prev.elts;
-    for (i = 0; i < va_prev.nelts; i++) {
+    if ((uscf->peer.init_upstream
+         && uscf->peer.init_upstream != ngx_http_upstream_init_round_robin)
+        || src == NULL || src->resolve
+        || (src->next && src->next->resolve))
+    {
+        ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                      "[dyups] upstream %V is not shared, "
+                      "not a round robin one", name);
+        return NULL;
+    }
 
-        if (v[i].get_handler) {
-            continue;
-        }
+#if (NGX_HTTP_UPSTREAM_CHECK)
+    {
+    ngx_http_upstream_rr_peer_t  *peer;
 
-        s.len = v[i].name.len;
-        s.data = ngx_pstrdup(ngx_cycle->pool, &v[i].name);
-        if (!s.data) {
-            rc = NGX_CONF_ERROR;
-            break;
+    for (peers = src; peers; peers = peers->next) {
+        for (peer = peers->peer; peer; peer = peer->next) {
+            if (peer->check_index != (ngx_uint_t) NGX_ERROR) {
+                ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                              "[dyups] upstream %V is not shared, "
+                              "health check enabled", name);
+                return NULL;
+            }
         }
+    }
 
-        /*
-         * variable name will be assign to cmcf->variables[idx].name directly
-         * so the lifetime of v[i].name should be the same as cmcf
-         */
-        v[i].name = s;
+    }
+#endif
 
-        cmcf->variables.elts = &v[i];
-        cmcf->variables.nelts = 1;
-        if (ngx_http_variables_init_vars(cf) != NGX_OK) {
-            rc = NGX_CONF_ERROR;
-            break;
-        }
+    speers = ngx_slab_calloc_locked(shpool, sizeof(ngx_dyups_shm_peers_t)
+                                    + NGX_MAX_PROCESSES * sizeof(ngx_pid_t));
+    if (speers == NULL) {
+        goto failed;
     }
 
-    cmcf->variables      = va_prev;
-    cmcf->variables_hash = vh_prev;
-    cmcf->variables_keys = NULL;
+    speers->pids = (ngx_pid_t *) &speers[1];
+    speers->npids = NGX_MAX_PROCESSES;
 
-    return rc;
-}
+    config = ngx_slab_calloc_locked(shpool, sizeof(ngx_uint_t));
+    if (config == NULL) {
+        goto failed;
+    }
 
+    pname = ngx_slab_alloc_locked(shpool, sizeof(ngx_str_t));
+    if (pname == NULL) {
+        goto failed;
+    }
 
-static ngx_int_t
-ngx_dyups_add_server(ngx_http_dyups_srv_conf_t *duscf, ngx_buf_t *buf)
-{
-    ngx_conf_t                           cf;
-    ngx_http_upstream_init_pt            init;
-    ngx_http_upstream_srv_conf_t        *uscf;
-    ngx_http_dyups_upstream_srv_conf_t  *dscf;
+    pname->len = name->len;
+    pname->data = ngx_slab_alloc_locked(shpool, name->len);
+    if (pname->data == NULL) {
+        ngx_slab_free_locked(shpool, pname);
+        goto failed;
+    }
 
-    uscf = duscf->upstream;
+    ngx_memcpy(pname->data, name->data, name->len);
 
-    if (uscf->servers == NULL) {
-        uscf->servers = ngx_array_create(duscf->pool, 4,
-                                         sizeof(ngx_http_upstream_server_t));
-        if (uscf->servers == NULL) {
-            return NGX_ERROR;
-        }
+    peers = ngx_dyups_copy_peers_locked(shpool, src, pname, config);
+    if (peers == NULL) {
+        ngx_slab_free_locked(shpool, pname->data);
+        ngx_slab_free_locked(shpool, pname);
+        goto failed;
     }
 
-    ngx_memzero(&cf, sizeof(ngx_conf_t));
-    cf.name = "dyups_init_module_conf";
-    cf.pool = duscf->pool;
-    cf.cycle = (ngx_cycle_t *) ngx_cycle;
-    cf.module_type = NGX_HTTP_MODULE;
-    cf.cmd_type = NGX_HTTP_UPS_CONF;
-    cf.log = ngx_cycle->log;
-    cf.ctx = duscf->ctx;
-    cf.args = ngx_array_create(duscf->pool, 10, sizeof(ngx_str_t));
-    if (cf.args == NULL) {
-        return NGX_ERROR;
-    }
+    speers->peers = peers;
+    speers->version = ++sh->peers_version;
 
-    if (ngx_dyups_parse_upstream(&cf, buf) != NGX_CONF_OK) {
-        return NGX_ERROR;
-    }
+    ngx_queue_insert_tail(&sh->peers_queue, &speers->queue);
 
-    ngx_memzero(&cf, sizeof(ngx_conf_t));
-    cf.name = "dyups_init_upstream";
-    cf.cycle = (ngx_cycle_t *) ngx_cycle;
-    cf.pool = duscf->pool;
-    cf.module_type = NGX_HTTP_MODULE;
-    cf.cmd_type = NGX_HTTP_MAIN_CONF;
-    cf.log = ngx_cycle->log;
-    cf.ctx = duscf->ctx;
+    /* the requests of this process use the shared set as well */
 
+    (void) ngx_dyups_hold_peers_locked(speers);
 
-    init = uscf->peer.init_upstream ? uscf->peer.init_upstream:
-        ngx_http_upstream_init_round_robin;
+    uscf->peer.data = peers;
+    duscf->shm_peers = speers;
 
-    if (init(&cf, uscf) != NGX_OK) {
-        return NGX_ERROR;
-    }
+    ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                  "[dyups] share upstream %V, version %ui",
+                  name, speers->version);
 
-#if (T_NGX_HTTP_UPSTREAM_RANDOM)
-    {
+    return speers;
 
-    ngx_http_upstream_rr_peers_t        *peers, *backup;
+failed:
 
-    /* add init_number initialization */
+    ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                  "[dyups] no memory to share upstream %V, "
+                  "other processes will build it", name);
 
-    peers = uscf->peer.data;
-    peers->init_number = ngx_random() % peers->number;
-    backup = peers->next;
+    if (speers) {
+        if (config) {
+            ngx_slab_free_locked(shpool, config);
+        }
 
-    if (backup) {
-        backup->init_number = ngx_random() % backup->number;
+        ngx_slab_free_locked(shpool, speers);
     }
 
+    return NULL;
+}
+
+
+static ngx_http_upstream_rr_peers_t *
+ngx_dyups_copy_peers_locked(ngx_slab_pool_t *shpool,
+    ngx_http_upstream_rr_peers_t *src, ngx_str_t *name, ngx_uint_t *config)
+{
+    ngx_http_upstream_rr_peer_t   *peer, *sp, **peerp;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    peers = ngx_slab_alloc_locked(shpool, sizeof(ngx_http_upstream_rr_peers_t));
+    if (peers == NULL) {
+        return NULL;
     }
+
+    ngx_memcpy(peers, src, sizeof(ngx_http_upstream_rr_peers_t));
+
+    peers->shpool = shpool;
+    peers->rwlock = 0;
+    peers->config = config;
+    peers->name = name;
+    peers->peer = NULL;
+    peers->next = NULL;
+
+#if (T_NGX_HTTP_ROUND_ROBIN_OPT_ALI)
+    peers->last_number = NGX_CONF_UNSET_UINT;
+    peers->last_peer = NULL;
 #endif
 
-    dscf = uscf->srv_conf[ngx_http_dyups_module.ctx_index];
-    dscf->init = uscf->peer.init;
+    peerp = &peers->peer;
 
-    uscf->peer.init = ngx_http_dyups_init_peer;
+    for (sp = src->peer; sp; sp = sp->next) {
 
-    return NGX_OK;
-}
+        peer = ngx_slab_alloc_locked(shpool,
+                                     sizeof(ngx_http_upstream_rr_peer_t));
+        if (peer == NULL) {
+            goto failed;
+        }
 
+        ngx_memcpy(peer, sp, sizeof(ngx_http_upstream_rr_peer_t));
 
-static ngx_http_dyups_srv_conf_t *
-ngx_dyups_find_upstream(ngx_str_t *name, ngx_int_t *idx)
-{
-    ngx_uint_t                      i;
-    ngx_http_dyups_srv_conf_t      *duscfs, *duscf, *duscf_del;
-    ngx_http_dyups_main_conf_t     *dumcf;
-    ngx_http_upstream_srv_conf_t   *uscf;
+        peer->sockaddr = NULL;
+        peer->name.data = NULL;
+        peer->server.data = NULL;
+#if (NGX_HTTP_UPSTREAM_SID)
+        peer->sid.data = NULL;
+#endif
+#if (NGX_HTTP_SSL || NGX_COMPAT)
+        peer->ssl_session = NULL;
+        peer->ssl_session_len = 0;
+#endif
+        peer->lock = 0;
+        peer->refs = 0;
+        peer->host = NULL;
+        peer->next = NULL;
 
-    dumcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
-                                                ngx_http_dyups_module);
-    *idx = -1;
-    duscf_del = NULL;
+        /* link the copy first, so that a partial set can be freed */
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "[dyups] find dynamic upstream");
+        *peerp = peer;
+        peerp = &peer->next;
 
-    duscfs = dumcf->dy_upstreams.elts;
-    for (i = 0; i < dumcf->dy_upstreams.nelts; i++) {
+        peer->sockaddr = ngx_slab_alloc_locked(shpool, sp->socklen);
+        if (peer->sockaddr == NULL) {
+            goto failed;
+        }
 
-        duscf = &duscfs[i];
-        if (!duscf->dynamic) {
-            continue;
+        ngx_memcpy(peer->sockaddr, sp->sockaddr, sp->socklen);
+
+        peer->name.data = ngx_slab_alloc_locked(shpool, sp->name.len);
+        if (peer->name.data == NULL) {
+            goto failed;
         }
 
-        if (duscf->deleted == NGX_DYUPS_DELETING) {
+        ngx_memcpy(peer->name.data, sp->name.data, sp->name.len);
 
-            ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
-                          "[dyups] find upstream idx: %ui ref: %ui "
-                          "on %V deleting",
-                          i, *(duscf->ref), &duscf->upstream->host);
+        if (sp->server.len) {
+            peer->server.data = ngx_slab_alloc_locked(shpool, sp->server.len);
+            if (peer->server.data == NULL) {
+                goto failed;
+            }
 
-            if (*(duscf->ref) == 0) {
-                ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
-                              "[dyups] free dynamic upstream in find upstream"
-                              " %ui", duscf->idx);
+            ngx_memcpy(peer->server.data, sp->server.data, sp->server.len);
+        }
 
-                duscf->deleted = NGX_DYUPS_DELETED;
+#if (NGX_HTTP_UPSTREAM_SID)
+        peer->sid.data = ngx_slab_calloc_locked(shpool,
+                                                NGX_HTTP_UPSTREAM_SID_LEN);
+        if (peer->sid.data == NULL) {
+            goto failed;
+        }
 
-                if (duscf->pool) {
-                    ngx_destroy_pool(duscf->pool);
-                    duscf->pool = NULL;
-                }
-            }
+        ngx_memcpy(peer->sid.data, sp->sid.data, sp->sid.len);
+#endif
+    }
+
+    if (src->next) {
+        peers->next = ngx_dyups_copy_peers_locked(shpool, src->next, name,
+                                                  config);
+        if (peers->next == NULL) {
+            goto failed;
         }
+    }
 
-        if (duscf->deleted == NGX_DYUPS_DELETING) {
-            continue;
+    (*config)++;
+
+    return peers;
+
+failed:
+
+    ngx_dyups_free_peers_locked(shpool, peers);
+
+    return NULL;
+}
+
+
+static void
+ngx_dyups_free_peers_locked(ngx_slab_pool_t *shpool,
+    ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_http_upstream_rr_peer_t  *peer, *next;
+
+    if (peers->next) {
+        ngx_dyups_free_peers_locked(shpool, peers->next);
+    }
+
+    for (peer = peers->peer; peer; peer = next) {
+        next = peer->next;
+
+        if (peer->sockaddr) {
+            ngx_slab_free_locked(shpool, peer->sockaddr);
         }
 
-        if (duscf->deleted == NGX_DYUPS_DELETED) {
-            *idx = i;
-            duscf_del = duscf;
-            continue;
+        if (peer->name.data) {
+            ngx_slab_free_locked(shpool, peer->name.data);
         }
 
-        uscf = duscf->upstream;
+        if (peer->server.data) {
+            ngx_slab_free_locked(shpool, peer->server.data);
+        }
 
-        if (uscf->host.len != name->len
-            || ngx_strncasecmp(uscf->host.data, name->data, uscf->host.len)
-               != 0)
-        {
-            continue;
+#if (NGX_HTTP_UPSTREAM_SID)
+        if (peer->sid.data) {
+            ngx_slab_free_locked(shpool, peer->sid.data);
         }
+#endif
 
-        *idx = i;
+#if (NGX_HTTP_SSL)
+        if (peer->ssl_session) {
+            ngx_slab_free_locked(shpool, peer->ssl_session);
+        }
+#endif
 
-        return duscf;
+        ngx_slab_free_locked(shpool, peer);
     }
 
-    return duscf_del;
+    ngx_slab_free_locked(shpool, peers);
 }
 
 
 static ngx_int_t
-ngx_dyups_init_upstream(ngx_http_dyups_srv_conf_t *duscf, ngx_str_t *name,
-    ngx_uint_t index)
+ngx_dyups_do_flip(ngx_str_t *name, ngx_dyups_shm_peers_t *speers,
+    ngx_str_t *rv)
 {
-    ngx_uint_t                           mi, m;
-    ngx_conf_t                           cf;
-    ngx_module_t                        **modules;
-    ngx_http_module_t                   *module;
-    ngx_http_conf_ctx_t                 *ctx;
-    ngx_http_upstream_srv_conf_t        *uscf, **uscfp;
-    ngx_http_upstream_main_conf_t       *umcf;
+    ngx_http_dyups_srv_conf_t           *duscf;
+    ngx_http_upstream_srv_conf_t        *uscf;
     ngx_http_dyups_upstream_srv_conf_t  *dscf;
 
-    umcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
-                                               ngx_http_upstream_module);
-    uscfp = umcf->upstreams.elts;
-
-    duscf->pool = ngx_create_pool(512, ngx_cycle->log);
-    if (duscf->pool == NULL) {
-        return NGX_ERROR;
-    }
+    /* without a free slot the set cannot be held, it is built here then */
 
-    uscf = ngx_pcalloc(duscf->pool, sizeof(ngx_http_upstream_srv_conf_t));
-    if (uscf == NULL) {
-        return NGX_ERROR;
+    if (ngx_dyups_hold_peers_locked(speers) != NGX_OK) {
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "[dyups] no slot to hold shared upstream %V, "
+                      "version %ui", name, speers->version);
+        ngx_str_set(rv, "no slot");
+        return NGX_DECLINED;
     }
 
-    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
-                 |NGX_HTTP_UPSTREAM_WEIGHT
-#ifdef NGX_HTTP_UPSTREAM_MAX_CONNS
-                 |NGX_HTTP_UPSTREAM_MAX_CONNS
-#endif
-                 |NGX_HTTP_UPSTREAM_MAX_FAILS
-                 |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
-                 |NGX_HTTP_UPSTREAM_DOWN
-                 |NGX_HTTP_UPSTREAM_BACKUP;
-
-    uscf->host.data = ngx_pstrdup(duscf->pool, name);
-    if (uscf->host.data == NULL) {
-        return NGX_ERROR;
+    duscf = ngx_dyups_new_upstream(name, rv);
+    if (duscf == NULL) {
+        ngx_dyups_release_peers(speers);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    uscf->host.len = name->len;
-    uscf->file_name = (u_char *) "dynamic_upstream";
-    uscf->line = 0;
-    uscf->port = 0;
-#if nginx_version < 1011006
-    uscf->default_port = 0;
-#endif
-    uscfp[index] = uscf;
-
-    duscf->dynamic = 1;
-    duscf->upstream = uscf;
+    uscf = duscf->upstream;
 
-    ngx_memzero(&cf, sizeof(ngx_conf_t));
-    cf.module_type = NGX_HTTP_MODULE;
-    cf.cmd_type = NGX_HTTP_MAIN_CONF;
-    cf.pool = duscf->pool;
-    cf.ctx = ngx_cycle->conf_ctx[ngx_http_module.index];
-    cf.cycle = (ngx_cycle_t *) ngx_cycle;
+    /*
+     * nothing is parsed or built here, the servers array is left empty
+     * and the peer set is the one published by the updating process
+     */
 
-    ctx = ngx_pcalloc(duscf->pool, sizeof(ngx_http_conf_ctx_t));
-    if (ctx == NULL) {
-        return NGX_ERROR;
+    uscf->servers = ngx_array_create(duscf->pool, 1,
+                                     sizeof(ngx_http_upstream_server_t));
+    if (uscf->servers == NULL) {
+        ngx_dyups_release_peers(speers);
+        ngx_str_set(rv, "out of memory");
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    ctx->main_conf = ((ngx_http_conf_ctx_t *)
-                      ngx_cycle->conf_ctx[ngx_http_module.index])->main_conf;
+    uscf->peer.init_upstream = ngx_http_upstream_init_round_robin;
+    uscf->peer.data = speers->peers;
 
-    ctx->srv_conf = ngx_pcalloc(cf.pool, sizeof(void *) * ngx_http_max_module);
-    if (ctx->srv_conf == NULL) {
-        return NGX_ERROR;
-    }
+    dscf = uscf->srv_conf[ngx_http_dyups_module.ctx_index];
+    dscf->init = ngx_http_upstream_init_round_robin_peer;
 
-    ctx->srv_conf[ngx_http_upstream_module.ctx_index] = uscf;
-    uscf->srv_conf = ctx->srv_conf;
+    uscf->peer.init = ngx_http_dyups_init_peer;
 
-#if nginx_version >= 1009011
-    modules = ngx_cycle->modules;
-#else
-    modules = ngx_modules;
-#endif
+    duscf->shm_peers = speers;
 
-    for (m = 0; modules[m]; m++) {
-        if (modules[m]->type != NGX_HTTP_MODULE) {
-            continue;
-        }
+    ngx_str_set(rv, "success");
 
-        if (modules[m]->index == ngx_http_core_module.index) {
-            continue;
-        }
+    return NGX_HTTP_OK;
+}
 
-        module = modules[m]->ctx;
-        mi = modules[m]->ctx_index;
 
-        if (module->create_srv_conf) {
-            ctx->srv_conf[mi] = module->create_srv_conf(&cf);
-            if (ctx->srv_conf[mi] == NULL) {
-                return NGX_ERROR;
-            }
+static ngx_int_t
+ngx_dyups_hold_peers_locked(ngx_dyups_shm_peers_t *speers)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < speers->npids; i++) {
+        if (speers->pids[i] == 0) {
+            speers->pids[i] = ngx_pid;
+            (void) ngx_atomic_fetch_add(&speers->refs, 1);
+            return NGX_OK;
         }
     }
 
-    dscf = uscf->srv_conf[ngx_http_dyups_module.ctx_index];
-    duscf->ref = &dscf->ref;
-    duscf->ctx = ctx;
-    duscf->deleted = 0;
-
-    ngx_dyups_add_upstream_top_filter(umcf, uscf);
-
-    return NGX_OK;
+    return NGX_DECLINED;
 }
 
 
 static void
-ngx_dyups_mark_upstream_delete(ngx_http_dyups_srv_conf_t *duscf)
+ngx_dyups_reap_peers_locked(void)
 {
-    ngx_uint_t                      i;
-    ngx_http_upstream_server_t     *us;
-    ngx_http_upstream_srv_conf_t   *uscf, **uscfp;
-    ngx_http_upstream_main_conf_t  *umcf;
+    ngx_queue_t            *q, *next;
+    ngx_slab_pool_t        *shpool;
+    ngx_dyups_shctx_t      *sh;
+    ngx_dyups_shm_peers_t  *speers;
 
-    uscf = duscf->upstream;
-    umcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
-                                               ngx_http_upstream_module);
-    uscfp = umcf->upstreams.elts;
+    sh = ngx_dyups_global_ctx.sh;
+    shpool = ngx_dyups_global_ctx.shpool;
 
-    ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
-                  "[dyups] delete upstream \"%V\"", &duscf->upstream->host);
+    for (q = ngx_queue_head(&sh->peers_queue);
+         q != ngx_queue_sentinel(&sh->peers_queue);
+         q = next)
+    {
+        next = ngx_queue_next(q);
 
-    ngx_dyups_del_upstream_top_filter(umcf, uscf);
+        speers = ngx_queue_data(q, ngx_dyups_shm_peers_t, queue);
 
-    us = uscf->servers->elts;
-    for (i = 0; i < uscf->servers->nelts; i++) {
-        us[i].down = 1;
+        if (speers->refs != 0) {
+            continue;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "[dyups] free shared peers version %ui",
+                       speers->version);
+
+        ngx_queue_remove(q);
+
+        ngx_slab_free_locked(shpool, speers->peers->config);
+        ngx_slab_free_locked(shpool, speers->peers->name->data);
+        ngx_slab_free_locked(shpool, speers->peers->name);
+        ngx_dyups_free_peers_locked(shpool, speers->peers);
+        ngx_slab_free_locked(shpool, speers);
+    }
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_dyups_sandbox_update(ngx_buf_t *buf, ngx_str_t *rv)
+{
+    ngx_int_t  rc;
+    ngx_str_t  dumy;
+
+    ngx_str_t  sandbox = ngx_string("_dyups_upstream_sandbox_");
+
+    rc = ngx_dyups_do_update(&sandbox, buf, rv);
+
+    (void) ngx_dyups_do_delete(&sandbox, &dumy);
+
+    return rc;
+}
+
+
+static char *
+ngx_dyups_parse_upstream(ngx_conf_t *cf, ngx_buf_t *buf)
+{
+    char                       *rc;
+    ngx_buf_t                   b;
+    ngx_str_t                   s;
+    ngx_uint_t                  i;
+    ngx_hash_t                  vh, vh_prev;
+    ngx_array_t                 va, va_prev;
+    ngx_conf_file_t             conf_file;
+    ngx_http_variable_t        *v;
+    ngx_hash_keys_arrays_t      vk;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    b = *buf;   /* avoid modifying @buf */
+
+    ngx_memzero(&conf_file, sizeof(ngx_conf_file_t));
+    conf_file.file.fd = NGX_INVALID_FILE;
+    conf_file.buffer = &b;
+
+    cf->conf_file = &conf_file;
+
+    rc = ngx_conf_parse(cf, NULL);
+    if (rc != NGX_CONF_OK) {
+        return rc;
+    }
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    va_prev = cmcf->variables;
+    vh_prev = cmcf->variables_hash;
+
+    ngx_memzero(&va, sizeof(va));
+    ngx_memzero(&vh, sizeof(vh));
+    ngx_memzero(&vk, sizeof(vk));
+
+    cmcf->variables      = va;
+    cmcf->variables_hash = vh;
+    cmcf->variables_keys = &vk;
+
+    v = va_prev.elts;
+    for (i = 0; i < va_prev.nelts; i++) {
+
+        if (v[i].get_handler) {
+            continue;
+        }
+
+        s.len = v[i].name.len;
+        s.data = ngx_pstrdup(ngx_cycle->pool, &v[i].name);
+        if (!s.data) {
+            rc = NGX_CONF_ERROR;
+            break;
+        }
+
+        /*
+         * variable name will be assign to cmcf->variables[idx].name directly
+         * so the lifetime of v[i].name should be the same as cmcf
+         */
+        v[i].name = s;
+
+        cmcf->variables.elts = &v[i];
+        cmcf->variables.nelts = 1;
+        if (ngx_http_variables_init_vars(cf) != NGX_OK) {
+            rc = NGX_CONF_ERROR;
+            break;
+        }
+    }
+
+    cmcf->variables      = va_prev;
+    cmcf->variables_hash = vh_prev;
+    cmcf->variables_keys = NULL;
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_dyups_add_server(ngx_http_dyups_srv_conf_t *duscf, ngx_buf_t *buf)
+{
+    ngx_conf_t                           cf;
+    ngx_http_upstream_init_pt            init;
+    ngx_http_upstream_srv_conf_t        *uscf;
+    ngx_http_dyups_upstream_srv_conf_t  *dscf;
+
+    uscf = duscf->upstream;
+
+    if (uscf->servers == NULL) {
+        uscf->servers = ngx_array_create(duscf->pool, 4,
+                                         sizeof(ngx_http_upstream_server_t));
+        if (uscf->servers == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_memzero(&cf, sizeof(ngx_conf_t));
+    cf.name = "dyups_init_module_conf";
+    cf.pool = duscf->pool;
+    cf.cycle = (ngx_cycle_t *) ngx_cycle;
+    cf.module_type = NGX_HTTP_MODULE;
+    cf.cmd_type = NGX_HTTP_UPS_CONF;
+    cf.log = ngx_cycle->log;
+    cf.ctx = duscf->ctx;
+    cf.args = ngx_array_create(duscf->pool, 10, sizeof(ngx_str_t));
+    if (cf.args == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_dyups_parse_upstream(&cf, buf) != NGX_CONF_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&cf, sizeof(ngx_conf_t));
+    cf.name = "dyups_init_upstream";
+    cf.cycle = (ngx_cycle_t *) ngx_cycle;
+    cf.pool = duscf->pool;
+    cf.module_type = NGX_HTTP_MODULE;
+    cf.cmd_type = NGX_HTTP_MAIN_CONF;
+    cf.log = ngx_cycle->log;
+    cf.ctx = duscf->ctx;
+
+
+    init = uscf->peer.init_upstream ? uscf->peer.init_upstream:
+        ngx_http_upstream_init_round_robin;
+
+    if (init(&cf, uscf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+#if (T_NGX_HTTP_UPSTREAM_RANDOM)
+    {
+
+    ngx_http_upstream_rr_peers_t        *peers, *backup;
+
+    /* add init_number initialization */
+
+    peers = uscf->peer.data;
+    peers->init_number = ngx_random() % peers->number;
+    backup = peers->next;
+
+    if (backup) {
+        backup->init_number = ngx_random() % backup->number;
+    }
+
+    }
+#endif
+
+    dscf = uscf->srv_conf[ngx_http_dyups_module.ctx_index];
+    dscf->init = uscf->peer.init;
+
+    uscf->peer.init = ngx_http_dyups_init_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_dyups_srv_conf_t *
+ngx_dyups_find_upstream(ngx_str_t *name, ngx_int_t *idx)
+{
+    ngx_uint_t                      i;
+    ngx_http_dyups_srv_conf_t      *duscfs, *duscf, *duscf_del;
+    ngx_http_dyups_main_conf_t     *dumcf;
+    ngx_http_upstream_srv_conf_t   *uscf;
+
+    dumcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
+                                                ngx_http_dyups_module);
+    *idx = -1;
+    duscf_del = NULL;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "[dyups] find dynamic upstream");
+
+    duscfs = dumcf->dy_upstreams.elts;
+    for (i = 0; i < dumcf->dy_upstreams.nelts; i++) {
+
+        duscf = &duscfs[i];
+        if (!duscf->dynamic) {
+            continue;
+        }
+
+        if (duscf->deleted == NGX_DYUPS_DELETING) {
+
+            ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
+                          "[dyups] find upstream idx: %ui ref: %ui "
+                          "on %V deleting",
+                          i, *(duscf->ref), &duscf->upstream->host);
+
+            if (*(duscf->ref) == 0) {
+                ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                              "[dyups] free dynamic upstream in find upstream"
+                              " %ui", duscf->idx);
+
+                duscf->deleted = NGX_DYUPS_DELETED;
+
+                ngx_dyups_free_upstream(duscf);
+            }
+        }
+
+        if (duscf->deleted == NGX_DYUPS_DELETING) {
+            continue;
+        }
+
+        if (duscf->deleted == NGX_DYUPS_DELETED) {
+            *idx = i;
+            duscf_del = duscf;
+            continue;
+        }
+
+        uscf = duscf->upstream;
+
+        if (uscf->host.len != name->len
+            || ngx_strncasecmp(uscf->host.data, name->data, uscf->host.len)
+               != 0)
+        {
+            continue;
+        }
+
+        *idx = i;
+
+        return duscf;
+    }
+
+    return duscf_del;
+}
+
+
+static ngx_int_t
+ngx_dyups_init_upstream(ngx_http_dyups_srv_conf_t *duscf, ngx_str_t *name,
+    ngx_uint_t index)
+{
+    ngx_uint_t                           mi, m;
+    ngx_conf_t                           cf;
+    ngx_module_t                        **modules;
+    ngx_http_module_t                   *module;
+    ngx_http_conf_ctx_t                 *ctx;
+    ngx_http_upstream_srv_conf_t        *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t       *umcf;
+    ngx_http_dyups_upstream_srv_conf_t  *dscf;
+
+    umcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
+                                               ngx_http_upstream_module);
+    uscfp = umcf->upstreams.elts;
+
+    duscf->pool = ngx_create_pool(512, ngx_cycle->log);
+    if (duscf->pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    uscf = ngx_pcalloc(duscf->pool, sizeof(ngx_http_upstream_srv_conf_t));
+    if (uscf == NULL) {
+        return NGX_ERROR;
+    }
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                 |NGX_HTTP_UPSTREAM_WEIGHT
+#ifdef NGX_HTTP_UPSTREAM_MAX_CONNS
+                 |NGX_HTTP_UPSTREAM_MAX_CONNS
+#endif
+                 |NGX_HTTP_UPSTREAM_MAX_FAILS
+                 |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                 |NGX_HTTP_UPSTREAM_DOWN
+                 |NGX_HTTP_UPSTREAM_BACKUP;
+
+    uscf->host.data = ngx_pstrdup(duscf->pool, name);
+    if (uscf->host.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    uscf->host.len = name->len;
+    uscf->file_name = (u_char *) "dynamic_upstream";
+    uscf->line = 0;
+    uscf->port = 0;
+#if nginx_version < 1011006
+    uscf->default_port = 0;
+#endif
+    uscfp[index] = uscf;
+
+    duscf->dynamic = 1;
+    duscf->upstream = uscf;
+
+    ngx_memzero(&cf, sizeof(ngx_conf_t));
+    cf.module_type = NGX_HTTP_MODULE;
+    cf.cmd_type = NGX_HTTP_MAIN_CONF;
+    cf.pool = duscf->pool;
+    cf.ctx = ngx_cycle->conf_ctx[ngx_http_module.index];
+    cf.cycle = (ngx_cycle_t *) ngx_cycle;
+
+    ctx = ngx_pcalloc(duscf->pool, sizeof(ngx_http_conf_ctx_t));
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->main_conf = ((ngx_http_conf_ctx_t *)
+                      ngx_cycle->conf_ctx[ngx_http_module.index])->main_conf;
+
+    ctx->srv_conf = ngx_pcalloc(cf.pool, sizeof(void *) * ngx_http_max_module);
+    if (ctx->srv_conf == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->srv_conf[ngx_http_upstream_module.ctx_index] = uscf;
+    uscf->srv_conf = ctx->srv_conf;
+
+#if nginx_version >= 1009011
+    modules = ngx_cycle->modules;
+#else
+    modules = ngx_modules;
+#endif
+
+    for (m = 0; modules[m]; m++) {
+        if (modules[m]->type != NGX_HTTP_MODULE) {
+            continue;
+        }
+
+        if (modules[m]->index == ngx_http_core_module.index) {
+            continue;
+        }
+
+        module = modules[m]->ctx;
+        mi = modules[m]->ctx_index;
+
+        if (module->create_srv_conf) {
+            ctx->srv_conf[mi] = module->create_srv_conf(&cf);
+            if (ctx->srv_conf[mi] == NULL) {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    dscf = uscf->srv_conf[ngx_http_dyups_module.ctx_index];
+    duscf->ref = &dscf->ref;
+    duscf->ctx = ctx;
+    duscf->deleted = 0;
+
+    ngx_dyups_add_upstream_top_filter(umcf, uscf);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_dyups_mark_upstream_delete(ngx_http_dyups_srv_conf_t *duscf)
+{
+    ngx_uint_t                      i;
+    ngx_http_upstream_server_t     *us;
+    ngx_http_upstream_srv_conf_t   *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    uscf = duscf->upstream;
+    umcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
+                                               ngx_http_upstream_module);
+    uscfp = umcf->upstreams.elts;
+
+    ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                  "[dyups] delete upstream \"%V\"", &duscf->upstream->host);
+
+    ngx_dyups_del_upstream_top_filter(umcf, uscf);
+
+    us = uscf->servers->elts;
+    for (i = 0; i < uscf->servers->nelts; i++) {
+        us[i].down = 1;
+
+#if (NGX_HTTP_UPSTREAM_CHECK)
+        ngx_uint_t  j;
+
+        for (j = 0; j < us[i].naddrs; j++) {
+            ngx_http_upstream_check_delete_dynamic_peer(&uscf->host,
+                                                        &us[i].addrs[j]);
+        }
+#endif
+    }
+
+#if (NGX_HTTP_SSL)
+    /* sessions of a shared set live in the zone and are freed with it */
+    if (uscf->peer.data && duscf->shm_peers == NULL) {
+        ngx_http_dyups_free_peer_sessions(uscf->peer.data);
+    }
+#endif
+
+    uscfp[duscf->idx] = &ngx_http_dyups_deleted_upstream;
+    duscf->deleted = NGX_DYUPS_DELETING;
+}
+
+
+static void
+ngx_http_dyups_send_response(ngx_http_request_t *r, ngx_int_t status,
+    ngx_str_t *content)
+{
+    ngx_int_t    rc;
+    ngx_buf_t   *b;
+    ngx_chain_t  out;
+
+    r->headers_out.status = status;
+    r->headers_out.content_length_n = content->len;
+
+    rc = ngx_http_send_header(r);
+    if (rc == NGX_ERROR || rc > NGX_OK) {
+        ngx_http_finalize_request(r, rc);
+        return;
+    }
+
+    if (content->len == 0) {
+        ngx_http_finalize_request(r, ngx_http_send_special(r, NGX_HTTP_FLUSH));
+        return;
+    }
+
+    b = ngx_create_temp_buf(r->pool, content->len);
+    if (b == NULL) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    b->pos = content->data;
+    b->last = content->data + content->len;
+    b->last_buf = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    ngx_http_finalize_request(r, ngx_http_output_filter(r, &out));
+}
+
+
+static ngx_buf_t *
+ngx_http_dyups_read_body(ngx_http_request_t *r)
+{
+    size_t        len;
+    ngx_buf_t    *buf, *next, *body;
+    ngx_chain_t  *cl;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[dyups] interface read post body");
+
+    cl = r->request_body->bufs;
+    buf = cl->buf;
+
+    if (cl->next == NULL) {
+
+        return buf;
+
+    } else {
+
+        next = cl->next->buf;
+        len = (buf->last - buf->pos) + (next->last - next->pos);
+
+        body = ngx_create_temp_buf(r->pool, len);
+        if (body == NULL) {
+            return NULL;
+        }
+
+        body->last = ngx_cpymem(body->last, buf->pos, buf->last - buf->pos);
+        body->last = ngx_cpymem(body->last, next->pos, next->last - next->pos);
+    }
+
+    return body;
+}
+
+
+static ngx_buf_t *
+ngx_http_dyups_read_body_from_file(ngx_http_request_t *r)
+{
+    size_t        len;
+    ssize_t       size;
+    ngx_buf_t    *buf, *body;
+    ngx_chain_t  *cl;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[dyups] interface read post body from file");
+
+    len = 0;
+    cl = r->request_body->bufs;
 
-#if (NGX_HTTP_UPSTREAM_CHECK)
-        ngx_uint_t  j;
+    while (cl) {
 
-        for (j = 0; j < us[i].naddrs; j++) {
-            ngx_http_upstream_check_delete_dynamic_peer(&uscf->host,
-                                                        &us[i].addrs[j]);
+        buf = cl->buf;
+
+        if (buf->in_file) {
+            len += buf->file_last - buf->file_pos;
+
+        } else {
+            len += buf->last - buf->pos;
+        }
+
+        cl = cl->next;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "[dyups] interface read post body file size %ui", len);
+
+    body = ngx_create_temp_buf(r->pool, len);
+    if (body == NULL) {
+        return NULL;
+    }
+
+    cl = r->request_body->bufs;
+
+    while (cl) {
+
+        buf = cl->buf;
+
+        if (buf->in_file) {
+
+            size = ngx_read_file(buf->file, body->last,
+                                 buf->file_last - buf->file_pos, buf->file_pos);
+
+            if (size == NGX_ERROR) {
+                return NULL;
+            }
+
+            body->last += size;
+
+        } else {
+
+            body->last = ngx_cpymem(body->last, buf->pos, buf->last - buf->pos);
+        }
+
+        cl = cl->next;
+    }
+
+    return body;
+}
+
+
+ngx_array_t *
+ngx_dyups_parse_path(ngx_pool_t *pool, ngx_str_t *path)
+{
+    u_char       *p, *last, *end;
+    ngx_str_t    *str;
+    ngx_array_t  *array;
+
+    array = ngx_array_create(pool, 8, sizeof(ngx_str_t));
+    if (array == NULL) {
+        return NULL;
+    }
+
+    p = path->data + 1;
+    last = path->data + path->len;
+
+    while(p < last) {
+        end = ngx_strlchr(p, last, '/');
+        str = ngx_array_push(array);
+
+        if (str == NULL) {
+            return NULL;
+        }
+
+        if (end) {
+            str->data = p;
+            str->len = end - p;
+
+        } else {
+            str->data = p;
+            str->len = last - p;
+
+        }
+
+        p += str->len + 1;
+    }
+
+#if (NGX_DEBUG)
+    ngx_str_t  *arg;
+    ngx_uint_t  i;
+
+    arg = array->elts;
+    for (i = 0; i < array->nelts; i++) {
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "[dyups] res[%i]:%V", i, &arg[i]);
+    }
+#endif
+
+    return array;
+}
+
+
+static ngx_int_t
+ngx_http_dyups_init_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_int_t                            rc;
+    ngx_pool_cleanup_t                  *cln;
+    ngx_http_dyups_ctx_t                *ctx;
+    ngx_http_dyups_upstream_srv_conf_t  *dscf;
+
+    dscf = us->srv_conf[ngx_http_dyups_module.ctx_index];
+
+    rc = dscf->init(r, us);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "[dyups] dynamic upstream init peer: %i",
+                   rc);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_dyups_ctx_t));
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->scf = dscf;
+    ctx->data = r->upstream->peer.data;
+    ctx->get = r->upstream->peer.get;
+    ctx->free = r->upstream->peer.free;
+
+    r->upstream->peer.data = ctx;
+    r->upstream->peer.get = ngx_http_dyups_get_peer;
+    r->upstream->peer.free = ngx_http_dyups_free_peer;
+
+#if (NGX_HTTP_SSL)
+    ctx->original_set_session = r->upstream->peer.set_session;
+    ctx->original_save_session = r->upstream->peer.save_session;
+    r->upstream->peer.set_session = ngx_http_dyups_set_peer_session;
+    r->upstream->peer.save_session = ngx_http_dyups_save_peer_session;
+#endif
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    dscf->ref++;
+
+    cln->handler = ngx_http_dyups_clean_request;
+    cln->data = &dscf->ref;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_dyups_get_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_dyups_ctx_t  *ctx = data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "[dyups] dynamic upstream get handler count %i",
+                   ctx->scf->ref);
+
+    return ctx->get(pc, ctx->data);
+}
+
+
+static void
+ngx_http_dyups_free_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_dyups_ctx_t  *ctx = data;
+
+    ngx_pool_cleanup_t  *cln;
+
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "[dyups] dynamic upstream free handler count %i",
+                   ctx->scf->ref);
+
+    /* upstream connect failed */
+    if (pc->connection == NULL) {
+        goto done;
+    }
+
+    if (pc->cached) {
+        goto done;
+    }
+
+    ctx->scf->ref++;
+
+    cln = ngx_pool_cleanup_add(pc->connection->pool, 0);
+    if (cln == NULL) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "[dyups] dynamic upstream free peer may cause memleak %i",
+                      ctx->scf->ref);
+        goto done;
+    }
+
+    cln->handler = ngx_http_dyups_clean_request;
+    cln->data = &ctx->scf->ref;
+
+ done:
+
+    ctx->free(pc, ctx->data, state);
+}
+
+
+static void
+ngx_http_dyups_clean_request(void *data)
+{
+    ngx_uint_t  *ref = data;
+
+    (*ref)--;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "[dyups] http clean request count %i", *ref);
+}
+
+
+static void
+ngx_http_dyups_read_msg(ngx_event_t *ev)
+{
+    ngx_uint_t                   i, count, s_count, d_count;
+    ngx_slab_pool_t             *shpool;
+    ngx_http_dyups_srv_conf_t   *duscfs, *duscf;
+    ngx_http_dyups_main_conf_t  *dmcf;
+
+    dmcf = ev->data;
+    shpool = ngx_dyups_global_ctx.shpool;
+
+    count = 0;
+    s_count = 0;
+    d_count = 0;
+
+    duscfs = dmcf->dy_upstreams.elts;
+    for (i = 0; i < dmcf->dy_upstreams.nelts; i++) {
+
+        duscf = &duscfs[i];
+
+        if (!duscf->dynamic) {
+            s_count++;
+            continue;
+        }
+
+        if (duscf->deleted) {
+            d_count++;
+            continue;
         }
-#endif
+
+        count++;
     }
 
-#if (NGX_HTTP_SSL)
-    if (uscf->peer.data) {
-        ngx_http_dyups_free_peer_sessions(uscf->peer.data);
+    if (dmcf->read_msg_log == 1) {
+        ngx_log_error(NGX_LOG_INFO, ev->log, 0,
+                      "[dyups] has %ui upstreams, %ui static, %ui deleted, all %ui",
+                      count, s_count, d_count, dmcf->dy_upstreams.nelts);
+    }
+
+#if (NGX_HTTP_UPSTREAM_CHECK)
+    if (!ngx_shmtx_trylock(&shpool->mutex)) {
+        goto finish;
     }
+#else
+    ngx_shmtx_lock(&shpool->mutex);
 #endif
 
-    uscfp[duscf->idx] = &ngx_http_dyups_deleted_upstream;
-    duscf->deleted = NGX_DYUPS_DELETING;
+    ngx_http_dyups_read_msg_locked(ev);
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+#if (NGX_HTTP_UPSTREAM_CHECK)
+finish:
+#endif
+    ngx_dyups_add_timer(ev, dmcf->read_msg_timeout);
 }
 
 
 static void
-ngx_http_dyups_send_response(ngx_http_request_t *r, ngx_int_t status,
-    ngx_str_t *content)
+ngx_http_dyups_read_msg_locked(ngx_event_t *ev)
 {
-    ngx_int_t    rc;
-    ngx_buf_t   *b;
-    ngx_chain_t  out;
+    ngx_int_t            i, rc;
+    ngx_str_t            name, content;
+    ngx_flag_t           found;
+    ngx_time_t          *tp;
+    ngx_pool_t          *pool;
+    ngx_msec_t           now;
+    ngx_queue_t         *q, *t;
+    ngx_core_conf_t     *ccf;
+    ngx_slab_pool_t     *shpool;
+    ngx_dyups_msg_t     *msg;
+    ngx_dyups_shctx_t   *sh;
+    ngx_dyups_status_t  *status;
 
-    r->headers_out.status = status;
-    r->headers_out.content_length_n = content->len;
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "[dyups] read msg %P", ngx_pid);
 
-    rc = ngx_http_send_header(r);
-    if (rc == NGX_ERROR || rc > NGX_OK) {
-        ngx_http_finalize_request(r, rc);
-        return;
+    ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                           ngx_core_module);
+
+    sh = ngx_dyups_global_ctx.sh;
+    shpool = ngx_dyups_global_ctx.shpool;
+
+    tp = ngx_timeofday();
+    now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+
+    for (i = 0; i < ccf->worker_processes; i++) {
+        status = &sh->status[i];
+
+        if (status->pid == 0 || status->pid == ngx_pid) {
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                           "[dyups] process %P update time %ui",
+                           status->pid, status->time);
+
+            status->pid = ngx_pid;
+            status->time = now;
+            break;
+        }
     }
 
-    if (content->len == 0) {
-        ngx_http_finalize_request(r, ngx_http_send_special(r, NGX_HTTP_FLUSH));
+    if (ngx_queue_empty(&sh->msg_queue)) {
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        ngx_dyups_reap_peers_locked();
+#endif
         return;
     }
 
-    b = ngx_create_temp_buf(r->pool, content->len);
-    if (b == NULL) {
-        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+    pool = ngx_create_pool(ngx_pagesize, ev->log);
+    if (pool == NULL) {
         return;
     }
 
-    b->pos = content->data;
-    b->last = content->data + content->len;
-    b->last_buf = 1;
+    for (q = ngx_queue_last(&sh->msg_queue);
+         q != ngx_queue_sentinel(&sh->msg_queue);
+         q = ngx_queue_prev(q))
+    {
+        msg = ngx_queue_data(q, ngx_dyups_msg_t, queue);
 
-    out.buf = b;
-    out.next = NULL;
+        if (msg->count == ccf->worker_processes) {
+            t = ngx_queue_next(q); ngx_queue_remove(q); q = t;
 
-    ngx_http_finalize_request(r, ngx_http_output_filter(r, &out));
-}
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                                  "[dyups] destroy msg %V:%V",
+                                  &msg->name, &msg->content);
 
+            ngx_dyups_destroy_msg(shpool, msg);
+            continue;
+        }
 
-static ngx_buf_t *
-ngx_http_dyups_read_body(ngx_http_request_t *r)
-{
-    size_t        len;
-    ngx_buf_t    *buf, *next, *body;
-    ngx_chain_t  *cl;
+        found = 0;
+        for (i = 0; i < msg->count; i++) {
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "[dyups] interface read post body");
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                           "[dyups] msg pids [%P]", msg->pid[i]);
 
-    cl = r->request_body->bufs;
-    buf = cl->buf;
+            if (msg->pid[i] == ngx_pid) {
+                found = 1;
+                break;
+            }
+        }
 
-    if (cl->next == NULL) {
+        if (found) {
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                           "[dyups] msg %V count %ui found",
+                           &msg->name, msg->count);
+            continue;
+        }
 
-        return buf;
+        msg->pid[i] = ngx_pid;
+        msg->count++;
 
-    } else {
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                       "[dyups] msg %V count %ui", &msg->name, msg->count);
 
-        next = cl->next->buf;
-        len = (buf->last - buf->pos) + (next->last - next->pos);
+        name = msg->name;
+        content = msg->content;
 
-        body = ngx_create_temp_buf(r->pool, len);
-        if (body == NULL) {
-            return NULL;
+        rc = ngx_dyups_sync_cmd(pool, &name, &content, msg->flag,
+                                msg->peers, msg->npeers);
+        if (rc != NGX_OK) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
+                          "[dyups] read msg error, may cause the "
+                          "config inaccuracy, name:%V, content:%V",
+                          &name, &content);
         }
-
-        body->last = ngx_cpymem(body->last, buf->pos, buf->last - buf->pos);
-        body->last = ngx_cpymem(body->last, next->pos, next->last - next->pos);
     }
 
-    return body;
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "[dyups] read end");
+
+    ngx_destroy_pool(pool);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_dyups_reap_peers_locked();
+#endif
+
+    return;
 }
 
 
-static ngx_buf_t *
-ngx_http_dyups_read_body_from_file(ngx_http_request_t *r)
+static ngx_int_t
+ngx_http_dyups_send_msg(ngx_str_t *name, ngx_buf_t *body, ngx_uint_t flag,
+    ngx_dyups_shm_peers_t **peers, ngx_uint_t npeers)
 {
-    size_t        len;
-    ssize_t       size;
-    ngx_buf_t    *buf, *body;
-    ngx_chain_t  *cl;
-
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "[dyups] interface read post body from file");
+    ngx_uint_t          i;
+    ngx_core_conf_t    *ccf;
+    ngx_slab_pool_t    *shpool;
+    ngx_dyups_msg_t    *msg;
+    ngx_dyups_shctx_t  *sh;
 
-    len = 0;
-    cl = r->request_body->bufs;
+    ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                           ngx_core_module);
 
-    while (cl) {
+    sh = ngx_dyups_global_ctx.sh;
+    shpool = ngx_dyups_global_ctx.shpool;
 
-        buf = cl->buf;
+    msg = ngx_slab_alloc_locked(shpool, sizeof(ngx_dyups_msg_t));
+    if (msg == NULL) {
+        goto failed;
+    }
 
-        if (buf->in_file) {
-            len += buf->file_last - buf->file_pos;
+    ngx_memzero(msg, sizeof(ngx_dyups_msg_t));
 
-        } else {
-            len += buf->last - buf->pos;
-        }
+    msg->flag = flag;
+    msg->count = 0;
+    msg->pid = ngx_slab_alloc_locked(shpool,
+                                     sizeof(ngx_pid_t) * ccf->worker_processes);
 
-        cl = cl->next;
+    if (msg->pid == NULL) {
+        goto failed;
     }
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "[dyups] interface read post body file size %ui", len);
+    ngx_memzero(msg->pid, sizeof(ngx_pid_t) * ccf->worker_processes);
+    msg->pid[0] = ngx_pid;
+    msg->count++;
 
-    body = ngx_create_temp_buf(r->pool, len);
-    if (body == NULL) {
-        return NULL;
+    msg->name.data = ngx_slab_alloc_locked(shpool, name->len);
+    if (msg->name.data == NULL) {
+        goto failed;
     }
 
-    cl = r->request_body->bufs;
+    ngx_memcpy(msg->name.data, name->data, name->len);
+    msg->name.len = name->len;
 
-    while (cl) {
+    if (body) {
+        msg->content.data = ngx_slab_alloc_locked(shpool,
+                                                  body->last - body->pos);
+        if (msg->content.data == NULL) {
+            goto failed;
+        }
 
-        buf = cl->buf;
+        ngx_memcpy(msg->content.data, body->pos, body->last - body->pos);
+        msg->content.len = body->last - body->pos;
 
-        if (buf->in_file) {
+    } else {
+        msg->content.data = NULL;
+        msg->content.len = 0;
+    }
 
-            size = ngx_read_file(buf->file, body->last,
-                                 buf->file_last - buf->file_pos, buf->file_pos);
+    if (npeers) {
+        msg->peers = ngx_slab_alloc_locked(shpool,
+                                    sizeof(ngx_dyups_shm_peers_t *) * npeers);
+        if (msg->peers == NULL) {
+            goto failed;
+        }
 
-            if (size == NGX_ERROR) {
-                return NULL;
+        /* the message keeps the sets alive until every worker has read it */
+
+        for (i = 0; i < npeers; i++) {
+            if (peers[i]) {
+                (void) ngx_atomic_fetch_add(&peers[i]->refs, 1);
             }
 
-            body->last += size;
+            msg->peers[i] = peers[i];
+        }
 
-        } else {
+        msg->npeers = npeers;
+    }
 
-            body->last = ngx_cpymem(body->last, buf->pos, buf->last - buf->pos);
-        }
+    sh->version++;
+
+    if (sh->version == 0) {
+        sh->version = 1;
+    };
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "[dyups] send msg %V count %ui version: %ui",
+                   &msg->name, msg->count, sh->version);
+
+    ngx_queue_insert_head(&sh->msg_queue, &msg->queue);
+
+    return NGX_OK;
+
+failed:
 
-        cl = cl->next;
+    if (msg) {
+        ngx_dyups_destroy_msg(shpool, msg);
     }
 
-    return body;
+    return NGX_ERROR;
 }
 
 
-ngx_array_t *
-ngx_dyups_parse_path(ngx_pool_t *pool, ngx_str_t *path)
+static void
+ngx_dyups_destroy_msg(ngx_slab_pool_t *shpool, ngx_dyups_msg_t *msg)
 {
-    u_char       *p, *last, *end;
-    ngx_str_t    *str;
-    ngx_array_t  *array;
+    ngx_uint_t  i;
 
-    array = ngx_array_create(pool, 8, sizeof(ngx_str_t));
-    if (array == NULL) {
-        return NULL;
+    if (msg->pid) {
+        ngx_slab_free_locked(shpool, msg->pid);
     }
 
-    p = path->data + 1;
-    last = path->data + path->len;
-
-    while(p < last) {
-        end = ngx_strlchr(p, last, '/');
-        str = ngx_array_push(array);
-
-        if (str == NULL) {
-            return NULL;
-        }
-
-        if (end) {
-            str->data = p;
-            str->len = end - p;
-
-        } else {
-            str->data = p;
-            str->len = last - p;
-
-        }
+    if (msg->name.data) {
+        ngx_slab_free_locked(shpool, msg->name.data);
+    }
 
-        p += str->len + 1;
+    if (msg->content.data) {
+        ngx_slab_free_locked(shpool, msg->content.data);
     }
 
-#if (NGX_DEBUG)
-    ngx_str_t  *arg;
-    ngx_uint_t  i;
+    if (msg->peers) {
+        for (i = 0; i < msg->npeers; i++) {
+            if (msg->peers[i]) {
+                (void) ngx_atomic_fetch_add(&msg->peers[i]->refs, -1);
+            }
+        }
 
-    arg = array->elts;
-    for (i = 0; i < array->nelts; i++) {
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "[dyups] res[%i]:%V", i, &arg[i]);
+        ngx_slab_free_locked(shpool, msg->peers);
     }
-#endif
 
-    return array;
+    ngx_slab_free_locked(shpool, msg);
 }
 
 
 static ngx_int_t
-ngx_http_dyups_init_peer(ngx_http_request_t *r,
-    ngx_http_upstream_srv_conf_t *us)
+ngx_dyups_sync_cmd(ngx_pool_t *pool, ngx_str_t *name, ngx_str_t *content,
+    ngx_uint_t flag, ngx_dyups_shm_peers_t **peers, ngx_uint_t npeers)
 {
-    ngx_int_t                            rc;
-    ngx_pool_cleanup_t                  *cln;
-    ngx_http_dyups_ctx_t                *ctx;
-    ngx_http_dyups_upstream_srv_conf_t  *dscf;
+    ngx_int_t     rc;
+    ngx_buf_t     body;
+    ngx_str_t     rv;
 
-    dscf = us->srv_conf[ngx_http_dyups_module.ctx_index];
+    if (flag == NGX_DYUPS_DELETE) {
 
-    rc = dscf->init(r, us);
+        rc = ngx_dyups_do_delete(name, &rv);
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "[dyups] dynamic upstream init peer: %i",
-                   rc);
+        ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                       "[dyups] sync del: %V rv: %V rc: %i",
+                       name, &rv, rc);
 
-    if (rc != NGX_OK) {
-        return rc;
-    }
+        if (rc != NGX_HTTP_OK) {
+            return NGX_ERROR;
+        }
 
-    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_dyups_ctx_t));
-    if (ctx == NULL) {
-        return NGX_ERROR;
-    }
+        return NGX_OK;
 
-    ctx->scf = dscf;
-    ctx->data = r->upstream->peer.data;
-    ctx->get = r->upstream->peer.get;
-    ctx->free = r->upstream->peer.free;
+    } else if (flag == NGX_DYUPS_ADD) {
 
-    r->upstream->peer.data = ctx;
-    r->upstream->peer.get = ngx_http_dyups_get_peer;
-    r->upstream->peer.free = ngx_http_dyups_free_peer;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (npeers && peers[0]) {
+            rc = ngx_dyups_do_flip(name, peers[0], &rv);
 
-#if (NGX_HTTP_SSL)
-    ctx->original_set_session = r->upstream->peer.set_session;
-    ctx->original_save_session = r->upstream->peer.save_session;
-    r->upstream->peer.set_session = ngx_http_dyups_set_peer_session;
-    r->upstream->peer.save_session = ngx_http_dyups_save_peer_session;
+            ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                          "[dyups] sync flip: %V version: %ui rv: %V rc: %i",
+                          name, peers[0]->version, &rv, rc);
+
+            if (rc == NGX_HTTP_OK) {
+                return NGX_OK;
+            }
+
+            if (rc != NGX_DECLINED) {
+                return NGX_ERROR;
+            }
+        }
 #endif
 
-    cln = ngx_pool_cleanup_add(r->pool, 0);
-    if (cln == NULL) {
-        return NGX_ERROR;
-    }
+        body.start = body.pos = content->data;
+        body.end = body.last = content->data + content->len;
+        body.temporary = 1;
 
-    dscf->ref++;
+        rc = ngx_dyups_do_update(name, &body, &rv);
 
-    cln->handler = ngx_http_dyups_clean_request;
-    cln->data = &dscf->ref;
+        ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                      "[dyups] sync add: %V rv: %V rc: %i",
+                      name, &rv, rc);
 
-    return NGX_OK;
-}
+        if (rc != NGX_HTTP_OK) {
+            return NGX_ERROR;
+        }
 
+        return NGX_OK;
 
-static ngx_int_t
-ngx_http_dyups_get_peer(ngx_peer_connection_t *pc, void *data)
-{
-    ngx_http_dyups_ctx_t  *ctx = data;
+    } else if (flag == NGX_DYUPS_BATCH) {
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "[dyups] dynamic upstream get handler count %i",
-                   ctx->scf->ref);
+        return ngx_dyups_sync_batch(pool, content, peers, npeers);
+    }
 
-    return ctx->get(pc, ctx->data);
+    return NGX_ERROR;
 }
 
 
-static void
-ngx_http_dyups_free_peer(ngx_peer_connection_t *pc, void *data,
-    ngx_uint_t state)
+static ngx_int_t
+ngx_dyups_sync_batch(ngx_pool_t *pool, ngx_str_t *content,
+    ngx_dyups_shm_peers_t **peers, ngx_uint_t npeers)
 {
-    ngx_http_dyups_ctx_t  *ctx = data;
-
-    ngx_pool_cleanup_t  *cln;
+    ngx_int_t                 rc, ret;
+    ngx_str_t                 rv;
+    ngx_buf_t                 body;
+    ngx_uint_t                i;
+    ngx_array_t              *entries;
+    ngx_dyups_batch_entry_t  *e;
+
+    ngx_memzero(&body, sizeof(ngx_buf_t));
+
+    body.start = body.pos = content->data;
+    body.end = body.last = content->data + content->len;
+    body.temporary = 1;
+
+    entries = ngx_dyups_parse_batch(pool, &body, &rv);
+    if (entries == NULL) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "[dyups] sync batch: %V", &rv);
+        return NGX_ERROR;
+    }
 
+    ret = NGX_OK;
+    e = entries->elts;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "[dyups] dynamic upstream free handler count %i",
-                   ctx->scf->ref);
+    for (i = 0; i < entries->nelts; i++) {
 
-    /* upstream connect failed */
-    if (pc->connection == NULL) {
-        goto done;
-    }
+        if (e[i].flag == NGX_DYUPS_DELETE) {
+            rc = ngx_dyups_do_delete(&e[i].name, &rv);
 
-    if (pc->cached) {
-        goto done;
-    }
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        } else if (i < npeers && peers[i]) {
+            rc = ngx_dyups_do_flip(&e[i].name, peers[i], &rv);
 
-    ctx->scf->ref++;
+            if (rc == NGX_DECLINED) {
+                rc = ngx_dyups_do_update(&e[i].name, &e[i].body, &rv);
+            }
+#endif
 
-    cln = ngx_pool_cleanup_add(pc->connection->pool, 0);
-    if (cln == NULL) {
-        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                      "[dyups] dynamic upstream free peer may cause memleak %i",
-                      ctx->scf->ref);
-        goto done;
-    }
+        } else {
+            rc = ngx_dyups_do_update(&e[i].name, &e[i].body, &rv);
+        }
 
-    cln->handler = ngx_http_dyups_clean_request;
-    cln->data = &ctx->scf->ref;
+        ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                      "[dyups] sync batch %s: %V rv: %V rc: %i",
+                      e[i].flag == NGX_DYUPS_DELETE ? "del" : "add",
+                      &e[i].name, &rv, rc);
 
- done:
+        if (rc != NGX_HTTP_OK) {
+            ret = NGX_ERROR;
+        }
+    }
 
-    ctx->free(pc, ctx->data, state);
+    return ret;
 }
 
 
-static void
-ngx_http_dyups_clean_request(void *data)
+/*
+ * The batch body is a list of
+ *
+ *     upstream NAME { ... }
+ *     delete NAME;
+ *
+ * where the block is the same as the body of a single update.
+ */
+
+static ngx_array_t *
+ngx_dyups_parse_batch(ngx_pool_t *pool, ngx_buf_t *buf, ngx_str_t *rv)
 {
-    ngx_uint_t  *ref = data;
+    u_char                   *p, *last, *start, quote;
+    ngx_str_t                 word;
+    ngx_uint_t                depth;
+    ngx_array_t              *entries;
+    ngx_dyups_batch_entry_t  *e;
+
+    entries = ngx_array_create(pool, 16, sizeof(ngx_dyups_batch_entry_t));
+    if (entries == NULL) {
+        ngx_str_set(rv, "out of memory");
+        return NULL;
+    }
 
-    (*ref)--;
+    p = buf->pos;
+    last = buf->last;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "[dyups] http clean request count %i", *ref);
-}
+    for ( ;; ) {
 
+        p = ngx_dyups_batch_word(p, last, &word);
+        if (word.len == 0) {
+            break;
+        }
 
-static void
-ngx_http_dyups_read_msg(ngx_event_t *ev)
-{
-    ngx_uint_t                   i, count, s_count, d_count;
-    ngx_slab_pool_t             *shpool;
-    ngx_http_dyups_srv_conf_t   *duscfs, *duscf;
-    ngx_http_dyups_main_conf_t  *dmcf;
+        e = ngx_array_push(entries);
+        if (e == NULL) {
+            ngx_str_set(rv, "out of memory");
+            return NULL;
+        }
 
-    dmcf = ev->data;
-    shpool = ngx_dyups_global_ctx.shpool;
+        ngx_memzero(e, sizeof(ngx_dyups_batch_entry_t));
 
-    count = 0;
-    s_count = 0;
-    d_count = 0;
+        if (word.len == 6 && ngx_strncmp(word.data, "delete", 6) == 0) {
 
-    duscfs = dmcf->dy_upstreams.elts;
-    for (i = 0; i < dmcf->dy_upstreams.nelts; i++) {
+            e->flag = NGX_DYUPS_DELETE;
 
-        duscf = &duscfs[i];
+            p = ngx_dyups_batch_word(p, last, &e->name);
+            p = ngx_dyups_batch_word(p, last, &word);
 
-        if (!duscf->dynamic) {
-            s_count++;
-            continue;
-        }
+            if (e->name.len == 0 || ngx_strchr("{};", e->name.data[0])
+                || word.len != 1 || word.data[0] != ';')
+            {
+                goto invalid;
+            }
 
-        if (duscf->deleted) {
-            d_count++;
             continue;
         }
 
-        count++;
-    }
-
-    if (dmcf->read_msg_log == 1) {
-        ngx_log_error(NGX_LOG_INFO, ev->log, 0,
-                      "[dyups] has %ui upstreams, %ui static, %ui deleted, all %ui",
-                      count, s_count, d_count, dmcf->dy_upstreams.nelts);
-    }
-
-#if (NGX_HTTP_UPSTREAM_CHECK)
-    if (!ngx_shmtx_trylock(&shpool->mutex)) {
-        goto finish;
-    }
-#else
-    ngx_shmtx_lock(&shpool->mutex);
-#endif
-
-    ngx_http_dyups_read_msg_locked(ev);
-
-    ngx_shmtx_unlock(&shpool->mutex);
+        if (word.len != 8 || ngx_strncmp(word.data, "upstream", 8) != 0) {
+            goto invalid;
+        }
 
-#if (NGX_HTTP_UPSTREAM_CHECK)
-finish:
-#endif
-    ngx_dyups_add_timer(ev, dmcf->read_msg_timeout);
-}
+        e->flag = NGX_DYUPS_ADD;
 
+        p = ngx_dyups_batch_word(p, last, &e->name);
+        p = ngx_dyups_batch_word(p, last, &word);
 
-static void
-ngx_http_dyups_read_msg_locked(ngx_event_t *ev)
-{
-    ngx_int_t            i, rc;
-    ngx_str_t            name, content;
-    ngx_flag_t           found;
-    ngx_time_t          *tp;
-    ngx_pool_t          *pool;
-    ngx_msec_t           now;
-    ngx_queue_t         *q, *t;
-    ngx_core_conf_t     *ccf;
-    ngx_slab_pool_t     *shpool;
-    ngx_dyups_msg_t     *msg;
-    ngx_dyups_shctx_t   *sh;
-    ngx_dyups_status_t  *status;
+        if (e->name.len == 0 || ngx_strchr("{};", e->name.data[0])
+            || word.len != 1 || word.data[0] != '{')
+        {
+            goto invalid;
+        }
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
-                   "[dyups] read msg %P", ngx_pid);
+        /* braces in quotes and comments do not end the block */
 
-    ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
-                                           ngx_core_module);
+        start = p;
+        depth = 1;
+        quote = 0;
 
-    sh = ngx_dyups_global_ctx.sh;
-    shpool = ngx_dyups_global_ctx.shpool;
+        for ( /* void */ ; p < last; p++) {
 
-    tp = ngx_timeofday();
-    now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+            if (quote) {
+                if (*p == '\\' && p + 1 < last) {
+                    p++;
 
-    for (i = 0; i < ccf->worker_processes; i++) {
-        status = &sh->status[i];
+                } else if (*p == quote) {
+                    quote = 0;
+                }
 
-        if (status->pid == 0 || status->pid == ngx_pid) {
+                continue;
+            }
 
-            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
-                           "[dyups] process %P update time %ui",
-                           status->pid, status->time);
+            if (*p == '"' || *p == '\'') {
+                quote = *p;
+                continue;
+            }
 
-            status->pid = ngx_pid;
-            status->time = now;
-            break;
+            if (*p == '#') {
+                while (p + 1 < last && p[1] != LF) {
+                    p++;
+                }
+
+                continue;
+            }
+
+            if (*p == '{') {
+                depth++;
+
+            } else if (*p == '}' && --depth == 0) {
+                break;
+            }
         }
-    }
 
-    if (ngx_queue_empty(&sh->msg_queue)) {
-        return;
-    }
+        if (p == last) {
+            goto invalid;
+        }
 
-    pool = ngx_create_pool(ngx_pagesize, ev->log);
-    if (pool == NULL) {
-        return;
+        e->body.start = e->body.pos = start;
+        e->body.end = e->body.last = p;
+        e->body.temporary = 1;
+
+        p++;
     }
 
-    for (q = ngx_queue_last(&sh->msg_queue);
-         q != ngx_queue_sentinel(&sh->msg_queue);
-         q = ngx_queue_prev(q))
-    {
-        msg = ngx_queue_data(q, ngx_dyups_msg_t, queue);
+    return entries;
 
-        if (msg->count == ccf->worker_processes) {
-            t = ngx_queue_next(q); ngx_queue_remove(q); q = t;
+invalid:
 
-            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
-                                  "[dyups] destroy msg %V:%V",
-                                  &msg->name, &msg->content);
+    rv->data = ngx_pnalloc(pool, sizeof("invalid batch at ") - 1
+                                 + NGX_OFF_T_LEN);
+    if (rv->data == NULL) {
+        ngx_str_set(rv, "invalid batch");
+        return NULL;
+    }
 
-            ngx_dyups_destroy_msg(shpool, msg);
-            continue;
-        }
+    rv->len = ngx_sprintf(rv->data, "invalid batch at %O", p - buf->pos)
+              - rv->data;
 
-        found = 0;
-        for (i = 0; i < msg->count; i++) {
+    return NULL;
+}
 
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
-                           "[dyups] msg pids [%P]", msg->pid[i]);
 
-            if (msg->pid[i] == ngx_pid) {
-                found = 1;
-                break;
-            }
+static u_char *
+ngx_dyups_batch_word(u_char *p, u_char *last, ngx_str_t *word)
+{
+    for ( ;; ) {
+
+        while (p < last
+               && (*p == ' ' || *p == '\t' || *p == CR || *p == LF))
+        {
+            p++;
         }
 
-        if (found) {
-            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
-                           "[dyups] msg %V count %ui found",
-                           &msg->name, msg->count);
+        if (p < last && *p == '#') {
+            while (p < last && *p != LF) {
+                p++;
+            }
+
             continue;
         }
 
-        msg->pid[i] = ngx_pid;
-        msg->count++;
-
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
-                       "[dyups] msg %V count %ui", &msg->name, msg->count);
+        break;
+    }
 
-        name = msg->name;
-        content = msg->content;
+    word->data = p;
 
-        rc = ngx_dyups_sync_cmd(pool, &name, &content, msg->flag);
-        if (rc != NGX_OK) {
-            ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
-                          "[dyups] read msg error, may cause the "
-                          "config inaccuracy, name:%V, content:%V",
-                          &name, &content);
-        }
+    if (p < last && (*p == '{' || *p == '}' || *p == ';')) {
+        word->len = 1;
+        return p + 1;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
-                   "[dyups] read end");
+    while (p < last
+           && *p != ' ' && *p != '\t' && *p != CR && *p != LF
+           && *p != '{' && *p != '}' && *p != ';' && *p != '#')
+    {
+        p++;
+    }
 
-    ngx_destroy_pool(pool);
+    word->len = p - word->data;
 
-    return;
+    return p;
 }
 
 
 static ngx_int_t
-ngx_http_dyups_send_msg(ngx_str_t *name, ngx_buf_t *body, ngx_uint_t flag)
+ngx_dyups_batch_update(ngx_pool_t *pool, ngx_buf_t *buf, ngx_str_t *rv)
 {
-    ngx_core_conf_t    *ccf;
-    ngx_slab_pool_t    *shpool;
-    ngx_dyups_msg_t    *msg;
-    ngx_dyups_shctx_t  *sh;
+    size_t                       len;
+    u_char                      *p;
+    ngx_int_t                    status, idx;
+    ngx_buf_t                    content;
+    ngx_uint_t                   i, j, n, applied, found, unsynced;
+    ngx_array_t                 *entries;
+    ngx_event_t                 *timer;
+    ngx_slab_pool_t             *shpool;
+    ngx_dyups_shm_peers_t      **peers;
+    ngx_dyups_batch_entry_t     *e;
+    ngx_http_dyups_srv_conf_t   *duscf;
+    ngx_http_dyups_main_conf_t  *dmcf;
 
-    ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
-                                           ngx_core_module);
+    ngx_str_t  name = ngx_string("_dyups_batch_");
+    ngx_str_t  alert = ngx_string("alert: batch success "
+                                  "but not sync to other process\n");
 
-    sh = ngx_dyups_global_ctx.sh;
+    dmcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
+                                               ngx_http_dyups_module);
+    timer = &ngx_dyups_global_ctx.msg_timer;
     shpool = ngx_dyups_global_ctx.shpool;
 
-    msg = ngx_slab_alloc_locked(shpool, sizeof(ngx_dyups_msg_t));
-    if (msg == NULL) {
-        goto failed;
+    if (!ngx_http_dyups_api_enable) {
+        ngx_str_set(rv, "API disabled\n");
+        return NGX_HTTP_NOT_ALLOWED;
     }
 
-    ngx_memzero(msg, sizeof(ngx_dyups_msg_t));
+    entries = ngx_dyups_parse_batch(pool, buf, rv);
+    if (entries == NULL) {
 
-    msg->flag = flag;
-    msg->count = 0;
-    msg->pid = ngx_slab_alloc_locked(shpool,
-                                     sizeof(ngx_pid_t) * ccf->worker_processes);
+        /* the error is logged as is on sync, it is a line of the reply here */
 
-    if (msg->pid == NULL) {
-        goto failed;
-    }
+        p = ngx_pnalloc(pool, rv->len + 1);
+        if (p == NULL) {
+            ngx_str_set(rv, "invalid batch\n");
+            return NGX_HTTP_BAD_REQUEST;
+        }
 
-    ngx_memzero(msg->pid, sizeof(ngx_pid_t) * ccf->worker_processes);
-    msg->pid[0] = ngx_pid;
-    msg->count++;
+        *ngx_cpymem(p, rv->data, rv->len) = LF;
 
-    msg->name.data = ngx_slab_alloc_locked(shpool, name->len);
-    if (msg->name.data == NULL) {
-        goto failed;
+        rv->data = p;
+        rv->len++;
+
+        return NGX_HTTP_BAD_REQUEST;
     }
 
-    ngx_memcpy(msg->name.data, name->data, name->len);
-    msg->name.len = name->len;
+    if (entries->nelts == 0) {
+        ngx_str_set(rv, "empty batch\n");
+        return NGX_HTTP_BAD_REQUEST;
+    }
 
-    if (body) {
-        msg->content.data = ngx_slab_alloc_locked(shpool,
-                                                  body->last - body->pos);
-        if (msg->content.data == NULL) {
-            goto failed;
-        }
+    if (!dmcf->trylock) {
 
-        ngx_memcpy(msg->content.data, body->pos, body->last - body->pos);
-        msg->content.len = body->last - body->pos;
+        ngx_shmtx_lock(&shpool->mutex);
 
     } else {
-        msg->content.data = NULL;
-        msg->content.len = 0;
+
+        if (!ngx_shmtx_trylock(&shpool->mutex)) {
+            ngx_str_set(rv, "wait and try again\n");
+            return NGX_HTTP_CONFLICT;
+        }
     }
 
-    sh->version++;
+    ngx_http_dyups_read_msg_locked(timer);
 
-    if (sh->version == 0) {
-        sh->version = 1;
-    };
+    e = entries->elts;
+    n = entries->nelts;
+    status = NGX_HTTP_OK;
+    unsynced = 0;
 
-    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "[dyups] send msg %V count %ui version: %ui",
-                   &msg->name, msg->count, sh->version);
+    /* check everything first, nothing is applied if one entry fails */
 
-    ngx_queue_insert_head(&sh->msg_queue, &msg->queue);
+    for (i = 0; i < n; i++) {
 
-    return NGX_OK;
+        if (e[i].flag == NGX_DYUPS_ADD) {
+            e[i].status = ngx_dyups_sandbox_update(&e[i].body, &e[i].rv);
 
-failed:
+        } else {
+            duscf = ngx_dyups_find_upstream(&e[i].name, &idx);
+            found = (duscf && !duscf->deleted);
+
+            for (j = 0; j < i; j++) {
+                if (e[j].name.len == e[i].name.len
+                    && ngx_strncasecmp(e[j].name.data, e[i].name.data,
+                                       e[i].name.len)
+                       == 0)
+                {
+                    found = (e[j].flag == NGX_DYUPS_ADD);
+                }
+            }
 
-    if (msg) {
-        ngx_dyups_destroy_msg(shpool, msg);
+            if (found) {
+                e[i].status = NGX_HTTP_OK;
+                ngx_str_set(&e[i].rv, "success");
+
+            } else {
+                e[i].status = NGX_HTTP_NOT_FOUND;
+                ngx_str_set(&e[i].rv, "not found uptream");
+            }
+        }
+
+        if (e[i].status != NGX_HTTP_OK && status == NGX_HTTP_OK) {
+            status = e[i].status;
+        }
     }
 
-    return NGX_ERROR;
-}
+    if (status != NGX_HTTP_OK) {
 
+        for (i = 0; i < n; i++) {
+            if (e[i].status == NGX_HTTP_OK) {
+                ngx_str_set(&e[i].rv, "not applied");
+            }
+        }
 
-static void
-ngx_dyups_destroy_msg(ngx_slab_pool_t *shpool, ngx_dyups_msg_t *msg)
-{
-    if (msg->pid) {
-        ngx_slab_free_locked(shpool, msg->pid);
+        ngx_shmtx_unlock(&shpool->mutex);
+        goto result;
     }
 
-    if (msg->name.data) {
-        ngx_slab_free_locked(shpool, msg->name.data);
+    for (applied = 0; applied < n; applied++) {
+
+        i = applied;
+
+        if (e[i].flag == NGX_DYUPS_DELETE) {
+            e[i].status = ngx_dyups_do_delete(&e[i].name, &e[i].rv);
+
+        } else {
+            e[i].status = ngx_dyups_do_update(&e[i].name, &e[i].body,
+                                              &e[i].rv);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+            if (e[i].status == NGX_HTTP_OK && dmcf->shared_peers) {
+                e[i].peers = ngx_dyups_share_peers(&e[i].name);
+            }
+#endif
+        }
+
+        if (e[i].status != NGX_HTTP_OK) {
+            status = e[i].status;
+            break;
+        }
     }
 
-    if (msg->content.data) {
-        ngx_slab_free_locked(shpool, msg->content.data);
+    for (i = applied + 1; i < n; i++) {
+        e[i].status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+        ngx_str_set(&e[i].rv, "not applied");
     }
 
-    ngx_slab_free_locked(shpool, msg);
-}
+    /* the entries applied here go to the other processes in one message */
 
+    if (applied) {
 
-static ngx_int_t
-ngx_dyups_sync_cmd(ngx_pool_t *pool, ngx_str_t *name, ngx_str_t *content,
-    ngx_uint_t flag)
-{
-    ngx_int_t     rc;
-    ngx_buf_t     body;
-    ngx_str_t     rv;
+        len = 0;
 
-    if (flag == NGX_DYUPS_DELETE) {
+        for (i = 0; i < applied; i++) {
+            len += sizeof("upstream  {}\n") - 1 + e[i].name.len
+                   + (e[i].body.last - e[i].body.pos);
+        }
 
-        rc = ngx_dyups_do_delete(name, &rv);
+        p = ngx_pnalloc(pool, len);
+        if (p == NULL) {
+            goto failed;
+        }
 
-        ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
-                       "[dyups] sync del: %V rv: %V rc: %i",
-                       name, &rv, rc);
+        ngx_memzero(&content, sizeof(ngx_buf_t));
+        content.start = content.pos = content.last = p;
+        content.temporary = 1;
+
+        for (i = 0; i < applied; i++) {
+            if (e[i].flag == NGX_DYUPS_DELETE) {
+                content.last = ngx_sprintf(content.last, "delete %V;\n",
+                                           &e[i].name);
+
+            } else {
+                content.last = ngx_sprintf(content.last, "upstream %V {",
+                                           &e[i].name);
+                content.last = ngx_cpymem(content.last, e[i].body.pos,
+                                          e[i].body.last - e[i].body.pos);
+                *content.last++ = '}';
+                *content.last++ = LF;
+            }
+        }
 
-        if (rc != NGX_HTTP_OK) {
-            return NGX_ERROR;
+        content.end = content.last;
+
+        peers = NULL;
+
+        if (dmcf->shared_peers) {
+            peers = ngx_palloc(pool, sizeof(ngx_dyups_shm_peers_t *) * applied);
+            if (peers == NULL) {
+                goto failed;
+            }
+
+            for (i = 0; i < applied; i++) {
+                peers[i] = e[i].peers;
+            }
         }
 
-        return NGX_OK;
+        if (ngx_http_dyups_send_msg(&name, &content, NGX_DYUPS_BATCH, peers,
+                                    peers ? applied : 0))
+        {
+            goto failed;
+        }
+    }
 
-    } else if (flag == NGX_DYUPS_ADD) {
+    ngx_shmtx_unlock(&shpool->mutex);
 
-        body.start = body.pos = content->data;
-        body.end = body.last = content->data + content->len;
-        body.temporary = 1;
+    ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                  "[dyups] batch of %ui, %ui applied", n, applied);
 
-        rc = ngx_dyups_do_update(name, &body, &rv);
+    goto result;
 
-        ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
-                      "[dyups] sync add: %V rv: %V rc: %i",
-                      name, &rv, rc);
+failed:
 
-        if (rc != NGX_HTTP_OK) {
-            return NGX_ERROR;
-        }
+    /* the entries stay applied here, the reply tells they are not synced */
 
-        return NGX_OK;
+    unsynced = 1;
+    status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                  "[dyups] batch of %ui, %ui applied but not synced",
+                  n, applied);
+
+result:
+
+    /* one line per entry: name, status, result */
+
+    if (!unsynced) {
+        alert.len = 0;
     }
 
-    return NGX_ERROR;
+    len = alert.len;
+
+    for (i = 0; i < n; i++) {
+        len += e[i].name.len + NGX_INT_T_LEN + e[i].rv.len + 3;
+    }
+
+    rv->data = ngx_pnalloc(pool, len);
+    if (rv->data == NULL) {
+        ngx_str_set(rv, "out of memory\n");
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    p = rv->data;
+
+    for (i = 0; i < n; i++) {
+        p = ngx_sprintf(p, "%V %i %V\n", &e[i].name, e[i].status, &e[i].rv);
+    }
+
+    p = ngx_cpymem(p, alert.data, alert.len);
+
+    rv->len = p - rv->data;
+
+    return status;
 }
 
 
@@ -22,6 +22,20 @@ struct ngx_http_upstream_rr_vpeers_s {
 };
 
 
+/*
+ * The virtual node sequence shared by all workers ("vnswrr shared"),
+ * vpeers are initialized lazily under the mutex of the zone, which
+ * the master process releases if a worker dies holding it, and picked
+ * with the shared cursor.
+ */
+typedef struct {
+    ngx_atomic_t                          cursor;
+    ngx_uint_t                            vnumber;
+    ngx_int_t                            *current_weight;
+    ngx_http_upstream_rr_vpeers_t        *vpeers;
+} ngx_http_upstream_vnswrr_shm_t;
+
+
 typedef struct ngx_http_upstream_vnswrr_srv_conf_s
     ngx_http_upstream_vnswrr_srv_conf_t;
 
@@ -35,6 +49,12 @@ struct ngx_http_upstream_vnswrr_srv_conf_s {
     ngx_http_upstream_rr_peer_t          *last_peer;
     ngx_http_upstream_rr_vpeers_t        *vpeers;
     ngx_http_upstream_vnswrr_srv_conf_t  *next;
+
+    ngx_flag_t                            shared;
+    ngx_uint_t                            total;
+    ngx_uint_t                            number;
+    ngx_http_upstream_vnswrr_shm_t       *sh;
+    ngx_slab_pool_t                      *shpool;
 };
 
 
@@ -64,12 +84,23 @@ static void ngx_http_upstream_init_virtual_peers(
     ngx_http_upstream_vnswrr_srv_conf_t *uvnscf,
     ngx_uint_t s, ngx_uint_t e);
 
+static ngx_int_t ngx_http_upstream_vnswrr_add_zone(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us,
+    ngx_http_upstream_vnswrr_srv_conf_t *uvnscf);
+static ngx_int_t ngx_http_upstream_vnswrr_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_http_upstream_rr_peer_t *ngx_http_upstream_get_vnswrr_shared(
+    ngx_http_upstream_vnswrr_peer_data_t *vnsp);
+static void ngx_http_upstream_init_shared_virtual_peers(
+    ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_vnswrr_srv_conf_t *uvnscf, ngx_uint_t e);
+
 static ngx_uint_t ngx_http_upstream_gcd(ngx_uint_t a, ngx_uint_t b);
 
 static ngx_command_t  ngx_http_upstream_vnswrr_commands[] = {
 
     { ngx_string("vnswrr"),
-      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE12,
       ngx_http_upstream_vnswrr,
       0,
       0,
@@ -143,6 +174,7 @@ ngx_http_upstream_vnswrr(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_upstream_vnswrr_srv_conf_t     *uvnscf;
     ngx_str_t                               *value;
     ngx_int_t                                max_init;
+    ngx_uint_t                               i;
 
     uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
 
@@ -170,20 +202,43 @@ ngx_http_upstream_vnswrr(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     max_init = 0;
 
-    if (cf->args->nelts > 1) {
+    for (i = 1; i < cf->args->nelts; i++) {
 
-        if (ngx_strncmp(value[1].data, "max_init=", 9) == 0) {
+        if (ngx_strncmp(value[i].data, "max_init=", 9) == 0) {
 
-            max_init = ngx_atoi(&value[1].data[9], value[1].len - 9);
+            max_init = ngx_atoi(&value[i].data[9], value[i].len - 9);
 
             if (max_init == NGX_ERROR) {
 
                 ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                                   "invalid parameter \"%V\"", &value[1]);
+                                   "invalid parameter \"%V\"", &value[i]);
 
                 return NGX_CONF_ERROR;
             }
+
+            continue;
         }
+
+        if (ngx_strcmp(value[i].data, "shared") == 0) {
+
+            if (ngx_process == NGX_PROCESS_WORKER) {
+
+                /* upstream added at runtime, e.g. by dyups */
+
+                ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                                   "\"shared\" is ignored in upstream "
+                                   "added at runtime");
+                continue;
+            }
+
+            uvnscf->shared = 1;
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+
+        return NGX_CONF_ERROR;
     }
 
     uvnscf->max_init = max_init;
@@ -252,7 +307,10 @@ ngx_http_upstream_init_vnswrr(ngx_conf_t *cf,
 
     us->peer.init = ngx_http_upstream_init_vnswrr_peer;
 
-    if (peers->weighted) {
+    uvnscf->total = peers->total_weight / uvnscf->gcd;
+    uvnscf->number = peers->number;
+
+    if (peers->weighted && !uvnscf->shared) {
         uvnscf->vpeers = ngx_pcalloc(cf->pool,
                                     sizeof(ngx_http_upstream_rr_vpeers_t)
                                     * peers->total_weight / uvnscf->gcd);
@@ -287,20 +345,27 @@ ngx_http_upstream_init_vnswrr(ngx_conf_t *cf,
             ubvnscf->max_init = backup->total_weight;
         }
 
+        ubvnscf->shared = uvnscf->shared;
+        ubvnscf->total = backup->total_weight / ubvnscf->gcd;
+        ubvnscf->number = backup->number;
+
         uvnscf->next = ubvnscf;
 
-        if (!backup->weighted) {
-            return NGX_OK;
-        }
+        if (backup->weighted && !ubvnscf->shared) {
+            ubvnscf->vpeers = ngx_pcalloc(cf->pool,
+                                          sizeof(ngx_http_upstream_rr_vpeers_t)
+                                          * backup->total_weight / ubvnscf->gcd);
+            if (ubvnscf->vpeers == NULL) {
+                return NGX_ERROR;
+            }
 
-        ubvnscf->vpeers = ngx_pcalloc(cf->pool,
-                                      sizeof(ngx_http_upstream_rr_vpeers_t)
-                                      * backup->total_weight / ubvnscf->gcd);
-        if (ubvnscf->vpeers == NULL) {
-            return NGX_ERROR;
+            ngx_http_upstream_init_virtual_peers(backup, ubvnscf, 0,
+                                                 ubvnscf->max_init);
         }
+    }
 
-        ngx_http_upstream_init_virtual_peers(backup, ubvnscf, 0, ubvnscf->max_init);
+    if (uvnscf->shared) {
+        return ngx_http_upstream_vnswrr_add_zone(cf, us, uvnscf);
     }
 
     return NGX_OK;
@@ -381,7 +446,12 @@ ngx_http_upstream_get_vnswrr_peer(ngx_peer_connection_t *pc, void *data)
 
         /* there are several peers */
 
-        peer = ngx_http_upstream_get_vnswrr(vnsp);
+        if (vnsp->uvnscf->sh) {
+            peer = ngx_http_upstream_get_vnswrr_shared(vnsp);
+
+        } else {
+            peer = ngx_http_upstream_get_vnswrr(vnsp);
+        }
 
         if (peer == NULL) {
             goto failed;
@@ -668,6 +738,238 @@ ngx_http_upstream_init_virtual_peers(ngx_http_upstream_rr_peers_t *peers,
     return;
 }
 
+static ngx_uint_t ngx_http_upstream_vnswrr_generation = 0;
+
+
+static ngx_int_t
+ngx_http_upstream_vnswrr_add_zone(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us, ngx_http_upstream_vnswrr_srv_conf_t *uvnscf)
+{
+    size_t                                size;
+    ngx_str_t                             name;
+    ngx_shm_zone_t                       *shm_zone;
+    ngx_http_upstream_vnswrr_srv_conf_t  *conf;
+
+    size = 0;
+
+    for (conf = uvnscf; conf; conf = conf->next) {
+        size += sizeof(ngx_http_upstream_vnswrr_shm_t)
+                + conf->total * sizeof(ngx_http_upstream_rr_vpeers_t)
+                + conf->number * sizeof(ngx_int_t);
+    }
+
+    size = ngx_align(size + size / 4, ngx_pagesize) + 8 * ngx_pagesize;
+
+    /* a new zone for every configuration, the old workers keep theirs */
+
+    name.len = sizeof("vnswrr_#") - 1 + us->host.len + NGX_INT_T_LEN;
+    name.data = ngx_pnalloc(cf->pool, name.len);
+    if (name.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    name.len = ngx_sprintf(name.data, "vnswrr_%V#%ui", &us->host,
+                           ngx_http_upstream_vnswrr_generation++)
+               - name.data;
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_upstream_vnswrr_module);
+    if (shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    shm_zone->init = ngx_http_upstream_vnswrr_init_zone;
+    shm_zone->data = uvnscf;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_vnswrr_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    u_char                               *p;
+    ngx_slab_pool_t                      *shpool;
+    ngx_http_upstream_vnswrr_shm_t       *sh;
+    ngx_http_upstream_vnswrr_srv_conf_t  *uvnscf;
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    for (uvnscf = shm_zone->data; uvnscf; uvnscf = uvnscf->next) {
+
+        p = ngx_slab_calloc(shpool, sizeof(ngx_http_upstream_vnswrr_shm_t)
+                            + uvnscf->total * sizeof(ngx_http_upstream_rr_vpeers_t)
+                            + uvnscf->number * sizeof(ngx_int_t));
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        sh = (ngx_http_upstream_vnswrr_shm_t *) p;
+        p += sizeof(ngx_http_upstream_vnswrr_shm_t);
+
+        sh->vpeers = (ngx_http_upstream_rr_vpeers_t *) p;
+        p += uvnscf->total * sizeof(ngx_http_upstream_rr_vpeers_t);
+
+        sh->current_weight = (ngx_int_t *) p;
+
+        /* start the workers at a random place, as the per worker mode */
+        sh->cursor = ngx_random() % uvnscf->total;
+
+        uvnscf->sh = sh;
+        uvnscf->shpool = shpool;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_http_upstream_rr_peer_t *
+ngx_http_upstream_get_vnswrr_shared(ngx_http_upstream_vnswrr_peer_data_t *vnsp)
+{
+    time_t                                  now;
+    uintptr_t                               m;
+    ngx_uint_t                              i, k, n, start;
+    ngx_http_upstream_rr_peer_t            *peer;
+    ngx_http_upstream_rr_peers_t           *peers;
+    ngx_http_upstream_vnswrr_shm_t         *sh;
+    ngx_http_upstream_rr_peer_data_t       *rrp;
+    ngx_http_upstream_vnswrr_srv_conf_t    *uvnscf;
+
+    now = ngx_time();
+
+    rrp = &vnsp->rrp;
+    peers = rrp->peers;
+    uvnscf = vnsp->uvnscf;
+    sh = uvnscf->sh;
+
+    start = ngx_atomic_fetch_add(&sh->cursor, 1) % uvnscf->total;
+
+    for (k = 0; k < uvnscf->total; k++) {
+
+        i = (start + k) % uvnscf->total;
+
+        if (i >= sh->vnumber) {
+            ngx_http_upstream_init_shared_virtual_peers(peers, uvnscf, i + 1);
+
+            if (i >= sh->vnumber) {
+                return NULL;
+            }
+        }
+
+        peer = sh->vpeers[i].vpeer;
+
+        n = sh->vpeers[i].rindex / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << sh->vpeers[i].rindex % (8 * sizeof(uintptr_t));
+
+        if (rrp->tried[n] & m) {
+            continue;
+        }
+
+        if (peer->down) {
+            continue;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            continue;
+        }
+
+#if defined(nginx_version) && nginx_version >= 1011005
+        if (peer->max_conns && peer->conns >= peer->max_conns) {
+            continue;
+        }
+#endif
+
+#if (NGX_HTTP_UPSTREAM_CHECK)
+        if (ngx_http_upstream_check_peer_down(peer->check_index)) {
+            continue;
+        }
+#endif
+
+        rrp->current = peer;
+        rrp->tried[n] |= m;
+
+        if (now - peer->checked > peer->fail_timeout) {
+            peer->checked = now;
+        }
+
+        return peer;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Extend the shared sequence to at least e virtual nodes, at most
+ * max_init more at a time.  The smooth weighted round robin state
+ * lives in the shared memory too, so any worker continues the same
+ * sequence; the configured weights are used as the workers' own
+ * effective weights differ.
+ */
+static void
+ngx_http_upstream_init_shared_virtual_peers(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_vnswrr_srv_conf_t *uvnscf, ngx_uint_t e)
+{
+    ngx_int_t                               total;
+    ngx_uint_t                              i, p, best_p;
+    ngx_http_upstream_rr_peer_t            *peer, *best;
+    ngx_http_upstream_vnswrr_shm_t         *sh;
+
+    sh = uvnscf->sh;
+
+    ngx_shmtx_lock(&uvnscf->shpool->mutex);
+
+    if (e < sh->vnumber + uvnscf->max_init) {
+        e = sh->vnumber + uvnscf->max_init;
+    }
+
+    if (e > uvnscf->total) {
+        e = uvnscf->total;
+    }
+
+    for (i = sh->vnumber; i < e; i++) {
+
+        best = NULL;
+        best_p = 0;
+        total = 0;
+
+        for (peer = peers->peer, p = 0;
+             peer && p < uvnscf->number;
+             peer = peer->next, p++)
+        {
+            sh->current_weight[p] += peer->weight / uvnscf->gcd;
+            total += peer->weight / uvnscf->gcd;
+
+            if (best == NULL
+                || sh->current_weight[p] > sh->current_weight[best_p])
+            {
+                best = peer;
+                best_p = p;
+            }
+        }
+
+        if (best == NULL) {
+            break;
+        }
+
+        sh->current_weight[best_p] -= total;
+
+        sh->vpeers[i].vpeer = best;
+        sh->vpeers[i].rindex = best_p;
+    }
+
+    /* the nodes must be visible before the number */
+    ngx_memory_barrier();
+
+    sh->vnumber = i;
+
+    ngx_shmtx_unlock(&uvnscf->shpool->mutex);
+}
+
+
 ngx_uint_t ngx_http_upstream_gcd(ngx_uint_t a, ngx_uint_t b)
 {
     ngx_uint_t r;
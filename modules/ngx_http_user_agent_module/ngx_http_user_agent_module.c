@@ -96,6 +96,9 @@ ngx_http_user_agent_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     char                      *rv;
     ngx_str_t                 *value, name;
     ngx_conf_t                 save;
+#if (T_NGX_TRIE_COMPACT)
+    ngx_pool_t                *pool;
+#endif
     ngx_http_variable_t       *var;
     ngx_http_user_agent_ctx_t *ctx;
 
@@ -116,11 +119,31 @@ ngx_http_user_agent_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     ctx->pool = cf->pool;
+
+#if (T_NGX_TRIE_COMPACT)
+
+    /* the nodes are only needed until the trie is compacted */
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, cf->log);
+    if (pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ctx->trie = ngx_trie_create(pool);
+    if (ctx->trie == NULL) {
+        ngx_destroy_pool(pool);
+        return NGX_CONF_ERROR;
+    }
+
+#else
+
     ctx->trie = ngx_trie_create(ctx->pool);
     if (ctx->trie == NULL) {
         return NGX_CONF_ERROR;
     }
 
+#endif
+
     ctx->default_value = NULL;
 
     var->get_handler = ngx_http_user_agent_variable;
@@ -132,10 +155,31 @@ ngx_http_user_agent_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cf->handler_conf = conf;
 
     rv = ngx_conf_parse(cf, NULL);
+
+#if (T_NGX_TRIE_COMPACT)
+
+    if (rv == NGX_CONF_OK) {
+        ctx->trie = ngx_trie_compact(ctx->trie, ctx->pool);
+        if (ctx->trie == NULL) {
+            rv = NGX_CONF_ERROR;
+        }
+    }
+
+    ngx_destroy_pool(pool);
+
+#if (NGX_HAVE_MALLOC_TRIM)
+    /* the memory of the nodes is not kept by the worker processes */
+    (void) malloc_trim(0);
+#endif
+
+#else
+
     if (NGX_OK != ctx->trie->build_clue(ctx->trie)) {
         return NGX_CONF_ERROR;
     }
 
+#endif
+
     *cf = save;
     if (ctx->default_value == NULL) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "no default value");
@@ -282,6 +282,24 @@ static ngx_command_t  ngx_http_xquic_commands[] = {
       offsetof(ngx_http_xquic_main_conf_t, pacing_on),
       NULL },
 
+#if (NGX_HAVE_UDP_SEGMENT)
+    { ngx_string("xquic_udp_gso"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_xquic_main_conf_t, udp_gso),
+      NULL },
+#endif
+
+#if (NGX_HAVE_UDP_GRO)
+    { ngx_string("xquic_udp_gro"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_xquic_main_conf_t, udp_gro),
+      NULL },
+#endif
+
     { ngx_string("xquic_manually_send"),
       NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_flag_slot,
@@ -1125,6 +1143,8 @@ ngx_http_xquic_create_main_conf(ngx_conf_t *cf)
     qmcf->streams_index_mask = NGX_CONF_UNSET_UINT;
 
     qmcf->pacing_on = NGX_CONF_UNSET;
+    qmcf->udp_gso = NGX_CONF_UNSET;
+    qmcf->udp_gro = NGX_CONF_UNSET;
     qmcf->manually_send = NGX_CONF_UNSET;
     qmcf->enable_keylog = NGX_CONF_UNSET;
 
@@ -1397,6 +1417,14 @@ ngx_http_xquic_init_main_conf(ngx_conf_t *cf, void *conf)
         qmcf->pacing_on = 0;
     }
 
+    if (qmcf->udp_gso == NGX_CONF_UNSET) {
+        qmcf->udp_gso = 0;
+    }
+
+    if (qmcf->udp_gro == NGX_CONF_UNSET) {
+        qmcf->udp_gro = 0;
+    }
+
     if (qmcf->manually_send == NGX_CONF_UNSET) {
         qmcf->manually_send = 0;
     }
@@ -49,6 +49,8 @@ typedef struct {
     ngx_int_t                   init_rtt_us;
     ngx_int_t                   init_pto_us;
     ngx_flag_t                  pacing_on;
+    ngx_flag_t                  udp_gso;
+    ngx_flag_t                  udp_gro;
     ngx_flag_t                  enable_keylog;
 
     ngx_flag_t                  new_udp_hash;
@@ -710,6 +710,28 @@ ngx_xquic_process_init(ngx_cycle_t *cycle)
         }
 #endif
 
+#if (NGX_HAVE_UDP_GRO)
+        if (qmcf->udp_gro
+#if (T_NGX_UDPV2)
+            && !ls[i].support_udpv2
+#endif
+           )
+        {
+            int  gro = 1;
+
+            /* the coalesced datagrams are split by ngx_xquic_event_recv() */
+
+            if (setsockopt(ls[i].fd, SOL_UDP, UDP_GRO,
+                           (const void *) &gro, sizeof(int))
+                == -1)
+            {
+                ngx_log_error(NGX_LOG_NOTICE, cycle->log, ngx_socket_errno,
+                              "|xquic|setsockopt(UDP_GRO) failed for %V, "
+                              "ignored|", &ls[i].addr_text);
+            }
+        }
+#endif
+
         rev->handler = ngx_xquic_event_recv;
         c->data = qmcf;
         if (c->data == NULL) {
@@ -720,6 +742,14 @@ ngx_xquic_process_init(ngx_cycle_t *cycle)
     }
 
     /* socket init end */
+
+#if (NGX_HAVE_UDP_GRO)
+    if (with_xquic && qmcf->udp_gro
+        && ngx_xquic_recv_batch_init(cycle) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+#endif
     if (with_xquic && ngx_xquic_engine_init(cycle) != NGX_OK) {
         ngx_log_error(NGX_LOG_EMERG, cycle->log, 0, 
                     "|xquic|ngx_xquic_process_init|engine_init fail|");
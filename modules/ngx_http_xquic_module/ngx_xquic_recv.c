@@ -4,6 +4,7 @@
 
 
 #include <ngx_xquic_recv.h>
+#include <ngx_xquic_udp.h>
 #include <ngx_xquic_intercom.h>
 #include <ngx_http_xquic_module.h>
 #include <ngx_xquic.h>
@@ -107,6 +108,91 @@ ngx_xquic_recv(ngx_connection_t *c, char *buf, size_t size)
 
 
 
+#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+
+/* the local address the datagram was sent to, from IP_PKTINFO and the like */
+
+static void
+ngx_xquic_recv_local_sockaddr(struct msghdr *msg,
+    ngx_xquic_recv_packet_t *packet)
+{
+    struct cmsghdr   *cmsg;
+    struct sockaddr  *sockaddr = &packet->local_sockaddr;
+    socklen_t        *socklen  = &packet->local_socklen;
+
+    if (msg->msg_controllen == 0) {
+        return;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(msg);
+            cmsg != NULL;
+            cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+
+#if (NGX_HAVE_IP_RECVDSTADDR)
+
+        if (cmsg->cmsg_level == IPPROTO_IP
+                && cmsg->cmsg_type == IP_RECVDSTADDR
+                && packet->local_sockaddr.sa_family == AF_INET)
+        {
+            struct in_addr      *addr;
+            struct sockaddr_in  *sin;
+
+            addr = (struct in_addr *) CMSG_DATA(cmsg);
+            sin = (struct sockaddr_in *) sockaddr;
+            sin->sin_family = AF_INET;
+            sin->sin_addr = *addr;
+            *socklen = sizeof(struct sockaddr_in);
+
+            break;
+        }
+
+#elif (NGX_HAVE_IP_PKTINFO)
+
+        if (cmsg->cmsg_level == IPPROTO_IP
+                && cmsg->cmsg_type == IP_PKTINFO
+                && packet->local_sockaddr.sa_family == AF_INET)
+        {
+            struct in_pktinfo   *pkt;
+            struct sockaddr_in  *sin;
+
+            pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
+            sin = (struct sockaddr_in *) sockaddr;
+            sin->sin_family = AF_INET;
+            sin->sin_addr = pkt->ipi_addr;
+            *socklen = sizeof(struct sockaddr_in);
+
+            break;
+        }
+
+#endif
+
+#if (NGX_HAVE_INET6 && NGX_HAVE_IPV6_RECVPKTINFO)
+
+        if (cmsg->cmsg_level == IPPROTO_IPV6
+                && cmsg->cmsg_type == IPV6_PKTINFO
+                && packet->local_sockaddr.sa_family == AF_INET6)
+        {
+            struct in6_pktinfo   *pkt6;
+            struct sockaddr_in6  *sin6;
+
+            pkt6 = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+            sin6 = (struct sockaddr_in6 *) sockaddr;
+            sin6->sin6_family = AF_INET6;
+            sin6->sin6_addr = pkt6->ipi6_addr;
+            *socklen = sizeof(struct sockaddr_in6);
+
+            break;
+        }
+
+#endif
+
+    }
+}
+
+#endif
+
+
 ngx_int_t
 ngx_xquic_recv_packet(ngx_connection_t *c, 
     ngx_xquic_recv_packet_t *packet, ngx_log_t *log, xqc_engine_t *engine)
@@ -130,6 +216,8 @@ ngx_xquic_recv_packet(ngx_connection_t *c,
 
 #endif
     
+    ngx_memzero(&msg, sizeof(struct msghdr));
+
     iov[0].iov_base = (void *) &packet->buf;
     iov[0].iov_len = sizeof(packet->buf);
 
@@ -187,108 +275,204 @@ ngx_xquic_recv_packet(ngx_connection_t *c,
     packet->socklen = msg.msg_namelen;
 
 #if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+    ngx_xquic_recv_local_sockaddr(&msg, packet);
+#endif
 
+#if (NGX_DEBUG)
     {
-        struct cmsghdr   *cmsg;
-        struct sockaddr  *sockaddr = &packet->local_sockaddr;
-        socklen_t        *socklen  = &packet->local_socklen;
+        ngx_str_t caddr, saddr;
+        u_char    ctext[NGX_SOCKADDR_STRLEN];
+        u_char    stext[NGX_SOCKADDR_STRLEN];
 
-        for (cmsg = CMSG_FIRSTHDR(&msg);
-                cmsg != NULL;
-                cmsg = CMSG_NXTHDR(&msg, cmsg))
-        {
+        if (log->log_level & NGX_LOG_DEBUG_EVENT) {
+            caddr.data = ctext;
+            caddr.len = ngx_sock_ntop(&packet->sockaddr, packet->socklen, ctext,
+                    NGX_SOCKADDR_STRLEN, 1);
+            saddr.data = stext;
+            saddr.len = ngx_sock_ntop(&packet->local_sockaddr, packet->local_socklen, stext,
+                    NGX_SOCKADDR_STRLEN, 1);
 
-#if (NGX_HAVE_IP_RECVDSTADDR)
+            ngx_log_debug4(NGX_LOG_DEBUG_EVENT, log, 0,
+                    "ngx_xquic_recv_packet: %V->%V fd:%d n:%z",
+                    &caddr, &saddr, c->fd, n);
+        }
 
-            if (cmsg->cmsg_level == IPPROTO_IP
-                    && cmsg->cmsg_type == IP_RECVDSTADDR
-                    && packet->local_sockaddr.sa_family == AF_INET)
-            {
-                struct in_addr      *addr;
-                struct sockaddr_in  *sin;
+    }
+#endif
 
-                addr = (struct in_addr *) CMSG_DATA(cmsg);
-                sin = (struct sockaddr_in *) sockaddr;
-                sin->sin_family = AF_INET;
-                sin->sin_addr = *addr;
-                *socklen = sizeof(struct sockaddr_in);
+    /* get dcid here */
+    ngx_xquic_packet_get_cid(packet, engine);
 
-                break;
-            }
+    return NGX_OK;
+}
 
-#elif (NGX_HAVE_IP_PKTINFO)
 
-            if (cmsg->cmsg_level == IPPROTO_IP
-                    && cmsg->cmsg_type == IP_PKTINFO
-                    && packet->local_sockaddr.sa_family == AF_INET)
-            {
-                struct in_pktinfo   *pkt;
-                struct sockaddr_in  *sin;
 
-                pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
-                sin = (struct sockaddr_in *) sockaddr;
-                sin->sin_family = AF_INET;
-                sin->sin_addr = pkt->ipi_addr;
-                *socklen = sizeof(struct sockaddr_in);
+#if (NGX_HAVE_UDP_GRO)
 
-                break;
-            }
+/*
+ * With xquic_udp_gro the datagrams are received in batches with recvmmsg(),
+ * each buffer may hold a number of datagrams of a flow coalesced by the
+ * kernel, they are split into packets here.
+ */
 
-#endif
+#define NGX_XQUIC_RECV_BATCH  16
 
-#if (NGX_HAVE_INET6 && NGX_HAVE_IPV6_RECVPKTINFO)
+#define NGX_XQUIC_RECV_CONTROL_SIZE                                          \
+    (CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(struct in6_pktinfo)))
 
-            if (cmsg->cmsg_level == IPPROTO_IPV6
-                    && cmsg->cmsg_type == IPV6_PKTINFO
-                    && packet->local_sockaddr.sa_family == AF_INET6)
-            {
-                struct in6_pktinfo   *pkt6;
-                struct sockaddr_in6  *sin6;
 
-                pkt6 = (struct in6_pktinfo *) CMSG_DATA(cmsg);
-                sin6 = (struct sockaddr_in6 *) sockaddr;
-                sin6->sin6_family = AF_INET6;
-                sin6->sin6_addr = pkt6->ipi6_addr;
-                *socklen = sizeof(struct sockaddr_in6);
+typedef struct {
+    struct mmsghdr        msg[NGX_XQUIC_RECV_BATCH];
+    struct iovec          iov[NGX_XQUIC_RECV_BATCH];
+    ngx_sockaddr_t        sockaddr[NGX_XQUIC_RECV_BATCH];
+    u_char                control[NGX_XQUIC_RECV_BATCH]
+                                 [NGX_XQUIC_RECV_CONTROL_SIZE];
+    u_char               *buf;
+} ngx_xquic_recv_batch_t;
 
-                break;
-            }
 
-#endif
+static ngx_xquic_recv_batch_t  *ngx_xquic_recv_batch;
 
-        }
+
+ngx_int_t
+ngx_xquic_recv_batch_init(ngx_cycle_t *cycle)
+{
+    ngx_xquic_recv_batch_t  *b;
+
+    b = ngx_pcalloc(cycle->pool, sizeof(ngx_xquic_recv_batch_t));
+    if (b == NULL) {
+        return NGX_ERROR;
     }
 
-#endif
+    b->buf = ngx_palloc(cycle->pool,
+                        NGX_XQUIC_RECV_BATCH * NGX_XQUIC_GRO_BUFFER_SIZE);
+    if (b->buf == NULL) {
+        return NGX_ERROR;
+    }
 
-#if (NGX_DEBUG)
-    {
-        ngx_str_t caddr, saddr;
-        u_char    ctext[NGX_SOCKADDR_STRLEN];
-        u_char    stext[NGX_SOCKADDR_STRLEN];
+    ngx_xquic_recv_batch = b;
 
-        if (log->log_level & NGX_LOG_DEBUG_EVENT) {
-            caddr.data = ctext;
-            caddr.len = ngx_sock_ntop(&packet->sockaddr, packet->socklen, ctext,
-                    NGX_SOCKADDR_STRLEN, 1);
-            saddr.data = stext;
-            saddr.len = ngx_sock_ntop(&packet->local_sockaddr, packet->local_socklen, stext,
-                    NGX_SOCKADDR_STRLEN, 1);
+    return NGX_OK;
+}
 
-            ngx_log_debug4(NGX_LOG_DEBUG_EVENT, log, 0,
-                    "ngx_xquic_recv_packet: %V->%V fd:%d n:%z",
-                    &caddr, &saddr, c->fd, n);
+
+static ngx_int_t
+ngx_xquic_recv_packets(ngx_connection_t *c, ngx_log_t *log,
+    xqc_engine_t *engine)
+{
+    int                              n, i;
+    u_char                          *p;
+    size_t                           len, seg, off, size;
+    ngx_err_t                        err;
+    struct msghdr                   *msg;
+    ngx_listening_t                 *ls;
+    ngx_xquic_recv_batch_t          *b;
+    static ngx_xquic_recv_packet_t   packet;
+
+    b = ngx_xquic_recv_batch;
+    ls = c->listening;
+
+    for (i = 0; i < NGX_XQUIC_RECV_BATCH; i++) {
+        b->iov[i].iov_base = b->buf + i * NGX_XQUIC_GRO_BUFFER_SIZE;
+        b->iov[i].iov_len = NGX_XQUIC_GRO_BUFFER_SIZE;
+
+        msg = &b->msg[i].msg_hdr;
+
+        msg->msg_name = &b->sockaddr[i];
+        msg->msg_namelen = sizeof(ngx_sockaddr_t);
+        msg->msg_iov = &b->iov[i];
+        msg->msg_iovlen = 1;
+        msg->msg_control = b->control[i];
+        msg->msg_controllen = NGX_XQUIC_RECV_CONTROL_SIZE;
+        msg->msg_flags = 0;
+    }
+
+    for ( ;; ) {
+        n = recvmmsg(c->fd, b->msg, NGX_XQUIC_RECV_BATCH, 0, NULL);
+
+        if (n >= 0) {
+            break;
+        }
+
+        err = ngx_socket_errno;
+
+        if (err == NGX_EINTR) {
+            continue;
         }
 
+        if (err == NGX_EAGAIN) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, log, err,
+                           "ngx_xquic_recv_packets: recvmmsg() not ready");
+            return NGX_AGAIN;
+        }
+
+        if (err == NGX_ECONNREFUSED) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, log, err,
+                           "ngx_xquic_recv_packets: recvmmsg() get icmp");
+            return NGX_DONE;
+        }
+
+        return ngx_connection_error(c, err, "quic recvmmsg() failed");
     }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "ngx_xquic_recv_packets: fd:%d n:%d", c->fd, n);
+
+    for (i = 0; i < n; i++) {
+        msg = &b->msg[i].msg_hdr;
+        len = b->msg[i].msg_len;
+        p = b->iov[i].iov_base;
+
+        seg = ngx_xquic_udp_gro_size(msg);
+
+        if (seg == 0 || seg > len) {
+            seg = len;
+        }
+
+        ngx_memzero(&packet, sizeof(ngx_xquic_recv_packet_t));
+
+        ngx_memcpy(&packet.sockaddr, msg->msg_name, msg->msg_namelen);
+        packet.socklen = msg->msg_namelen;
+
+        ngx_memcpy(&packet.local_sockaddr, ls->sockaddr, ls->socklen);
+        packet.local_socklen = ls->socklen;
+
+#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+        ngx_xquic_recv_local_sockaddr(msg, &packet);
 #endif
 
-    /* get dcid here */
-    ngx_xquic_packet_get_cid(packet, engine);
+        for (off = 0; off < len; off += seg) {
+            size = ngx_min(seg, len - off);
 
-    return NGX_OK;
+            ngx_memzero(&packet.xquic, sizeof(packet.xquic));
+
+            /* the datagrams larger than the buffer are truncated as before */
+
+            packet.len = ngx_min(size, sizeof(packet.buf));
+            ngx_memcpy(packet.buf, p + off, packet.len);
+
+            ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                           "ngx_xquic_recv_packets: #%d %uz of %uz",
+                           i, size, len);
+
+            ngx_xquic_packet_get_cid(&packet, engine);
+
+#if (NGX_STAT_STUB)
+            (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
+#endif
+
+            ngx_accept_disabled = ngx_cycle->connection_n / 8
+                                  - ngx_cycle->free_connection_n;
+
+            ngx_xquic_dispatcher_process_packet(c, &packet);
+        }
+    }
+
+    return (n == NGX_XQUIC_RECV_BATCH) ? NGX_OK : NGX_AGAIN;
 }
 
+#endif
 
 
 void
@@ -319,6 +503,19 @@ ngx_xquic_event_recv(ngx_event_t *ev)
                    "ngx_xquic_event_recv on %V, ready: %d",
                    &ls->addr_text, ev->available);
 
+#if (NGX_HAVE_UDP_GRO)
+
+    if (ngx_xquic_recv_batch) {
+
+        do {
+            rc = ngx_xquic_recv_packets(lc, ev->log, qmcf->xquic_engine);
+        } while (rc == NGX_OK && ev->available);
+
+        goto finish_recv;
+    }
+
+#endif
+
     do {
         ngx_memset(&packet, 0, sizeof(ngx_xquic_recv_packet_t));
         packet.local_socklen = ls->socklen;
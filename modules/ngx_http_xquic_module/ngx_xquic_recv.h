@@ -40,6 +40,9 @@ typedef struct {
 ngx_int_t ngx_xquic_recv(ngx_connection_t *c, char *buf, size_t size);
 ngx_int_t ngx_xquic_recv_packet(ngx_connection_t *c, ngx_xquic_recv_packet_t *packet, ngx_log_t *log, xqc_engine_t *engine);
 void ngx_xquic_event_recv(ngx_event_t *ev);
+#if (NGX_HAVE_UDP_GRO)
+ngx_int_t ngx_xquic_recv_batch_init(ngx_cycle_t *cycle);
+#endif
 void ngx_xquic_dispatcher_process_packet(ngx_connection_t *c, ngx_xquic_recv_packet_t *packet);
 void ngx_xquic_recv_from_intercom(ngx_xquic_recv_packet_t *packet);
 void ngx_xquic_packet_get_cid(ngx_xquic_recv_packet_t *packet, 
@@ -3,6 +3,7 @@
  */
 
 #include <ngx_xquic_send.h>
+#include <ngx_xquic_udp.h>
 #include <ngx_http_xquic_module.h>
 #include <ngx_http_v3_stream.h>
 #include <xquic/xquic.h>
@@ -14,6 +15,11 @@
 #define NGX_XQUIC_MAX_SEND_MSG_ONCE  XQC_MAX_SEND_MSG_ONCE
 
 static ssize_t ngx_http_xquic_on_write_block(ngx_http_xquic_connection_t *qc, ngx_event_t *wev);
+#if defined(T_NGX_XQUIC_SUPPORT_SENDMMSG)
+static ssize_t ngx_xquic_sendmmsg(ngx_connection_t *c,
+    const struct iovec *msg_iov, unsigned int vlen,
+    const struct sockaddr *peer_addr, socklen_t peer_addrlen);
+#endif
 
 void
 ngx_http_xquic_write_handler(ngx_event_t *wev)
@@ -251,11 +257,6 @@ ngx_xquic_server_send_mmsg(const struct iovec *msg_iov, unsigned int vlen,
 {
     ngx_event_t               *wev;
     ssize_t                    res = 0;
-    unsigned int               i = 0;
-
-    struct mmsghdr             msg[NGX_XQUIC_MAX_SEND_MSG_ONCE];
-
-    memset(msg, 0, sizeof(msg));
 
     ngx_http_xquic_connection_t *qc = (ngx_http_xquic_connection_t *)user_data;
 
@@ -265,7 +266,6 @@ ngx_xquic_server_send_mmsg(const struct iovec *msg_iov, unsigned int vlen,
         return (ssize_t)NGX_ERROR;
     }
 
-    ngx_socket_t fd = qc->connection->fd;
     ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
                     "|xquic|ngx_xquic_server_send_mmsg|vlen=%z now=%i|dcid=%s|",
                     vlen, ngx_xquic_get_time(), xqc_dcid_str(qc->engine, &qc->dcid));
@@ -305,14 +305,8 @@ degrade:
 #endif
 #endif
 
-    for (i = 0 ; i < vlen; i++) {
-        msg[i].msg_hdr.msg_name = (void *)peer_addr;
-        msg[i].msg_hdr.msg_namelen = peer_addrlen;
-        msg[i].msg_hdr.msg_iov = (struct iovec *) msg_iov + i;
-        msg[i].msg_hdr.msg_iovlen = 1;
-    }
-
-    res = sendmmsg(fd, msg, vlen, 0);
+    res = ngx_xquic_sendmmsg(qc->connection, msg_iov, vlen,
+                             peer_addr, peer_addrlen);
 
     if (res < 0 && (errno == EAGAIN)) {
         return ngx_http_xquic_on_write_block(qc, wev);
@@ -341,7 +335,6 @@ ngx_xquic_server_mp_send_mmsg(uint64_t path_id,
 {
     ngx_event_t               *wev;
     ssize_t                    res = 0;
-    unsigned int               i = 0;
 
     ngx_xquic_list_node_t     *node = NULL;
     ngx_uint_t                 index = 0;
@@ -352,10 +345,6 @@ ngx_xquic_server_mp_send_mmsg(uint64_t path_id,
     u_char                     text[NGX_SOCKADDR_STRLEN];
     ngx_str_t                  addr_text;
 
-    struct mmsghdr             msg[NGX_XQUIC_MAX_SEND_MSG_ONCE];
-
-    memset(msg, 0, sizeof(msg));
-
     ngx_http_xquic_connection_t *qc = (ngx_http_xquic_connection_t *)conn_user_data;
 
     if (qc == NULL) {
@@ -440,14 +429,8 @@ degrade:
 #endif
 #endif
 
-    for(i = 0 ; i < vlen; i++){
-        msg[i].msg_hdr.msg_name = (void *)peer_addr;
-        msg[i].msg_hdr.msg_namelen = peer_addrlen;
-        msg[i].msg_hdr.msg_iov = (struct iovec *)(msg_iov + i);
-        msg[i].msg_hdr.msg_iovlen = 1;
-    }
-
-    res = sendmmsg(fd, msg, vlen, 0);
+    res = ngx_xquic_sendmmsg(ngx_conn, msg_iov, vlen,
+                             peer_addr, peer_addrlen);
 
     if (res < 0 && (errno == EAGAIN)) {
         return ngx_http_xquic_on_write_block(qc, wev);
@@ -468,6 +451,52 @@ degrade:
     return res;
 }
 
+
+/*
+ * With xquic_udp_gso the datagrams of a batch are sent as runs of segments,
+ * see ngx_xquic_udp.h.  If the route cannot segment them, the batch is sent
+ * as separate datagrams, and segmentation is not tried again by the worker.
+ */
+
+static ssize_t
+ngx_xquic_sendmmsg(ngx_connection_t *c, const struct iovec *msg_iov,
+    unsigned int vlen, const struct sockaddr *peer_addr, socklen_t peer_addrlen)
+{
+    ssize_t                       res;
+    ngx_err_t                     err;
+    ngx_http_xquic_main_conf_t   *qmcf;
+
+    qmcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
+                                               ngx_http_xquic_module);
+
+    if (qmcf->udp_gso) {
+        res = ngx_xquic_udp_sendmmsg(c->fd, msg_iov, vlen,
+                                     peer_addr, peer_addrlen, 1);
+
+        if (res != -1) {
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "|xquic|sendmmsg(UDP_SEGMENT)|%z of %ud|",
+                           res, vlen);
+            return res;
+        }
+
+        err = ngx_socket_errno;
+
+        if (err != NGX_EIO && err != NGX_EINVAL) {
+            return res;
+        }
+
+        ngx_log_error(NGX_LOG_NOTICE, c->log, err,
+                      "|xquic|sendmmsg(UDP_SEGMENT) failed, "
+                      "xquic_udp_gso disabled|");
+
+        qmcf->udp_gso = 0;
+    }
+
+    return ngx_xquic_udp_sendmmsg(c->fd, msg_iov, vlen,
+                                  peer_addr, peer_addrlen, 0);
+}
+
 #endif
 
 
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2010-2026 Alibaba Group Holding Limited
+ */
+
+#ifndef _NGX_XQUIC_UDP_H_INCLUDED_
+#define _NGX_XQUIC_UDP_H_INCLUDED_
+
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Batched UDP sends and receives for QUIC.
+ *
+ * With UDP_SEGMENT (GSO) a run of datagrams of the same size, the last one
+ * possibly shorter, is passed to the kernel as one buffer and split into the
+ * datagrams after the routing, so a flight of packets costs one pass through
+ * the stack per run instead of per packet.  All the runs of a batch are sent
+ * with one sendmmsg().
+ *
+ * With UDP_GRO the kernel coalesces the datagrams of a flow received back to
+ * back into one buffer and reports the size of the segments in a control
+ * message, the receiver splits them again.
+ *
+ * Only the system headers are needed here, so the stand-alone benchmark under
+ * test/unit/ exercises this very source without a full nginx build.  The
+ * functions are inline, each source file uses some of them only.
+ */
+
+
+/* the most datagrams passed to a single sendmmsg() or recvmmsg() */
+#define NGX_XQUIC_UDP_BATCH            64
+
+/* UDP_MAX_SEGMENTS of the kernel */
+#define NGX_XQUIC_GSO_MAX_SEGMENTS     64
+
+/* the largest UDP payload over IPv4 */
+#define NGX_XQUIC_GSO_MAX_SIZE         65507
+
+/* the buffer for the datagrams coalesced by UDP_GRO */
+#define NGX_XQUIC_GRO_BUFFER_SIZE      65535
+
+
+#if (NGX_HAVE_UDP_SEGMENT)
+
+typedef union {
+    struct cmsghdr  cmsg;
+    unsigned char   buf[CMSG_SPACE(sizeof(uint16_t))];
+} ngx_xquic_gso_control_t;
+
+
+static inline ssize_t
+ngx_xquic_udp_sendmmsg_gso(int fd, const struct iovec *iov, unsigned int vlen,
+    const struct sockaddr *peer_addr, socklen_t peer_addrlen)
+{
+    int                       n, rc;
+    size_t                    seg, total;
+    ssize_t                   sent;
+    uint16_t                  size;
+    unsigned int              i, j;
+    unsigned int              npkts[NGX_XQUIC_UDP_BATCH];
+    struct cmsghdr           *cmsg;
+    struct mmsghdr            msg[NGX_XQUIC_UDP_BATCH];
+    ngx_xquic_gso_control_t   control[NGX_XQUIC_UDP_BATCH];
+
+    memset(msg, 0, vlen * sizeof(struct mmsghdr));
+
+    n = 0;
+
+    for (i = 0; i < vlen; i = j) {
+
+        /* a run ends with a datagram shorter than the first one */
+
+        seg = iov[i].iov_len;
+        total = seg;
+
+        for (j = i + 1;
+             j < vlen
+             && iov[j - 1].iov_len == seg
+             && iov[j].iov_len <= seg
+             && j - i < NGX_XQUIC_GSO_MAX_SEGMENTS
+             && total + iov[j].iov_len <= NGX_XQUIC_GSO_MAX_SIZE;
+             j++)
+        {
+            total += iov[j].iov_len;
+        }
+
+        msg[n].msg_hdr.msg_name = (void *) peer_addr;
+        msg[n].msg_hdr.msg_namelen = peer_addrlen;
+        msg[n].msg_hdr.msg_iov = (struct iovec *) &iov[i];
+        msg[n].msg_hdr.msg_iovlen = j - i;
+
+        if (j - i > 1) {
+            msg[n].msg_hdr.msg_control = control[n].buf;
+            msg[n].msg_hdr.msg_controllen = sizeof(control[n].buf);
+
+            cmsg = CMSG_FIRSTHDR(&msg[n].msg_hdr);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+
+            size = (uint16_t) seg;
+            memcpy(CMSG_DATA(cmsg), &size, sizeof(uint16_t));
+        }
+
+        npkts[n++] = j - i;
+    }
+
+    do {
+        rc = sendmmsg(fd, msg, n, 0);
+    } while (rc == -1 && errno == EINTR);
+
+    if (rc == -1) {
+        return -1;
+    }
+
+    for (sent = 0, i = 0; i < (unsigned int) rc; i++) {
+        sent += npkts[i];
+    }
+
+    return sent;
+}
+
+#endif
+
+
+/*
+ * Sends the vlen datagrams of iov to the peer with one sendmmsg(), as runs
+ * of equally sized segments if gso is set.  Returns the number of datagrams
+ * sent, or -1 with errno set if none was.  With gso, EIO and EINVAL mean
+ * that the route or the device cannot segment the datagrams, the caller is
+ * expected to retry without it.
+ */
+
+static inline ssize_t
+ngx_xquic_udp_sendmmsg(int fd, const struct iovec *iov, unsigned int vlen,
+    const struct sockaddr *peer_addr, socklen_t peer_addrlen, int gso)
+{
+    int             rc;
+    unsigned int    i;
+    struct mmsghdr  msg[NGX_XQUIC_UDP_BATCH];
+
+    if (vlen > NGX_XQUIC_UDP_BATCH) {
+        vlen = NGX_XQUIC_UDP_BATCH;
+    }
+
+#if (NGX_HAVE_UDP_SEGMENT)
+    if (gso) {
+        return ngx_xquic_udp_sendmmsg_gso(fd, iov, vlen, peer_addr,
+                                          peer_addrlen);
+    }
+#else
+    (void) gso;
+#endif
+
+    memset(msg, 0, vlen * sizeof(struct mmsghdr));
+
+    for (i = 0; i < vlen; i++) {
+        msg[i].msg_hdr.msg_name = (void *) peer_addr;
+        msg[i].msg_hdr.msg_namelen = peer_addrlen;
+        msg[i].msg_hdr.msg_iov = (struct iovec *) &iov[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    do {
+        rc = sendmmsg(fd, msg, vlen, 0);
+    } while (rc == -1 && errno == EINTR);
+
+    return rc;
+}
+
+
+#if (NGX_HAVE_UDP_GRO)
+
+/*
+ * Returns the size of the segments of a datagram received with UDP_GRO,
+ * or 0 if it was not coalesced.
+ */
+
+static inline size_t
+ngx_xquic_udp_gro_size(struct msghdr *msg)
+{
+    int              size;
+    struct cmsghdr  *cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(msg);
+         cmsg != NULL;
+         cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            memcpy(&size, CMSG_DATA(cmsg), sizeof(int));
+            return size > 0 ? (size_t) size : 0;
+        }
+    }
+
+    return 0;
+}
+
+#endif
+
+
+#endif /* _NGX_XQUIC_UDP_H_INCLUDED_ */
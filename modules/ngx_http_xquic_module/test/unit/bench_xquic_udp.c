@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2010-2026 Alibaba Group Holding Limited
+ */
+
+/*
+ * Loopback throughput benchmark for the batched UDP paths of the xquic
+ * module (ngx_xquic_udp.h).
+ *
+ * A sender thread pushes datagrams of QUIC size to a receiver thread over
+ * 127.0.0.1, each carrying its sequence number, in three modes:
+ *
+ *     per-packet  sendto() and recvmsg() for every datagram, as without
+ *                 sendmmsg support;
+ *     batched     ngx_xquic_udp_sendmmsg() and recvmmsg();
+ *     gso+gro     ngx_xquic_udp_sendmmsg() with UDP_SEGMENT, and recvmmsg()
+ *                 with UDP_GRO, the coalesced buffers split with
+ *                 ngx_xquic_udp_gro_size() as ngx_xquic_event_recv() does.
+ *
+ * The datagrams dropped by the loopback under load are counted, the order
+ * and the payload of the ones received are verified.
+ *
+ *     make bench
+ *     ./bench_xquic_udp [packets] [size]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#define NGX_HAVE_UDP_SEGMENT  1
+#define NGX_HAVE_UDP_GRO      1
+
+#include "../../ngx_xquic_udp.h"
+
+
+#define BENCH_BATCH      32
+#define BENCH_RECV_SLOTS 16
+#define BENCH_MAX_SIZE   1500
+
+
+typedef enum {
+    BENCH_PER_PACKET = 0,
+    BENCH_BATCHED,
+    BENCH_GSO_GRO
+} bench_mode_e;
+
+
+static const char *bench_mode_names[] = { "per-packet", "batched", "gso+gro" };
+
+
+typedef struct {
+    bench_mode_e         mode;
+    int                  fd;
+    unsigned long        packets;
+    size_t               size;
+
+    /* results of the receiver */
+    unsigned long        received;
+    unsigned long        reordered;
+    unsigned long        corrupted;
+    unsigned long        syscalls;
+    double               elapsed;
+} bench_recv_t;
+
+
+static double
+bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void
+bench_fill(unsigned char *p, size_t size, uint32_t seq)
+{
+    size_t  i;
+
+    memcpy(p, &seq, sizeof(uint32_t));
+
+    for (i = sizeof(uint32_t); i < size; i++) {
+        p[i] = (unsigned char) (seq + i);
+    }
+}
+
+
+static void
+bench_check(bench_recv_t *r, const unsigned char *p, size_t len,
+    uint32_t *next)
+{
+    size_t    i;
+    uint32_t  seq;
+
+    r->received++;
+
+    if (len != r->size) {
+        r->corrupted++;
+        return;
+    }
+
+    memcpy(&seq, p, sizeof(uint32_t));
+
+    for (i = sizeof(uint32_t); i < len; i++) {
+        if (p[i] != (unsigned char) (seq + i)) {
+            r->corrupted++;
+            return;
+        }
+    }
+
+    /* the gaps are drops, a sequence number going back is reordering */
+
+    if (seq < *next) {
+        r->reordered++;
+    }
+
+    *next = seq + 1;
+}
+
+
+static void *
+bench_receiver(void *data)
+{
+    bench_recv_t *r = data;
+
+    int              n, i;
+    size_t           len, seg, off;
+    double           start;
+    uint32_t         next;
+    struct pollfd    pfd;
+    unsigned char   *buf;
+    struct iovec     iov[BENCH_RECV_SLOTS];
+    struct mmsghdr   msg[BENCH_RECV_SLOTS];
+    unsigned char    control[BENCH_RECV_SLOTS][CMSG_SPACE(sizeof(int))];
+
+    buf = malloc(BENCH_RECV_SLOTS * NGX_XQUIC_GRO_BUFFER_SIZE);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    next = 0;
+    start = 0;
+
+    pfd.fd = r->fd;
+    pfd.events = POLLIN;
+
+    /* the run ends when nothing is received for 200 ms */
+
+    while (r->received < r->packets && poll(&pfd, 1, 200) == 1) {
+
+        if (start == 0) {
+            start = bench_now();
+        }
+
+        if (r->mode == BENCH_PER_PACKET) {
+            struct msghdr  m;
+
+            memset(&m, 0, sizeof(struct msghdr));
+
+            iov[0].iov_base = buf;
+            iov[0].iov_len = BENCH_MAX_SIZE;
+            m.msg_iov = iov;
+            m.msg_iovlen = 1;
+
+            n = recvmsg(r->fd, &m, MSG_DONTWAIT);
+            r->syscalls++;
+
+            if (n >= 0) {
+                bench_check(r, buf, n, &next);
+            }
+
+            continue;
+        }
+
+        for (i = 0; i < BENCH_RECV_SLOTS; i++) {
+            iov[i].iov_base = buf + i * NGX_XQUIC_GRO_BUFFER_SIZE;
+            iov[i].iov_len = NGX_XQUIC_GRO_BUFFER_SIZE;
+
+            memset(&msg[i], 0, sizeof(struct mmsghdr));
+            msg[i].msg_hdr.msg_iov = &iov[i];
+            msg[i].msg_hdr.msg_iovlen = 1;
+            msg[i].msg_hdr.msg_control = control[i];
+            msg[i].msg_hdr.msg_controllen = sizeof(control[i]);
+        }
+
+        n = recvmmsg(r->fd, msg, BENCH_RECV_SLOTS, MSG_DONTWAIT, NULL);
+        r->syscalls++;
+
+        for (i = 0; i < n; i++) {
+            len = msg[i].msg_len;
+            seg = ngx_xquic_udp_gro_size(&msg[i].msg_hdr);
+
+            if (seg == 0 || seg > len) {
+                seg = len;
+            }
+
+            for (off = 0; off < len; off += seg) {
+                bench_check(r, (unsigned char *) iov[i].iov_base + off,
+                            len - off < seg ? len - off : seg, &next);
+            }
+        }
+    }
+
+    r->elapsed = start ? bench_now() - start - (r->received < r->packets
+                                                ? 0.2 : 0)
+                       : 0;
+
+    free(buf);
+
+    return NULL;
+}
+
+
+static int
+bench_run(bench_mode_e mode, unsigned long packets, size_t size)
+{
+    int                 rfd, sfd, on, rcvbuf;
+    double              start, elapsed;
+    ssize_t             n;
+    uint32_t            seq;
+    pthread_t           tid;
+    socklen_t           socklen;
+    unsigned int        i, vlen;
+    bench_recv_t        r;
+    unsigned long       syscalls, failed;
+    struct iovec        iov[BENCH_BATCH];
+    struct sockaddr_in  sin;
+    unsigned char       data[BENCH_BATCH][BENCH_MAX_SIZE];
+
+    rfd = socket(AF_INET, SOCK_DGRAM, 0);
+    sfd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (rfd == -1 || sfd == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&sin, 0, sizeof(struct sockaddr_in));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen = sizeof(struct sockaddr_in);
+
+    if (bind(rfd, (struct sockaddr *) &sin, socklen) == -1
+        || getsockname(rfd, (struct sockaddr *) &sin, &socklen) == -1)
+    {
+        perror("bind");
+        return -1;
+    }
+
+    /* capped by net.core.rmem_max */
+
+    rcvbuf = 8 * 1024 * 1024;
+    (void) setsockopt(rfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(int));
+
+    if (mode == BENCH_GSO_GRO) {
+        on = 1;
+
+        if (setsockopt(rfd, SOL_UDP, UDP_GRO, &on, sizeof(int)) == -1) {
+            printf("%-12s setsockopt(UDP_GRO) failed: %s\n",
+                   bench_mode_names[mode], strerror(errno));
+        }
+    }
+
+    memset(&r, 0, sizeof(bench_recv_t));
+    r.mode = mode;
+    r.fd = rfd;
+    r.packets = packets;
+    r.size = size;
+
+    if (pthread_create(&tid, NULL, bench_receiver, &r) != 0) {
+        perror("pthread_create");
+        return -1;
+    }
+
+    seq = 0;
+    syscalls = 0;
+    failed = 0;
+
+    start = bench_now();
+
+    while (seq < packets) {
+        vlen = packets - seq < BENCH_BATCH ? packets - seq : BENCH_BATCH;
+
+        for (i = 0; i < vlen; i++) {
+            bench_fill(data[i], size, seq + i);
+            iov[i].iov_base = data[i];
+            iov[i].iov_len = size;
+        }
+
+        if (mode == BENCH_PER_PACKET) {
+            for (i = 0; i < vlen; i++) {
+                n = sendto(sfd, data[i], size, 0, (struct sockaddr *) &sin,
+                           socklen);
+                syscalls++;
+
+                if (n == -1) {
+                    failed++;
+                }
+            }
+
+            seq += vlen;
+            continue;
+        }
+
+        n = ngx_xquic_udp_sendmmsg(sfd, iov, vlen, (struct sockaddr *) &sin,
+                                   socklen, mode == BENCH_GSO_GRO);
+        syscalls++;
+
+        if (n == -1) {
+            if (errno == ENOBUFS || errno == EAGAIN) {
+                failed += vlen;
+                seq += vlen;
+                continue;
+            }
+
+            printf("%-12s sendmmsg() failed: %s\n",
+                   bench_mode_names[mode], strerror(errno));
+            break;
+        }
+
+        /* the rest of a partial batch is sent again */
+
+        seq += n;
+    }
+
+    elapsed = bench_now() - start;
+
+    pthread_join(tid, NULL);
+
+    close(sfd);
+    close(rfd);
+
+    printf("%-12s send %8.0f pkt/s %7lu syscalls | "
+           "recv %8.0f pkt/s %7lu syscalls, %lu of %lu received, "
+           "%lu reordered, %lu corrupted%s\n",
+           bench_mode_names[mode],
+           elapsed ? (seq - failed) / elapsed : 0, syscalls,
+           r.elapsed ? r.received / r.elapsed : 0, r.syscalls,
+           r.received, packets, r.reordered, r.corrupted,
+           failed ? " (send failures)" : "");
+
+    return (r.corrupted || r.reordered) ? -1 : 0;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int            rc;
+    size_t         size;
+    unsigned long  packets;
+
+    packets = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    size = argc > 2 ? strtoul(argv[2], NULL, 10) : 1200;
+
+    if (size < sizeof(uint32_t) || size > BENCH_MAX_SIZE) {
+        fprintf(stderr, "size must be from %zu to %d\n",
+                sizeof(uint32_t), BENCH_MAX_SIZE);
+        return 2;
+    }
+
+    printf("%lu datagrams of %zu bytes over 127.0.0.1, batches of %d\n",
+           packets, size, BENCH_BATCH);
+
+    rc = 0;
+
+    rc |= bench_run(BENCH_PER_PACKET, packets, size);
+    rc |= bench_run(BENCH_BATCHED, packets, size);
+    rc |= bench_run(BENCH_GSO_GRO, packets, size);
+
+    return rc ? 1 : 0;
+}
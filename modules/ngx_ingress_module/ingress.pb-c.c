@@ -1087,6 +1087,51 @@ void   ingress__config__free_unpacked
   assert(message->base.descriptor == &ingress__config__descriptor);
   protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
 }
+void   ingress__config_delta__init
+                     (Ingress__ConfigDelta         *message)
+{
+  static const Ingress__ConfigDelta init_value = INGRESS__CONFIG_DELTA__INIT;
+  *message = init_value;
+}
+size_t ingress__config_delta__get_packed_size
+                     (const Ingress__ConfigDelta *message)
+{
+  assert(message->base.descriptor == &ingress__config_delta__descriptor);
+  return protobuf_c_message_get_packed_size ((const ProtobufCMessage*)(message));
+}
+size_t ingress__config_delta__pack
+                     (const Ingress__ConfigDelta *message,
+                      uint8_t       *out)
+{
+  assert(message->base.descriptor == &ingress__config_delta__descriptor);
+  return protobuf_c_message_pack ((const ProtobufCMessage*)message, out);
+}
+size_t ingress__config_delta__pack_to_buffer
+                     (const Ingress__ConfigDelta *message,
+                      ProtobufCBuffer *buffer)
+{
+  assert(message->base.descriptor == &ingress__config_delta__descriptor);
+  return protobuf_c_message_pack_to_buffer ((const ProtobufCMessage*)message, buffer);
+}
+Ingress__ConfigDelta *
+       ingress__config_delta__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data)
+{
+  return (Ingress__ConfigDelta *)
+     protobuf_c_message_unpack (&ingress__config_delta__descriptor,
+                                allocator, len, data);
+}
+void   ingress__config_delta__free_unpacked
+                     (Ingress__ConfigDelta *message,
+                      ProtobufCAllocator *allocator)
+{
+  if(!message)
+    return;
+  assert(message->base.descriptor == &ingress__config_delta__descriptor);
+  protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
+}
 static const ProtobufCFieldDescriptor ingress__tag_value_str_list__field_descriptors[1] =
 {
   {
@@ -2610,6 +2655,109 @@ const ProtobufCMessageDescriptor ingress__config__descriptor =
   (ProtobufCMessageInit) ingress__config__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
+static const ProtobufCFieldDescriptor ingress__config_delta__field_descriptors[6] =
+{
+  {
+    "base_version",
+    1,
+    PROTOBUF_C_LABEL_OPTIONAL,
+    PROTOBUF_C_TYPE_UINT64,
+    offsetof(Ingress__ConfigDelta, has_base_version),
+    offsetof(Ingress__ConfigDelta, base_version),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "routers",
+    2,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_MESSAGE,
+    offsetof(Ingress__ConfigDelta, n_routers),
+    offsetof(Ingress__ConfigDelta, routers),
+    &ingress__router__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "services",
+    3,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_MESSAGE,
+    offsetof(Ingress__ConfigDelta, n_services),
+    offsetof(Ingress__ConfigDelta, services),
+    &ingress__virtual_service__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "removed_hosts",
+    4,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_STRING,
+    offsetof(Ingress__ConfigDelta, n_removed_hosts),
+    offsetof(Ingress__ConfigDelta, removed_hosts),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "removed_appnames",
+    5,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_STRING,
+    offsetof(Ingress__ConfigDelta, n_removed_appnames),
+    offsetof(Ingress__ConfigDelta, removed_appnames),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "removed_services",
+    6,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_STRING,
+    offsetof(Ingress__ConfigDelta, n_removed_services),
+    offsetof(Ingress__ConfigDelta, removed_services),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+};
+static const unsigned ingress__config_delta__field_indices_by_name[] = {
+  0,   /* field[0] = base_version */
+  4,   /* field[4] = removed_appnames */
+  3,   /* field[3] = removed_hosts */
+  5,   /* field[5] = removed_services */
+  1,   /* field[1] = routers */
+  2,   /* field[2] = services */
+};
+static const ProtobufCIntRange ingress__config_delta__number_ranges[1 + 1] =
+{
+  { 1, 0 },
+  { 0, 6 }
+};
+const ProtobufCMessageDescriptor ingress__config_delta__descriptor =
+{
+  PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,
+  "Ingress.ConfigDelta",
+  "ConfigDelta",
+  "Ingress__ConfigDelta",
+  "Ingress",
+  sizeof(Ingress__ConfigDelta),
+  6,
+  ingress__config_delta__field_descriptors,
+  ingress__config_delta__field_indices_by_name,
+  1,  ingress__config_delta__number_ranges,
+  (ProtobufCMessageInit) ingress__config_delta__init,
+  NULL,NULL,NULL    /* reserved[123] */
+};
 static const ProtobufCEnumValue ingress__location_type__enum_values_by_number[6] =
 {
   { "LocUnDefined", "INGRESS__LOCATION_TYPE__LocUnDefined", 0 },
@@ -39,6 +39,7 @@ typedef struct _Ingress__VirtualService Ingress__VirtualService;
 typedef struct _Ingress__ExpireTime Ingress__ExpireTime;
 typedef struct _Ingress__HostCertEntry Ingress__HostCertEntry;
 typedef struct _Ingress__Config Ingress__Config;
+typedef struct _Ingress__ConfigDelta Ingress__ConfigDelta;
 
 
 /* --- enums --- */
@@ -545,6 +546,52 @@ struct  _Ingress__Config
     , 0,NULL, 0,NULL, 0,NULL }
 
 
+/*
+ * ConfigDelta patches the config of base_version into the version found
+ * in the shared memory header.
+ * routers replace the host router of the same host and the appname router
+ * of the same appname, services replace the service of the same
+ * service_name; anything not mentioned is left untouched.
+ */
+struct  _Ingress__ConfigDelta
+{
+  ProtobufCMessage base;
+  /*
+   * version the delta applies on
+   */
+  protobuf_c_boolean has_base_version;
+  uint64_t base_version;
+  /*
+   * added or replaced routers
+   */
+  size_t n_routers;
+  Ingress__Router **routers;
+  /*
+   * added or replaced services
+   */
+  size_t n_services;
+  Ingress__VirtualService **services;
+  /*
+   * host routers to remove
+   */
+  size_t n_removed_hosts;
+  char **removed_hosts;
+  /*
+   * appname routers to remove
+   */
+  size_t n_removed_appnames;
+  char **removed_appnames;
+  /*
+   * services to remove
+   */
+  size_t n_removed_services;
+  char **removed_services;
+};
+#define INGRESS__CONFIG_DELTA__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&ingress__config_delta__descriptor) \
+    , 0, 0, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL }
+
+
 /* Ingress__TagValueStrList methods */
 void   ingress__tag_value_str_list__init
                      (Ingress__TagValueStrList         *message);
@@ -1001,6 +1048,25 @@ Ingress__Config *
 void   ingress__config__free_unpacked
                      (Ingress__Config *message,
                       ProtobufCAllocator *allocator);
+/* Ingress__ConfigDelta methods */
+void   ingress__config_delta__init
+                     (Ingress__ConfigDelta         *message);
+size_t ingress__config_delta__get_packed_size
+                     (const Ingress__ConfigDelta   *message);
+size_t ingress__config_delta__pack
+                     (const Ingress__ConfigDelta   *message,
+                      uint8_t             *out);
+size_t ingress__config_delta__pack_to_buffer
+                     (const Ingress__ConfigDelta   *message,
+                      ProtobufCBuffer     *buffer);
+Ingress__ConfigDelta *
+       ingress__config_delta__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   ingress__config_delta__free_unpacked
+                     (Ingress__ConfigDelta *message,
+                      ProtobufCAllocator *allocator);
 /* --- per-message closures --- */
 
 typedef void (*Ingress__TagValueStrList_Closure)
@@ -1075,6 +1141,9 @@ typedef void (*Ingress__HostCertEntry_Closure)
 typedef void (*Ingress__Config_Closure)
                  (const Ingress__Config *message,
                   void *closure_data);
+typedef void (*Ingress__ConfigDelta_Closure)
+                 (const Ingress__ConfigDelta *message,
+                  void *closure_data);
 
 /* --- services --- */
 
@@ -1111,6 +1180,7 @@ extern const ProtobufCMessageDescriptor ingress__virtual_service__descriptor;
 extern const ProtobufCMessageDescriptor ingress__expire_time__descriptor;
 extern const ProtobufCMessageDescriptor ingress__host_cert_entry__descriptor;
 extern const ProtobufCMessageDescriptor ingress__config__descriptor;
+extern const ProtobufCMessageDescriptor ingress__config_delta__descriptor;
 
 PROTOBUF_C__END_DECLS
 
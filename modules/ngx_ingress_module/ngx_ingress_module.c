@@ -474,55 +474,105 @@ ngx_ingress_get_req_tag_value(ngx_http_request_t *r, ngx_ingress_tag_value_locat
     return ret;
 }
 
-static ngx_ingress_service_t *
-ngx_ingress_get_tag_match_service(ngx_ingress_gateway_t *gateway,
-ngx_http_request_t *r, ngx_shm_array_t *tags)
+static ngx_inline void
+ngx_ingress_tag_rule_hit(ngx_http_request_t *r, ngx_ingress_tag_matcher_t *matcher,
+    ngx_uint_t rule, ngx_uint_t first, ngx_uint_t **hits, ngx_uint_t *best)
 {
-    ngx_uint_t                      i, j, k;
-    ngx_ingress_service_t          *service = NULL;
-    ngx_int_t                       ret = NGX_ERROR;
-    ngx_str_t                       value;
+    ngx_ingress_tag_compiled_rule_t *rules = matcher->rules->elts;
 
-    ngx_ingress_tag_router_t *tag_router = tags->elts;
+    if (rule < first || rule >= *best) {
+        return;
+    }
 
-    /* Traversing each tag route (sorted in the array by priority), the first match is returned */
-    for (i = 0; i < tags->nelts; i++) {
+    if (rules[rule].nitems > 1) {
+        if (*hits == NULL) {
+            *hits = ngx_pcalloc(r->pool, matcher->rules->nelts * sizeof(ngx_uint_t));
+            if (*hits == NULL) {
+                return;
+            }
+        }
 
-        ngx_ingress_tag_rule_t *tag_rule = tag_router[i].rules->elts;
+        if (++(*hits)[rule] < rules[rule].nitems) {
+            return;
+        }
+    }
 
-        /* Traversing each tag rule (sorted in the array by priority), the first match is returned */
-        for (j = 0; j < tag_router[i].rules->nelts; j++) {
-            if (tag_rule[j].items->nelts == 0) { /* no items */
-                continue;
-            }
+    *best = rule;
+}
 
-            ngx_ingress_tag_item_t *tag_item = tag_rule[j].items->elts;
-            
-            /* Traversing each tag item, each item must match before returning */
-            for (k = 0; k < tag_rule[j].items->nelts; k++) {
+/*
+ * Returns the smallest fully matched rule index not less than "first",
+ * or the number of rules if there is none
+ */
+static ngx_uint_t
+ngx_ingress_tag_match_rule(ngx_http_request_t *r,
+    ngx_ingress_tag_matcher_t *matcher, ngx_uint_t first)
+{
+    ngx_uint_t                        i, best, *hits;
+    ngx_int_t                         ret;
+    ngx_ingress_tag_key_t            *keys;
+    ngx_ingress_tag_value_t           lookup, *v;
+    ngx_ingress_tag_posting_t        *posting;
+    ngx_ingress_tag_mod_item_t       *mod_item;
+
+    hits = NULL;
+    best = matcher->rules->nelts;
+    keys = matcher->keys->elts;
+
+    /* Every distinct key is read once, the smallest fully matched rule wins */
+    for (i = 0; i < matcher->keys->nelts && best != first; i++) {
+
+        ret = ngx_ingress_get_req_tag_value(r, keys[i].location, &keys[i].key, &lookup.value);
+        /* The request does not carry the target parameter */
+        if (ret != NGX_OK) {
+            continue;
+        }
 
-                ret = ngx_ingress_get_req_tag_value(r, tag_item[k].location, &tag_item[k].key, &value);
-                /* The request does not carry the target parameter */
-                if (ret != NGX_OK) {
-                    break;
-                } else {
-                    ret = ngx_ingress_cmp_tag_value(tag_item[k].match_type, &tag_item[k].condition, &value);
-                    if (ret != NGX_INGRESS_TAG_MATCH_SUCCESS) {
-                        break;
-                    }
-                }
+        lookup.key_index = i;
+
+        v = ngx_shm_hash_get(matcher->values, &lookup);
+        if (v != NULL) {
+            for (posting = v->postings; posting; posting = posting->next) {
+                ngx_ingress_tag_rule_hit(r, matcher, posting->rule, first, &hits, &best);
             }
+        }
 
-            /* every item matched */
-            if (k == tag_rule[j].items->nelts) {
-                if (ngx_ingress_check_upstream_enable(tag_router[i].service)) {
-                    return tag_router[i].service;
-                }
+        for (mod_item = keys[i].mod_items; mod_item; mod_item = mod_item->next) {
+            if (mod_item->rule < first || mod_item->rule >= best) {
+                continue;
+            }
+
+            ret = ngx_ingress_cmp_tag_value(mod_item->item->match_type,
+                                            &mod_item->item->condition, &lookup.value);
+            if (ret == NGX_INGRESS_TAG_MATCH_SUCCESS) {
+                ngx_ingress_tag_rule_hit(r, matcher, mod_item->rule, first, &hits, &best);
             }
         }
     }
 
-    return service;
+    return best;
+}
+
+static ngx_ingress_service_t *
+ngx_ingress_get_tag_match_service(ngx_ingress_gateway_t *gateway,
+ngx_http_request_t *r, ngx_ingress_tag_matcher_t *matcher)
+{
+    ngx_uint_t                        rule;
+    ngx_ingress_tag_compiled_rule_t  *rules;
+
+    rules = matcher->rules->elts;
+
+    /* A matched rule with a disabled upstream falls through to the next one */
+    for (rule = ngx_ingress_tag_match_rule(r, matcher, 0);
+         rule < matcher->rules->nelts;
+         rule = ngx_ingress_tag_match_rule(r, matcher, rule + 1))
+    {
+        if (ngx_ingress_check_upstream_enable(rules[rule].service)) {
+            return rules[rule].service;
+        }
+    }
+
+    return NULL;
 }
 
 ngx_int_t
@@ -580,14 +630,48 @@ ngx_ingress_appname_service_queue_head_insert(
     return NGX_OK;
 }
 
+/*
+ * Longest prefix first: probe the uri prefix of every distinct
+ * prefix length in the host path map.
+ */
+static ngx_ingress_path_router_t *
+ngx_ingress_match_path(ngx_ingress_host_router_t *host_router, ngx_str_t *uri)
+{
+    size_t                      *lens;
+    ngx_uint_t                   i;
+    ngx_ingress_path_router_t    path_key, *path_router;
+
+    if (host_router->path_map == NULL) {
+        return NULL;
+    }
+
+    lens = host_router->path_lens->elts;
+    path_key.prefix.data = uri->data;
+
+    for (i = 0; i < host_router->path_lens->nelts; i++) {
+        if (lens[i] > uri->len) {
+            continue;
+        }
+
+        path_key.prefix.len = lens[i];
+
+        path_router = ngx_shm_hash_get(host_router->path_map, &path_key);
+        if (path_router != NULL) {
+            return path_router;
+        }
+    }
+
+    return NULL;
+}
+
 static ngx_int_t
 ngx_ingress_match_service(ngx_ingress_ctx_t *ctx, ngx_ingress_gateway_t *gateway, ngx_http_request_t* r, ngx_queue_t *head)
 {
-    ngx_uint_t i;
     ngx_ingress_t *current;
     ngx_ingress_service_t *service = NULL;
     ngx_ingress_host_router_t host_key;
     ngx_ingress_host_router_t *host_router;
+    ngx_ingress_path_router_t *path_router;
     ngx_int_t rc;
 
     current = ngx_strategy_get_current_slot(gateway->ingress_app);
@@ -646,77 +730,46 @@ ngx_ingress_match_service(ngx_ingress_ctx_t *ctx, ngx_ingress_gateway_t *gateway
         }
     }
 
+    /* match path */
     if (host_router->type == INGRESS__HOST_TYPE__Web) {
-        /* match path */
-        ngx_ingress_path_router_t *path_router = host_router->paths->elts;
-        for (i = 0; i < host_router->paths->nelts; i++) {
-            if (ngx_comm_prefix_casecmp(&r->uri, &path_router[i].prefix) == 0) {
-                ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
-                        "|ingress|match prefix prefix|%V|%V|",
-                        &host_key.host,
-                        &r->uri);
-                
-                if (ngx_ingress_check_upstream_enable(path_router[i].service)) {
-                    rc = ngx_ingress_service_queue_head_insert(r, head, path_router[i].service);
-                    if (rc != NGX_OK) {
-                        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                                "|ingress|path service insert service queue failed|");
-                        return NGX_ERROR;
-                    }
-                }
+        path_router = ngx_ingress_match_path(host_router, &r->uri);
 
-                /* add appname tag router */
-                ngx_ingress_appname_service_queue_head_insert(gateway, current, path_router[i].service, r, head);
- 
-                /* if path route has tag router, match first */
-                if (path_router[i].tags) {
-                    service = ngx_ingress_get_tag_match_service(gateway, r, path_router[i].tags);
-                    if (service) {
-                        rc = ngx_ingress_service_queue_head_insert(r, head, service);
-                        if (rc != NGX_OK) {
-                            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                                    "|ingress|path service with tag insert service queue failed|");
-                            return NGX_ERROR;
-                        }
-                    }
-                }
-                
-                break;
+    } else if (host_router->type == INGRESS__HOST_TYPE__MCP) {
+        path_router = ngx_shm_trie_search(host_router->tries, &r->uri);
+
+    } else {
+        path_router = NULL;
+    }
+
+    if (path_router != NULL) {
+        ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
+                "|ingress|match prefix prefix|%V|%V|",
+                &host_key.host,
+                &r->uri);
+
+        if (ngx_ingress_check_upstream_enable(path_router->service)) {
+            rc = ngx_ingress_service_queue_head_insert(r, head, path_router->service);
+            if (rc != NGX_OK) {
+                ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                        "|ingress|path service insert service queue failed|");
+                return NGX_ERROR;
             }
         }
-    } else if (host_router->type == INGRESS__HOST_TYPE__MCP) {
-        /* match path */
-        ngx_ingress_path_router_t *path_router = ngx_shm_trie_search(host_router->tries, &r->uri);
-        if (path_router != NULL) {
-            ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
-                    "|ingress|match tries prefix|%V|%V|",
-                    &host_key.host,
-                    &r->uri);
-            
-            if (ngx_ingress_check_upstream_enable(path_router->service)) {
-                rc = ngx_ingress_service_queue_head_insert(r, head, path_router->service);
+
+        /* add appname tag router */
+        ngx_ingress_appname_service_queue_head_insert(gateway, current, path_router->service, r, head);
+
+        /* if path route has tag router, match first */
+        if (path_router->tags) {
+            service = ngx_ingress_get_tag_match_service(gateway, r, path_router->tags);
+            if (service) {
+                rc = ngx_ingress_service_queue_head_insert(r, head, service);
                 if (rc != NGX_OK) {
                     ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                            "|ingress|path service insert service queue failed|");
+                            "|ingress|path service with tag insert service queue failed|");
                     return NGX_ERROR;
                 }
             }
-
-            /* add appname tag router */
-            ngx_ingress_appname_service_queue_head_insert(gateway, current, path_router->service, r, head);
-
-            /* if path route has tag router, match first */
-            if (path_router->tags) {
-                service = ngx_ingress_get_tag_match_service(gateway, r, path_router->tags);
-                if (service) {
-                    rc = ngx_ingress_service_queue_head_insert(r, head, service);
-                    if (rc != NGX_OK) {
-                        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                                "|ingress|path service with tag insert service queue failed|");
-                        return NGX_ERROR;
-                    }
-                }
-            }
         }
     }
 
@@ -738,6 +791,7 @@ ngx_ingress_update(ngx_cycle_t *cycle,
     ngx_ingress_t *ingress = data;
 
     ngx_int_t rc;
+    ngx_msec_t start;
 
     ngx_ingress_shared_memory_config_t shm_pb_config;
 
@@ -748,6 +802,7 @@ ngx_ingress_update(ngx_cycle_t *cycle,
     
     ingress->pool = pool;
     shm_pb_config.pbconfig = NULL;
+    shm_pb_config.pbdelta = NULL;
 
     rc = ngx_ingress_shared_memory_read_pb(gateway->shared, &shm_pb_config, ngx_ingress_pb_read_body);
     if (rc != NGX_OK) {
@@ -756,6 +811,36 @@ ngx_ingress_update(ngx_cycle_t *cycle,
         goto ret;
     }
 
+    start = ngx_current_msec;
+
+    if (shm_pb_config.pbdelta != NULL) {
+        rc = ngx_ingress_update_shm_by_delta(gateway, &shm_pb_config, ingress);
+        if (rc == NGX_DECLINED) {
+            goto ret;
+        }
+
+        if (rc != NGX_OK) {
+            /* the slot is half patched, only a full config can fix it */
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                     "|ingress|ngx_ingress_update delta failed|%V|", &gateway->name);
+            ingress->version = 0;
+            goto ret;
+        }
+
+        ngx_time_update();
+
+        ngx_log_error(NGX_LOG_ERR, cycle->log, 0,
+                      "|ingress|update ingress delta md5|%*s|ver=%uL|cost=%Mms|used_rate=%i",
+                      NGX_COMM_MD5_HEX_LEN,
+                      shm_pb_config.md5_digit,
+                      shm_pb_config.version,
+                      ngx_current_msec - start,
+                      ngx_shm_pool_used_rate(ingress->pool));
+
+        ingress->version = shm_pb_config.version;
+        goto ret;
+    }
+
     if (ingress->version != 0 && shm_pb_config.pbconfig->n_services == 0) {
         /* empty config protection */
         ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
@@ -763,28 +848,58 @@ ngx_ingress_update(ngx_cycle_t *cycle,
         goto ret;
     }
 
+    /* a full config restarts the delta chain */
+    if (gateway->last_delta != NULL) {
+        ingress__config_delta__free_unpacked(gateway->last_delta, NULL);
+        gateway->last_delta = NULL;
+    }
+
+    if (gateway->last_config != NULL) {
+        ingress__config__free_unpacked(gateway->last_config, NULL);
+        gateway->last_config = NULL;
+    }
+
     ngx_shm_pool_reset(ingress->pool);
 
     rc = ngx_ingress_update_shm_by_pb(gateway, &shm_pb_config, ingress);
     if (rc != NGX_OK) {
         ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
                  "|ingress|ngx_ingress_update failed|%V|", &gateway->name);
+
+    } else {
+        /* keep the config to rebuild the other slot for the next delta */
+        gateway->last_config = shm_pb_config.pbconfig;
+        gateway->last_config_version = shm_pb_config.version;
     }
 
+    ngx_time_update();
+
     ngx_log_error(NGX_LOG_ERR, cycle->log, 0,
-                  "|ingress|update ingress md5|%*s|num=%uz|ver=%uL",
+                  "|ingress|update ingress md5|%*s|num=%uz|ver=%uL|cost=%Mms|used_rate=%i",
                   NGX_COMM_MD5_HEX_LEN,
                   shm_pb_config.md5_digit,
                   shm_pb_config.pbconfig->n_services,
-                  shm_pb_config.version);
+                  shm_pb_config.version,
+                  ngx_current_msec - start,
+                  ngx_shm_pool_used_rate(ingress->pool));
 
     ingress->version = shm_pb_config.version;
 
+    if (gateway->last_config == shm_pb_config.pbconfig) {
+        shm_pb_config.pbconfig = NULL;
+    }
+
 ret:
 
     ngx_ingress_shared_memory_free_pb(&shm_pb_config);
 
-    if (rc != NGX_OK) {
+    if (rc == NGX_DECLINED) {
+        ngx_ingress_shared_memory_write_status(gateway->shared,
+                                               NGX_INGRESS_SHARED_MEMORY_STATUS_INGRESS,
+                                               NGX_INGRESS_SHARED_MEMORY_TYPE_NEED_FULL);
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0, "|ingress|update ingress rule need full|");
+    }
+    else if (rc != NGX_OK) {
         ngx_ingress_shared_memory_write_status(gateway->shared,
                                                NGX_INGRESS_SHARED_MEMORY_STATUS_INGRESS,
                                                NGX_INGRESS_SHARED_MEMORY_TYPE_ERR);
@@ -113,22 +113,68 @@ typedef struct {
     ngx_ingress_service_t   *service;
 } ngx_ingress_tag_router_t;
 
+/*
+ * Tag routers compiled into a dispatch structure: every distinct
+ * (location, key) pair is read from the request once, equality values
+ * are looked up in a hash and only mod comparisons are evaluated per item.
+ */
+typedef struct ngx_ingress_tag_posting_s  ngx_ingress_tag_posting_t;
+
+struct ngx_ingress_tag_posting_s {
+    ngx_uint_t                   rule;          /* index in matcher rules */
+    ngx_ingress_tag_posting_t   *next;
+};
+
+typedef struct ngx_ingress_tag_mod_item_s  ngx_ingress_tag_mod_item_t;
+
+struct ngx_ingress_tag_mod_item_s {
+    ngx_uint_t                   rule;          /* index in matcher rules */
+    ngx_ingress_tag_item_t      *item;
+    ngx_ingress_tag_mod_item_t  *next;
+};
+
+typedef struct {
+    ngx_ingress_tag_value_location_e    location;
+    ngx_str_t                           key;
+    ngx_ingress_tag_mod_item_t         *mod_items;
+} ngx_ingress_tag_key_t;
+
+typedef struct {
+    ngx_uint_t                   key_index;
+    ngx_str_t                    value;
+    ngx_ingress_tag_posting_t   *postings;
+    ngx_ingress_tag_item_t      *last_item;     /* build time only */
+} ngx_ingress_tag_value_t;
+
+typedef struct {
+    ngx_uint_t                   nitems;
+    ngx_ingress_service_t       *service;
+} ngx_ingress_tag_compiled_rule_t;
+
+typedef struct {
+    ngx_shm_array_t             *keys;          /* ngx_ingress_tag_key_t */
+    ngx_shm_array_t             *rules;         /* ngx_ingress_tag_compiled_rule_t, by priority */
+    ngx_shm_hash_t              *values;        /* ngx_ingress_tag_value_t */
+} ngx_ingress_tag_matcher_t;
+
 typedef struct {
     ngx_str_t                prefix;
-    ngx_shm_array_t         *tags;              /* ngx_ingress_tag_router_t: The number of elements is 0 and assigned to NULL */
+    ngx_ingress_tag_matcher_t *tags;            /* The number of tag routers is 0 and assigned to NULL */
     ngx_ingress_service_t   *service;
 } ngx_ingress_path_router_t;
 
 typedef struct {
     ngx_str_t                appname;
-    ngx_shm_array_t         *tags;              /* ngx_ingress_tag_router_t: The number of elements is 0 and assigned to NULL */
+    ngx_ingress_tag_matcher_t *tags;            /* The number of tag routers is 0 and assigned to NULL */
 } ngx_ingress_app_router_t;
 
 typedef struct {
     ngx_str_t                   host;
     ngx_shm_array_t            *paths;          /* ngx_ingress_path_router_t */
+    ngx_shm_hash_t             *path_map;       /* ngx_ingress_path_router_t, keyed by prefix */
+    ngx_shm_array_t            *path_lens;      /* size_t: distinct prefix lengths, longest first */
     ngx_shm_array_t            *tries;          /* ngx_ingress_path_router_t */
-    ngx_shm_array_t            *tags;           /* ngx_ingress_tag_router_t: The number of elements is 0 and assigned to NULL */
+    ngx_ingress_tag_matcher_t  *tags;           /* The number of tag routers is 0 and assigned to NULL */
     ngx_ingress_service_t      *service;
     ngx_int_t                   type;
 } ngx_ingress_host_router_t;
@@ -161,6 +207,12 @@ typedef struct {
     ngx_int_t                        path_segment_bucket_num;
     ngx_ingress_shared_memory_t     *shared;
     ngx_strategy_slot_app_t         *ingress_app;
+
+    Ingress__Config                 *last_config;
+    uint64_t                         last_config_version;
+
+    Ingress__ConfigDelta            *last_delta;
+    uint64_t                         last_delta_version;
 } ngx_ingress_gateway_t;
 
 
@@ -216,6 +268,7 @@ ngx_ingress_ctx_t *ngx_ingress_get_ctx(ngx_ingress_main_conf_t *imcf,
                                        ngx_http_request_t *r);
 
 ngx_int_t ngx_ingress_update_shm_by_pb(ngx_ingress_gateway_t *gateway, ngx_ingress_shared_memory_config_t *shm_pb_config, ngx_ingress_t *ingress);
+ngx_int_t ngx_ingress_update_shm_by_delta(ngx_ingress_gateway_t *gateway, ngx_ingress_shared_memory_config_t *shm_pb_config, ngx_ingress_t *ingress);
 int ngx_ingress_tag_value_compar(const void *v1, const void *v2);
 
 #endif // NGX_INGRESS_MODULE_H
@@ -15,6 +15,8 @@
 #define NGX_INGRESS_METADATA_KEY_APPNAME            "app_name"
 #define NGX_INGRESS_METADATA_KEY_FORCEHTTPS         "force_https"
 
+#define NGX_INGRESS_DELTA_MAX_USED_RATE             90
+
 
 ngx_int_t
 ngx_ingress_shared_memory_init(ngx_ingress_shared_memory_t * shared, ngx_str_t *shm_name, ngx_uint_t shm_size, ngx_str_t *lock_file)
@@ -153,6 +155,7 @@ ngx_ingress_shared_memory_read_pb_locked(
     left = shared->shm_size;
 
     shm_pb_config->pbconfig = NULL;
+    shm_pb_config->pbdelta = NULL;
 
     /* read Status */
     rc = ngx_serialize_read_uint32(&pos, &left, &status);
@@ -184,7 +187,8 @@ ngx_ingress_shared_memory_read_pb_locked(
     shm_pb_config->type = type;
 
     if (shm_pb_config->type != NGX_INGRESS_SHARED_MEMORY_TYPE_SERVICE &&
-        shm_pb_config->type != NGX_INGRESS_SHARED_MEMORY_TYPE_SECRET) {
+        shm_pb_config->type != NGX_INGRESS_SHARED_MEMORY_TYPE_SECRET &&
+        shm_pb_config->type != NGX_INGRESS_SHARED_MEMORY_TYPE_DELTA) {
         ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
                       "|ingress|unknown config type|%d|", shm_pb_config->type);
         return NGX_ERROR;
@@ -222,6 +226,19 @@ ngx_ingress_shared_memory_read_pb_locked(
         return NGX_ERROR;
     }
 
+    if (shm_pb_config->type == NGX_INGRESS_SHARED_MEMORY_TYPE_DELTA) {
+        Ingress__ConfigDelta * pbdelta = ingress__config_delta__unpack(NULL, src.len, src.data);
+        if (pbdelta == NULL) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                          "|ingress|shared parse delta pb failed|");
+            return NGX_ERROR;
+        }
+
+        shm_pb_config->pbdelta = pbdelta;
+
+        return NGX_OK;
+    }
+
     /* parse PB */
     Ingress__Config * pbconfig = ingress__config__unpack(NULL, src.len, src.data);
     if (pbconfig == NULL) {
@@ -282,6 +299,10 @@ ngx_ingress_shared_memory_free_pb(ngx_ingress_shared_memory_config_t *shm_pb_con
     if (shm_pb_config->pbconfig != NULL) {
         ingress__config__free_unpacked(shm_pb_config->pbconfig, NULL);
     }
+
+    if (shm_pb_config->pbdelta != NULL) {
+        ingress__config_delta__free_unpacked(shm_pb_config->pbdelta, NULL);
+    }
 }
 
 static int
@@ -804,6 +825,74 @@ ngx_path_prefix_compare(const void *c1, const void *c2)
     return ngx_comm_str_compare(&router1->prefix, &router2->prefix);
 }
 
+static int
+ngx_ingress_path_compare(const void *p1, const void *p2)
+{
+    ngx_ingress_path_router_t *v1 = (ngx_ingress_path_router_t *)p1;
+    ngx_ingress_path_router_t *v2 = (ngx_ingress_path_router_t *)p2;
+
+    return ngx_comm_strcasecmp(&v1->prefix, &v2->prefix);
+}
+
+static ngx_uint_t
+ngx_ingress_path_hash(const void *p)
+{
+    ngx_ingress_path_router_t *v = (ngx_ingress_path_router_t *)p;
+
+    return ngx_hash_key_lc(v->prefix.data, v->prefix.len);
+}
+
+/*
+ * Index the sorted prefix routers by prefix, a lookup then probes
+ * one uri prefix per distinct length instead of comparing every path.
+ */
+static ngx_int_t
+ngx_ingress_update_shm_path_map(ngx_ingress_t *ingress,
+    ngx_ingress_host_router_t *shm_host)
+{
+    size_t                      *len;
+    ngx_uint_t                   i;
+    ngx_ingress_path_router_t   *path_router;
+
+    shm_host->path_map = ngx_shm_hash_create(ingress->pool, shm_host->paths->nelts,
+                                             ngx_ingress_path_hash,
+                                             ngx_ingress_path_compare);
+    if (shm_host->path_map == NULL) {
+        return NGX_ERROR;
+    }
+
+    shm_host->path_lens = ngx_shm_array_create(ingress->pool, shm_host->paths->nelts,
+                                               sizeof(size_t));
+    if (shm_host->path_lens == NULL) {
+        return NGX_ERROR;
+    }
+
+    len = NULL;
+    path_router = shm_host->paths->elts;
+
+    for (i = 0; i < shm_host->paths->nelts; i++) {
+        /* keep the first router of duplicated prefixes, as the linear scan did */
+        if (ngx_shm_hash_get(shm_host->path_map, &path_router[i]) != NULL) {
+            continue;
+        }
+
+        if (ngx_shm_hash_add(shm_host->path_map, &path_router[i]) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        /* paths are sorted longest first */
+        if (len == NULL || *len != path_router[i].prefix.len) {
+            len = ngx_shm_array_push(shm_host->path_lens);
+            if (len == NULL) {
+                return NGX_ERROR;
+            }
+
+            *len = path_router[i].prefix.len;
+        }
+    }
+
+    return NGX_OK;
+}
 
 /* 
  * this function check the tag item's data when reading configuration.
@@ -955,10 +1044,250 @@ ngx_ingress_pb_parse_tag_item(ngx_ingress_t *ingress,
     return NGX_OK;
 }
 
+static int
+ngx_ingress_tag_value_compare(const void *p1, const void *p2)
+{
+    ngx_ingress_tag_value_t *v1 = (ngx_ingress_tag_value_t *)p1;
+    ngx_ingress_tag_value_t *v2 = (ngx_ingress_tag_value_t *)p2;
+
+    if (v1->key_index != v2->key_index) {
+        return v1->key_index < v2->key_index ? -1 : 1;
+    }
+
+    return ngx_comm_strcasecmp(&v1->value, &v2->value);
+}
+
+static ngx_uint_t
+ngx_ingress_tag_value_hash(const void *p)
+{
+    size_t                    i;
+    ngx_uint_t                hash;
+    ngx_ingress_tag_value_t  *v = (ngx_ingress_tag_value_t *)p;
+
+    hash = v->key_index;
+
+    for (i = 0; i < v->value.len; i++) {
+        hash = ngx_hash(hash, ngx_tolower(v->value.data[i]));
+    }
+
+    return hash;
+}
+
+static ngx_int_t
+ngx_ingress_tag_matcher_add_value(ngx_ingress_t *ingress,
+    ngx_ingress_tag_matcher_t *matcher, ngx_uint_t key_index,
+    ngx_str_t *value, ngx_uint_t rule, ngx_ingress_tag_item_t *item)
+{
+    ngx_ingress_tag_value_t     key, *v;
+    ngx_ingress_tag_posting_t  *posting;
+
+    key.key_index = key_index;
+    key.value = *value;
+
+    v = ngx_shm_hash_get(matcher->values, &key);
+    if (v == NULL) {
+        v = ngx_shm_pool_calloc(ingress->pool, sizeof(ngx_ingress_tag_value_t));
+        if (v == NULL) {
+            return NGX_ERROR;
+        }
+
+        /* the string already lives in the shm condition */
+        v->key_index = key_index;
+        v->value = *value;
+
+        if (ngx_shm_hash_add(matcher->values, v) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    /* a value list may repeat the same value, count the item once */
+    if (v->last_item == item) {
+        return NGX_OK;
+    }
+
+    posting = ngx_shm_pool_calloc(ingress->pool, sizeof(ngx_ingress_tag_posting_t));
+    if (posting == NULL) {
+        return NGX_ERROR;
+    }
+
+    posting->rule = rule;
+    posting->next = v->postings;
+    v->postings = posting;
+    v->last_item = item;
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_ingress_tag_matcher_key_index(ngx_ingress_tag_matcher_t *matcher,
+    ngx_ingress_tag_item_t *item)
+{
+    ngx_uint_t              i;
+    ngx_ingress_tag_key_t  *keys, *key;
+
+    keys = matcher->keys->elts;
+
+    for (i = 0; i < matcher->keys->nelts; i++) {
+        if (keys[i].location == item->location
+            && ngx_comm_strcasecmp(&keys[i].key, &item->key) == 0)
+        {
+            return i;
+        }
+    }
+
+    key = ngx_shm_array_push(matcher->keys);
+    if (key == NULL) {
+        return NGX_ERROR;
+    }
+
+    key->location = item->location;
+    key->key = item->key;
+    key->mod_items = NULL;
+
+    return matcher->keys->nelts - 1;
+}
+
+/*
+ * Compile tag routers into a matcher, the flattened rule index keeps
+ * the router/rule priority so the smallest fully matched index wins.
+ */
+static ngx_int_t
+ngx_ingress_compile_tag_matcher(ngx_ingress_t *ingress,
+    ngx_shm_array_t *ptags, ngx_ingress_tag_matcher_t **ppmatcher)
+{
+    ngx_int_t                         key_index;
+    ngx_uint_t                        i, j, k, v, n_rules, n_items, n_values;
+    ngx_uint_t                        rule;
+    ngx_str_t                        *values;
+    ngx_ingress_tag_key_t            *key;
+    ngx_ingress_tag_rule_t           *tag_rule;
+    ngx_ingress_tag_item_t           *tag_item;
+    ngx_ingress_tag_router_t         *tag_router;
+    ngx_ingress_tag_matcher_t        *matcher;
+    ngx_ingress_tag_mod_item_t       *mod_item;
+    ngx_ingress_tag_compiled_rule_t  *compiled;
+
+    n_rules = 0;
+    n_items = 0;
+    n_values = 0;
+
+    tag_router = ptags->elts;
+    for (i = 0; i < ptags->nelts; i++) {
+        tag_rule = tag_router[i].rules->elts;
+        n_rules += tag_router[i].rules->nelts;
+
+        for (j = 0; j < tag_router[i].rules->nelts; j++) {
+            tag_item = tag_rule[j].items->elts;
+            n_items += tag_rule[j].items->nelts;
+
+            for (k = 0; k < tag_rule[j].items->nelts; k++) {
+                if (tag_item[k].condition.value_a != NULL) {
+                    n_values += tag_item[k].condition.value_a->nelts;
+                }
+                n_values++;
+            }
+        }
+    }
+
+    matcher = ngx_shm_pool_calloc(ingress->pool, sizeof(ngx_ingress_tag_matcher_t));
+    if (matcher == NULL) {
+        return NGX_ERROR;
+    }
+
+    matcher->keys = ngx_shm_array_create(ingress->pool, n_items, sizeof(ngx_ingress_tag_key_t));
+    matcher->rules = ngx_shm_array_create(ingress->pool, n_rules, sizeof(ngx_ingress_tag_compiled_rule_t));
+    matcher->values = ngx_shm_hash_create(ingress->pool, n_values,
+                                          ngx_ingress_tag_value_hash,
+                                          ngx_ingress_tag_value_compare);
+
+    if (matcher->keys == NULL || matcher->rules == NULL || matcher->values == NULL) {
+        return NGX_ERROR;
+    }
+
+    rule = 0;
+
+    for (i = 0; i < ptags->nelts; i++) {
+        tag_rule = tag_router[i].rules->elts;
+
+        for (j = 0; j < tag_router[i].rules->nelts; j++, rule++) {
+            compiled = ngx_shm_array_push(matcher->rules);
+            if (compiled == NULL) {
+                return NGX_ERROR;
+            }
+
+            compiled->service = tag_router[i].service;
+            compiled->nitems = tag_rule[j].items->nelts;
+
+            tag_item = tag_rule[j].items->elts;
+
+            for (k = 0; k < tag_rule[j].items->nelts; k++) {
+                if (tag_item[k].key.len == 0) {
+                    /* broken item, the rule can never match */
+                    continue;
+                }
+
+                key_index = ngx_ingress_tag_matcher_key_index(matcher, &tag_item[k]);
+                if (key_index == NGX_ERROR) {
+                    return NGX_ERROR;
+                }
+
+                switch (tag_item[k].match_type) {
+                case INGRESS__MATCH_TYPE__WholeMatch:
+                    if (ngx_ingress_tag_matcher_add_value(ingress, matcher, key_index,
+                            &tag_item[k].condition.value_str, rule, &tag_item[k])
+                        != NGX_OK)
+                    {
+                        return NGX_ERROR;
+                    }
+                    break;
+
+                case INGRESS__MATCH_TYPE__StrListInMatch:
+                    if (tag_item[k].condition.value_a == NULL) {
+                        break;
+                    }
+
+                    values = tag_item[k].condition.value_a->elts;
+                    for (v = 0; v < tag_item[k].condition.value_a->nelts; v++) {
+                        if (ngx_ingress_tag_matcher_add_value(ingress, matcher, key_index,
+                                &values[v], rule, &tag_item[k])
+                            != NGX_OK)
+                        {
+                            return NGX_ERROR;
+                        }
+                    }
+                    break;
+
+                case INGRESS__MATCH_TYPE__ModCompare:
+                    mod_item = ngx_shm_pool_calloc(ingress->pool,
+                                                   sizeof(ngx_ingress_tag_mod_item_t));
+                    if (mod_item == NULL) {
+                        return NGX_ERROR;
+                    }
+
+                    key = (ngx_ingress_tag_key_t *) matcher->keys->elts + key_index;
+
+                    mod_item->rule = rule;
+                    mod_item->item = &tag_item[k];
+                    mod_item->next = key->mod_items;
+                    key->mod_items = mod_item;
+                    break;
+
+                default:
+                    break;
+                }
+            }
+        }
+    }
+
+    *ppmatcher = matcher;
+
+    return NGX_OK;
+}
+
 static ngx_int_t
 ngx_ingress_update_shm_tag_routers(ngx_ingress_t *ingress,
     size_t n_tags, Ingress__TagRouter **pb_tag_routers,
-    ngx_shm_array_t **pptags)
+    ngx_ingress_tag_matcher_t **ppmatcher)
 {
     size_t                  i, j, k;
     ngx_shm_array_t        *ptags = NULL;
@@ -1107,10 +1436,14 @@ ngx_ingress_update_shm_tag_routers(ngx_ingress_t *ingress,
             }
         }
 
-        *pptags = ptags;
+        if (ngx_ingress_compile_tag_matcher(ingress, ptags, ppmatcher) != NGX_OK) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                          "|ingress|tag matcher compile failed|");
+            return NGX_ERROR;
+        }
 
     } else {
-        *pptags = NULL;
+        *ppmatcher = NULL;
     }
 
     return NGX_OK;
@@ -1230,6 +1563,15 @@ ngx_ingress_update_shm_host(
         }
     }
 
+    if (shm_host->type != INGRESS__HOST_TYPE__MCP && shm_host->paths->nelts > 0) {
+        rc = ngx_ingress_update_shm_path_map(ingress, shm_host);
+        if (rc != NGX_OK) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                          "|ingress|update path map failed|%V|", &shm_host->host);
+            return NGX_ERROR;
+        }
+    }
+
     /* Under the host granularity, different tags match routes */
     rc = ngx_ingress_update_shm_tag_routers(ingress, pbrouter->n_tags, pbrouter->tags, &shm_host->tags);
     if (rc != NGX_OK) {
@@ -1295,6 +1637,94 @@ ngx_ingress_update_shm_app(ngx_ingress_t *ingress,
     return NGX_OK;
 }
 
+static ngx_int_t
+ngx_ingress_update_shm_router(ngx_ingress_gateway_t *gateway,
+    ngx_ingress_t *ingress, Ingress__Router *pbrouter, ngx_uint_t replace)
+{
+    ngx_int_t                       rc;
+
+    if (pbrouter->host_router != NULL) {
+        Ingress__HostRouter *pb_host_router = pbrouter->host_router;
+
+        ngx_str_t wildcard_prefix = ngx_string("*.");
+        ngx_str_t remove_prefix = ngx_null_string;
+
+        ngx_ingress_host_router_t *shm_host = ngx_shm_pool_calloc(ingress->pool, sizeof(ngx_ingress_host_router_t));
+        if (shm_host == NULL) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                          "|ingress|host router alloc failed|gateway=%V|", &gateway->name);
+            return NGX_ERROR;
+        }
+
+        ngx_shm_hash_t *host_map = ingress->host_map;
+        if (pb_host_router->host != NULL
+            && ngx_strncmp(pb_host_router->host, wildcard_prefix.data, wildcard_prefix.len) == 0)
+        {
+            ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
+                          "|ingress|match wildcard|host=%s|", pb_host_router->host);
+
+            host_map = ingress->wildcard_host_map;
+            remove_prefix = wildcard_prefix;
+        }
+
+        rc = ngx_ingress_update_shm_host(gateway, ingress, shm_host, pb_host_router, &remove_prefix);
+        if (rc != NGX_OK) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                          "|ingress|update host router failed|gateway=%V|", &gateway->name);
+            return NGX_ERROR;
+        }
+
+        if (replace) {
+            ngx_shm_hash_del(host_map, shm_host);
+        }
+
+        rc = ngx_shm_hash_add(host_map, shm_host);
+        if (rc != NGX_OK) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                          "|ingress|host ngx_shm_hash_add failed|host=%V", &shm_host->host);
+            return NGX_ERROR;
+        }
+
+        ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
+                      "|ingress|host add succ|host=%V", &shm_host->host);
+    }
+
+    if (pbrouter->appname_router != NULL) {
+        Ingress__AppnameRouter *pb_appname_router = pbrouter->appname_router;      
+        
+        ngx_ingress_app_router_t *shm_app = ngx_shm_pool_calloc(ingress->pool,
+                                                                sizeof(ngx_ingress_app_router_t));
+        if (shm_app == NULL) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                          "|ingress|app router alloc failed|gateway=%V|", &gateway->name);
+            return NGX_ERROR;
+        }
+
+        rc = ngx_ingress_update_shm_app(ingress, shm_app, pb_appname_router);
+        if (rc != NGX_OK) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                          "|ingress|update app router failed|gateway=%V|", &gateway->name);
+            return NGX_ERROR;
+        }
+
+        if (replace) {
+            ngx_shm_hash_del(ingress->app_map, shm_app);
+        }
+
+        rc = ngx_shm_hash_add(ingress->app_map, shm_app);
+        if (rc != NGX_OK) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                          "|ingress|app ngx_shm_hash_add failed|host=%V", &shm_app->appname);
+            return NGX_ERROR;
+        }
+
+        ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
+                      "|ingress|app add succ|app=%V|", &shm_app->appname);
+    }
+
+    return NGX_OK;
+}
+
 ngx_int_t
 ngx_ingress_update_shm_by_pb(ngx_ingress_gateway_t *gateway, ngx_ingress_shared_memory_config_t *shm_pb_config, ngx_ingress_t *ingress)
 {
@@ -1358,76 +1788,207 @@ ngx_ingress_update_shm_by_pb(ngx_ingress_gateway_t *gateway, ngx_ingress_shared_
     Ingress__Router **pbrouter = shm_pb_config->pbconfig->routers;
 
     for (i = 0; i < shm_pb_config->pbconfig->n_routers; i++) {
-        if (pbrouter[i]->host_router != NULL) {
-            Ingress__HostRouter *pb_host_router = pbrouter[i]->host_router;
+        rc = ngx_ingress_update_shm_router(gateway, ingress, pbrouter[i], 0);
+        if (rc != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
 
-            ngx_str_t wildcard_prefix = ngx_string("*.");
-            ngx_str_t remove_prefix = ngx_null_string;
+    return NGX_OK;
+}
 
-            ngx_ingress_host_router_t *shm_host = ngx_shm_pool_calloc(ingress->pool, sizeof(ngx_ingress_host_router_t));
-            if (shm_host == NULL) {
-                ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                              "|ingress|host router alloc failed|gateway=%V|", &gateway->name);
-                return NGX_ERROR;
-            }
+/*
+ * Replace a service in place: routers keep pointing at the same
+ * ngx_ingress_service_t, only its content changes.
+ */
+static ngx_int_t
+ngx_ingress_delta_upsert_service(ngx_ingress_gateway_t *gateway,
+    ngx_ingress_t *ingress, Ingress__VirtualService *pbservice)
+{
+    ngx_int_t                rc;
+    ngx_ingress_service_t   *shm_service, *exist, key;
 
-            ngx_shm_hash_t *host_map = ingress->host_map;
-            if (pb_host_router->host != NULL
-                && ngx_strncmp(pb_host_router->host, wildcard_prefix.data, wildcard_prefix.len) == 0)
-            {
-                ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
-                              "|ingress|match wildcard|host=%s|", pb_host_router->host);
+    shm_service = ngx_shm_pool_calloc(ingress->pool, sizeof(ngx_ingress_service_t));
+    if (shm_service == NULL) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "|ingress|alloc service failed|gateway=%V|", &gateway->name);
+        return NGX_ERROR;
+    }
 
-                host_map = ingress->wildcard_host_map;
-                remove_prefix = wildcard_prefix;
-            }
+    rc = ngx_ingress_update_shm_service(ingress, shm_service, pbservice);
+    if (rc != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "|ingress|update service failed|gateway=%V|", &gateway->name);
+        return NGX_ERROR;
+    }
 
-            rc = ngx_ingress_update_shm_host(gateway, ingress, shm_host, pb_host_router, &remove_prefix);
-            if (rc != NGX_OK) {
-                ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                              "|ingress|update host router failed|gateway=%V|", &gateway->name);
-                return NGX_ERROR;
-            }
+    key.name = shm_service->name;
 
-            rc = ngx_shm_hash_add(host_map, shm_host);
-            if (rc != NGX_OK) {
-                ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                              "|ingress|host ngx_shm_hash_add failed|host=%V", &shm_host->host);
-                return NGX_ERROR;
-            }
+    exist = ngx_shm_hash_get(ingress->service_map, &key);
+    if (exist != NULL) {
+        *exist = *shm_service;
+        return NGX_OK;
+    }
 
-            ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
-                          "|ingress|host add succ|host=%V", &shm_host->host);
+    rc = ngx_shm_hash_add(ingress->service_map, shm_service);
+    if (rc != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "|ingress|service ngx_shm_hash_add failed|service=%V|", &shm_service->name);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+static void
+ngx_ingress_delta_remove_host(ngx_ingress_t *ingress, char *host)
+{
+    ngx_str_t                    wildcard_prefix = ngx_string("*.");
+    ngx_shm_hash_t              *host_map;
+    ngx_ingress_host_router_t    key;
+
+    key.host.data = (u_char *) host;
+    key.host.len = ngx_strlen(host);
+    host_map = ingress->host_map;
+
+    if (key.host.len >= wildcard_prefix.len
+        && ngx_strncmp(key.host.data, wildcard_prefix.data, wildcard_prefix.len) == 0)
+    {
+        key.host.data += wildcard_prefix.len;
+        key.host.len -= wildcard_prefix.len;
+        host_map = ingress->wildcard_host_map;
+    }
+
+    ngx_shm_hash_del(host_map, &key);
+}
+
+static ngx_int_t
+ngx_ingress_update_shm_by_delta_pb(ngx_ingress_gateway_t *gateway,
+    Ingress__ConfigDelta *pbdelta, ngx_ingress_t *ingress)
+{
+    size_t                          i;
+    ngx_int_t                       rc;
+    ngx_ingress_service_t           service_key;
+    ngx_ingress_app_router_t        app_key;
+
+    /* services first, the routers of the delta may refer to them */
+    for (i = 0; i < pbdelta->n_services; i++) {
+        rc = ngx_ingress_delta_upsert_service(gateway, ingress, pbdelta->services[i]);
+        if (rc != NGX_OK) {
+            return NGX_ERROR;
         }
+    }
 
-        if (pbrouter[i]->appname_router != NULL) {
-            Ingress__AppnameRouter *pb_appname_router = pbrouter[i]->appname_router;      
-            
-            ngx_ingress_app_router_t *shm_app = ngx_shm_pool_calloc(ingress->pool,
-                                                                    sizeof(ngx_ingress_app_router_t));
-            if (shm_app == NULL) {
-                ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                              "|ingress|app router alloc failed|gateway=%V|", &gateway->name);
-                return NGX_ERROR;
-            }
+    for (i = 0; i < pbdelta->n_routers; i++) {
+        rc = ngx_ingress_update_shm_router(gateway, ingress, pbdelta->routers[i], 1);
+        if (rc != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
 
-            rc = ngx_ingress_update_shm_app(ingress, shm_app, pb_appname_router);
-            if (rc != NGX_OK) {
-                ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                              "|ingress|update app router failed|gateway=%V|", &gateway->name);
-                return NGX_ERROR;
-            }
-            
-            rc = ngx_shm_hash_add(ingress->app_map, shm_app);
-            if (rc != NGX_OK) {
-                ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                              "|ingress|app ngx_shm_hash_add failed|host=%V", &shm_app->appname);
-                return NGX_ERROR;
-            }
+    for (i = 0; i < pbdelta->n_removed_hosts; i++) {
+        ngx_ingress_delta_remove_host(ingress, pbdelta->removed_hosts[i]);
+    }
 
-            ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
-                          "|ingress|app add succ|app=%V|", &shm_app->appname);
+    for (i = 0; i < pbdelta->n_removed_appnames; i++) {
+        app_key.appname.data = (u_char *) pbdelta->removed_appnames[i];
+        app_key.appname.len = ngx_strlen(pbdelta->removed_appnames[i]);
+
+        ngx_shm_hash_del(ingress->app_map, &app_key);
+    }
+
+    /* routers still referring to a removed service keep its old content */
+    for (i = 0; i < pbdelta->n_removed_services; i++) {
+        service_key.name.data = (u_char *) pbdelta->removed_services[i];
+        service_key.name.len = ngx_strlen(pbdelta->removed_services[i]);
+
+        ngx_shm_hash_del(ingress->service_map, &service_key);
+    }
+
+    return NGX_OK;
+}
+
+/*
+ * Patch the slot in place.  The two strategy slots alternate, so a slot
+ * is one delta behind the current one: replay the previous delta first
+ * when the slot has not seen it yet.  A slot that cannot be patched, e.g.
+ * the one left behind by a full config, is rebuilt from the last full
+ * config when the delta is based on it.  Replaced entries are not
+ * reclaimed from the shm pool, once it gets too full the slot is rebuilt
+ * the same way, or a full config is requested.
+ */
+ngx_int_t
+ngx_ingress_update_shm_by_delta(ngx_ingress_gateway_t *gateway,
+    ngx_ingress_shared_memory_config_t *shm_pb_config, ngx_ingress_t *ingress)
+{
+    uint64_t                             base;
+    ngx_int_t                            rc, replay;
+    Ingress__ConfigDelta                *pbdelta;
+    ngx_ingress_shared_memory_config_t   full;
+
+    pbdelta = shm_pb_config->pbdelta;
+    base = pbdelta->has_base_version ? pbdelta->base_version : 0;
+
+    replay = gateway->last_delta != NULL
+             && gateway->last_delta_version == base
+             && gateway->last_delta->has_base_version
+             && gateway->last_delta->base_version == ingress->version;
+
+    if ((ingress->version != base && !replay)
+        || ingress->service_map == NULL
+        || ngx_shm_pool_used_rate(ingress->pool) >= NGX_INGRESS_DELTA_MAX_USED_RATE)
+    {
+        if (gateway->last_config == NULL
+            || gateway->last_config_version != base)
+        {
+            ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                          "|ingress|delta needs full config|%V|slot=%uL|base=%uL|used_rate=%i|",
+                          &gateway->name, ingress->version, base,
+                          ngx_shm_pool_used_rate(ingress->pool));
+            return NGX_DECLINED;
         }
+
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "|ingress|delta rebuilds slot from full config|%V|slot=%uL|base=%uL|",
+                      &gateway->name, ingress->version, base);
+
+        ngx_memzero(&full, sizeof(ngx_ingress_shared_memory_config_t));
+        full.pbconfig = gateway->last_config;
+        full.version = base;
+
+        ngx_shm_pool_reset(ingress->pool);
+
+        rc = ngx_ingress_update_shm_by_pb(gateway, &full, ingress);
+        if (rc != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ingress->version = base;
+    }
+
+    if (ingress->version != base) {
+        rc = ngx_ingress_update_shm_by_delta_pb(gateway, gateway->last_delta, ingress);
+        if (rc != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ingress->version = base;
+    }
+
+    rc = ngx_ingress_update_shm_by_delta_pb(gateway, pbdelta, ingress);
+    if (rc != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /* keep the delta for the other slot */
+    if (gateway->last_delta != pbdelta) {
+        if (gateway->last_delta != NULL) {
+            ingress__config_delta__free_unpacked(gateway->last_delta, NULL);
+        }
+
+        gateway->last_delta = pbdelta;
+        gateway->last_delta_version = shm_pb_config->version;
+        shm_pb_config->pbdelta = NULL;
     }
 
     return NGX_OK;
@@ -17,6 +17,7 @@ typedef enum {
     NGX_INGRESS_SHARED_MEMORY_TYPE_EMPTY        = 0,
     NGX_INGRESS_SHARED_MEMORY_TYPE_SERVICE      = 1,
     NGX_INGRESS_SHARED_MEMORY_TYPE_SECRET       = 2,  /* ShmSecretCfg: dynamic certificate data */
+    NGX_INGRESS_SHARED_MEMORY_TYPE_DELTA        = 3,  /* ConfigDelta: patch of the previous version */
 } ngx_ingress_shared_memory_type_e;
 
 typedef enum {
@@ -27,6 +28,7 @@ typedef enum {
 typedef enum {
     NGX_INGRESS_SHARED_MEMORY_TYPE_SUCCESS      = 0,
     NGX_INGRESS_SHARED_MEMORY_TYPE_ERR          = 1,
+    NGX_INGRESS_SHARED_MEMORY_TYPE_NEED_FULL    = 2,  /* delta not applicable, write a full config */
 } ngx_ingress_shared_memory_status_e;
 
 typedef struct {
@@ -34,6 +36,7 @@ typedef struct {
     uint64_t                             version;
     u_char                               md5_digit[NGX_COMM_MD5_HEX_LEN];
     Ingress__Config                     *pbconfig;
+    Ingress__ConfigDelta                *pbdelta;
 } ngx_ingress_shared_memory_config_t;
 
 typedef struct {
@@ -109,6 +109,10 @@ ngx_http_slab_stat_buf(ngx_pool_t *pool, ngx_buf_t *b)
     ngx_slab_page_t              *page;
     ngx_slab_stat_t              *stats;
     volatile ngx_list_part_t     *part;
+#if (T_NGX_SLAB_MAGAZINE)
+    ngx_uint_t                    w, cached, hits, misses;
+    ngx_slab_magazine_slot_t     *ms;
+#endif
 
 #define NGX_SLAB_SHM_SIZE               (sizeof("* shared memory: \n") - 1)
 #define NGX_SLAB_SHM_FORMAT             "* shared memory: %V\n"
@@ -124,6 +128,10 @@ ngx_http_slab_stat_buf(ngx_pool_t *pool, ngx_buf_t *b)
     (12 * 5 + sizeof("slot:(Bytes) total: used: reqs: fails:\n") - 1)
 #define NGX_SLAB_SLOT_ENTRY_FORMAT      \
     "slot:%12z(Bytes) total:%12z used:%12z reqs:%12z fails:%12z\n"
+#define NGX_SLAB_MAGAZINE_ENTRY_SIZE    \
+    (12 * 4 + sizeof("magazine:(Bytes) cached: hits: misses:\n") - 1)
+#define NGX_SLAB_MAGAZINE_ENTRY_FORMAT  \
+    "magazine:%12z(Bytes) cached:%12z hits:%12z misses:%12z\n"
 
     pz = 0;
 
@@ -160,6 +168,9 @@ ngx_http_slab_stat_buf(ngx_pool_t *pool, ngx_buf_t *b)
 
         for (k = 0; k < n; k++) {
             pz += NGX_SLAB_SLOT_ENTRY_SIZE;
+#if (T_NGX_SLAB_MAGAZINE)
+            pz += NGX_SLAB_MAGAZINE_ENTRY_SIZE;
+#endif
         }
 
     }
@@ -215,6 +226,30 @@ ngx_http_slab_stat_buf(ngx_pool_t *pool, ngx_buf_t *b)
                 stats[k].total, stats[k].used, stats[k].reqs, stats[k].fails);
         }
 
+#if (T_NGX_SLAB_MAGAZINE)
+
+        /* the chunks cached by the workers are counted as used above */
+
+        for (k = 0; shpool->magazines && k < n; k++) {
+            cached = 0;
+            hits = 0;
+            misses = 0;
+
+            for (w = 0; w < shpool->nmagazines; w++) {
+                ms = &ngx_slab_magazine(shpool, w)->slots[k];
+
+                cached += ms->count;
+                hits += ms->hits;
+                misses += ms->misses;
+            }
+
+            p = ngx_snprintf(p, NGX_SLAB_MAGAZINE_ENTRY_SIZE,
+                NGX_SLAB_MAGAZINE_ENTRY_FORMAT,
+                1 << (k + shpool->min_shift), cached, hits, misses);
+        }
+
+#endif
+
         ngx_shmtx_unlock(&shpool->mutex);
     }
 
@@ -33,6 +33,10 @@ static void ngx_unload_module(void *data);
 #if (T_NGX_MASTER_ENV)
 static char *ngx_master_set_env(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 #endif
+#if (T_NGX_HASH_CACHE)
+static char *ngx_set_hash_cache_file(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#endif
 
 
 static ngx_conf_enum_t  ngx_debug_points[] = {
@@ -176,6 +180,24 @@ static ngx_command_t  ngx_core_commands[] = {
       NULL },
 #endif
 
+#if (T_NGX_SLAB_MAGAZINE)
+    { ngx_string("slab_magazine"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_core_conf_t, slab_magazine),
+      NULL },
+#endif
+
+#if (T_NGX_HASH_CACHE)
+    { ngx_string("hash_cache_file"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_set_hash_cache_file,
+      0,
+      0,
+      NULL },
+#endif
+
       ngx_null_command
 };
 
@@ -1213,6 +1235,10 @@ ngx_core_module_create_conf(ngx_cycle_t *cycle)
     ccf->pipe_size = NGX_CONF_UNSET_SIZE;
 #endif
 
+#if (T_NGX_SLAB_MAGAZINE)
+    ccf->slab_magazine = NGX_CONF_UNSET;
+#endif
+
     return ccf;
 }
 
@@ -1235,6 +1261,10 @@ ngx_core_module_init_conf(ngx_cycle_t *cycle, void *conf)
 #endif
     ngx_conf_init_value(ccf->debug_points, 0);
 
+#if (T_NGX_SLAB_MAGAZINE)
+    ngx_conf_init_value(ccf->slab_magazine, 0);
+#endif
+
 #if (NGX_HAVE_CPU_AFFINITY)
 
     if (!ccf->cpu_affinity_auto
@@ -1814,3 +1844,34 @@ ngx_master_set_env(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 #endif
+
+
+#if (T_NGX_HASH_CACHE)
+
+static char *
+ngx_set_hash_cache_file(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_str_t  *value, file;
+    ngx_int_t   rc;
+
+    value = cf->args->elts;
+    file = value[1];
+
+    if (ngx_conf_full_name(cf->cycle, &file, 0) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    rc = ngx_hash_cache_open(cf, &file);
+
+    if (rc == NGX_DECLINED) {
+        return "is duplicate";
+    }
+
+    if (rc != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+#endif
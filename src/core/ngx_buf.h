@@ -52,6 +52,14 @@ struct ngx_buf_s {
     unsigned         last_shadow:1;
     unsigned         temp_file:1;
 
+#if (T_NGX_SEND_ZEROCOPY)
+    /*
+     * the buf's memory is not reused until the kernel has sent it,
+     * so it may be sent with MSG_ZEROCOPY
+     */
+    unsigned         zerocopy:1;
+#endif
+
     /* STUB */ int   num;
 };
 
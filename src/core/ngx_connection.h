@@ -265,6 +265,10 @@ struct ngx_connection_s {
     ngx_thread_task_t  *sendfile_task;
 #endif
 
+#if (T_NGX_SEND_ZEROCOPY)
+    ngx_zerocopy_t     *zerocopy;
+#endif
+
 #if (T_NGX_HAVE_XUDP)
     unsigned            xudp_tx:1;
 #endif
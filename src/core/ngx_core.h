@@ -41,6 +41,10 @@ typedef struct ngx_udpv2_traffic_filter_st                  ngx_udpv2_traffic_fi
 #include <ngx_xudp_inc.h>
 #endif
 
+#if (T_NGX_SEND_ZEROCOPY)
+typedef struct ngx_zerocopy_s        ngx_zerocopy_t;
+#endif
+
 typedef void (*ngx_event_handler_pt)(ngx_event_t *ev);
 typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 
@@ -91,6 +95,7 @@ typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 #include <ngx_trie.h>
 #include <ngx_radix_tree.h>
 #include <ngx_segment_tree.h>
+#include <ngx_maglev.h>
 #include <ngx_times.h>
 #include <ngx_rwlock.h>
 #include <ngx_shmtx.h>
@@ -129,8 +134,12 @@ typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 #define ngx_max(val1, val2)  ((val1 < val2) ? (val2) : (val1))
 #define ngx_min(val1, val2)  ((val1 > val2) ? (val2) : (val1))
 
+#define NGX_CPU_SSE42        0x0001
+
 void ngx_cpuinfo(void);
 
+extern ngx_uint_t  ngx_cpu_features;
+
 #if (NGX_HAVE_OPENAT)
 #define NGX_DISABLE_SYMLINKS_OFF        0
 #define NGX_DISABLE_SYMLINKS_ON         1
@@ -767,6 +767,43 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
 
 old_shm_zone_done:
 
+#if (T_NGX_SLAB_MAGAZINE)
+
+    /* the slab magazines of all zones follow the new configuration */
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        ngx_slab_magazines_init((ngx_slab_pool_t *) shm_zone[i].shm.addr,
+                                cycle);
+    }
+
+#endif
+
+#if (T_NGX_HASH_CACHE)
+
+    /*
+     * the hash sizes are saved once the configuration is committed,
+     * and neither by "nginx -t" nor by a signaller process
+     */
+
+    if (!ngx_test_config && ngx_process <= NGX_PROCESS_MASTER) {
+        ngx_hash_cache_save(cycle);
+    }
+
+#endif
+
 
     /* close the unnecessary listening sockets */
 
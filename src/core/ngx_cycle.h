@@ -138,6 +138,10 @@ typedef struct {
     size_t pipe_size;
 #endif
 
+#if (T_NGX_SLAB_MAGAZINE)
+    ngx_int_t                 slab_magazine;
+#endif
+
 } ngx_core_conf_t;
 
 
@@ -9,6 +9,57 @@
 #include <ngx_core.h>
 
 
+#if (T_NGX_HASH_CACHE)
+
+#define NGX_HASH_CACHE_VERSION  1
+
+
+typedef struct {
+    uint32_t                 key;
+    uint32_t                 nelts;
+    uint32_t                 size;
+} ngx_hash_cache_entry_t;
+
+
+typedef struct {
+    u_char                   magic[8];
+    uint32_t                 version;
+    uint32_t                 ptr_size;
+    uint32_t                 nentries;
+    uint32_t                 reserved;
+} ngx_hash_cache_header_t;
+
+
+typedef struct {
+    ngx_str_t                name;
+    ngx_log_t               *log;
+
+    u_char                  *map;
+    size_t                   map_size;
+
+    ngx_hash_cache_entry_t  *entries;
+    ngx_uint_t               nentries;
+
+    ngx_array_t              found;
+    ngx_uint_t               hits;
+} ngx_hash_cache_t;
+
+
+static uint32_t ngx_hash_cache_key(ngx_hash_init_t *hinit,
+    ngx_hash_key_t *names, ngx_uint_t nelts);
+static ngx_uint_t ngx_hash_cache_size(uint32_t key, ngx_uint_t nelts);
+static void ngx_hash_cache_add(uint32_t key, ngx_uint_t nelts,
+    ngx_uint_t size);
+static int ngx_libc_cdecl ngx_hash_cache_cmp(const void *one,
+    const void *two);
+static void ngx_hash_cache_cleanup(void *data);
+
+
+static ngx_hash_cache_t  *ngx_hash_cache;
+
+#endif
+
+
 void *
 ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
 {
@@ -256,6 +307,9 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
     u_short         *test;
     ngx_uint_t       i, n, key, size, start, bucket_size;
     ngx_hash_elt_t  *elt, **buckets;
+#if (T_NGX_HASH_CACHE)
+    uint32_t         ckey;
+#endif
 
     if (hinit->max_size == 0) {
         ngx_log_error(NGX_LOG_EMERG, hinit->pool->log, 0,
@@ -302,6 +356,48 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
         start = hinit->max_size - 1000;
     }
 
+#if (T_NGX_HASH_CACHE)
+
+    /*
+     * the size found for the same keys and limits last time is checked
+     * first, so the search below is not needed if the keys did not change
+     */
+
+    ckey = 0;
+
+    if (ngx_hash_cache) {
+        ckey = ngx_hash_cache_key(hinit, names, nelts);
+        size = ngx_hash_cache_size(ckey, nelts);
+
+        if (size >= start && size <= hinit->max_size) {
+
+            ngx_memzero(test, size * sizeof(u_short));
+
+            for (n = 0; n < nelts; n++) {
+                if (names[n].key.data == NULL) {
+                    continue;
+                }
+
+                key = names[n].key_hash % size;
+                len = test[key] + NGX_HASH_ELT_SIZE(&names[n]);
+
+                if (len > bucket_size) {
+                    break;
+                }
+
+                test[key] = (u_short) len;
+            }
+
+            if (n == nelts) {
+                ngx_hash_cache->hits++;
+                ngx_hash_cache_add(ckey, nelts, size);
+                goto found;
+            }
+        }
+    }
+
+#endif
+
     for (size = start; size <= hinit->max_size; size++) {
 
         ngx_memzero(test, size * sizeof(u_short));
@@ -327,6 +423,12 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
             test[key] = (u_short) len;
         }
 
+#if (T_NGX_HASH_CACHE)
+        if (ngx_hash_cache) {
+            ngx_hash_cache_add(ckey, nelts, size);
+        }
+#endif
+
         goto found;
 
     next:
@@ -1011,3 +1113,351 @@ wildcard:
 
     return NGX_OK;
 }
+
+
+#if (T_NGX_HASH_CACHE)
+
+/*
+ * The hash cache keeps the sizes found by ngx_hash_init() in a file, so
+ * that the next configuration with the same keys reuses them instead of
+ * searching again, which takes most of the time of building large hashes,
+ * e.g., of server names and maps.  The file is mapped while the
+ * configuration is parsed and is written again if the sizes changed, once
+ * the new configuration is committed; it is only read by "nginx -t".
+ */
+
+ngx_int_t
+ngx_hash_cache_open(ngx_conf_t *cf, ngx_str_t *name)
+{
+    u_char                   *map;
+    ngx_fd_t                  fd;
+    ngx_file_info_t           fi;
+    ngx_hash_cache_t         *cache;
+    ngx_pool_cleanup_t       *cln;
+    ngx_hash_cache_header_t  *header;
+
+    if (ngx_hash_cache) {
+        return NGX_DECLINED;
+    }
+
+    cache = ngx_pcalloc(cf->pool, sizeof(ngx_hash_cache_t));
+    if (cache == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_array_init(&cache->found, cf->pool, 64,
+                       sizeof(ngx_hash_cache_entry_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->name = *name;
+    cache->log = cf->log;
+
+    cln->handler = ngx_hash_cache_cleanup;
+    cln->data = cache;
+
+    ngx_hash_cache = cache;
+
+    fd = ngx_open_file(name->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        if (ngx_errno != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_WARN, cf->log, ngx_errno,
+                          ngx_open_file_n " \"%s\" failed", name->data);
+        }
+
+        return NGX_OK;
+    }
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_WARN, cf->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name->data);
+        goto done;
+    }
+
+    if ((size_t) ngx_file_size(&fi) < sizeof(ngx_hash_cache_header_t)) {
+        goto invalid;
+    }
+
+    map = mmap(NULL, ngx_file_size(&fi), PROT_READ, MAP_SHARED, fd, 0);
+
+    if (map == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_WARN, cf->log, ngx_errno,
+                      "mmap(\"%s\") failed", name->data);
+        goto done;
+    }
+
+    cache->map = map;
+    cache->map_size = ngx_file_size(&fi);
+
+    header = (ngx_hash_cache_header_t *) map;
+
+    if (ngx_memcmp(header->magic, "NGXHASHC", 8) != 0
+        || header->version != NGX_HASH_CACHE_VERSION
+        || header->ptr_size != sizeof(void *)
+        || cache->map_size != sizeof(ngx_hash_cache_header_t)
+                              + header->nentries
+                                * sizeof(ngx_hash_cache_entry_t))
+    {
+        goto invalid;
+    }
+
+    cache->entries = (ngx_hash_cache_entry_t *) (map + sizeof(*header));
+    cache->nentries = header->nentries;
+
+    goto done;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_WARN, cf->log, 0,
+                  "hash cache \"%s\" is invalid, ignored", name->data);
+
+done:
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name->data);
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_hash_cache_save(ngx_cycle_t *cycle)
+{
+    u_char                   *name;
+    ngx_fd_t                  fd;
+    ngx_uint_t                i, n;
+    ngx_hash_cache_t         *cache;
+    ngx_hash_cache_entry_t   *entries;
+    ngx_hash_cache_header_t   header;
+
+    cache = ngx_hash_cache;
+
+    if (cache == NULL) {
+        return;
+    }
+
+    entries = cache->found.elts;
+    n = cache->found.nelts;
+
+    if (n) {
+        ngx_qsort(entries, n, sizeof(ngx_hash_cache_entry_t),
+                  ngx_hash_cache_cmp);
+
+        for (i = 1, n = 1; i < cache->found.nelts; i++) {
+            if (ngx_hash_cache_cmp(&entries[n - 1], &entries[i]) != 0) {
+                entries[n++] = entries[i];
+            }
+        }
+    }
+
+    ngx_log_error(NGX_LOG_INFO, cycle->log, 0,
+                  "hash cache \"%V\": %ui of %ui sizes reused",
+                  &cache->name, cache->hits, cache->found.nelts);
+
+    if (n == cache->nentries
+        && ngx_memcmp(entries, cache->entries,
+                      n * sizeof(ngx_hash_cache_entry_t))
+           == 0)
+    {
+        goto done;
+    }
+
+    /* the file is replaced at once, it may be mapped by another process */
+
+    name = ngx_pnalloc(cycle->pool, cache->name.len + sizeof(".tmp"));
+    if (name == NULL) {
+        goto done;
+    }
+
+    ngx_sprintf(name, "%V.tmp%Z", &cache->name);
+
+    fd = ngx_open_file(name, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                       NGX_FILE_DEFAULT_ACCESS);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name);
+        goto done;
+    }
+
+    ngx_memzero(&header, sizeof(ngx_hash_cache_header_t));
+
+    ngx_memcpy(header.magic, "NGXHASHC", 8);
+    header.version = NGX_HASH_CACHE_VERSION;
+    header.ptr_size = sizeof(void *);
+    header.nentries = n;
+
+    if (ngx_write_fd(fd, &header, sizeof(ngx_hash_cache_header_t))
+        != (ssize_t) sizeof(ngx_hash_cache_header_t)
+        || ngx_write_fd(fd, entries, n * sizeof(ngx_hash_cache_entry_t))
+           != (ssize_t) (n * sizeof(ngx_hash_cache_entry_t)))
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      ngx_write_fd_n " to \"%s\" failed", name);
+
+        if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", name);
+        }
+
+        if (ngx_delete_file(name) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", name);
+        }
+
+        goto done;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+    if (ngx_rename_file(name, cache->name.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%V\" failed",
+                      name, &cache->name);
+    }
+
+done:
+
+    ngx_hash_cache_cleanup(cache);
+}
+
+
+static uint32_t
+ngx_hash_cache_key(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
+    ngx_uint_t nelts)
+{
+    uint32_t    crc, v[2];
+    ngx_uint_t  n;
+
+    /* the size found depends on the hashes and the lengths of the keys */
+
+    ngx_crc32_init(crc);
+
+    ngx_crc32_update(&crc, (u_char *) hinit->name, ngx_strlen(hinit->name));
+
+    v[0] = (uint32_t) hinit->max_size;
+    v[1] = (uint32_t) hinit->bucket_size;
+
+    ngx_crc32_update(&crc, (u_char *) v, sizeof(v));
+
+    for (n = 0; n < nelts; n++) {
+        if (names[n].key.data == NULL) {
+            continue;
+        }
+
+        v[0] = (uint32_t) names[n].key_hash;
+        v[1] = (uint32_t) names[n].key.len;
+
+        ngx_crc32_update(&crc, (u_char *) v, sizeof(v));
+    }
+
+    ngx_crc32_final(crc);
+
+    return crc;
+}
+
+
+static ngx_uint_t
+ngx_hash_cache_size(uint32_t key, ngx_uint_t nelts)
+{
+    ngx_uint_t               left, right, i;
+    ngx_hash_cache_entry_t  *e;
+
+    left = 0;
+    right = ngx_hash_cache->nentries;
+
+    while (left < right) {
+        i = left + (right - left) / 2;
+        e = &ngx_hash_cache->entries[i];
+
+        if (e->key == key && e->nelts == nelts) {
+            return e->size;
+        }
+
+        if (e->key < key || (e->key == key && e->nelts < nelts)) {
+            left = i + 1;
+
+        } else {
+            right = i;
+        }
+    }
+
+    return 0;
+}
+
+
+static void
+ngx_hash_cache_add(uint32_t key, ngx_uint_t nelts, ngx_uint_t size)
+{
+    ngx_hash_cache_entry_t  *e;
+
+    e = ngx_array_push(&ngx_hash_cache->found);
+    if (e == NULL) {
+        return;
+    }
+
+    e->key = key;
+    e->nelts = (uint32_t) nelts;
+    e->size = (uint32_t) size;
+}
+
+
+static int ngx_libc_cdecl
+ngx_hash_cache_cmp(const void *one, const void *two)
+{
+    ngx_hash_cache_entry_t  *first, *second;
+
+    first = (ngx_hash_cache_entry_t *) one;
+    second = (ngx_hash_cache_entry_t *) two;
+
+    if (first->key != second->key) {
+        return first->key < second->key ? -1 : 1;
+    }
+
+    if (first->nelts != second->nelts) {
+        return first->nelts < second->nelts ? -1 : 1;
+    }
+
+    if (first->size != second->size) {
+        return first->size < second->size ? -1 : 1;
+    }
+
+    return 0;
+}
+
+
+static void
+ngx_hash_cache_cleanup(void *data)
+{
+    ngx_hash_cache_t  *cache = data;
+
+    if (cache->map) {
+        if (munmap(cache->map, cache->map_size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cache->log, ngx_errno,
+                          "munmap(\"%V\") failed", &cache->name);
+        }
+
+        cache->map = NULL;
+        cache->entries = NULL;
+        cache->nentries = 0;
+    }
+
+    if (ngx_hash_cache == cache) {
+        ngx_hash_cache = NULL;
+    }
+}
+
+#endif
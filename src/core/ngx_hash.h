@@ -121,5 +121,10 @@ ngx_int_t ngx_hash_keys_array_init(ngx_hash_keys_arrays_t *ha, ngx_uint_t type);
 ngx_int_t ngx_hash_add_key(ngx_hash_keys_arrays_t *ha, ngx_str_t *key,
     void *value, ngx_uint_t flags);
 
+#if (T_NGX_HASH_CACHE)
+ngx_int_t ngx_hash_cache_open(ngx_conf_t *cf, ngx_str_t *name);
+void ngx_hash_cache_save(ngx_cycle_t *cycle);
+#endif
+
 
 #endif /* _NGX_HASH_H_INCLUDED_ */
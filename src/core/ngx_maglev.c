@@ -0,0 +1,253 @@
+
+/*
+ * Copyright (C) 2010-2026 Alibaba Group Holding Limited
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/* a prime about a hundred times the number of entries */
+
+uint32_t
+ngx_maglev_size(ngx_uint_t n)
+{
+    ngx_uint_t  i;
+
+    static uint32_t  sizes[] = { 1021, 4093, 16381, 65521, 262139, 1048573 };
+
+    for (i = 0; i < sizeof(sizes) / sizeof(uint32_t) - 1; i++) {
+        if (sizes[i] >= n * 100) {
+            break;
+        }
+    }
+
+    return sizes[i];
+}
+
+
+/*
+ * The table is allocated from the pool, or with ngx_alloc() if there is
+ * no pool, in one block.  Without "down", the entries are never marked
+ * down, and the base table is the one in use.
+ */
+
+ngx_maglev_t *
+ngx_maglev_create(ngx_pool_t *pool, ngx_uint_t n, uint32_t size,
+    ngx_uint_t down)
+{
+    u_char        *p;
+    size_t         len;
+    ngx_maglev_t  *mg;
+
+    len = sizeof(ngx_maglev_t)
+          + n * (sizeof(void *) + sizeof(ngx_uint_t))
+          + n * 3 * sizeof(uint32_t)
+          + (down ? 3 : 1) * size * sizeof(uint32_t)
+          + n;
+
+    p = pool ? ngx_palloc(pool, len) : ngx_alloc(len, ngx_cycle->log);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    mg = (ngx_maglev_t *) p;
+    p += sizeof(ngx_maglev_t);
+
+    mg->size = size;
+    mg->number = n;
+    mg->ndown = 0;
+    mg->checked = 0;
+
+    mg->data = (void **) p;
+    p += n * sizeof(void *);
+
+    mg->weight = (ngx_uint_t *) p;
+    p += n * sizeof(ngx_uint_t);
+
+    mg->offset = (uint32_t *) p;
+    mg->skip = mg->offset + n;
+    mg->inverse = mg->skip + n;
+    mg->base = mg->inverse + n;
+
+    if (down) {
+        mg->table = mg->base + size;
+        mg->spare = mg->table + size;
+        p = (u_char *) (mg->spare + size);
+
+    } else {
+        mg->table = mg->base;
+        mg->spare = NULL;
+        p = (u_char *) (mg->base + size);
+    }
+
+    mg->down = p;
+    ngx_memzero(mg->down, n);
+
+    return mg;
+}
+
+
+void
+ngx_maglev_set(ngx_maglev_t *mg, ngx_uint_t i, void *data, uint32_t offset,
+    uint32_t skip, ngx_uint_t weight)
+{
+    uint32_t  m, c, e, r;
+
+    m = mg->size;
+
+    mg->data[i] = data;
+    mg->weight[i] = weight;
+    mg->offset[i] = offset % m;
+    mg->skip[i] = skip % (m - 1) + 1;
+
+    /* skip^(m - 2) mod m, the inverse of skip, as m is a prime */
+
+    r = 1;
+    c = mg->skip[i];
+
+    for (e = m - 2; e; e >>= 1) {
+        if (e & 1) {
+            r = (uint32_t) ((uint64_t) r * c % m);
+        }
+
+        c = (uint32_t) ((uint64_t) c * c % m);
+    }
+
+    mg->inverse[i] = r;
+}
+
+
+ngx_int_t
+ngx_maglev_populate(ngx_maglev_t *mg)
+{
+    uint32_t    m, c, filled, *next;
+    ngx_uint_t  i, n, w;
+
+    m = mg->size;
+    n = mg->number;
+
+    for (c = 0; c < m; c++) {
+        mg->base[c] = NGX_MAGLEV_NONE;
+    }
+
+    if (n == 0) {
+        goto done;
+    }
+
+    next = ngx_calloc(n * sizeof(uint32_t), ngx_cycle->log);
+    if (next == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* each entry takes the next free slot of its permutation, weight times */
+
+    filled = 0;
+
+    while (filled < m) {
+
+        for (i = 0; i < n && filled < m; i++) {
+
+            for (w = 0; w < mg->weight[i] && filled < m; w++) {
+
+                do {
+                    c = (uint32_t) ((mg->offset[i]
+                                     + (uint64_t) next[i] * mg->skip[i]) % m);
+                    next[i]++;
+
+                } while (mg->base[c] != NGX_MAGLEV_NONE);
+
+                mg->base[c] = (uint32_t) i;
+                filled++;
+            }
+        }
+    }
+
+    ngx_free(next);
+
+done:
+
+    if (mg->table != mg->base) {
+        ngx_memcpy(mg->table, mg->base, m * sizeof(uint32_t));
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * Only the slots of the entries marked down change: each one goes to the
+ * live entry that reaches it first in its permutation, relative to its
+ * weight.  The result depends on the set of down entries only, so all the
+ * workers that know the same entries to be down have the same table.
+ * The table is built aside and then replaces the one in use, and as it only
+ * uses the weights saved in ngx_maglev_set(), it is built without locks.
+ */
+
+void
+ngx_maglev_rebuild(ngx_maglev_t *mg)
+{
+    uint32_t   c, *table;
+
+    table = mg->spare;
+
+    for (c = 0; c < mg->size; c++) {
+
+        if (mg->base[c] == NGX_MAGLEV_NONE || !mg->down[mg->base[c]]) {
+            table[c] = mg->base[c];
+            continue;
+        }
+
+        table[c] = ngx_maglev_choose(mg, c, NULL, NULL);
+
+        if (table[c] == NGX_MAGLEV_NONE) {
+            table[c] = mg->base[c];
+        }
+    }
+
+    mg->spare = mg->table;
+    mg->table = table;
+}
+
+
+/*
+ * The live entry which prefers the slot most, that is, with the lowest
+ * position of the slot in its permutation relative to its weight, and
+ * not skipped by the caller.
+ */
+
+uint32_t
+ngx_maglev_choose(ngx_maglev_t *mg, uint32_t slot, ngx_maglev_skip_pt skip,
+    void *data)
+{
+    uint32_t    best, rank, best_rank;
+    ngx_uint_t  i;
+
+    best = NGX_MAGLEV_NONE;
+    best_rank = 0;
+
+    for (i = 0; i < mg->number; i++) {
+
+        if (mg->down[i]) {
+            continue;
+        }
+
+        if (skip && skip(mg, i, data)) {
+            continue;
+        }
+
+        rank = (uint32_t) ((uint64_t) (slot + mg->size - mg->offset[i])
+                           * mg->inverse[i] % mg->size);
+
+        if (best == NGX_MAGLEV_NONE
+            || (uint64_t) rank * mg->weight[best]
+               < (uint64_t) best_rank * mg->weight[i])
+        {
+            best = (uint32_t) i;
+            best_rank = rank;
+        }
+    }
+
+    return best;
+}
@@ -0,0 +1,63 @@
+
+/*
+ * Copyright (C) 2010-2026 Alibaba Group Holding Limited
+ */
+
+
+#ifndef _NGX_MAGLEV_H_INCLUDED_
+#define _NGX_MAGLEV_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_MAGLEV_NONE  ((uint32_t) -1)
+
+
+/*
+ * The maglev lookup table: every entry walks its own permutation of the
+ * table slots, given by an offset and a skip, and takes the next free slot
+ * of it, as many slots per round as its weight, until the table is full.
+ * A key is then looked up with one modulo, and removing an entry only moves
+ * the keys of its own slots.
+ *
+ * "base" is the table populated from the permutations of all the entries,
+ * "table" is the one in use, where the slots of the entries marked down
+ * are given to the live entry that prefers them most.
+ */
+
+typedef struct ngx_maglev_s  ngx_maglev_t;
+
+typedef ngx_uint_t (*ngx_maglev_skip_pt)(ngx_maglev_t *mg, ngx_uint_t i,
+    void *data);
+
+struct ngx_maglev_s {
+    uint32_t              size;
+    ngx_uint_t            number;
+    ngx_uint_t            ndown;
+    time_t                checked;
+    void                **data;
+    ngx_uint_t           *weight;
+    uint32_t             *offset;
+    uint32_t             *skip;
+    uint32_t             *inverse;
+    u_char               *down;
+    uint32_t             *base;
+    uint32_t             *table;
+    uint32_t             *spare;
+};
+
+
+uint32_t ngx_maglev_size(ngx_uint_t n);
+ngx_maglev_t *ngx_maglev_create(ngx_pool_t *pool, ngx_uint_t n, uint32_t size,
+    ngx_uint_t down);
+void ngx_maglev_set(ngx_maglev_t *mg, ngx_uint_t i, void *data,
+    uint32_t offset, uint32_t skip, ngx_uint_t weight);
+ngx_int_t ngx_maglev_populate(ngx_maglev_t *mg);
+void ngx_maglev_rebuild(ngx_maglev_t *mg);
+uint32_t ngx_maglev_choose(ngx_maglev_t *mg, uint32_t slot,
+    ngx_maglev_skip_pt skip, void *data);
+
+
+#endif /* _NGX_MAGLEV_H_INCLUDED_ */
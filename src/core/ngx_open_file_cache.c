@@ -52,6 +52,16 @@ static ngx_cached_open_file_t *
     uint32_t hash);
 static void ngx_open_file_cache_remove(ngx_event_t *ev);
 
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+static ngx_int_t ngx_open_file_shared_get(ngx_open_file_shared_t *shared,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of);
+static ngx_uint_t ngx_open_file_shared_valid(ngx_open_file_shared_t *shared,
+    ngx_str_t *name, uint32_t hash, ngx_cached_open_file_t *file,
+    ngx_uint_t valid);
+static void ngx_open_file_shared_update(ngx_open_file_shared_t *shared,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of);
+#endif
+
 
 ngx_open_file_cache_t *
 ngx_open_file_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t inactive)
@@ -73,6 +83,10 @@ ngx_open_file_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t inactive)
     cache->max = max;
     cache->inactive = inactive;
 
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+    cache->shared = NULL;
+#endif
+
     cln = ngx_pool_cleanup_add(pool, 0);
     if (cln == NULL) {
         return NULL;
@@ -147,15 +161,23 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     time_t                          now;
     uint32_t                        hash;
     ngx_int_t                       rc;
+    ngx_uint_t                      valid;
     ngx_file_info_t                 fi;
     ngx_pool_cleanup_t             *cln;
     ngx_cached_open_file_t         *file;
     ngx_pool_cleanup_file_t        *clnf;
     ngx_open_file_cache_cleanup_t  *ofcln;
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+    ngx_open_file_shared_t         *shared;
+#endif
 
     of->fd = NGX_INVALID_FILE;
     of->err = 0;
 
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+    of->shared = 0;
+#endif
+
     if (cache == NULL) {
 
         if (of->test_only) {
@@ -206,6 +228,19 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
     hash = ngx_crc32_long(name->data, name->len);
 
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+
+    shared = cache->shared;
+
+#if (NGX_HAVE_OPENAT)
+    if (of->disable_symlinks) {
+        /* the watcher tests the files with lstat() */
+        shared = NULL;
+    }
+#endif
+
+#endif
+
     file = ngx_open_file_lookup(cache, name, hash);
 
     if (file) {
@@ -218,6 +253,22 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
             /* file was not used often enough to keep open */
 
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+
+            if (of->test_only
+                && shared
+                && ngx_open_file_shared_get(shared, name, hash, of)
+                   == NGX_OK)
+            {
+                if (of->err && !of->errors) {
+                    goto failed;
+                }
+
+                goto update;
+            }
+
+#endif
+
             rc = ngx_open_and_stat_file(name, of, pool->log);
 
             if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
@@ -227,10 +278,21 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
             goto add_event;
         }
 
+        valid = (now - file->created < of->valid);
+
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+
+        if (shared) {
+            valid = ngx_open_file_shared_valid(shared, name, hash,
+                                               file, valid);
+        }
+
+#endif
+
         if (file->use_event
             || (file->event == NULL
                 && (of->uniq == 0 || of->uniq == file->uniq)
-                && now - file->created < of->valid
+                && valid
 #if (NGX_HAVE_OPENAT)
                 && of->disable_symlinks == file->disable_symlinks
                 && of->disable_symlinks_from == file->disable_symlinks_from
@@ -351,6 +413,21 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
     /* not found */
 
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+
+    if (of->test_only
+        && shared
+        && ngx_open_file_shared_get(shared, name, hash, of) == NGX_OK)
+    {
+        if (of->err && !of->errors) {
+            goto failed;
+        }
+
+        goto create;
+    }
+
+#endif
+
     rc = ngx_open_and_stat_file(name, of, pool->log);
 
     if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
@@ -396,6 +473,16 @@ add_event:
 
 update:
 
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+
+    if (shared && !of->shared) {
+        ngx_open_file_shared_update(shared, name, hash, of);
+    }
+
+    file->shared_version = 0;
+
+#endif
+
     file->fd = of->fd;
     file->err = of->err;
 #if (NGX_HAVE_OPENAT)
@@ -1251,3 +1338,1262 @@ ngx_open_file_cache_remove(ngx_event_t *ev)
     ngx_free(ev->data);
     ngx_free(ev);
 }
+
+
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+
+/*
+ * The shared open file cache keeps stat() info of files and directories
+ * for all workers.  An entry is trusted, i.e. used without stat(), once
+ * the watcher in the first worker watches every directory on its path
+ * with inotify and has checked the entry again after adding the watches.
+ * The watcher removes entries on inotify events about them or about the
+ * directories on their path, so the workers see changes at once; a file
+ * changed in place is seen once it is closed, not on every write, as the
+ * logs in the watched directories would be.  Trusted
+ * entries expire after the "valid" time anyway, for the changes inotify
+ * does not report: writes through hard links in other directories, remote
+ * file systems, etc.
+ *
+ * The version of the zone is incremented on every change which may make a
+ * trusted entry differ from a worker's copy: an entry changed or removed,
+ * or a new watcher.  A worker which found its copy the same as a trusted
+ * entry uses it without the lock while the version is unchanged.  The LRU
+ * queue is only updated once in NGX_OPEN_FILE_SHARED_TOUCH seconds on hits.
+ */
+
+
+#define NGX_OPEN_FILE_SHARED_EVENTS                                           \
+    (IN_ATTRIB|IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO   \
+     |IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR)
+
+#define NGX_OPEN_FILE_SHARED_PERIOD  100
+#define NGX_OPEN_FILE_SHARED_BATCH   1000
+#define NGX_OPEN_FILE_SHARED_TOUCH   1
+
+
+typedef struct {
+    ngx_str_node_t                 sn;
+    ngx_queue_t                    queue;
+    ngx_queue_t                    pending;
+
+    ngx_file_uniq_t                uniq;
+    time_t                         mtime;
+    time_t                         created;
+    time_t                         accessed;
+    off_t                          size;
+    off_t                          fs_size;
+    ngx_err_t                      err;
+
+    ngx_uint_t                     generation;
+
+    unsigned                       is_dir:1;
+    unsigned                       is_file:1;
+    unsigned                       is_link:1;
+    unsigned                       is_exec:1;
+    unsigned                       is_pending:1;
+
+    u_char                         name[1];
+} ngx_open_file_shared_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                   rbtree;
+    ngx_rbtree_node_t              sentinel;
+    ngx_queue_t                    queue;
+    ngx_queue_t                    pending;
+
+    /* the generation of the current watcher, 0 if there is none yet */
+    ngx_uint_t                     generation;
+
+    /* read by the workers without the lock */
+    ngx_atomic_t                   version;
+} ngx_open_file_shared_sh_t;
+
+
+/* a watch of the watcher, the same directory may be on several paths */
+
+typedef struct {
+    ngx_rbtree_node_t              node;
+    ngx_queue_t                    paths;
+} ngx_open_file_shared_watch_t;
+
+
+typedef struct {
+    ngx_str_node_t                 sn;
+    ngx_queue_t                    queue;
+    ngx_queue_t                    link;
+    ngx_open_file_shared_watch_t  *watch;
+    u_char                         name[1];
+} ngx_open_file_shared_path_t;
+
+
+struct ngx_open_file_shared_s {
+    ngx_open_file_shared_sh_t     *sh;
+    ngx_slab_pool_t               *shpool;
+    time_t                         valid;
+
+    /* the watcher */
+
+    ngx_connection_t              *connection;
+    ngx_event_t                    event;
+    ngx_uint_t                     generation;
+
+    ngx_rbtree_t                   watches;
+    ngx_rbtree_node_t              watches_sentinel;
+    ngx_rbtree_t                   paths;
+    ngx_rbtree_node_t              paths_sentinel;
+    ngx_queue_t                    paths_queue;
+
+    unsigned                       warned:1;
+};
+
+
+static ngx_int_t ngx_open_file_shared_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_uint_t ngx_open_file_shared_trusted(ngx_open_file_shared_t *shared,
+    ngx_open_file_shared_node_t *node);
+static void ngx_open_file_shared_touch(ngx_open_file_shared_t *shared,
+    ngx_open_file_shared_node_t *node);
+static void ngx_open_file_shared_delete(ngx_open_file_shared_t *shared,
+    ngx_open_file_shared_node_t *node);
+static ngx_uint_t ngx_open_file_shared_under(u_char *name, size_t len,
+    u_char *dir, size_t dlen);
+static ngx_int_t ngx_open_file_shared_reset(ngx_open_file_shared_t *shared,
+    ngx_uint_t force);
+static void ngx_open_file_shared_stop(ngx_open_file_shared_t *shared);
+static void ngx_open_file_shared_handler(ngx_event_t *ev);
+static ngx_int_t ngx_open_file_shared_check(ngx_open_file_shared_t *shared,
+    ngx_log_t *log);
+static ngx_int_t ngx_open_file_shared_test(ngx_open_file_shared_node_t *node,
+    u_char *name);
+static ngx_int_t ngx_open_file_shared_watch_dirs(
+    ngx_open_file_shared_t *shared, u_char *name, size_t len, ngx_log_t *log);
+static ngx_int_t ngx_open_file_shared_add_watch(ngx_open_file_shared_t *shared,
+    u_char *name, size_t len, ngx_log_t *log);
+static ngx_open_file_shared_path_t *ngx_open_file_shared_path(
+    ngx_open_file_shared_t *shared, u_char *name, size_t len);
+static ngx_open_file_shared_watch_t *ngx_open_file_shared_watch(
+    ngx_open_file_shared_t *shared, int wd);
+static void ngx_open_file_shared_unwatch(ngx_open_file_shared_t *shared,
+    u_char *name, size_t len);
+static void ngx_open_file_shared_read_handler(ngx_event_t *rev);
+static ngx_int_t ngx_open_file_shared_event(ngx_open_file_shared_t *shared,
+    struct inotify_event *ie, ngx_log_t *log);
+static ngx_int_t ngx_open_file_shared_invalidate(
+    ngx_open_file_shared_t *shared, u_char *name, size_t len,
+    ngx_uint_t dir);
+
+
+ngx_open_file_shared_t *
+ngx_open_file_shared_add(ngx_conf_t *cf, ngx_str_t *name, size_t size,
+    time_t valid, void *tag)
+{
+    ngx_shm_zone_t          *shm_zone;
+    ngx_open_file_shared_t  *shared;
+
+    shared = ngx_pcalloc(cf->pool, sizeof(ngx_open_file_shared_t));
+    if (shared == NULL) {
+        return NULL;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, name, size, tag);
+    if (shm_zone == NULL) {
+        return NULL;
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate zone \"%V\"", name);
+        return NULL;
+    }
+
+    shm_zone->init = ngx_open_file_shared_init_zone;
+    shm_zone->data = shared;
+
+    shared->valid = valid;
+
+    return shared;
+}
+
+
+static ngx_int_t
+ngx_open_file_shared_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_open_file_shared_t  *oshared = data;
+
+    size_t                   len;
+    ngx_open_file_shared_t  *shared;
+
+    shared = shm_zone->data;
+
+    if (oshared) {
+        shared->sh = oshared->sh;
+        shared->shpool = oshared->shpool;
+        return NGX_OK;
+    }
+
+    shared->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shared->sh = shared->shpool->data;
+        return NGX_OK;
+    }
+
+    shared->sh = ngx_slab_alloc(shared->shpool,
+                                sizeof(ngx_open_file_shared_sh_t));
+    if (shared->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shared->shpool->data = shared->sh;
+
+    ngx_rbtree_init(&shared->sh->rbtree, &shared->sh->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&shared->sh->queue);
+    ngx_queue_init(&shared->sh->pending);
+
+    shared->sh->generation = 0;
+    shared->sh->version = 1;
+
+    len = sizeof(" in open file cache zone \"\"") + shm_zone->shm.name.len;
+
+    shared->shpool->log_ctx = ngx_slab_alloc(shared->shpool, len);
+    if (shared->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shared->shpool->log_ctx, " in open file cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* the least recently used entries are removed if the zone is full */
+
+    shared->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_open_file_shared_get(ngx_open_file_shared_t *shared, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of)
+{
+    ngx_int_t                     rc;
+    ngx_open_file_shared_node_t  *node;
+
+    rc = NGX_DECLINED;
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    node = (ngx_open_file_shared_node_t *)
+               ngx_str_rbtree_lookup(&shared->sh->rbtree, name, hash);
+
+    if (node && ngx_open_file_shared_trusted(shared, node)) {
+
+        of->err = node->err;
+
+        if (node->err) {
+            of->failed = ngx_file_info_n;
+
+        } else {
+            of->uniq = node->uniq;
+            of->mtime = node->mtime;
+            of->size = node->size;
+            of->fs_size = node->fs_size;
+
+            of->is_dir = node->is_dir;
+            of->is_file = node->is_file;
+            of->is_link = node->is_link;
+            of->is_exec = node->is_exec;
+            of->is_directio = 0;
+        }
+
+        of->shared = 1;
+
+        ngx_open_file_shared_touch(shared, node);
+
+        rc = NGX_OK;
+    }
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "shared open file: \"%V\" %i", name, rc);
+
+    return rc;
+}
+
+
+/*
+ * a file cached by a worker is valid if it is the same as a trusted entry,
+ * a changed or removed entry makes the worker test the file again, and an
+ * entry which is not trusted yet leaves it to the worker's own validity time
+ */
+
+static ngx_uint_t
+ngx_open_file_shared_valid(ngx_open_file_shared_t *shared, ngx_str_t *name,
+    uint32_t hash, ngx_cached_open_file_t *file, ngx_uint_t valid)
+{
+    ngx_open_file_shared_node_t  *node;
+
+    /* nothing has changed since the file was found the same as the entry */
+
+    if (file->shared_version
+        && file->shared_version == shared->sh->version
+        && ngx_time() < file->shared_expire)
+    {
+        return 1;
+    }
+
+    file->shared_version = 0;
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    node = (ngx_open_file_shared_node_t *)
+               ngx_str_rbtree_lookup(&shared->sh->rbtree, name, hash);
+
+    if (node == NULL
+        || node->err != file->err
+        || (file->err == 0
+            && (node->uniq != file->uniq
+                || node->mtime != file->mtime
+                || node->size != file->size
+                || node->is_dir != file->is_dir)))
+    {
+        valid = 0;
+
+    } else if (ngx_open_file_shared_trusted(shared, node)) {
+        valid = 1;
+
+        file->shared_version = shared->sh->version;
+        file->shared_expire = node->created + shared->valid;
+
+        ngx_open_file_shared_touch(shared, node);
+    }
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    return valid;
+}
+
+
+static void
+ngx_open_file_shared_update(ngx_open_file_shared_t *shared, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of)
+{
+    ngx_uint_t                    n;
+    ngx_queue_t                  *q;
+    ngx_open_file_shared_sh_t    *sh;
+    ngx_open_file_shared_node_t  *node;
+
+    if (name->len > NGX_MAX_PATH) {
+        return;
+    }
+
+    sh = shared->sh;
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    node = (ngx_open_file_shared_node_t *)
+               ngx_str_rbtree_lookup(&sh->rbtree, name, hash);
+
+    if (node) {
+
+        if (node->err == of->err
+            && (of->err
+                || (node->uniq == of->uniq
+                    && node->mtime == of->mtime
+                    && node->size == of->size
+                    && node->is_dir == of->is_dir)))
+        {
+            /* tested again, still the same and watched if it was */
+
+            node->created = ngx_time();
+
+            ngx_queue_remove(&node->queue);
+            ngx_queue_insert_head(&sh->queue, &node->queue);
+
+            ngx_shmtx_unlock(&shared->shpool->mutex);
+            return;
+        }
+
+        ngx_queue_remove(&node->queue);
+
+        /* the entry is changed, the workers compare their copies again */
+
+        sh->version++;
+
+    } else {
+
+        for (n = 0; n < 8; n++) {
+            node = ngx_slab_alloc_locked(shared->shpool,
+                                         sizeof(ngx_open_file_shared_node_t)
+                                         + name->len);
+            if (node) {
+                break;
+            }
+
+            if (ngx_queue_empty(&sh->queue)) {
+                break;
+            }
+
+            q = ngx_queue_last(&sh->queue);
+
+            ngx_open_file_shared_delete(shared,
+                    ngx_queue_data(q, ngx_open_file_shared_node_t, queue));
+        }
+
+        if (node == NULL) {
+            ngx_shmtx_unlock(&shared->shpool->mutex);
+            return;
+        }
+
+        ngx_memcpy(node->name, name->data, name->len);
+        node->name[name->len] = '\0';
+
+        node->sn.node.key = hash;
+        node->sn.str.len = name->len;
+        node->sn.str.data = node->name;
+
+        ngx_rbtree_insert(&sh->rbtree, &node->sn.node);
+
+        node->is_pending = 0;
+    }
+
+    node->err = of->err;
+    node->uniq = of->uniq;
+    node->mtime = of->mtime;
+    node->size = of->size;
+    node->fs_size = of->fs_size;
+
+    node->is_dir = of->is_dir;
+    node->is_file = of->is_file;
+    node->is_link = of->is_link;
+    node->is_exec = of->is_exec;
+
+    node->created = ngx_time();
+    node->accessed = node->created;
+    node->generation = 0;
+
+    ngx_queue_insert_head(&sh->queue, &node->queue);
+
+    if (!node->is_pending) {
+        ngx_queue_insert_head(&sh->pending, &node->pending);
+        node->is_pending = 1;
+    }
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+}
+
+
+static ngx_uint_t
+ngx_open_file_shared_trusted(ngx_open_file_shared_t *shared,
+    ngx_open_file_shared_node_t *node)
+{
+    return node->generation
+           && node->generation == shared->sh->generation
+           && ngx_time() - node->created < shared->valid;
+}
+
+
+static void
+ngx_open_file_shared_touch(ngx_open_file_shared_t *shared,
+    ngx_open_file_shared_node_t *node)
+{
+    time_t  now;
+
+    now = ngx_time();
+
+    if (now - node->accessed < NGX_OPEN_FILE_SHARED_TOUCH) {
+        return;
+    }
+
+    node->accessed = now;
+
+    ngx_queue_remove(&node->queue);
+    ngx_queue_insert_head(&shared->sh->queue, &node->queue);
+}
+
+
+static void
+ngx_open_file_shared_delete(ngx_open_file_shared_t *shared,
+    ngx_open_file_shared_node_t *node)
+{
+    shared->sh->version++;
+
+    ngx_rbtree_delete(&shared->sh->rbtree, &node->sn.node);
+
+    ngx_queue_remove(&node->queue);
+
+    if (node->is_pending) {
+        ngx_queue_remove(&node->pending);
+    }
+
+    ngx_slab_free_locked(shared->shpool, node);
+}
+
+
+/* the name is in the directory or deeper */
+
+static ngx_uint_t
+ngx_open_file_shared_under(u_char *name, size_t len, u_char *dir,
+    size_t dlen)
+{
+    if (dlen == 1) {
+        return len > 1 && name[0] == '/';
+    }
+
+    return len > dlen
+           && name[dlen] == '/'
+           && ngx_memcmp(name, dir, dlen) == 0;
+}
+
+
+ngx_int_t
+ngx_open_file_shared_init_process(ngx_cycle_t *cycle,
+    ngx_open_file_shared_t *shared)
+{
+    int                fd;
+    ngx_connection_t  *c;
+
+    /* the first worker watches the files */
+
+    if (ngx_process != NGX_PROCESS_SINGLE
+        && (ngx_process != NGX_PROCESS_WORKER || ngx_worker != 0))
+    {
+        return NGX_OK;
+    }
+
+    fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+
+    if (fd == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "inotify_init1() failed");
+        return NGX_OK;
+    }
+
+    c = ngx_get_connection(fd, cycle->log);
+
+    if (c == NULL) {
+        if (close(fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "inotify close() failed");
+        }
+
+        return NGX_OK;
+    }
+
+    c->data = shared;
+
+    /* closed on graceful shutdown, as idle connections are */
+    c->idle = 1;
+
+    c->read->handler = ngx_open_file_shared_read_handler;
+    c->read->log = cycle->log;
+    c->write->log = cycle->log;
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_close_connection(c);
+        return NGX_OK;
+    }
+
+    shared->connection = c;
+
+    ngx_rbtree_init(&shared->watches, &shared->watches_sentinel,
+                    ngx_rbtree_insert_value);
+    ngx_rbtree_init(&shared->paths, &shared->paths_sentinel,
+                    ngx_str_rbtree_insert_value);
+    ngx_queue_init(&shared->paths_queue);
+
+    (void) ngx_open_file_shared_reset(shared, 1);
+
+    shared->event.handler = ngx_open_file_shared_handler;
+    shared->event.data = shared;
+    shared->event.log = cycle->log;
+    shared->event.cancelable = 1;
+
+    ngx_add_timer(&shared->event, NGX_OPEN_FILE_SHARED_PERIOD);
+
+    return NGX_OK;
+}
+
+
+/*
+ * a new generation of the watcher: the entries of the previous watcher are
+ * not trusted any more and are checked again
+ */
+
+static ngx_int_t
+ngx_open_file_shared_reset(ngx_open_file_shared_t *shared, ngx_uint_t force)
+{
+    ngx_queue_t                  *q;
+    ngx_open_file_shared_sh_t    *sh;
+    ngx_open_file_shared_node_t  *node;
+
+    sh = shared->sh;
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    if (!force && sh->generation != shared->generation) {
+        ngx_shmtx_unlock(&shared->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    shared->generation = ++sh->generation;
+    sh->version++;
+
+    for (q = ngx_queue_head(&sh->queue);
+         q != ngx_queue_sentinel(&sh->queue);
+         q = ngx_queue_next(q))
+    {
+        node = ngx_queue_data(q, ngx_open_file_shared_node_t, queue);
+
+        if (!node->is_pending) {
+            ngx_queue_insert_tail(&sh->pending, &node->pending);
+            node->is_pending = 1;
+        }
+    }
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "shared open file watcher generation: %ui",
+                   shared->generation);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_open_file_shared_stop(ngx_open_file_shared_t *shared)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "shared open file watcher stop");
+
+    if (shared->event.timer_set) {
+        ngx_del_timer(&shared->event);
+    }
+
+    if (shared->connection) {
+        ngx_close_connection(shared->connection);
+        shared->connection = NULL;
+    }
+
+    ngx_open_file_shared_unwatch(shared, NULL, 0);
+}
+
+
+static void
+ngx_open_file_shared_handler(ngx_event_t *ev)
+{
+    ngx_open_file_shared_t  *shared;
+
+    shared = ev->data;
+
+    if (ngx_open_file_shared_check(shared, ev->log) != NGX_OK) {
+        ngx_open_file_shared_stop(shared);
+        return;
+    }
+
+    ngx_add_timer(ev, NGX_OPEN_FILE_SHARED_PERIOD);
+}
+
+
+/*
+ * the entries added or changed by the workers: the directories on the path
+ * are watched first, then the entry is tested again, so no change between
+ * the test of the worker and the watches is missed
+ */
+
+static ngx_int_t
+ngx_open_file_shared_check(ngx_open_file_shared_t *shared, ngx_log_t *log)
+{
+    size_t                        len;
+    uint32_t                      hash;
+    ngx_int_t                     rc;
+    ngx_str_t                     name;
+    ngx_uint_t                    n;
+    ngx_queue_t                  *q;
+    ngx_open_file_shared_sh_t    *sh;
+    ngx_open_file_shared_node_t  *node, test;
+    u_char                        buf[NGX_MAX_PATH + 1];
+
+    sh = shared->sh;
+
+    for (n = 0; n < NGX_OPEN_FILE_SHARED_BATCH; n++) {
+
+        ngx_shmtx_lock(&shared->shpool->mutex);
+
+        if (sh->generation != shared->generation) {
+            ngx_shmtx_unlock(&shared->shpool->mutex);
+            return NGX_DECLINED;
+        }
+
+        if (ngx_queue_empty(&sh->pending)) {
+            ngx_shmtx_unlock(&shared->shpool->mutex);
+            return NGX_OK;
+        }
+
+        q = ngx_queue_last(&sh->pending);
+        ngx_queue_remove(q);
+
+        node = ngx_queue_data(q, ngx_open_file_shared_node_t, pending);
+        node->is_pending = 0;
+
+        test = *node;
+
+        len = node->sn.str.len;
+        hash = node->sn.node.key;
+
+        ngx_memcpy(buf, node->name, len);
+        buf[len] = '\0';
+
+        ngx_shmtx_unlock(&shared->shpool->mutex);
+
+        rc = ngx_open_file_shared_watch_dirs(shared, buf, len, log);
+
+        if (rc == NGX_OK) {
+            rc = ngx_open_file_shared_test(&test, buf);
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                       "shared open file check: \"%s\" %i", buf, rc);
+
+        name.len = len;
+        name.data = buf;
+
+        ngx_shmtx_lock(&shared->shpool->mutex);
+
+        if (sh->generation != shared->generation) {
+            ngx_shmtx_unlock(&shared->shpool->mutex);
+            return NGX_DECLINED;
+        }
+
+        node = (ngx_open_file_shared_node_t *)
+                   ngx_str_rbtree_lookup(&sh->rbtree, &name, hash);
+
+        /* the entry may have been changed by a worker meanwhile */
+
+        if (node
+            && !node->is_pending
+            && node->err == test.err
+            && node->uniq == test.uniq
+            && node->mtime == test.mtime
+            && node->size == test.size
+            && node->is_dir == test.is_dir)
+        {
+            if (rc == NGX_OK) {
+                node->generation = shared->generation;
+
+            } else if (rc == NGX_ERROR) {
+                ngx_open_file_shared_delete(shared, node);
+            }
+
+            /* NGX_DECLINED: cannot be watched, the entry is not trusted */
+        }
+
+        ngx_shmtx_unlock(&shared->shpool->mutex);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_open_file_shared_test(ngx_open_file_shared_node_t *node, u_char *name)
+{
+    ngx_file_info_t  fi;
+
+    /* symbolic links are not trusted, their targets are not watched */
+
+    if (ngx_link_info(name, &fi) == NGX_FILE_ERROR) {
+        return (node->err == ngx_errno) ? NGX_OK : NGX_ERROR;
+    }
+
+    if (ngx_is_link(&fi)) {
+        return NGX_DECLINED;
+    }
+
+    if (node->err == 0
+        && node->uniq == ngx_file_uniq(&fi)
+        && node->mtime == ngx_file_mtime(&fi)
+        && node->size == ngx_file_size(&fi)
+        && node->is_dir == (ngx_is_dir(&fi) != 0))
+    {
+        return NGX_OK;
+    }
+
+    return NGX_ERROR;
+}
+
+
+/*
+ * every directory on the path is watched, so that renaming any of them
+ * or replacing a symbolic link is seen as well
+ */
+
+static ngx_int_t
+ngx_open_file_shared_watch_dirs(ngx_open_file_shared_t *shared, u_char *name,
+    size_t len, ngx_log_t *log)
+{
+    size_t  n, plen;
+
+    /* the directory of the file */
+
+    for (n = len; n && name[n - 1] != '/'; n--) { /* void */ }
+
+    if (n == 0) {
+        return NGX_DECLINED;
+    }
+
+    plen = (n == 1) ? 1 : n - 1;
+
+    /* the deepest directory watched, the ones above it are watched too */
+
+    n = plen;
+
+    while (ngx_open_file_shared_path(shared, name, n) == NULL) {
+
+        if (n == 1) {
+            n = 0;
+            break;
+        }
+
+        while (--n && name[n] != '/') { /* void */ }
+
+        if (n == 0) {
+            n = 1;
+        }
+    }
+
+    /* the directories below it, from the top */
+
+    while (n < plen) {
+
+        if (n == 0) {
+            n = 1;
+
+        } else {
+            for (n++; n < plen && name[n] != '/'; n++) { /* void */ }
+        }
+
+        if (ngx_open_file_shared_add_watch(shared, name, n, log) != NGX_OK) {
+            return NGX_DECLINED;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_open_file_shared_add_watch(ngx_open_file_shared_t *shared, u_char *name,
+    size_t len, ngx_log_t *log)
+{
+    int                            wd;
+    u_char                         c;
+    ngx_err_t                      err;
+    ngx_open_file_shared_path_t   *path;
+    ngx_open_file_shared_watch_t  *watch;
+
+    c = name[len];
+    name[len] = '\0';
+
+    wd = inotify_add_watch(shared->connection->fd, (char *) name,
+                           NGX_OPEN_FILE_SHARED_EVENTS);
+
+    if (wd == -1) {
+        err = ngx_errno;
+
+        if (err == NGX_ENOENT || err == NGX_ENOTDIR || err == NGX_EACCES
+            || shared->warned)
+        {
+            ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, err,
+                           "inotify_add_watch(\"%s\") failed", name);
+
+        } else {
+            ngx_log_error(NGX_LOG_WARN, log, err,
+                          "inotify_add_watch(\"%s\") failed, "
+                          "such files are not cached in shared memory", name);
+            shared->warned = 1;
+        }
+
+        name[len] = c;
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "inotify_add_watch(\"%s\"): %d", name, wd);
+
+    name[len] = c;
+
+    watch = ngx_open_file_shared_watch(shared, wd);
+
+    if (watch == NULL) {
+        watch = ngx_alloc(sizeof(ngx_open_file_shared_watch_t), log);
+        if (watch == NULL) {
+            (void) inotify_rm_watch(shared->connection->fd, wd);
+            return NGX_ERROR;
+        }
+
+        watch->node.key = wd;
+        ngx_queue_init(&watch->paths);
+
+        ngx_rbtree_insert(&shared->watches, &watch->node);
+    }
+
+    path = ngx_alloc(sizeof(ngx_open_file_shared_path_t) + len, log);
+    if (path == NULL) {
+        if (ngx_queue_empty(&watch->paths)) {
+            (void) inotify_rm_watch(shared->connection->fd, wd);
+            ngx_rbtree_delete(&shared->watches, &watch->node);
+            ngx_free(watch);
+        }
+
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(path->name, name, len);
+    path->name[len] = '\0';
+
+    path->sn.node.key = ngx_crc32_long(name, len);
+    path->sn.str.len = len;
+    path->sn.str.data = path->name;
+    path->watch = watch;
+
+    ngx_rbtree_insert(&shared->paths, &path->sn.node);
+    ngx_queue_insert_tail(&shared->paths_queue, &path->queue);
+    ngx_queue_insert_tail(&watch->paths, &path->link);
+
+    return NGX_OK;
+}
+
+
+static ngx_open_file_shared_path_t *
+ngx_open_file_shared_path(ngx_open_file_shared_t *shared, u_char *name,
+    size_t len)
+{
+    ngx_str_t  str;
+
+    str.len = len;
+    str.data = name;
+
+    return (ngx_open_file_shared_path_t *)
+               ngx_str_rbtree_lookup(&shared->paths, &str,
+                                     ngx_crc32_long(name, len));
+}
+
+
+static ngx_open_file_shared_watch_t *
+ngx_open_file_shared_watch(ngx_open_file_shared_t *shared, int wd)
+{
+    ngx_rbtree_key_t    key;
+    ngx_rbtree_node_t  *node, *sentinel;
+
+    key = wd;
+
+    node = shared->watches.root;
+    sentinel = shared->watches.sentinel;
+
+    while (node != sentinel) {
+
+        if (key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        return (ngx_open_file_shared_watch_t *) node;
+    }
+
+    return NULL;
+}
+
+
+/* stops watching the directory and the ones below it, or all if no name */
+
+static void
+ngx_open_file_shared_unwatch(ngx_open_file_shared_t *shared, u_char *name,
+    size_t len)
+{
+    ngx_queue_t                   *q, *next;
+    ngx_open_file_shared_path_t   *path;
+    ngx_open_file_shared_watch_t  *watch;
+
+    for (q = ngx_queue_head(&shared->paths_queue);
+         q != ngx_queue_sentinel(&shared->paths_queue);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+
+        path = ngx_queue_data(q, ngx_open_file_shared_path_t, queue);
+
+        if (name
+            && !(path->sn.str.len == len
+                 && ngx_memcmp(path->name, name, len) == 0)
+            && !ngx_open_file_shared_under(path->name, path->sn.str.len,
+                                           name, len))
+        {
+            continue;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                       "shared open file unwatch: \"%s\"", path->name);
+
+        watch = path->watch;
+
+        ngx_rbtree_delete(&shared->paths, &path->sn.node);
+        ngx_queue_remove(&path->queue);
+        ngx_queue_remove(&path->link);
+        ngx_free(path);
+
+        if (ngx_queue_empty(&watch->paths)) {
+
+            if (shared->connection) {
+                (void) inotify_rm_watch(shared->connection->fd,
+                                        (int) watch->node.key);
+            }
+
+            ngx_rbtree_delete(&shared->watches, &watch->node);
+            ngx_free(watch);
+        }
+    }
+}
+
+
+static void
+ngx_open_file_shared_read_handler(ngx_event_t *rev)
+{
+    u_char                  *p, *last;
+    ssize_t                  n;
+    ngx_err_t                err;
+    ngx_connection_t        *c;
+    struct inotify_event    *ie;
+    ngx_open_file_shared_t  *shared;
+
+    /* aligned for struct inotify_event */
+    uint32_t                 buf[1024];
+
+    c = rev->data;
+    shared = c->data;
+
+    if (c->close) {
+        ngx_open_file_shared_stop(shared);
+        return;
+    }
+
+    for ( ;; ) {
+
+        n = read(c->fd, buf, sizeof(buf));
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EAGAIN) {
+                break;
+            }
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            ngx_log_error(NGX_LOG_ALERT, rev->log, err,
+                          "inotify read() failed");
+            ngx_open_file_shared_stop(shared);
+            return;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        p = (u_char *) buf;
+        last = p + n;
+
+        while (p < last) {
+            ie = (struct inotify_event *) p;
+
+            if (ngx_open_file_shared_event(shared, ie, rev->log) != NGX_OK) {
+                ngx_open_file_shared_stop(shared);
+                return;
+            }
+
+            p += sizeof(struct inotify_event) + ie->len;
+        }
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_open_file_shared_stop(shared);
+    }
+}
+
+
+static ngx_int_t
+ngx_open_file_shared_event(ngx_open_file_shared_t *shared,
+    struct inotify_event *ie, ngx_log_t *log)
+{
+    size_t                         len, n;
+    ngx_queue_t                   *q;
+    ngx_open_file_shared_path_t   *path;
+    ngx_open_file_shared_watch_t  *watch;
+    u_char                         buf[NGX_MAX_PATH + 1];
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, log, 0,
+                   "inotify event: wd:%d mask:%uxD \"%s\"",
+                   ie->wd, ie->mask, ie->len ? ie->name : "");
+
+    if (ie->mask & IN_Q_OVERFLOW) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "inotify event queue overflow, "
+                      "shared open file cache entries are checked again");
+
+        ngx_open_file_shared_unwatch(shared, NULL, 0);
+
+        return ngx_open_file_shared_reset(shared, 0);
+    }
+
+    if (ie->len == 0) {
+
+        /*
+         * the watched directory itself was removed, renamed, changed, etc.:
+         * nothing below it is trusted and it is watched again if needed
+         */
+
+        while ((watch = ngx_open_file_shared_watch(shared, ie->wd))) {
+
+            q = ngx_queue_head(&watch->paths);
+            path = ngx_queue_data(q, ngx_open_file_shared_path_t, link);
+
+            len = path->sn.str.len;
+            ngx_memcpy(buf, path->name, len);
+
+            if (ngx_open_file_shared_invalidate(shared, buf, len, 1)
+                != NGX_OK)
+            {
+                return NGX_DECLINED;
+            }
+
+            ngx_open_file_shared_unwatch(shared, buf, len);
+        }
+
+        return NGX_OK;
+    }
+
+    n = ngx_strlen(ie->name);
+
+again:
+
+    watch = ngx_open_file_shared_watch(shared, ie->wd);
+
+    if (watch == NULL) {
+        return NGX_OK;
+    }
+
+    for (q = ngx_queue_head(&watch->paths);
+         q != ngx_queue_sentinel(&watch->paths);
+         q = ngx_queue_next(q))
+    {
+        path = ngx_queue_data(q, ngx_open_file_shared_path_t, link);
+
+        len = path->sn.str.len;
+
+        if (len + 1 + n > NGX_MAX_PATH) {
+            continue;
+        }
+
+        ngx_memcpy(buf, path->name, len);
+
+        if (len != 1) {
+            buf[len++] = '/';
+        }
+
+        ngx_memcpy(buf + len, ie->name, n);
+        len += n;
+
+        if (ngx_open_file_shared_path(shared, buf, len) == NULL) {
+
+            if (ngx_open_file_shared_invalidate(shared, buf, len, 0)
+                != NGX_OK)
+            {
+                return NGX_DECLINED;
+            }
+
+            continue;
+        }
+
+        /* a watched directory on the path of other entries */
+
+        if (ngx_open_file_shared_invalidate(shared, buf, len, 1) != NGX_OK) {
+            return NGX_DECLINED;
+        }
+
+        ngx_open_file_shared_unwatch(shared, buf, len);
+
+        goto again;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_open_file_shared_invalidate(ngx_open_file_shared_t *shared, u_char *name,
+    size_t len, ngx_uint_t dir)
+{
+    ngx_str_t                     str;
+    ngx_queue_t                  *q, *next;
+    ngx_open_file_shared_sh_t    *sh;
+    ngx_open_file_shared_node_t  *node;
+
+    sh = shared->sh;
+
+    str.len = len;
+    str.data = name;
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    if (sh->generation != shared->generation) {
+        ngx_shmtx_unlock(&shared->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    node = (ngx_open_file_shared_node_t *)
+               ngx_str_rbtree_lookup(&sh->rbtree, &str,
+                                     ngx_crc32_long(name, len));
+
+    if (node) {
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                       "shared open file invalidate: \"%V\"", &str);
+
+        ngx_open_file_shared_delete(shared, node);
+    }
+
+    if (dir) {
+
+        for (q = ngx_queue_head(&sh->queue);
+             q != ngx_queue_sentinel(&sh->queue);
+             q = next)
+        {
+            next = ngx_queue_next(q);
+
+            node = ngx_queue_data(q, ngx_open_file_shared_node_t, queue);
+
+            if (ngx_open_file_shared_under(node->name, node->sn.str.len,
+                                           name, len))
+            {
+                ngx_open_file_shared_delete(shared, node);
+            }
+        }
+    }
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    return NGX_OK;
+}
+
+#endif
@@ -48,6 +48,10 @@ typedef struct {
     unsigned                 is_link:1;
     unsigned                 is_exec:1;
     unsigned                 is_directio:1;
+
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+    unsigned                 shared:1;
+#endif
 } ngx_open_file_info_t;
 
 
@@ -85,9 +89,19 @@ struct ngx_cached_open_file_s {
     unsigned                 is_directio:1;
 
     ngx_event_t             *event;
+
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+    ngx_atomic_uint_t        shared_version;
+    time_t                   shared_expire;
+#endif
 };
 
 
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+typedef struct ngx_open_file_shared_s  ngx_open_file_shared_t;
+#endif
+
+
 typedef struct {
     ngx_rbtree_t             rbtree;
     ngx_rbtree_node_t        sentinel;
@@ -96,6 +110,10 @@ typedef struct {
     ngx_uint_t               current;
     ngx_uint_t               max;
     time_t                   inactive;
+
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+    ngx_open_file_shared_t  *shared;
+#endif
 } ngx_open_file_cache_t;
 
 
@@ -125,5 +143,12 @@ ngx_open_file_cache_t *ngx_open_file_cache_init(ngx_pool_t *pool,
 ngx_int_t ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_pool_t *pool);
 
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+ngx_open_file_shared_t *ngx_open_file_shared_add(ngx_conf_t *cf,
+    ngx_str_t *name, size_t size, time_t valid, void *tag);
+ngx_int_t ngx_open_file_shared_init_process(ngx_cycle_t *cycle,
+    ngx_open_file_shared_t *shared);
+#endif
+
 
 #endif /* _NGX_OPEN_FILE_CACHE_H_INCLUDED_ */
@@ -69,12 +69,23 @@
 
 #endif
 
+static void *ngx_slab_do_alloc(ngx_slab_pool_t *pool, size_t size);
+static void ngx_slab_do_free(ngx_slab_pool_t *pool, void *p);
 static ngx_slab_page_t *ngx_slab_alloc_pages(ngx_slab_pool_t *pool,
     ngx_uint_t pages);
 static void ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
     ngx_uint_t pages);
 static void ngx_slab_error(ngx_slab_pool_t *pool, ngx_uint_t level,
     char *text);
+#if (T_NGX_SLAB_MAGAZINE)
+static ngx_slab_magazine_t *ngx_slab_get_magazine(ngx_slab_pool_t *pool,
+    ngx_uint_t locked);
+static ngx_int_t ngx_slab_magazine_alloc(ngx_slab_pool_t *pool, size_t size,
+    ngx_uint_t locked, void **p);
+static ngx_int_t ngx_slab_magazine_free(ngx_slab_pool_t *pool, void *p,
+    ngx_uint_t locked);
+static ngx_uint_t ngx_slab_magazines_drain(ngx_slab_pool_t *pool);
+#endif
 
 
 static ngx_uint_t  ngx_slab_max_size;
@@ -162,6 +173,12 @@ ngx_slab_init(ngx_slab_pool_t *pool)
     pool->log_nomem = 1;
     pool->log_ctx = &pool->zero;
     pool->zero = '\0';
+
+#if (T_NGX_SLAB_MAGAZINE)
+    pool->magazines = NULL;
+    pool->nmagazines = 0;
+    pool->magazine = 0;
+#endif
 }
 
 
@@ -170,9 +187,15 @@ ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 {
     void  *p;
 
+#if (T_NGX_SLAB_MAGAZINE)
+    if (ngx_slab_magazine_alloc(pool, size, 0, &p) == NGX_OK) {
+        return p;
+    }
+#endif
+
     ngx_shmtx_lock(&pool->mutex);
 
-    p = ngx_slab_alloc_locked(pool, size);
+    p = ngx_slab_do_alloc(pool, size);
 
     ngx_shmtx_unlock(&pool->mutex);
 
@@ -182,6 +205,21 @@ ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 
 void *
 ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
+{
+#if (T_NGX_SLAB_MAGAZINE)
+    void  *p;
+
+    if (ngx_slab_magazine_alloc(pool, size, 1, &p) == NGX_OK) {
+        return p;
+    }
+#endif
+
+    return ngx_slab_do_alloc(pool, size);
+}
+
+
+static void *
+ngx_slab_do_alloc(ngx_slab_pool_t *pool, size_t size)
 {
     size_t            s;
     uintptr_t         p, m, mask, *bitmap;
@@ -422,6 +460,18 @@ ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size)
 {
     void  *p;
 
+#if (T_NGX_SLAB_MAGAZINE)
+
+    if (ngx_slab_magazine_alloc(pool, size, 0, &p) == NGX_OK) {
+        if (p) {
+            ngx_memzero(p, size);
+        }
+
+        return p;
+    }
+
+#endif
+
     ngx_shmtx_lock(&pool->mutex);
 
     p = ngx_slab_calloc_locked(pool, size);
@@ -449,9 +499,15 @@ ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size)
 void
 ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 {
+#if (T_NGX_SLAB_MAGAZINE)
+    if (ngx_slab_magazine_free(pool, p, 0) == NGX_OK) {
+        return;
+    }
+#endif
+
     ngx_shmtx_lock(&pool->mutex);
 
-    ngx_slab_free_locked(pool, p);
+    ngx_slab_do_free(pool, p);
 
     ngx_shmtx_unlock(&pool->mutex);
 }
@@ -459,6 +515,19 @@ ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 
 void
 ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
+{
+#if (T_NGX_SLAB_MAGAZINE)
+    if (ngx_slab_magazine_free(pool, p, 1) == NGX_OK) {
+        return;
+    }
+#endif
+
+    ngx_slab_do_free(pool, p);
+}
+
+
+static void
+ngx_slab_do_free(ngx_slab_pool_t *pool, void *p)
 {
     size_t            size;
     uintptr_t         slab, m, *bitmap;
@@ -678,6 +747,13 @@ static ngx_slab_page_t *
 ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
     ngx_slab_page_t  *page, *p;
+#if (T_NGX_SLAB_MAGAZINE)
+    ngx_uint_t        drained;
+
+    drained = 0;
+
+again:
+#endif
 
     for (page = pool->free.next; page != &pool->free; page = page->next) {
 
@@ -721,6 +797,17 @@ ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
         }
     }
 
+#if (T_NGX_SLAB_MAGAZINE)
+
+    /* the chunks cached by the workers are returned to the pool */
+
+    if (!drained && ngx_slab_magazines_drain(pool)) {
+        drained = 1;
+        goto again;
+    }
+
+#endif
+
     if (pool->log_nomem) {
         ngx_slab_error(pool, NGX_LOG_CRIT,
                        "ngx_slab_alloc() failed: no memory");
@@ -815,3 +902,398 @@ ngx_slab_error(ngx_slab_pool_t *pool, ngx_uint_t level, char *text)
 {
     ngx_log_error(level, ngx_cycle->log, 0, "%s%s", text, pool->log_ctx);
 }
+
+
+#if (T_NGX_SLAB_MAGAZINE)
+
+/*
+ * Each worker caches up to "slab_magazine" free chunks of each size class
+ * in a magazine in the pool itself.  An allocation or a free of a chunk
+ * takes the worker's magazine lock only, which nobody but the worker
+ * normally contends for; the magazine is filled from or emptied to the slab
+ * with a half of its size at once under the pool mutex.  The magazines are
+ * only tried to lock, a busy magazine is just bypassed, so the lock order
+ * does not matter.
+ *
+ * The magazines are kept in the shared memory, so a worker that replaces
+ * an exited or a crashed one continues with its magazine, and the chunks
+ * of all magazines are returned to the pool when it runs out of memory.
+ * A magazine is locked with the pid of the worker, so the master unlocks
+ * the magazine of a crashed worker as it does with the pool mutex.
+ *
+ * The size of the magazines is set from "slab_magazine" each time
+ * a configuration is loaded, 0 disables them and returns their chunks.
+ */
+
+#define ngx_slab_magazine_trylock(mag)                                        \
+    ((mag)->lock == 0 && ngx_atomic_cmp_set(&(mag)->lock, 0, ngx_pid))
+
+#define ngx_slab_magazine_unlock(mag)                                         \
+    (mag)->lock = 0
+
+
+void
+ngx_slab_magazines_init(ngx_slab_pool_t *pool, ngx_cycle_t *cycle)
+{
+    ngx_uint_t        n;
+    ngx_core_conf_t  *ccf;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    ngx_shmtx_lock(&pool->mutex);
+
+    pool->magazine = (ccf->slab_magazine > 0) ? ccf->slab_magazine : 0;
+
+    if (pool->magazines) {
+
+        if (pool->magazine == 0) {
+            (void) ngx_slab_magazines_drain(pool);
+        }
+
+        n = (ngx_process == NGX_PROCESS_SINGLE) ? 1 : ccf->worker_processes;
+
+        if (pool->magazine && n > pool->nmagazines) {
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                          "slab magazines are kept for %ui workers%s",
+                          pool->nmagazines, pool->log_ctx);
+        }
+    }
+
+    ngx_shmtx_unlock(&pool->mutex);
+}
+
+
+ngx_uint_t
+ngx_slab_magazines_force_unlock(ngx_slab_pool_t *pool, ngx_pid_t pid)
+{
+    ngx_uint_t            i, n;
+    ngx_slab_magazine_t  *mag;
+
+    n = 0;
+
+    for (i = 0; i < pool->nmagazines; i++) {
+        mag = ngx_slab_magazine(pool, i);
+
+        if (ngx_atomic_cmp_set(&mag->lock, pid, 0)) {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+
+static ngx_slab_magazine_t *
+ngx_slab_get_magazine(ngx_slab_pool_t *pool, ngx_uint_t locked)
+{
+    size_t                size;
+    ngx_uint_t            n;
+    ngx_core_conf_t      *ccf;
+    ngx_slab_magazine_t  *magazines;
+
+    /*
+     * zones are also allocated from while the configuration is parsed,
+     * a single process is not yet running until the cycle is set
+     */
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && (ngx_process != NGX_PROCESS_SINGLE
+            || ngx_cycle->conf_ctx == NULL
+            || ngx_test_config))
+    {
+        return NULL;
+    }
+
+    if (pool->magazine == 0) {
+        return NULL;
+    }
+
+    if (pool->magazines) {
+        goto found;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                           ngx_core_module);
+
+    if (!locked) {
+        ngx_shmtx_lock(&pool->mutex);
+    }
+
+    if (pool->magazines == NULL) {
+        n = (ngx_process == NGX_PROCESS_SINGLE) ? 1 : ccf->worker_processes;
+
+        size = n * ngx_slab_magazine_size(pool);
+
+        magazines = ngx_slab_do_alloc(pool, size);
+
+        if (magazines) {
+            ngx_memzero(magazines, size);
+            pool->nmagazines = n;
+
+            /* the magazines are used without the mutex once they are seen */
+
+            ngx_memory_barrier();
+
+            pool->magazines = magazines;
+        }
+    }
+
+    if (!locked) {
+        ngx_shmtx_unlock(&pool->mutex);
+    }
+
+    if (pool->magazines == NULL) {
+        return NULL;
+    }
+
+found:
+
+    if (ngx_worker >= pool->nmagazines) {
+        return NULL;
+    }
+
+    return ngx_slab_magazine(pool, ngx_worker);
+}
+
+
+static ngx_int_t
+ngx_slab_magazine_alloc(ngx_slab_pool_t *pool, size_t size, ngx_uint_t locked,
+    void **p)
+{
+    void                      *chunk, *next, *list, *last;
+    size_t                     s;
+    ngx_uint_t                 n, slot, shift, count;
+    ngx_slab_magazine_t       *mag;
+    ngx_slab_magazine_slot_t  *ms;
+
+    if (size > ngx_slab_max_size) {
+        return NGX_DECLINED;
+    }
+
+    mag = ngx_slab_get_magazine(pool, locked);
+
+    if (mag == NULL || !ngx_slab_magazine_trylock(mag)) {
+        return NGX_DECLINED;
+    }
+
+    if (size > pool->min_size) {
+        shift = 1;
+        for (s = size - 1; s >>= 1; shift++) { /* void */ }
+        slot = shift - pool->min_shift;
+
+    } else {
+        shift = pool->min_shift;
+        slot = 0;
+    }
+
+    ms = &mag->slots[slot];
+
+    if (ms->free) {
+        chunk = ms->free;
+
+        ms->free = *(void **) chunk;
+        ms->count--;
+        ms->hits++;
+
+        ngx_slab_magazine_unlock(mag);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                       "slab magazine alloc: %uz %p", size, chunk);
+
+        *p = chunk;
+        return NGX_OK;
+    }
+
+    ms->misses++;
+
+    /*
+     * the magazine is unlocked while it is filled,
+     * so it can be drained if the pool runs out of memory
+     */
+
+    ngx_slab_magazine_unlock(mag);
+
+    list = NULL;
+    last = NULL;
+    count = 0;
+
+    if (!locked) {
+        ngx_shmtx_lock(&pool->mutex);
+    }
+
+    chunk = ngx_slab_do_alloc(pool, (size_t) 1 << shift);
+
+    for (n = pool->magazine / 2; chunk && n; n--) {
+        next = ngx_slab_do_alloc(pool, (size_t) 1 << shift);
+        if (next == NULL) {
+            break;
+        }
+
+        if (last == NULL) {
+            last = next;
+        }
+
+        *(void **) next = list;
+        list = next;
+        count++;
+    }
+
+    if (list && !ngx_slab_magazine_trylock(mag)) {
+
+        while (list) {
+            next = list;
+            list = *(void **) next;
+
+            ngx_slab_do_free(pool, next);
+        }
+    }
+
+    if (!locked) {
+        ngx_shmtx_unlock(&pool->mutex);
+    }
+
+    if (list) {
+        *(void **) last = ms->free;
+        ms->free = list;
+        ms->count += count;
+
+        ngx_slab_magazine_unlock(mag);
+    }
+
+    *p = chunk;
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_slab_magazine_free(ngx_slab_pool_t *pool, void *p, ngx_uint_t locked)
+{
+    void                      *chunk;
+    ngx_uint_t                 n, slot, shift;
+    ngx_slab_page_t           *page;
+    ngx_slab_magazine_t       *mag;
+    ngx_slab_magazine_slot_t  *ms;
+
+    if ((u_char *) p < pool->start || (u_char *) p >= pool->end) {
+        return NGX_DECLINED;
+    }
+
+    /*
+     * the type and the shift of a page do not change while
+     * there are chunks allocated from it
+     */
+
+    page = &pool->pages[((u_char *) p - pool->start) >> ngx_pagesize_shift];
+
+    switch (ngx_slab_page_type(page)) {
+
+    case NGX_SLAB_SMALL:
+    case NGX_SLAB_BIG:
+        shift = page->slab & NGX_SLAB_SHIFT_MASK;
+        break;
+
+    case NGX_SLAB_EXACT:
+        shift = ngx_slab_exact_shift;
+        break;
+
+    default: /* NGX_SLAB_PAGE */
+        return NGX_DECLINED;
+    }
+
+    if ((uintptr_t) p & (((uintptr_t) 1 << shift) - 1)) {
+        return NGX_DECLINED;
+    }
+
+    mag = ngx_slab_get_magazine(pool, locked);
+
+    if (mag == NULL || !ngx_slab_magazine_trylock(mag)) {
+        return NGX_DECLINED;
+    }
+
+    slot = shift - pool->min_shift;
+    ms = &mag->slots[slot];
+
+    if (ms->count >= pool->magazine) {
+
+        if (!locked) {
+            ngx_shmtx_lock(&pool->mutex);
+        }
+
+        /* the size may have been lowered on reload */
+
+        for (n = ms->count - pool->magazine / 2; n && ms->free; n--) {
+            chunk = ms->free;
+
+            ms->free = *(void **) chunk;
+            ms->count--;
+
+            ngx_slab_do_free(pool, chunk);
+        }
+
+        if (!locked) {
+            ngx_shmtx_unlock(&pool->mutex);
+        }
+    }
+
+    ngx_slab_junk(p, (size_t) 1 << shift);
+
+    *(void **) p = ms->free;
+    ms->free = p;
+    ms->count++;
+
+    ngx_slab_magazine_unlock(mag);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                   "slab magazine free: %p", p);
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_slab_magazines_drain(ngx_slab_pool_t *pool)
+{
+    void                      *chunk;
+    ngx_uint_t                 i, k, n, drained;
+    ngx_slab_magazine_t       *mag;
+    ngx_slab_magazine_slot_t  *ms;
+
+    /* called with the pool mutex held */
+
+    drained = 0;
+    n = ngx_pagesize_shift - pool->min_shift;
+
+    for (i = 0; i < pool->nmagazines; i++) {
+        mag = ngx_slab_magazine(pool, i);
+
+        if (!ngx_slab_magazine_trylock(mag)) {
+            continue;
+        }
+
+        for (k = 0; k < n; k++) {
+            ms = &mag->slots[k];
+
+            while (ms->free) {
+                chunk = ms->free;
+
+                ms->free = *(void **) chunk;
+                ms->count--;
+
+                ngx_slab_do_free(pool, chunk);
+
+                drained++;
+            }
+        }
+
+        ngx_slab_magazine_unlock(mag);
+    }
+
+    if (drained) {
+        ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                       "slab magazines drained: %ui", drained);
+    }
+
+    return drained;
+}
+
+#endif
@@ -31,6 +31,40 @@ typedef struct {
 } ngx_slab_stat_t;
 
 
+#if (T_NGX_SLAB_MAGAZINE)
+
+typedef struct {
+    void             *free;
+    ngx_uint_t        count;
+
+    ngx_uint_t        hits;
+    ngx_uint_t        misses;
+} ngx_slab_magazine_slot_t;
+
+
+/*
+ * a per worker cache of the free chunks of each size class; it is only
+ * tried to lock, so a worker never waits for it, and the lock keeps the pid
+ * of its owner, so it is unlocked if the owner exits abnormally
+ */
+
+typedef struct {
+    ngx_atomic_t              lock;
+    ngx_slab_magazine_slot_t  slots[1];
+} ngx_slab_magazine_t;
+
+
+#define ngx_slab_magazine_size(pool)                                          \
+    (sizeof(ngx_slab_magazine_t) + sizeof(ngx_slab_magazine_slot_t)           \
+     * (ngx_pagesize_shift - (pool)->min_shift - 1))
+
+#define ngx_slab_magazine(pool, n)                                            \
+    ((ngx_slab_magazine_t *) ((u_char *) (pool)->magazines                    \
+                              + (n) * ngx_slab_magazine_size(pool)))
+
+#endif
+
+
 typedef struct {
     ngx_shmtx_sh_t    lock;
 
@@ -54,6 +88,12 @@ typedef struct {
 
     unsigned          log_nomem:1;
 
+#if (T_NGX_SLAB_MAGAZINE)
+    ngx_slab_magazine_t  *magazines;
+    ngx_uint_t            nmagazines;
+    ngx_uint_t            magazine;
+#endif
+
     void             *data;
     void             *addr;
 } ngx_slab_pool_t;
@@ -67,6 +107,11 @@ void *ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+#if (T_NGX_SLAB_MAGAZINE)
+void ngx_slab_magazines_init(ngx_slab_pool_t *pool, ngx_cycle_t *cycle);
+ngx_uint_t ngx_slab_magazines_force_unlock(ngx_slab_pool_t *pool,
+    ngx_pid_t pid);
+#endif
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
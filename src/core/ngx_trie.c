@@ -12,6 +12,21 @@
 #define NGX_TRIE_KIND               256
 
 
+#if (T_NGX_TRIE_COMPACT)
+
+typedef struct {
+    ngx_trie_node_t                *node;
+    int32_t                         state;
+} ngx_trie_compact_queue_t;
+
+
+static ngx_int_t ngx_trie_compact_grow(ngx_trie_state_t **states,
+    ngx_uint_t *n, ngx_uint_t size);
+static void ngx_trie_compact_cleanup(void *data);
+
+#endif
+
+
 ngx_trie_t *
 ngx_trie_create(ngx_pool_t *pool)
 {
@@ -110,17 +125,33 @@ ngx_trie_insert(ngx_trie_t *trie, ngx_str_t *str, ngx_uint_t mode)
 ngx_int_t
 ngx_trie_build_clue(ngx_trie_t *trie)
 {
-    ngx_int_t        i, head, tail;
-    ngx_trie_node_t *q[NGX_TRIE_MAX_QUEUE_SIZE], *p, *t, *root;
+    ngx_int_t         i;
+    ngx_uint_t        tail;
+    ngx_array_t       queue;
+    ngx_trie_node_t  *p, *t, *root, **q;
+
+    /* all the nodes of a level may be queued, there can be many of them */
+
+    if (ngx_array_init(&queue, trie->pool, NGX_TRIE_MAX_QUEUE_SIZE,
+                       sizeof(ngx_trie_node_t *))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
 
-    head = tail = 0;
     root = trie->root;
-    q[head++] = root;
     root->search_clue = NULL;
 
-    while (head != tail) {
-        t = q[tail++];
-        tail %= NGX_TRIE_MAX_QUEUE_SIZE;
+    q = ngx_array_push(&queue);
+    if (q == NULL) {
+        return NGX_ERROR;
+    }
+
+    *q = root;
+
+    for (tail = 0; tail < queue.nelts; tail++) {
+        q = queue.elts;
+        t = q[tail];
 
         if (t->next == NULL) {
             continue;
@@ -136,10 +167,7 @@ ngx_trie_build_clue(ngx_trie_t *trie)
             if (t == root) {
                 t->next[i]->search_clue = root;
 
-                q[head++] = t->next[i];
-                head %= NGX_TRIE_MAX_QUEUE_SIZE;
-
-                continue;
+                goto next;
             }
 
             p = t->search_clue;
@@ -156,8 +184,14 @@ ngx_trie_build_clue(ngx_trie_t *trie)
                 t->next[i]->search_clue = root;
             }
 
-            q[head++] = t->next[i];
-            head %= NGX_TRIE_MAX_QUEUE_SIZE;
+        next:
+
+            q = ngx_array_push(&queue);
+            if (q == NULL) {
+                return NGX_ERROR;
+            }
+
+            *q = t->next[i];
         }
     }
 
@@ -198,7 +232,7 @@ ngx_trie_query(ngx_trie_t *trie, ngx_str_t *str, ngx_int_t *version_pos,
             index = 0;
         }
 
-        while (p->next[index] == NULL) {
+        while (p->next == NULL || p->next[index] == NULL) {
             if (p == root) {
                 break;
             }
@@ -221,3 +255,394 @@ ngx_trie_query(ngx_trie_t *trie, ngx_str_t *str, ngx_int_t *version_pos,
 
     return value;
 }
+
+
+#if (T_NGX_TRIE_COMPACT)
+
+/*
+ * ngx_trie_compact() converts a trie built with ngx_trie_insert() into a
+ * double-array trie with the failure links of the search clues, which is
+ * several times smaller than the 256 pointers of every node and keeps the
+ * transitions of a state close to each other.  The arrays are placed into
+ * anonymous memory which is made read-only once built, so its pages are
+ * shared by the worker processes with the master process.  Nothing can be
+ * inserted into the compact trie, and the original one is not needed after
+ * the conversion.
+ */
+
+ngx_trie_t *
+ngx_trie_compact(ngx_trie_t *trie, ngx_pool_t *pool)
+{
+    u_char                    *map;
+    size_t                     size;
+    int32_t                    s, t, f, b, base;
+    ngx_int_t                  c, first, last;
+    ngx_uint_t                 i, n, nstates, free_slot, start, used;
+    ngx_trie_t                *ct;
+    ngx_pool_t                *temp;
+    ngx_array_t                queue, outputs;
+    ngx_trie_node_t           *node;
+    ngx_trie_state_t          *states;
+    ngx_trie_output_t         *out;
+    ngx_pool_cleanup_t        *cln;
+    ngx_trie_compact_queue_t  *q;
+
+    ct = ngx_pcalloc(pool, sizeof(ngx_trie_t));
+    if (ct == NULL) {
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    temp = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, pool->log);
+    if (temp == NULL) {
+        return NULL;
+    }
+
+    states = NULL;
+    nstates = 0;
+
+    if (ngx_array_init(&queue, temp, 256, sizeof(ngx_trie_compact_queue_t))
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    if (ngx_array_init(&outputs, temp, 16, sizeof(ngx_trie_output_t))
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    /* the output 0 means that the state has no key */
+
+    out = ngx_array_push(&outputs);
+    if (out == NULL) {
+        goto failed;
+    }
+
+    ngx_memzero(out, sizeof(ngx_trie_output_t));
+
+    if (ngx_trie_compact_grow(&states, &nstates, 1024) != NGX_OK) {
+        goto failed;
+    }
+
+    /* the root */
+
+    states[0].check = 0;
+
+    q = ngx_array_push(&queue);
+    if (q == NULL) {
+        goto failed;
+    }
+
+    q->node = trie->root;
+    q->state = 0;
+
+    free_slot = 1;
+    base = 0;
+
+    /* breadth-first, so the failure links of the shorter keys are known */
+
+    for (i = 0; i < queue.nelts; i++) {
+        q = queue.elts;
+        node = q[i].node;
+        s = q[i].state;
+
+        if (node->key) {
+            out = ngx_array_push(&outputs);
+            if (out == NULL) {
+                goto failed;
+            }
+
+            out->value = node->value;
+            out->key = node->key;
+            out->greedy = node->greedy;
+
+            states[s].output = outputs.nelts - 1;
+        }
+
+        if (node->next == NULL) {
+            continue;
+        }
+
+        first = -1;
+        last = -1;
+
+        for (c = 0; c < NGX_TRIE_KIND; c++) {
+            if (node->next[c]) {
+                if (first == -1) {
+                    first = c;
+                }
+
+                last = c;
+            }
+        }
+
+        if (first == -1) {
+            continue;
+        }
+
+        /*
+         * the lowest base with the slots of all the children free, the
+         * search starts from the first free slot found last time, and
+         * skips the slots before the found one if they are mostly used
+         */
+
+        start = ngx_max(free_slot, (ngx_uint_t) first + 1);
+        used = 0;
+
+        for (n = start; /* void */; n++) {
+
+            if (n < nstates && states[n].check != -1) {
+                used++;
+                continue;
+            }
+
+            if (used == n - start) {
+                free_slot = n;
+            }
+
+            b = n - first;
+
+            if (ngx_trie_compact_grow(&states, &nstates, b + last + 1)
+                != NGX_OK)
+            {
+                goto failed;
+            }
+
+            for (c = first; c <= last; c++) {
+                if (node->next[c] && states[b + c].check != -1) {
+                    break;
+                }
+            }
+
+            if (c > last) {
+                break;
+            }
+        }
+
+        if (used * 20 >= (n - start + 1) * 19) {
+            free_slot = n + 1;
+        }
+
+        states[s].base = b;
+
+        if (b > base) {
+            base = b;
+        }
+
+        for (c = first; c <= last; c++) {
+            if (node->next[c] == NULL) {
+                continue;
+            }
+
+            t = b + c;
+            states[t].check = s;
+
+            /* the longest proper suffix which is in the trie */
+
+            for (f = s; f != 0; /* void */) {
+                f = states[f].fail;
+
+                if (states[f].base
+                    && (ngx_uint_t) (states[f].base + c) < nstates
+                    && states[states[f].base + c].check == f)
+                {
+                    states[t].fail = states[f].base + c;
+                    break;
+                }
+            }
+
+            q = ngx_array_push(&queue);
+            if (q == NULL) {
+                goto failed;
+            }
+
+            q->node = node->next[c];
+            q->state = t;
+        }
+
+    }
+
+    /* no transition goes beyond the array, so it is not checked */
+
+    if (ngx_trie_compact_grow(&states, &nstates, base + NGX_TRIE_KIND)
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    n = base + NGX_TRIE_KIND;
+
+    size = n * sizeof(ngx_trie_state_t)
+           + outputs.nelts * sizeof(ngx_trie_output_t);
+    size = ngx_align(size, ngx_pagesize);
+
+    map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+
+    if (map == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ALERT, pool->log, ngx_errno,
+                      "mmap(MAP_ANON, %uz) failed", size);
+        goto failed;
+    }
+
+    ct->pool = pool;
+    ct->query = ngx_trie_query_compact;
+
+    ct->states = (ngx_trie_state_t *) map;
+    ct->nstates = n;
+    ct->outputs = (ngx_trie_output_t *) (map + n * sizeof(ngx_trie_state_t));
+    ct->noutputs = outputs.nelts;
+    ct->map = map;
+    ct->size = size;
+
+    ngx_memcpy(ct->states, states, n * sizeof(ngx_trie_state_t));
+    ngx_memcpy(ct->outputs, outputs.elts,
+               outputs.nelts * sizeof(ngx_trie_output_t));
+
+    cln->handler = ngx_trie_compact_cleanup;
+    cln->data = ct;
+
+    if (mprotect(map, size, PROT_READ) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, pool->log, ngx_errno,
+                      "mprotect(PROT_READ) failed");
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_CORE, pool->log, 0,
+                   "trie compact: %ui nodes, %ui states, %ui keys, %uz bytes",
+                   queue.nelts, n, outputs.nelts - 1, size);
+
+    ngx_free(states);
+    ngx_destroy_pool(temp);
+
+    return ct;
+
+failed:
+
+    if (states) {
+        ngx_free(states);
+    }
+
+    ngx_destroy_pool(temp);
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_trie_compact_grow(ngx_trie_state_t **states, ngx_uint_t *n,
+    ngx_uint_t size)
+{
+    ngx_uint_t         i, nalloc;
+    ngx_trie_state_t  *p;
+
+    if (size <= *n) {
+        return NGX_OK;
+    }
+
+    nalloc = ngx_max(size, 2 * *n);
+
+    p = ngx_alloc(nalloc * sizeof(ngx_trie_state_t), ngx_cycle->log);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (*states) {
+        ngx_memcpy(p, *states, *n * sizeof(ngx_trie_state_t));
+        ngx_free(*states);
+    }
+
+    for (i = *n; i < nalloc; i++) {
+        p[i].base = 0;
+        p[i].check = -1;
+        p[i].fail = 0;
+        p[i].output = 0;
+    }
+
+    *states = p;
+    *n = nalloc;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_trie_compact_cleanup(void *data)
+{
+    ngx_trie_t  *trie = data;
+
+    if (munmap(trie->map, trie->size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "munmap(%uz) failed", trie->size);
+    }
+}
+
+
+void *
+ngx_trie_query_compact(ngx_trie_t *trie, ngx_str_t *str,
+    ngx_int_t *version_pos, ngx_uint_t mode)
+{
+    void               *value;
+    size_t              i;
+    int32_t             s, t;
+    ngx_int_t           step, pos;
+    ngx_trie_state_t   *states;
+    ngx_trie_output_t  *out;
+
+    states = trie->states;
+
+    if (states[0].base == 0) {
+        return NULL;
+    }
+
+    value = NULL;
+    s = 0;
+
+    if (mode & NGX_TRIE_REVERSE) {
+        pos = str->len;
+        step = -1;
+    } else {
+        pos = -1;
+        step = 1;
+    }
+
+    for (i = 0; i < str->len; i++) {
+        pos += step;
+
+        for ( ;; ) {
+            t = states[s].base + str->data[pos];
+
+            if (states[t].check == s) {
+                s = t;
+                break;
+            }
+
+            if (s == 0) {
+                break;
+            }
+
+            s = states[s].fail;
+        }
+
+        if (states[s].output) {
+            out = &trie->outputs[states[s].output];
+
+            value = out->value;
+            *version_pos = pos + out->key;
+
+            if (!out->greedy) {
+                return value;
+            }
+
+            s = 0;
+        }
+    }
+
+    return value;
+}
+
+#endif
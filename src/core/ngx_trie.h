@@ -26,6 +26,31 @@ typedef void *(*ngx_trie_query_pt)(ngx_trie_t *trie,
     ngx_str_t *str, ngx_int_t *pos, ngx_uint_t mode);
 
 
+#if (T_NGX_TRIE_COMPACT)
+
+/*
+ * a state of the compact trie: the transition from a state by a byte "c" is
+ * to the state "base + c" if its "check" is the state, otherwise the search
+ * goes on from the "fail" state, as the search_clue of the node
+ */
+
+typedef struct {
+    int32_t                         base;
+    int32_t                         check;
+    int32_t                         fail;
+    uint32_t                        output;
+} ngx_trie_state_t;
+
+
+typedef struct {
+    void                           *value;
+    uint32_t                        key;
+    uint32_t                        greedy;
+} ngx_trie_output_t;
+
+#endif
+
+
 struct ngx_trie_node_s {
     void                           *value;
     ngx_trie_node_t                *search_clue;
@@ -42,6 +67,16 @@ struct ngx_trie_s {
     ngx_trie_insert_pt              insert;
     ngx_trie_query_pt               query;
     ngx_trie_build_clue_pt          build_clue;
+
+#if (T_NGX_TRIE_COMPACT)
+    ngx_trie_state_t               *states;
+    ngx_trie_output_t              *outputs;
+    ngx_uint_t                      nstates;
+    ngx_uint_t                      noutputs;
+
+    u_char                         *map;
+    size_t                          size;
+#endif
 };
 
 
@@ -53,5 +88,11 @@ void *ngx_trie_query(ngx_trie_t *trie, ngx_str_t *str, ngx_int_t *pos,
     ngx_uint_t mode);
 ngx_int_t ngx_trie_build_clue(ngx_trie_t *trie);
 
+#if (T_NGX_TRIE_COMPACT)
+ngx_trie_t *ngx_trie_compact(ngx_trie_t *trie, ngx_pool_t *pool);
+void *ngx_trie_query_compact(ngx_trie_t *trie, ngx_str_t *str, ngx_int_t *pos,
+    ngx_uint_t mode);
+#endif
+
 
 #endif /* _NGX_TRIE_H_INCLUDE_ */
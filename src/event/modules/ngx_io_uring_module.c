@@ -0,0 +1,1673 @@
+
+/*
+ * Copyright (C) 2010-2026 Alibaba Group Holding Limited
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <linux/io_uring.h>
+
+
+/*
+ * The ring is used as an edge triggered event notification mechanism
+ * through multishot IORING_OP_POLL_ADD requests, registrations and their
+ * changes are queued and submitted with the wait in one io_uring_enter().
+ * File AIO reads are submitted to the same ring as IORING_OP_READ requests.
+ *
+ * Connections are accepted by multishot IORING_OP_ACCEPT requests on the
+ * listening sockets: the accepted sockets are queued, and the accept handler
+ * takes them from the queue instead of calling accept().  Reading and sending
+ * stay readiness based, as OpenSSL and the MSG_PEEK checks of the protocol
+ * handlers read the sockets directly, and data already consumed by a ring
+ * request would be lost for them.
+ *
+ * Unlike epoll, a poll request holds a reference to the file, so the poll
+ * must be removed before the descriptor is closed, otherwise the socket
+ * stays open until the removal is submitted.
+ */
+
+
+/* the multishot poll and its update appeared in Linux 5.13 */
+
+#define NGX_IO_URING_FEATURES                                                 \
+    (IORING_FEAT_SINGLE_MMAP|IORING_FEAT_NODROP|IORING_FEAT_EXT_ARG           \
+     |IORING_FEAT_RSRC_TAGS)
+
+#define NGX_IO_URING_AIO          ((uint64_t) 1 << 63)
+#define NGX_IO_URING_UPDATE       ((uint64_t) 1 << 62)
+#define NGX_IO_URING_REMOVE       ((uint64_t) 1 << 61)
+#define NGX_IO_URING_ACCEPT       ((uint64_t) 1 << 60)
+
+
+typedef struct {
+    ngx_uint_t               entries;
+} ngx_io_uring_conf_t;
+
+
+typedef struct {
+    int                      fd;
+
+    u_char                  *ring;
+    size_t                   ring_size;
+
+    struct io_uring_sqe     *sqes;
+    size_t                   sqes_size;
+
+    volatile uint32_t       *sq_head;
+    volatile uint32_t       *sq_tail;
+    uint32_t                 sq_mask;
+    uint32_t                 sq_entries;
+    uint32_t                 tail;
+
+    volatile uint32_t       *cq_head;
+    volatile uint32_t       *cq_tail;
+    uint32_t                 cq_mask;
+    struct io_uring_cqe     *cqes;
+} ngx_io_uring_t;
+
+
+typedef struct {
+    ngx_connection_t        *connection;
+
+    /* the accepted sockets, or the accept() errors as -errno */
+    ngx_socket_t            *fds;
+    ngx_uint_t               head;
+    ngx_uint_t               n;
+    ngx_uint_t               size;
+
+    unsigned                 armed:1;
+} ngx_io_uring_accept_t;
+
+
+static ngx_int_t ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+static ngx_int_t ngx_io_uring_setup(ngx_cycle_t *cycle, ngx_uint_t entries);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_io_uring_notify_init(ngx_log_t *log);
+static void ngx_io_uring_notify_handler(ngx_event_t *ev);
+#endif
+static void ngx_io_uring_done(ngx_cycle_t *cycle);
+static struct io_uring_sqe *ngx_io_uring_get_sqe(ngx_log_t *log);
+static ngx_int_t ngx_io_uring_submit(ngx_log_t *log);
+static ngx_int_t ngx_io_uring_poll_add(ngx_fd_t fd, uint32_t events,
+    ngx_uint_t flags, uint64_t data, ngx_log_t *log);
+static ngx_int_t ngx_io_uring_poll_update(uint64_t data, uint32_t events,
+    ngx_uint_t flags, ngx_log_t *log);
+static ngx_int_t ngx_io_uring_poll_remove(uint64_t data, ngx_log_t *log);
+static ngx_int_t ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_add_connection(ngx_connection_t *c);
+static ngx_int_t ngx_io_uring_del_connection(ngx_connection_t *c,
+    ngx_uint_t flags);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_io_uring_notify(ngx_event_handler_pt handler);
+#endif
+static ngx_int_t ngx_io_uring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+static void ngx_io_uring_rearm(ngx_connection_t *c, ngx_uint_t async);
+static uint32_t ngx_io_uring_events(ngx_connection_t *c, ngx_uint_t *flags);
+static void ngx_io_uring_retry(uint64_t data, ngx_log_t *log);
+static ngx_io_uring_accept_t *ngx_io_uring_accept_queue(ngx_connection_t *c);
+static ngx_int_t ngx_io_uring_accept_add(ngx_io_uring_accept_t *q,
+    ngx_log_t *log);
+static ngx_int_t ngx_io_uring_accept_cancel(ngx_io_uring_accept_t *q,
+    ngx_log_t *log);
+static void ngx_io_uring_accepted(ngx_io_uring_accept_t *q, int res,
+    uint32_t cflags, ngx_log_t *log);
+static void ngx_io_uring_accept_close(ngx_io_uring_accept_t *q);
+static void ngx_io_uring_post_accepts(ngx_uint_t flags);
+#if (NGX_SSL && NGX_SSL_ASYNC)
+static ngx_int_t ngx_io_uring_add_async_connection(ngx_connection_t *c);
+static ngx_int_t ngx_io_uring_del_async_connection(ngx_connection_t *c,
+    ngx_uint_t flags);
+#endif
+
+static void *ngx_io_uring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf);
+
+
+static ngx_io_uring_t       ring;
+
+static ngx_io_uring_accept_t  *accepts;
+static ngx_uint_t           naccepts;
+static ngx_uint_t           accept_queued;
+static ngx_uint_t           accept_multishot = 1;
+
+#if (NGX_HAVE_EVENTFD)
+static int                  notify_fd = -1;
+static ngx_event_t          notify_event;
+static ngx_connection_t     notify_conn;
+#endif
+
+ngx_uint_t                  ngx_use_io_uring;
+
+static ngx_str_t      io_uring_name = ngx_string("io_uring");
+
+static ngx_command_t  ngx_io_uring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_io_uring_conf_t, entries),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_event_module_t  ngx_io_uring_module_ctx = {
+    &io_uring_name,
+    ngx_io_uring_create_conf,            /* create configuration */
+    ngx_io_uring_init_conf,              /* init configuration */
+
+    {
+        ngx_io_uring_add_event,          /* add an event */
+        ngx_io_uring_del_event,          /* delete an event */
+        ngx_io_uring_add_event,          /* enable an event */
+        ngx_io_uring_del_event,          /* disable an event */
+        ngx_io_uring_add_connection,     /* add an connection */
+        ngx_io_uring_del_connection,     /* delete an connection */
+#if (NGX_HAVE_EVENTFD)
+        ngx_io_uring_notify,             /* trigger a notify */
+#else
+        NULL,                            /* trigger a notify */
+#endif
+        ngx_io_uring_process_events,     /* process the events */
+        ngx_io_uring_init,               /* init the events */
+        ngx_io_uring_done,               /* done the events */
+#if (NGX_SSL && NGX_SSL_ASYNC)
+        ngx_io_uring_add_async_connection, /* add an async conn */
+        ngx_io_uring_del_async_connection  /* del an async conn */
+#endif
+    }
+};
+
+ngx_module_t  ngx_io_uring_module = {
+    NGX_MODULE_V1,
+    &ngx_io_uring_module_ctx,            /* module context */
+    ngx_io_uring_commands,               /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    NULL,                                /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/*
+ * We call io_uring_setup() and io_uring_enter() directly as syscalls,
+ * so liburing is not required.
+ */
+
+static int
+io_uring_setup(u_int entries, struct io_uring_params *params)
+{
+    return syscall(SYS_io_uring_setup, entries, params);
+}
+
+
+static int
+io_uring_enter(int fd, u_int to_submit, u_int min_complete, u_int flags,
+    void *arg, size_t argsz)
+{
+    return syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags,
+                   arg, argsz);
+}
+
+
+static ngx_int_t
+ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    ngx_io_uring_conf_t  *iucf;
+
+    iucf = ngx_event_get_conf(cycle->conf_ctx, ngx_io_uring_module);
+
+    if (ring.ring == NULL) {
+        if (ngx_io_uring_setup(cycle, iucf->entries) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+#if (NGX_HAVE_EVENTFD)
+        if (ngx_io_uring_notify_init(cycle->log) != NGX_OK) {
+            ngx_io_uring_module_ctx.actions.notify = NULL;
+        }
+#endif
+    }
+
+    /* an accept queue for each listening socket, as in cycle->listening */
+
+    if (accepts == NULL && cycle->listening.nelts) {
+        accepts = ngx_calloc(cycle->listening.nelts
+                             * sizeof(ngx_io_uring_accept_t), cycle->log);
+        if (accepts == NULL) {
+            return NGX_ERROR;
+        }
+
+        naccepts = cycle->listening.nelts;
+    }
+
+    ngx_io = ngx_os_io;
+
+    ngx_event_actions = ngx_io_uring_module_ctx.actions;
+
+    /*
+     * the poll masks are the same as the epoll ones,
+     * so the epoll specific paths are used as is
+     */
+
+    ngx_event_flags = NGX_USE_CLEAR_EVENT
+                      |NGX_USE_GREEDY_EVENT
+                      |NGX_USE_EPOLL_EVENT;
+
+#if (NGX_HAVE_EPOLLRDHUP)
+    ngx_use_epoll_rdhup = 1;
+#endif
+
+    ngx_use_io_uring = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_setup(ngx_cycle_t *cycle, ngx_uint_t entries)
+{
+    u_char                  *p;
+    size_t                   size;
+    uint32_t                 i, *array;
+    struct io_uring_params   params;
+
+    ngx_memzero(&params, sizeof(struct io_uring_params));
+
+    ring.fd = io_uring_setup(entries, &params);
+
+    if (ring.fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "io_uring_setup(%ui) failed", entries);
+        return NGX_ERROR;
+    }
+
+    if ((params.features & NGX_IO_URING_FEATURES) != NGX_IO_URING_FEATURES) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "io_uring features %08XD are not enough, "
+                      "Linux 5.13 or newer is required", params.features);
+        goto failed;
+    }
+
+    size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+
+    if (size < params.cq_off.cqes
+               + params.cq_entries * sizeof(struct io_uring_cqe))
+    {
+        size = params.cq_off.cqes
+               + params.cq_entries * sizeof(struct io_uring_cqe);
+    }
+
+    p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+             ring.fd, IORING_OFF_SQ_RING);
+
+    if (p == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(%uz) of io_uring failed", size);
+        goto failed;
+    }
+
+    ring.ring = p;
+    ring.ring_size = size;
+
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ|PROT_WRITE,
+                     MAP_SHARED|MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+
+    if (ring.sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(%uz) of io_uring entries failed", ring.sqes_size);
+        goto failed;
+    }
+
+    ring.sq_head = (uint32_t *) (p + params.sq_off.head);
+    ring.sq_tail = (uint32_t *) (p + params.sq_off.tail);
+    ring.sq_mask = *(uint32_t *) (p + params.sq_off.ring_mask);
+    ring.sq_entries = params.sq_entries;
+    ring.tail = *ring.sq_tail;
+
+    /* the entries are always used in order */
+
+    array = (uint32_t *) (p + params.sq_off.array);
+
+    for (i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+
+    ring.cq_head = (uint32_t *) (p + params.cq_off.head);
+    ring.cq_tail = (uint32_t *) (p + params.cq_off.tail);
+    ring.cq_mask = *(uint32_t *) (p + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *) (p + params.cq_off.cqes);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: fd:%d sq:%uD cq:%uD",
+                   ring.fd, params.sq_entries, params.cq_entries);
+
+    return NGX_OK;
+
+failed:
+
+    if (ring.ring && munmap(ring.ring, ring.ring_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap() of io_uring failed");
+    }
+
+    if (close(ring.fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring.fd = -1;
+    ring.ring = NULL;
+    ring.sqes = NULL;
+
+    return NGX_ERROR;
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_io_uring_notify_init(ngx_log_t *log)
+{
+#if (NGX_HAVE_SYS_EVENTFD_H)
+    notify_fd = eventfd(0, 0);
+#else
+    notify_fd = syscall(SYS_eventfd, 0);
+#endif
+
+    if (notify_fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno, "eventfd() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "notify eventfd: %d", notify_fd);
+
+    notify_event.handler = ngx_io_uring_notify_handler;
+    notify_event.log = log;
+    notify_event.active = 1;
+
+    notify_conn.fd = notify_fd;
+    notify_conn.read = &notify_event;
+    notify_conn.log = log;
+
+    if (ngx_io_uring_poll_add(notify_fd, EPOLLIN, NGX_CLEAR_EVENT,
+                              (uint64_t) (uintptr_t) &notify_conn, log)
+        != NGX_OK)
+    {
+        if (close(notify_fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "eventfd close() failed");
+        }
+
+        notify_fd = -1;
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_notify_handler(ngx_event_t *ev)
+{
+    ssize_t               n;
+    uint64_t              count;
+    ngx_err_t             err;
+    ngx_event_handler_pt  handler;
+
+    if (++ev->index == NGX_MAX_UINT32_VALUE) {
+        ev->index = 0;
+
+        n = read(notify_fd, &count, sizeof(uint64_t));
+
+        err = ngx_errno;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "read() eventfd %d: %z count:%uL", notify_fd, n, count);
+
+        if ((size_t) n != sizeof(uint64_t)) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                          "read() eventfd %d failed", notify_fd);
+        }
+    }
+
+    handler = ev->data;
+    handler(ev);
+}
+
+#endif
+
+
+static void
+ngx_io_uring_done(ngx_cycle_t *cycle)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < naccepts; i++) {
+        ngx_io_uring_accept_close(&accepts[i]);
+        ngx_free(accepts[i].fds);
+    }
+
+    ngx_free(accepts);
+
+    accepts = NULL;
+    naccepts = 0;
+
+    if (munmap(ring.sqes, ring.sqes_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap() of io_uring entries failed");
+    }
+
+    if (munmap(ring.ring, ring.ring_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap() of io_uring failed");
+    }
+
+    if (close(ring.fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring.fd = -1;
+    ring.ring = NULL;
+    ring.sqes = NULL;
+
+#if (NGX_HAVE_EVENTFD)
+
+    if (notify_fd != -1 && close(notify_fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "eventfd close() failed");
+    }
+
+    notify_fd = -1;
+
+#endif
+
+    ngx_use_io_uring = 0;
+}
+
+
+static struct io_uring_sqe *
+ngx_io_uring_get_sqe(ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    if (ring.tail - *ring.sq_head >= ring.sq_entries) {
+
+        if (ngx_io_uring_submit(log) != NGX_OK) {
+            return NULL;
+        }
+
+        if (ring.tail - *ring.sq_head >= ring.sq_entries) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "io_uring submission queue is full");
+            return NULL;
+        }
+    }
+
+    /*
+     * the entry is reserved here, the tail is passed to the kernel
+     * by the next io_uring_enter()
+     */
+
+    sqe = &ring.sqes[ring.tail & ring.sq_mask];
+    ring.tail++;
+
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    return sqe;
+}
+
+
+static ngx_int_t
+ngx_io_uring_submit(ngx_log_t *log)
+{
+    int        n;
+    uint32_t   pending;
+    ngx_err_t  err;
+
+    for ( ;; ) {
+        pending = ring.tail - *ring.sq_head;
+
+        if (pending == 0) {
+            return NGX_OK;
+        }
+
+        ngx_memory_barrier();
+
+        *ring.sq_tail = ring.tail;
+
+        n = io_uring_enter(ring.fd, pending, 0, 0, NULL, 0);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "io_uring submit: %uD, %d", pending, n);
+
+        if (n != -1) {
+            return NGX_OK;
+        }
+
+        err = ngx_errno;
+
+        if (err != NGX_EINTR) {
+            ngx_log_error(NGX_LOG_ALERT, log, err, "io_uring_enter() failed");
+            return NGX_ERROR;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_io_uring_poll_add(ngx_fd_t fd, uint32_t events, ngx_uint_t flags,
+    uint64_t data, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring poll add: fd:%d ev:%08XD fl:%ui d:%p",
+                   fd, events, flags, (void *) (uintptr_t) data);
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+#if !(NGX_HAVE_LITTLE_ENDIAN)
+    events = (events << 16) | (events >> 16);
+#endif
+
+    /*
+     * a multishot poll is edge triggered, a level triggered poll
+     * is emulated with a oneshot poll that is added again once
+     * it completes
+     */
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->len = (flags & NGX_CLEAR_EVENT) ? IORING_POLL_ADD_MULTI : 0;
+    sqe->poll32_events = events;
+    sqe->user_data = data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_poll_update(uint64_t data, uint32_t events, ngx_uint_t flags,
+    ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring poll update: ev:%08XD fl:%ui d:%p",
+                   events, flags, (void *) (uintptr_t) data);
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+#if !(NGX_HAVE_LITTLE_ENDIAN)
+    events = (events << 16) | (events >> 16);
+#endif
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->len = IORING_POLL_UPDATE_EVENTS;
+    sqe->user_data = data | NGX_IO_URING_UPDATE;
+    sqe->poll32_events = events;
+
+    if (flags & NGX_CLEAR_EVENT) {
+        sqe->len |= IORING_POLL_ADD_MULTI;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_poll_remove(uint64_t data, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring poll remove: d:%p", (void *) (uintptr_t) data);
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->user_data = data | NGX_IO_URING_REMOVE;
+
+    /*
+     * the removal is submitted right now: the descriptor is usually closed
+     * just after it, and the connection may be reused with the same data
+     */
+
+    return ngx_io_uring_submit(log);
+}
+
+
+static ngx_int_t
+ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t                events, prev;
+    uint64_t                data;
+    ngx_int_t               rc;
+    ngx_event_t            *e;
+    ngx_connection_t       *c;
+    ngx_io_uring_accept_t  *q;
+
+    c = ev->data;
+
+    if (ev->accept) {
+        q = ngx_io_uring_accept_queue(c);
+
+        if (q) {
+            q->connection = c;
+
+            /*
+             * the accept being cancelled is added again
+             * by the completion handler
+             */
+
+            if (!q->armed && ngx_io_uring_accept_add(q, ev->log) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            ev->active = 1;
+
+            return NGX_OK;
+        }
+    }
+
+    if (event == NGX_READ_EVENT) {
+        e = c->write;
+        prev = EPOLLOUT;
+        events = EPOLLIN|EPOLLRDHUP;
+
+    } else {
+        e = c->read;
+        prev = EPOLLIN|EPOLLRDHUP;
+        events = EPOLLOUT;
+    }
+
+    data = (uintptr_t) c | ev->instance;
+
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+    if (flags & NGX_EXCLUSIVE_EVENT) {
+        events = (events & ~EPOLLRDHUP) | EPOLLEXCLUSIVE;
+    }
+#endif
+
+    /*
+     * as with epoll, the poll is level triggered unless NGX_CLEAR_EVENT
+     * is set, e.g., for listening sockets
+     */
+
+    if (e->active) {
+        rc = ngx_io_uring_poll_update(data, events|prev, flags, ev->log);
+
+    } else {
+        rc = ngx_io_uring_poll_add(c->fd, events, flags, data, ev->log);
+    }
+
+    if (rc != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ev->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t                prev;
+    uint64_t                data;
+    ngx_int_t               rc;
+    ngx_event_t            *e;
+    ngx_connection_t       *c;
+    ngx_io_uring_accept_t  *q;
+
+    c = ev->data;
+
+    if (ev->accept) {
+        q = ngx_io_uring_accept_queue(c);
+
+        if (q && q->connection == c) {
+            ev->active = 0;
+
+            /* the accept holds the socket, it is cancelled even on close */
+
+            return q->armed ? ngx_io_uring_accept_cancel(q, ev->log) : NGX_OK;
+        }
+    }
+
+    if (event == NGX_READ_EVENT) {
+        e = c->write;
+        prev = EPOLLOUT;
+
+    } else {
+        e = c->read;
+        prev = EPOLLIN|EPOLLRDHUP;
+    }
+
+    data = (uintptr_t) c | ev->instance;
+
+    ev->active = 0;
+
+    if (flags & NGX_CLOSE_EVENT) {
+
+        /* the poll is removed with the last event before the closing */
+
+        if (e->active) {
+            return NGX_OK;
+        }
+
+        return ngx_io_uring_poll_remove(data, ev->log);
+    }
+
+    if (e->active) {
+        rc = ngx_io_uring_poll_update(data, prev, flags, ev->log);
+
+    } else {
+        rc = ngx_io_uring_poll_remove(data, ev->log);
+    }
+
+    return rc == NGX_OK ? NGX_OK : NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_io_uring_add_connection(ngx_connection_t *c)
+{
+    if (ngx_io_uring_poll_add(c->fd, EPOLLIN|EPOLLOUT|EPOLLRDHUP,
+                              NGX_CLEAR_EVENT,
+                              (uintptr_t) c | c->read->instance, c->log)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    c->read->active = 1;
+    c->write->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_connection(ngx_connection_t *c, ngx_uint_t flags)
+{
+    ngx_int_t  rc;
+
+    if ((flags & NGX_CLOSE_EVENT) && !c->read->active && !c->write->active) {
+        return NGX_OK;
+    }
+
+    rc = ngx_io_uring_poll_remove((uintptr_t) c | c->read->instance, c->log);
+
+    c->read->active = 0;
+    c->write->active = 0;
+
+    return rc;
+}
+
+
+#if (NGX_SSL && NGX_SSL_ASYNC)
+
+static ngx_int_t
+ngx_io_uring_add_async_connection(ngx_connection_t *c)
+{
+    uint64_t  data;
+
+    data = (uintptr_t) c | (c->async->async << 1) | c->async->instance;
+
+    if (ngx_io_uring_poll_add(c->async_fd, EPOLLIN|EPOLLOUT|EPOLLRDHUP,
+                              NGX_CLEAR_EVENT, data, c->log)
+        != NGX_OK)
+    {
+        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                      "async add conn io_uring poll %d failed", c->async_fd);
+        return NGX_ERROR;
+    }
+
+    c->async->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_async_connection(ngx_connection_t *c, ngx_uint_t flags)
+{
+    uint64_t   data;
+    ngx_int_t  rc;
+
+    data = (uintptr_t) c | (c->async->async << 1) | c->async->instance;
+
+    rc = ngx_io_uring_poll_remove(data, c->log);
+
+    if (rc != NGX_OK) {
+        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                      "async del conn io_uring poll %d failed", c->async_fd);
+    }
+
+    c->async_fd = -1;
+    c->async->active = 0;
+
+    return rc;
+}
+
+#endif
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_io_uring_notify(ngx_event_handler_pt handler)
+{
+    static uint64_t inc = 1;
+
+    notify_event.data = handler;
+
+    if ((size_t) write(notify_fd, &inc, sizeof(uint64_t)) != sizeof(uint64_t)) {
+        ngx_log_error(NGX_LOG_ALERT, notify_event.log, ngx_errno,
+                      "write() to eventfd %d failed", notify_fd);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+#if (NGX_HAVE_FILE_AIO)
+
+ngx_int_t
+ngx_io_uring_read(ngx_event_t *ev, ngx_fd_t fd, u_char *buf, size_t size,
+    off_t offset)
+{
+    struct io_uring_sqe  *sqe;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring read: fd:%d %p:%uz @%O", fd, buf, size, offset);
+
+    sqe = ngx_io_uring_get_sqe(ev->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = (uint64_t) (uintptr_t) ev | NGX_IO_URING_AIO;
+
+    return NGX_OK;
+}
+
+#endif
+
+
+ngx_socket_t
+ngx_io_uring_accept(ngx_connection_t *lc, struct sockaddr *sa,
+    socklen_t *socklen)
+{
+    ngx_socket_t            s;
+    ngx_io_uring_accept_t  *q;
+
+    q = ngx_io_uring_accept_queue(lc);
+
+    if (q == NULL || q->connection != lc) {
+        return accept4(lc->fd, sa, socklen, SOCK_NONBLOCK);
+    }
+
+    if (q->n == 0) {
+        ngx_set_socket_errno(NGX_EAGAIN);
+        return (ngx_socket_t) -1;
+    }
+
+    s = q->fds[q->head];
+
+    q->head = (q->head + 1) & (q->size - 1);
+    q->n--;
+    accept_queued--;
+
+    if (s < 0) {
+        ngx_set_socket_errno(-s);
+        return (ngx_socket_t) -1;
+    }
+
+    /* the multishot accept does not return the addresses */
+
+    if (getpeername(s, sa, socklen) == -1) {
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, lc->log, ngx_socket_errno,
+                       "io_uring accept: getpeername(%d) on %V failed",
+                       s, &lc->listening->addr_text);
+
+        if (ngx_close_socket(s) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, lc->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+
+        /* the connection was reset before it was handled, as accept() does */
+
+        ngx_set_socket_errno(NGX_ECONNABORTED);
+        return (ngx_socket_t) -1;
+    }
+
+    return s;
+}
+
+
+static ngx_io_uring_accept_t *
+ngx_io_uring_accept_queue(ngx_connection_t *c)
+{
+    ngx_uint_t        i;
+    ngx_listening_t  *ls;
+
+    ls = c->listening;
+
+    if (!accept_multishot || ls == NULL || ls->type != SOCK_STREAM) {
+        return NULL;
+    }
+
+    i = ls - (ngx_listening_t *) ngx_cycle->listening.elts;
+
+    return (i < naccepts) ? &accepts[i] : NULL;
+}
+
+
+static ngx_int_t
+ngx_io_uring_accept_add(ngx_io_uring_accept_t *q, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring accept add: fd:%d q:%p", q->connection->fd, q);
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = q->connection->fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = (uintptr_t) q | NGX_IO_URING_ACCEPT;
+
+    q->armed = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_accept_cancel(ngx_io_uring_accept_t *q, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring accept cancel: q:%p", q);
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t) q | NGX_IO_URING_ACCEPT;
+    sqe->user_data = (uintptr_t) q | NGX_IO_URING_ACCEPT | NGX_IO_URING_REMOVE;
+
+    /* the listening socket may be closed just after it */
+
+    return ngx_io_uring_submit(log);
+}
+
+
+static void
+ngx_io_uring_accepted(ngx_io_uring_accept_t *q, int res, uint32_t cflags,
+    ngx_log_t *log)
+{
+    ngx_socket_t      *fds;
+    ngx_connection_t  *c;
+
+    c = q->connection;
+
+    if (!(cflags & IORING_CQE_F_MORE)) {
+        q->armed = 0;
+    }
+
+    if (c->fd == -1 || !c->read->accept) {
+
+        /* the listening socket is already closed */
+
+        if (res >= 0 && ngx_close_socket(res) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+
+        return;
+    }
+
+    if (res == -EINVAL && !q->armed) {
+
+        /* the multishot accept appeared in Linux 5.19 */
+
+        if (accept_multishot) {
+            ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                          "io_uring multishot accept is not supported, "
+                          "listening sockets are polled");
+            accept_multishot = 0;
+        }
+
+        if (c->read->active) {
+            c->read->active = 0;
+
+            if (ngx_io_uring_add_event(c->read, NGX_READ_EVENT,
+                                       ngx_use_exclusive_accept
+                                       ? NGX_EXCLUSIVE_EVENT : 0)
+                != NGX_OK)
+            {
+                ngx_log_error(NGX_LOG_ALERT, log, 0,
+                              "io_uring poll on %V failed",
+                              &c->listening->addr_text);
+            }
+        }
+
+        return;
+    }
+
+    if (res != -NGX_ECANCELED) {
+
+        if (q->n == q->size) {
+            fds = ngx_alloc((q->size ? q->size * 2 : 16)
+                            * sizeof(ngx_socket_t), log);
+
+            if (fds == NULL) {
+                if (res >= 0 && ngx_close_socket(res) == -1) {
+                    ngx_log_error(NGX_LOG_ALERT, log, ngx_socket_errno,
+                                  ngx_close_socket_n " failed");
+                }
+
+                goto rearm;
+            }
+
+            /* the queue is unrolled, it starts at 0 then */
+
+            if (q->n) {
+                ngx_memcpy(fds, &q->fds[q->head],
+                           (q->size - q->head) * sizeof(ngx_socket_t));
+                ngx_memcpy(&fds[q->size - q->head], q->fds,
+                           q->head * sizeof(ngx_socket_t));
+            }
+
+            ngx_free(q->fds);
+
+            q->fds = fds;
+            q->head = 0;
+            q->size = q->size ? q->size * 2 : 16;
+        }
+
+        q->fds[(q->head + q->n) & (q->size - 1)] = res;
+        q->n++;
+        accept_queued++;
+    }
+
+rearm:
+
+    /* the kernel terminates a multishot accept on errors */
+
+    if (!q->armed && c->read->active) {
+        (void) ngx_io_uring_accept_add(q, log);
+    }
+}
+
+
+static void
+ngx_io_uring_accept_close(ngx_io_uring_accept_t *q)
+{
+    ngx_socket_t  s;
+
+    while (q->n) {
+        s = q->fds[q->head];
+
+        q->head = (q->head + 1) & (q->size - 1);
+        q->n--;
+        accept_queued--;
+
+        if (s >= 0 && ngx_close_socket(s) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+    }
+}
+
+
+static void
+ngx_io_uring_post_accepts(ngx_uint_t flags)
+{
+    ngx_uint_t              i;
+    ngx_event_t            *rev;
+    ngx_io_uring_accept_t  *q;
+
+    /*
+     * the queued sockets are handled as a level triggered event,
+     * even if the accept is disabled, e.g., without the accept mutex
+     */
+
+    for (i = 0; accept_queued && i < naccepts; i++) {
+        q = &accepts[i];
+
+        if (q->n == 0) {
+            continue;
+        }
+
+        if (q->connection->fd == -1 || !q->connection->read->accept) {
+            ngx_io_uring_accept_close(q);
+            continue;
+        }
+
+        rev = q->connection->read;
+
+        rev->ready = 1;
+
+        if (flags & NGX_POST_EVENTS) {
+            ngx_post_event(rev, &ngx_posted_accept_events);
+
+        } else {
+            rev->handler(rev);
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_io_uring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    int                                n, res;
+    uint32_t                           pending, head, tail, revents, cflags;
+    uint64_t                           data;
+    ngx_int_t                          instance;
+    ngx_uint_t                         level, wait;
+    ngx_err_t                          err;
+    ngx_event_t                       *rev, *wev;
+    ngx_queue_t                       *queue;
+    ngx_connection_t                  *c;
+    struct io_uring_cqe               *cqe;
+    struct __kernel_timespec           ts;
+    struct io_uring_getevents_arg      arg;
+#if (NGX_HAVE_FILE_AIO)
+    ngx_event_t                       *e;
+    ngx_event_aio_t                   *aio;
+#endif
+#if (NGX_SSL && NGX_SSL_ASYNC)
+    ngx_int_t                          async;
+    ngx_event_t                       *aev;
+#endif
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M", timer);
+
+    /* the queued requests are submitted with the wait in one syscall */
+
+    pending = ring.tail - *ring.sq_head;
+
+    ngx_memory_barrier();
+
+    *ring.sq_tail = ring.tail;
+
+    wait = (*ring.cq_head == *ring.cq_tail && accept_queued == 0);
+
+    err = 0;
+
+    if (pending || wait) {
+        ngx_memzero(&arg, sizeof(struct io_uring_getevents_arg));
+
+        if (timer != NGX_TIMER_INFINITE) {
+            ts.tv_sec = timer / 1000;
+            ts.tv_nsec = (timer % 1000) * 1000000;
+
+            arg.ts = (uint64_t) (uintptr_t) &ts;
+        }
+
+        n = io_uring_enter(ring.fd, pending, wait,
+                           wait ? IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG
+                                : 0,
+                           &arg, sizeof(struct io_uring_getevents_arg));
+
+        err = (n == -1) ? ngx_errno : 0;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring_enter: %uD, %d", pending, n);
+
+        if (err == ETIME) {
+            err = 0;
+        }
+    }
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    if (err) {
+        if (err == NGX_EINTR) {
+
+            if (ngx_event_timer_alarm) {
+                ngx_event_timer_alarm = 0;
+                return NGX_OK;
+            }
+
+            level = NGX_LOG_INFO;
+
+        } else {
+            level = NGX_LOG_ALERT;
+        }
+
+        ngx_log_error(level, cycle->log, err, "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    head = *ring.cq_head;
+    tail = *ring.cq_tail;
+
+    ngx_memory_barrier();
+
+    if (head == tail) {
+        if (timer != NGX_TIMER_INFINITE || accept_queued) {
+            ngx_io_uring_post_accepts(flags);
+            return NGX_OK;
+        }
+
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "io_uring_enter() returned no events without timeout");
+        return NGX_ERROR;
+    }
+
+    for ( /* void */ ; head != tail; head++) {
+        cqe = &ring.cqes[head & ring.cq_mask];
+
+        data = cqe->user_data;
+        res = cqe->res;
+        cflags = cqe->flags;
+
+        ngx_memory_barrier();
+
+        *ring.cq_head = head + 1;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: d:%p res:%d f:%uD",
+                       (void *) (uintptr_t) data, res, cflags);
+
+        if (data & (NGX_IO_URING_UPDATE|NGX_IO_URING_REMOVE)) {
+
+            /*
+             * EALREADY means that the poll was triggered and its completion
+             * is not yet posted, so it has been neither changed nor removed
+             */
+
+            if (res == -EALREADY) {
+                ngx_io_uring_retry(data, cycle->log);
+            }
+
+            continue;
+        }
+
+#if (NGX_HAVE_FILE_AIO)
+
+        if (data & NGX_IO_URING_AIO) {
+            e = (ngx_event_t *) (uintptr_t) (data & ~NGX_IO_URING_AIO);
+
+            e->complete = 1;
+            e->active = 0;
+            e->ready = 1;
+
+            aio = e->data;
+            aio->res = res;
+
+            ngx_post_event(e, &ngx_posted_events);
+
+            continue;
+        }
+
+#endif
+
+        if (data & NGX_IO_URING_ACCEPT) {
+            ngx_io_uring_accepted((ngx_io_uring_accept_t *) (uintptr_t)
+                                  (data & ~NGX_IO_URING_ACCEPT),
+                                  res, cflags, cycle->log);
+            continue;
+        }
+
+        if (res == -NGX_ECANCELED) {
+            /* the final completion of a removed poll */
+            continue;
+        }
+
+        c = (ngx_connection_t *) (uintptr_t) data;
+
+        instance = (uintptr_t) c & 1;
+#if (NGX_SSL)
+#if (NGX_SSL_ASYNC)
+        async = ((uintptr_t) c & 2) >> 1;
+#endif
+        c = (ngx_connection_t *) ((uintptr_t) c & (uintptr_t) ~3);
+#else
+        c = (ngx_connection_t *) ((uintptr_t) c & (uintptr_t) ~1);
+#endif
+
+        rev = c->read;
+
+        if (c->fd == -1 || rev->instance != instance) {
+
+            /*
+             * the stale event from a file descriptor
+             * that was just closed in this iteration
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %p", c);
+            continue;
+        }
+
+        if (res < 0) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, -res,
+                          "io_uring poll on fd:%d failed", c->fd);
+
+            revents = EPOLLERR;
+
+        } else if (!(cflags & IORING_CQE_F_MORE)) {
+            revents = (uint32_t) res;
+
+            /*
+             * a oneshot poll has completed, or the kernel has terminated
+             * a multishot one; the poll is added before the handlers are
+             * called, so they may delete or change it as usual, and it is
+             * submitted after them, so a level triggered poll does not
+             * complete again for the events just handled
+             */
+
+#if (NGX_SSL && NGX_SSL_ASYNC)
+            ngx_io_uring_rearm(c, async);
+#else
+            ngx_io_uring_rearm(c, 0);
+#endif
+
+        } else {
+            revents = (uint32_t) res;
+        }
+
+        if (revents & (EPOLLERR|EPOLLHUP)) {
+
+            /*
+             * if the error events were returned, add EPOLLIN and EPOLLOUT
+             * to handle the events at least in one active handler
+             */
+
+            revents |= EPOLLIN|EPOLLOUT;
+        }
+
+#if (NGX_SSL && NGX_SSL_ASYNC)
+        if ((revents & EPOLLIN) && rev->active && !async) {
+#else
+        if ((revents & EPOLLIN) && rev->active) {
+#endif
+
+            if (revents & EPOLLRDHUP) {
+                rev->pending_eof = 1;
+            }
+
+            rev->ready = 1;
+            rev->available = -1;
+
+            if (flags & NGX_POST_EVENTS) {
+                queue = rev->accept ? &ngx_posted_accept_events
+                                    : &ngx_posted_events;
+
+                ngx_post_event(rev, queue);
+
+            } else {
+                rev->handler(rev);
+            }
+        }
+
+        wev = c->write;
+
+#if (NGX_SSL && NGX_SSL_ASYNC)
+        if ((revents & EPOLLOUT) && wev->active && !async) {
+#else
+        if ((revents & EPOLLOUT) && wev->active) {
+#endif
+
+            if (c->fd == -1 || wev->instance != instance) {
+
+                /*
+                 * the stale event from a file descriptor
+                 * that was just closed in this iteration
+                 */
+
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                               "io_uring: stale event %p", c);
+                continue;
+            }
+
+            wev->ready = 1;
+#if (NGX_THREADS)
+            wev->complete = 1;
+#endif
+
+            if (flags & NGX_POST_EVENTS) {
+                ngx_post_event(wev, &ngx_posted_events);
+
+            } else {
+                wev->handler(wev);
+            }
+        }
+
+#if (NGX_SSL && NGX_SSL_ASYNC)
+        aev = c->async;
+
+        if ((revents & EPOLLIN) && aev && aev->active && async) {
+
+            if (c->async_fd == -1 || aev->instance != instance) {
+
+                /*
+                 * the stale event from a file descriptor
+                 * that was just closed in this iteration
+                 */
+
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                               "io_uring: stale event %p", c);
+                continue;
+            }
+
+            aev->ready = 1;
+
+            if (flags & NGX_POST_EVENTS) {
+                ngx_post_event(aev, &ngx_posted_events);
+
+            } else {
+                aev->handler(aev);
+            }
+        }
+#endif
+    }
+
+    ngx_io_uring_post_accepts(flags);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_rearm(ngx_connection_t *c, ngx_uint_t async)
+{
+    uint32_t    events;
+    ngx_uint_t  flags;
+
+#if (NGX_SSL && NGX_SSL_ASYNC)
+
+    if (async) {
+        if (c->async->active && c->async_fd != -1) {
+            (void) ngx_io_uring_poll_add(c->async_fd,
+                                         EPOLLIN|EPOLLOUT|EPOLLRDHUP,
+                                         NGX_CLEAR_EVENT,
+                                         (uintptr_t) c
+                                         | (c->async->async << 1)
+                                         | c->async->instance,
+                                         c->log);
+        }
+
+        return;
+    }
+
+#endif
+
+    events = ngx_io_uring_events(c, &flags);
+
+    if (events) {
+        (void) ngx_io_uring_poll_add(c->fd, events, flags,
+                                     (uintptr_t) c | c->read->instance,
+                                     c->log);
+    }
+}
+
+
+static uint32_t
+ngx_io_uring_events(ngx_connection_t *c, ngx_uint_t *flags)
+{
+    uint32_t  events;
+
+    events = 0;
+
+    if (c->read->active) {
+        events |= EPOLLIN|EPOLLRDHUP;
+    }
+
+    if (c->write->active) {
+        events |= EPOLLOUT;
+    }
+
+    /*
+     * only the listening sockets are polled level triggered,
+     * as the channel sockets are read until EAGAIN
+     */
+
+    if (!c->read->accept) {
+        *flags = NGX_CLEAR_EVENT;
+        return events;
+    }
+
+    *flags = 0;
+
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+    if (ngx_use_exclusive_accept && events) {
+        events = (events & ~EPOLLRDHUP) | EPOLLEXCLUSIVE;
+    }
+#endif
+
+    return events;
+}
+
+
+static void
+ngx_io_uring_retry(uint64_t data, ngx_log_t *log)
+{
+    uint32_t                events;
+    ngx_uint_t              flags;
+    ngx_connection_t       *c;
+    ngx_io_uring_accept_t  *q;
+
+    if (data & NGX_IO_URING_ACCEPT) {
+        q = (ngx_io_uring_accept_t *) (uintptr_t)
+                (data & ~(NGX_IO_URING_ACCEPT|NGX_IO_URING_REMOVE));
+
+        (void) ngx_io_uring_accept_cancel(q, log);
+        return;
+    }
+
+    if (data & NGX_IO_URING_REMOVE) {
+        (void) ngx_io_uring_poll_remove(data & ~NGX_IO_URING_REMOVE, log);
+        return;
+    }
+
+    data &= ~NGX_IO_URING_UPDATE;
+
+    /* the update is repeated with the events the connection has now */
+
+    c = (ngx_connection_t *) (uintptr_t) (data & (uintptr_t) ~3);
+
+#if (NGX_SSL && NGX_SSL_ASYNC)
+    if (data & 2) {
+        return;
+    }
+#endif
+
+    if (c->fd == -1 || c->read->instance != (data & 1)) {
+        return;
+    }
+
+    events = ngx_io_uring_events(c, &flags);
+
+    if (events) {
+        (void) ngx_io_uring_poll_update(data, events, flags, log);
+    }
+}
+
+
+static void *
+ngx_io_uring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_io_uring_conf_t  *iucf;
+
+    iucf = ngx_palloc(cycle->pool, sizeof(ngx_io_uring_conf_t));
+    if (iucf == NULL) {
+        return NULL;
+    }
+
+    iucf->entries = NGX_CONF_UNSET;
+
+    return iucf;
+}
+
+
+static char *
+ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_io_uring_conf_t *iucf = conf;
+
+    ngx_conf_init_uint_value(iucf->entries, 512);
+
+    return NGX_CONF_OK;
+}
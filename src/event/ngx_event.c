@@ -188,6 +188,17 @@ static ngx_command_t  ngx_event_core_commands[] = {
       offsetof(ngx_event_conf_t, accept_mutex_delay),
       NULL },
 
+#if (T_NGX_TIMER_WHEEL)
+
+    { ngx_string("timer_wheel"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_event_conf_t, timer_wheel),
+      NULL },
+
+#endif
+
     { ngx_string("debug_connection"),
       NGX_EVENT_CONF|NGX_CONF_TAKE1,
       ngx_event_debug_connection,
@@ -748,6 +759,16 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         return NGX_ERROR;
     }
 
+#if (T_NGX_TIMER_WHEEL)
+
+    if (ecf->timer_wheel
+        && ngx_event_timer_wheel_init(cycle) == NGX_ERROR)
+    {
+        return NGX_ERROR;
+    }
+
+#endif
+
     for (m = 0; cycle->modules[m]; m++) {
         if (cycle->modules[m]->type != NGX_EVENT_MODULE) {
             continue;
@@ -1368,6 +1389,9 @@ ngx_event_core_create_conf(ngx_cycle_t *cycle)
     ecf->multi_accept = NGX_CONF_UNSET;
     ecf->accept_mutex = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
+#if (T_NGX_TIMER_WHEEL)
+    ecf->timer_wheel = NGX_CONF_UNSET;
+#endif
     ecf->name = (void *) NGX_CONF_UNSET;
 
 #if (NGX_DEBUG)
@@ -1473,6 +1497,10 @@ ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)
                             500);
 #endif
 
+#if (T_NGX_TIMER_WHEEL)
+    ngx_conf_init_value(ecf->timer_wheel, 0);
+#endif
+
     return NGX_CONF_OK;
 }
 
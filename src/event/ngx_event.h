@@ -77,6 +77,10 @@ struct ngx_event_s {
 
     unsigned         timedout:1;
     unsigned         timer_set:1;
+#if (T_NGX_TIMER_WHEEL)
+    /* the timer is in the timer wheel rather than in the rbtree */
+    unsigned         timer_wheel:1;
+#endif
 
     unsigned         delayed:1;
 
@@ -183,6 +187,11 @@ struct ngx_event_aio_s {
     ngx_event_t                event;
 };
 
+#if (NGX_HAVE_IO_URING)
+ngx_int_t ngx_io_uring_read(ngx_event_t *ev, ngx_fd_t fd, u_char *buf,
+    size_t size, off_t offset);
+#endif
+
 #endif
 
 
@@ -215,6 +224,12 @@ extern ngx_event_actions_t   ngx_event_actions;
 #if (NGX_HAVE_EPOLLRDHUP)
 extern ngx_uint_t            ngx_use_epoll_rdhup;
 #endif
+#if (NGX_HAVE_IO_URING)
+extern ngx_uint_t            ngx_use_io_uring;
+
+ngx_socket_t ngx_io_uring_accept(ngx_connection_t *lc, struct sockaddr *sa,
+    socklen_t *socklen);
+#endif
 #if (T_NGX_ACCEPT_FILTER)
 typedef ngx_int_t (*ngx_event_accept_filter_pt) (ngx_connection_t *c);
 extern ngx_event_accept_filter_pt ngx_event_top_accept_filter;
@@ -472,6 +487,10 @@ typedef struct {
 
     ngx_msec_t    accept_mutex_delay;
 
+#if (T_NGX_TIMER_WHEEL)
+    ngx_flag_t    timer_wheel;
+#endif
+
     u_char       *name;
 
 #if (NGX_DEBUG)
@@ -2189,6 +2189,37 @@ ngx_ssl_early_data(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable)
 }
 
 
+#if (T_NGX_SSL_KTLS)
+
+ngx_int_t
+ngx_ssl_ktls(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable)
+{
+    if (!enable) {
+        return NGX_OK;
+    }
+
+#ifdef SSL_OP_ENABLE_KTLS
+
+    /*
+     * OpenSSL switches the connection to the kernel TLS after the handshake
+     * if the kernel and the negotiated cipher allow it, and silently keeps
+     * the user-space records otherwise; the result is checked with
+     * BIO_get_ktls_send() for each connection
+     */
+
+    SSL_CTX_set_options(ssl->ctx, SSL_OP_ENABLE_KTLS);
+
+#else
+    ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
+                  "\"ssl_ktls\" is not supported on this platform, ignored");
+#endif
+
+    return NGX_OK;
+}
+
+#endif
+
+
 ngx_int_t
 ngx_ssl_conf_commands(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *commands)
 {
@@ -3595,6 +3626,23 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                 break;
             }
 
+#if (T_NGX_SSL_KTLS)
+
+            /*
+             * with the kernel TLS the records are built by the kernel from
+             * the data passed to SSL_write(), so large memory bufs are sent
+             * in place instead of being copied to our buffer first
+             */
+
+            if (c->ssl->sendfile
+                && buf->pos == buf->last
+                && in->buf->last - in->buf->pos >= buf->end - buf->start)
+            {
+                flush = 1;
+                break;
+            }
+#endif
+
             size = in->buf->last - in->buf->pos;
 
             if (size > buf->end - buf->last) {
@@ -3652,6 +3700,56 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                 continue;
             }
 
+#if (T_NGX_SSL_KTLS)
+
+            if (in && c->ssl->sendfile && !in->buf->in_file && send < limit) {
+
+                /*
+                 * the buf is written up to the limit, but SSL_write()
+                 * blocked before is retried with no less than the same
+                 * length, as OpenSSL requires
+                 */
+
+                size = in->buf->last - in->buf->pos;
+
+                if (send + size > limit) {
+                    size = (ssize_t) (limit - send);
+                }
+
+                if ((size_t) size < c->ssl->write_size) {
+                    size = ngx_min(c->ssl->write_size,
+                                   (size_t) (in->buf->last - in->buf->pos));
+                }
+
+                n = ngx_ssl_write(c, in->buf->pos, size);
+
+                if (n == NGX_ERROR) {
+                    return NGX_CHAIN_ERROR;
+                }
+
+                if (n == NGX_AGAIN) {
+                    c->ssl->write_size = size;
+                    break;
+                }
+
+                c->ssl->write_size = 0;
+
+                in->buf->pos += n;
+                send += n;
+                flush = 0;
+
+                if (in->buf->pos == in->buf->last) {
+                    in = in->next;
+                }
+
+                if (n < size) {
+                    break;
+                }
+
+                continue;
+            }
+#endif
+
             buf->flush = 0;
             c->buffered &= ~NGX_SSL_BUFFERED;
 
@@ -7226,6 +7324,40 @@ ngx_ssl_get_client_v_remain(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
 }
 
 
+#if (T_NGX_SSL_KTLS)
+
+ngx_int_t
+ngx_ssl_get_ktls(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+#if (defined BIO_get_ktls_send && !NGX_WIN32)
+    ngx_uint_t  tx, rx;
+
+    tx = BIO_get_ktls_send(SSL_get_wbio(c->ssl->connection)) == 1;
+    rx = BIO_get_ktls_recv(SSL_get_rbio(c->ssl->connection)) == 1;
+
+    if (tx && rx) {
+        ngx_str_set(s, "send,recv");
+
+    } else if (tx) {
+        ngx_str_set(s, "send");
+
+    } else if (rx) {
+        ngx_str_set(s, "recv");
+
+    } else {
+        ngx_str_set(s, "off");
+    }
+
+#else
+    ngx_str_set(s, "off");
+#endif
+
+    return NGX_OK;
+}
+
+#endif
+
+
 #if (T_NGX_SSL_HANDSHAKE_TIME)
 
 ngx_int_t
@@ -134,6 +134,10 @@ struct ngx_ssl_connection_s {
 
     ngx_ssl_ocsp_t             *ocsp;
 
+#if (T_NGX_SSL_KTLS)
+    size_t                      write_size;
+#endif
+
     u_char                      early_buf;
 
 #if (T_NGX_SSL_HANDSHAKE_TIME)
@@ -312,6 +316,9 @@ ngx_int_t ngx_ssl_ech_files(ngx_conf_t *cf, ngx_ssl_t *ssl,
 ngx_int_t ngx_ssl_ecdh_curve(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *name);
 ngx_int_t ngx_ssl_early_data(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_uint_t enable);
+#if (T_NGX_SSL_KTLS)
+ngx_int_t ngx_ssl_ktls(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable);
+#endif
 ngx_int_t ngx_ssl_conf_commands(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_array_t *commands);
 
@@ -415,6 +422,10 @@ ngx_int_t ngx_ssl_get_client_v_remain(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
 ngx_int_t ngx_ssl_get_client_sigalg(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
+#if (T_NGX_SSL_KTLS)
+ngx_int_t ngx_ssl_get_ktls(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s);
+#endif
 #if (T_NGX_SSL_HANDSHAKE_TIME)
 ngx_int_t ngx_ssl_get_handshake_time(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
@@ -18,6 +18,15 @@ static ngx_int_t ngx_event_pipe_write_chain_to_temp_file(ngx_event_pipe_t *p);
 static ngx_inline void ngx_event_pipe_remove_shadow_links(ngx_buf_t *buf);
 static ngx_int_t ngx_event_pipe_drain_chains(ngx_event_pipe_t *p);
 
+#if (T_NGX_SEND_ZEROCOPY)
+static ngx_buf_t *ngx_event_pipe_zerocopy_buf(ngx_event_pipe_t *p);
+static void ngx_event_pipe_zerocopy_cleanup(void *data);
+static ngx_int_t ngx_event_pipe_free_sent(ngx_event_pipe_t *p, ngx_buf_t *b);
+static ngx_int_t ngx_event_pipe_zerocopy_release(ngx_event_pipe_t *p);
+#else
+#define ngx_event_pipe_free_sent  ngx_event_pipe_add_free_buf
+#endif
+
 
 ngx_int_t
 ngx_event_pipe(ngx_event_pipe_t *p, ngx_int_t do_write)
@@ -90,6 +99,14 @@ ngx_event_pipe(ngx_event_pipe_t *p, ngx_int_t do_write)
             if (wev->active && !wev->ready) {
                 ngx_add_timer(wev, p->send_timeout);
 
+#if (T_NGX_SEND_ZEROCOPY)
+            } else if (p->zerocopy_wait) {
+
+                /* the completions are reported with the write event */
+
+                ngx_add_timer(wev, p->send_timeout);
+#endif
+
             } else if (wev->timer_set) {
                 ngx_del_timer(wev);
             }
@@ -140,6 +157,10 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, p->log, 0,
                    "pipe read upstream: %d", p->upstream->read->ready);
 
+#if (T_NGX_SEND_ZEROCOPY)
+    p->zerocopy_wait = 0;
+#endif
+
     for ( ;; ) {
 
         if (p->upstream_eof || p->upstream_error || p->upstream_done) {
@@ -221,6 +242,14 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
                 limit = 0;
             }
 
+#if (T_NGX_SEND_ZEROCOPY)
+            if (p->free_raw_bufs == NULL && p->zerocopy_busy) {
+                if (ngx_event_pipe_zerocopy_release(p) != NGX_OK) {
+                    return NGX_ABORT;
+                }
+            }
+#endif
+
             if (p->free_raw_bufs) {
 
                 /* use the free bufs if they exist */
@@ -237,7 +266,12 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
 
                 /* allocate a new buf if it's still allowed */
 
+#if (T_NGX_SEND_ZEROCOPY)
+                b = p->zerocopy ? ngx_event_pipe_zerocopy_buf(p)
+                                : ngx_create_temp_buf(p->pool, p->bufs.size);
+#else
                 b = ngx_create_temp_buf(p->pool, p->bufs.size);
+#endif
                 if (b == NULL) {
                     return NGX_ABORT;
                 }
@@ -252,6 +286,22 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
                 chain->buf = b;
                 chain->next = NULL;
 
+#if (T_NGX_SEND_ZEROCOPY)
+            } else if (p->zerocopy_busy && p->in == NULL && p->out == NULL) {
+
+                /*
+                 * all the bufs are sent, but the kernel still uses them,
+                 * wait for the completions
+                 */
+
+                p->zerocopy_wait = 1;
+
+                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                               "pipe wait for zerocopy completions");
+
+                break;
+#endif
+
             } else if (!p->cacheable
                        && p->downstream->data == p->output_ctx
                        && p->downstream->write->ready
@@ -723,7 +773,7 @@ ngx_event_pipe_write_to_downstream(ngx_event_pipe_t *p)
             /* add the free shadow raw buf to p->free_raw_bufs */
 
             if (cl->buf->last_shadow) {
-                if (ngx_event_pipe_add_free_buf(p, cl->buf->shadow) != NGX_OK) {
+                if (ngx_event_pipe_free_sent(p, cl->buf->shadow) != NGX_OK) {
                     return NGX_ABORT;
                 }
 
@@ -1129,7 +1179,7 @@ ngx_event_pipe_drain_chains(ngx_event_pipe_t *p)
 
         while (cl) {
             if (cl->buf->last_shadow) {
-                if (ngx_event_pipe_add_free_buf(p, cl->buf->shadow) != NGX_OK) {
+                if (ngx_event_pipe_free_sent(p, cl->buf->shadow) != NGX_OK) {
                     return NGX_ABORT;
                 }
 
@@ -1144,3 +1194,157 @@ ngx_event_pipe_drain_chains(ngx_event_pipe_t *p)
         }
     }
 }
+
+
+#if (T_NGX_SEND_ZEROCOPY)
+
+/*
+ * The raw bufs of the zero-copy sends are allocated from one anonymous
+ * mapping: the request pool may be destroyed before the kernel has sent
+ * them, and munmap() leaves the pinned pages to the kernel while the freed
+ * heap memory could be reused and sent changed.
+ */
+
+static ngx_buf_t *
+ngx_event_pipe_zerocopy_buf(ngx_event_pipe_t *p)
+{
+    size_t               size;
+    ngx_buf_t           *b;
+    ngx_pool_cleanup_t  *cln;
+
+    size = ngx_align(p->bufs.size, ngx_pagesize);
+
+    if (p->zerocopy_bufs == NULL) {
+        cln = ngx_pool_cleanup_add(p->pool, 0);
+        if (cln == NULL) {
+            return NULL;
+        }
+
+        p->zerocopy_bufs = mmap(NULL, size * p->bufs.num,
+                                PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON,
+                                -1, 0);
+
+        if (p->zerocopy_bufs == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_ALERT, p->log, ngx_errno,
+                          "mmap(MAP_ANON, %uz) failed", size * p->bufs.num);
+            p->zerocopy_bufs = NULL;
+            return NULL;
+        }
+
+        cln->handler = ngx_event_pipe_zerocopy_cleanup;
+        cln->data = p;
+    }
+
+    b = ngx_calloc_buf(p->pool);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->start = p->zerocopy_bufs + size * p->allocated;
+    b->pos = b->start;
+    b->last = b->start;
+    b->end = b->start + p->bufs.size;
+    b->temporary = 1;
+    b->zerocopy = 1;
+
+    return b;
+}
+
+
+static void
+ngx_event_pipe_zerocopy_cleanup(void *data)
+{
+    ngx_event_pipe_t  *p = data;
+    size_t             size;
+
+    size = ngx_align(p->bufs.size, ngx_pagesize) * p->bufs.num;
+
+    if (munmap(p->zerocopy_bufs, size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, p->log, ngx_errno,
+                      "munmap(%p, %uz) failed", p->zerocopy_bufs, size);
+    }
+}
+
+
+/*
+ * a raw buf sent with MSG_ZEROCOPY is kept until all the sends done so far
+ * are completed, and then added to p->free_raw_bufs
+ */
+
+static ngx_int_t
+ngx_event_pipe_free_sent(ngx_event_pipe_t *p, ngx_buf_t *b)
+{
+    ngx_zerocopy_t             *zc;
+    ngx_event_pipe_zerocopy_t  *z;
+
+    zc = p->downstream->zerocopy;
+
+    if (!b->zerocopy || zc == NULL || zc->done == zc->sent) {
+        return ngx_event_pipe_add_free_buf(p, b);
+    }
+
+    z = p->zerocopy_free;
+
+    if (z) {
+        p->zerocopy_free = z->next;
+
+    } else {
+        z = ngx_palloc(p->pool, sizeof(ngx_event_pipe_zerocopy_t));
+        if (z == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                   "pipe zerocopy busy buf %p #%uD", b->start, zc->sent);
+
+    b->shadow = NULL;
+
+    z->buf = b;
+    z->seq = zc->sent;
+    z->next = NULL;
+
+    if (p->zerocopy_busy == NULL) {
+        p->zerocopy_last = &p->zerocopy_busy;
+    }
+
+    *p->zerocopy_last = z;
+    p->zerocopy_last = &z->next;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_event_pipe_zerocopy_release(ngx_event_pipe_t *p)
+{
+    ngx_zerocopy_t             *zc;
+    ngx_event_pipe_zerocopy_t  *z;
+
+    if (p->downstream->fd == (ngx_socket_t) -1) {
+        return NGX_OK;
+    }
+
+    zc = p->downstream->zerocopy;
+
+    ngx_linux_zerocopy_complete(p->downstream);
+
+    while (p->zerocopy_busy && ngx_zerocopy_done(zc, p->zerocopy_busy->seq)) {
+        z = p->zerocopy_busy;
+        p->zerocopy_busy = z->next;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                       "pipe zerocopy free buf %p #%uD", z->buf->start, z->seq);
+
+        if (ngx_event_pipe_add_free_buf(p, z->buf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        z->next = p->zerocopy_free;
+        p->zerocopy_free = z;
+    }
+
+    return NGX_OK;
+}
+
+#endif
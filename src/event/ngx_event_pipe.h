@@ -22,6 +22,21 @@ typedef ngx_int_t (*ngx_event_pipe_output_filter_pt)(void *data,
                                                      ngx_chain_t *chain);
 
 
+#if (T_NGX_SEND_ZEROCOPY)
+
+typedef struct ngx_event_pipe_zerocopy_s  ngx_event_pipe_zerocopy_t;
+
+/* a sent raw buf, still used by the kernel until the send is completed */
+
+struct ngx_event_pipe_zerocopy_s {
+    ngx_buf_t                  *buf;
+    uint32_t                    seq;
+    ngx_event_pipe_zerocopy_t  *next;
+};
+
+#endif
+
+
 struct ngx_event_pipe_s {
     ngx_connection_t  *upstream;
     ngx_connection_t  *downstream;
@@ -66,6 +81,10 @@ struct ngx_event_pipe_s {
     unsigned           downstream_error:1;
     unsigned           cyclic_temp_file:1;
     unsigned           aio:1;
+#if (T_NGX_SEND_ZEROCOPY)
+    unsigned           zerocopy:1;
+    unsigned           zerocopy_wait:1;
+#endif
 
     ngx_int_t          allocated;
     ngx_bufs_t         bufs;
@@ -95,6 +114,13 @@ struct ngx_event_pipe_s {
 
     ngx_temp_file_t   *temp_file;
 
+#if (T_NGX_SEND_ZEROCOPY)
+    u_char                      *zerocopy_bufs;
+    ngx_event_pipe_zerocopy_t   *zerocopy_busy;
+    ngx_event_pipe_zerocopy_t  **zerocopy_last;
+    ngx_event_pipe_zerocopy_t   *zerocopy_free;
+#endif
+
     /* STUB */ int     num;
 };
 
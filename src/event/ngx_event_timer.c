@@ -13,6 +13,18 @@
 ngx_rbtree_t              ngx_event_timer_rbtree;
 static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 
+#if (T_NGX_TIMER_WHEEL)
+
+static ngx_int_t ngx_event_timer_wheel_insert(ngx_event_t *ev);
+static void ngx_event_timer_wheel_advance(void);
+static void ngx_event_timer_wheel_cascade(ngx_uint_t level, ngx_msec_t tick);
+static ngx_msec_t ngx_event_timer_wheel_find(void);
+
+ngx_event_timer_wheel_t         *ngx_event_timer_wheel;
+static ngx_event_timer_wheel_t   ngx_event_timer_wheel_data;
+
+#endif
+
 /*
  * the event timer rbtree may contain the duplicate keys, however,
  * it should not be a problem, because we use the rbtree to find
@@ -29,15 +41,291 @@ ngx_event_timer_init(ngx_log_t *log)
 }
 
 
+#if (T_NGX_TIMER_WHEEL)
+
+/*
+ * The hierarchical timer wheel keeps the timers that are not due soon,
+ * such as keepalive and read timeouts which are mostly deleted before
+ * they expire, so they are added and deleted in O(1).  When the time of
+ * a timer comes within a tick or two, it is moved to the rbtree, which
+ * still gives the exact expiration order and the nearest timer value.
+ */
+
+ngx_int_t
+ngx_event_timer_wheel_init(ngx_cycle_t *cycle)
+{
+    ngx_uint_t          i, n;
+    ngx_rbtree_node_t  *head;
+
+    ngx_event_timer_wheel = &ngx_event_timer_wheel_data;
+
+    for (i = 0; i < NGX_TIMER_WHEEL_LEVELS; i++) {
+        for (n = 0; n < NGX_TIMER_WHEEL_SIZE; n++) {
+            head = &ngx_event_timer_wheel->slots[i][n];
+
+            head->left = head;
+            head->right = head;
+        }
+    }
+
+    ngx_event_timer_wheel->count = 0;
+    ngx_event_timer_wheel->next = (ngx_current_msec >> NGX_TIMER_WHEEL_TICK)
+                                  + 2;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, cycle->log, 0, "timer wheel init");
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_event_timer_wheel_add(ngx_event_t *ev)
+{
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = ngx_event_timer_wheel;
+
+    if (wheel->count == 0) {
+
+        /* the ticks of the empty wheel are not processed */
+
+        wheel->next = (ngx_current_msec >> NGX_TIMER_WHEEL_TICK) + 2;
+    }
+
+    return ngx_event_timer_wheel_insert(ev);
+}
+
+
+static ngx_int_t
+ngx_event_timer_wheel_insert(ngx_event_t *ev)
+{
+    ngx_msec_t                tick, idx;
+    ngx_uint_t                level;
+    ngx_rbtree_node_t        *head;
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = ngx_event_timer_wheel;
+
+    tick = ev->timer.key >> NGX_TIMER_WHEEL_TICK;
+    idx = tick - wheel->next;
+
+    if ((ngx_msec_int_t) idx < 0) {
+        return NGX_DECLINED;
+    }
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        if (idx < ((ngx_msec_t) 1 << (NGX_TIMER_WHEEL_BITS * (level + 1)))) {
+            break;
+        }
+    }
+
+    if (level == NGX_TIMER_WHEEL_LEVELS) {
+        return NGX_DECLINED;
+    }
+
+    head = &wheel->slots[level][(tick >> (NGX_TIMER_WHEEL_BITS * level))
+                                & NGX_TIMER_WHEEL_MASK];
+
+    ev->timer.left = head->left;
+    ev->timer.right = head;
+    head->left->right = &ev->timer;
+    head->left = &ev->timer;
+
+    wheel->count++;
+    ev->timer_wheel = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_event_timer_wheel_advance(void)
+{
+    ngx_msec_t                now;
+    ngx_uint_t                idx;
+    ngx_event_t              *ev;
+    ngx_rbtree_node_t        *head, *node;
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = ngx_event_timer_wheel;
+
+    /* the timers of the next tick are moved in advance */
+
+    now = (ngx_current_msec >> NGX_TIMER_WHEEL_TICK) + 1;
+
+    while (wheel->count && (ngx_msec_int_t) (now - wheel->next) >= 0) {
+        idx = wheel->next & NGX_TIMER_WHEEL_MASK;
+
+        if (idx == 0) {
+            ngx_event_timer_wheel_cascade(1, wheel->next);
+        }
+
+        head = &wheel->slots[0][idx];
+
+        while (head->right != head) {
+            node = head->right;
+
+            head->right = node->right;
+            node->right->left = head;
+
+            ev = ngx_rbtree_data(node, ngx_event_t, timer);
+
+            ev->timer_wheel = 0;
+            wheel->count--;
+
+            ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+        }
+
+        wheel->next++;
+    }
+
+    if (wheel->count == 0) {
+        wheel->next = now + 1;
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_cascade(ngx_uint_t level, ngx_msec_t tick)
+{
+    ngx_uint_t                idx;
+    ngx_event_t              *ev;
+    ngx_rbtree_node_t        *head, *node;
+    ngx_event_timer_wheel_t  *wheel;
+
+    if (level == NGX_TIMER_WHEEL_LEVELS) {
+        return;
+    }
+
+    wheel = ngx_event_timer_wheel;
+
+    idx = (tick >> (NGX_TIMER_WHEEL_BITS * level)) & NGX_TIMER_WHEEL_MASK;
+
+    if (idx == 0) {
+        ngx_event_timer_wheel_cascade(level + 1, tick);
+    }
+
+    /* the timers of the slot are distributed over the lower levels */
+
+    head = &wheel->slots[level][idx];
+    node = head->right;
+
+    head->left = head;
+    head->right = head;
+
+    while (node != head) {
+        ev = ngx_rbtree_data(node, ngx_event_t, timer);
+        node = node->right;
+
+        ev->timer_wheel = 0;
+        wheel->count--;
+
+        if (ngx_event_timer_wheel_insert(ev) != NGX_OK) {
+            ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+        }
+    }
+}
+
+
+static ngx_msec_t
+ngx_event_timer_wheel_find(void)
+{
+    ngx_msec_t                tick;
+    ngx_msec_int_t            timer;
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = ngx_event_timer_wheel;
+
+    if (wheel->count == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    /*
+     * the next tick with the timers in the first level,
+     * or the next cascade of the upper levels
+     */
+
+    for (tick = wheel->next; /* void */ ; tick++) {
+        if ((tick & NGX_TIMER_WHEEL_MASK) == 0
+            || wheel->slots[0][tick & NGX_TIMER_WHEEL_MASK].right
+               != &wheel->slots[0][tick & NGX_TIMER_WHEEL_MASK])
+        {
+            break;
+        }
+    }
+
+    timer = (ngx_msec_int_t) (((tick - 1) << NGX_TIMER_WHEEL_TICK)
+                              - ngx_current_msec);
+
+    return (ngx_msec_t) (timer > 0 ? timer : 0);
+}
+
+
+void
+ngx_event_timer_wheel_flush(void)
+{
+    ngx_uint_t                i, n;
+    ngx_event_t              *ev;
+    ngx_rbtree_node_t        *head, *node;
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = ngx_event_timer_wheel;
+
+    if (wheel == NULL) {
+        return;
+    }
+
+    /* all the timers are moved to the rbtree, e.g., to be walked over */
+
+    for (i = 0; i < NGX_TIMER_WHEEL_LEVELS; i++) {
+        for (n = 0; n < NGX_TIMER_WHEEL_SIZE; n++) {
+            head = &wheel->slots[i][n];
+
+            while (head->right != head) {
+                node = head->right;
+
+                head->right = node->right;
+                node->right->left = head;
+
+                ev = ngx_rbtree_data(node, ngx_event_t, timer);
+
+                ev->timer_wheel = 0;
+                wheel->count--;
+
+                ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+            }
+        }
+    }
+}
+
+#endif
+
+
 ngx_msec_t
 ngx_event_find_timer(void)
 {
     ngx_msec_int_t      timer;
     ngx_rbtree_node_t  *node, *root, *sentinel;
+#if (T_NGX_TIMER_WHEEL)
+    ngx_msec_t          wheel;
+
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_advance();
+        wheel = ngx_event_timer_wheel_find();
+
+    } else {
+        wheel = NGX_TIMER_INFINITE;
+    }
+
+    if (ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel) {
+        return wheel;
+    }
+#else
 
     if (ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel) {
         return NGX_TIMER_INFINITE;
     }
+#endif
 
     root = ngx_event_timer_rbtree.root;
     sentinel = ngx_event_timer_rbtree.sentinel;
@@ -46,6 +334,12 @@ ngx_event_find_timer(void)
 
     timer = (ngx_msec_int_t) (node->key - ngx_current_msec);
 
+#if (T_NGX_TIMER_WHEEL)
+    if (timer > 0 && (ngx_msec_t) timer > wheel) {
+        return wheel;
+    }
+#endif
+
     return (ngx_msec_t) (timer > 0 ? timer : 0);
 }
 
@@ -56,6 +350,12 @@ ngx_event_expire_timers(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+#if (T_NGX_TIMER_WHEEL)
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_advance();
+    }
+#endif
+
     sentinel = ngx_event_timer_rbtree.sentinel;
 
     for ( ;; ) {
@@ -102,6 +402,27 @@ ngx_event_no_timers_left(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+#if (T_NGX_TIMER_WHEEL)
+    ngx_uint_t          i, n;
+    ngx_rbtree_node_t  *head;
+
+    if (ngx_event_timer_wheel && ngx_event_timer_wheel->count) {
+        for (i = 0; i < NGX_TIMER_WHEEL_LEVELS; i++) {
+            for (n = 0; n < NGX_TIMER_WHEEL_SIZE; n++) {
+                head = &ngx_event_timer_wheel->slots[i][n];
+
+                for (node = head->right; node != head; node = node->right) {
+                    ev = ngx_rbtree_data(node, ngx_event_t, timer);
+
+                    if (!ev->cancelable) {
+                        return NGX_AGAIN;
+                    }
+                }
+            }
+        }
+    }
+#endif
+
     sentinel = ngx_event_timer_rbtree.sentinel;
     root = ngx_event_timer_rbtree.root;
 
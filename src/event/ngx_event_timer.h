@@ -19,14 +19,50 @@
 #define NGX_TIMER_LAZY_DELAY  300
 
 
+#if (T_NGX_TIMER_WHEEL)
+
+/*
+ * the wheel has 4 levels of 64 slots, a tick is 128 ms: a level covers
+ * 8.2 s, 8.7 min, 9.3 hours and 24.8 days
+ */
+
+#define NGX_TIMER_WHEEL_TICK    7
+#define NGX_TIMER_WHEEL_BITS    6
+#define NGX_TIMER_WHEEL_SIZE    (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_MASK    (NGX_TIMER_WHEEL_SIZE - 1)
+#define NGX_TIMER_WHEEL_LEVELS  4
+
+
+typedef struct {
+    /* the next tick whose timers are moved to the rbtree */
+    ngx_msec_t          next;
+    ngx_uint_t          count;
+
+    /* the list heads, the timers are linked through timer.left and right */
+    ngx_rbtree_node_t   slots[NGX_TIMER_WHEEL_LEVELS][NGX_TIMER_WHEEL_SIZE];
+} ngx_event_timer_wheel_t;
+
+#endif
+
+
 ngx_int_t ngx_event_timer_init(ngx_log_t *log);
 ngx_msec_t ngx_event_find_timer(void);
 void ngx_event_expire_timers(void);
 ngx_int_t ngx_event_no_timers_left(void);
 
+#if (T_NGX_TIMER_WHEEL)
+ngx_int_t ngx_event_timer_wheel_init(ngx_cycle_t *cycle);
+ngx_int_t ngx_event_timer_wheel_add(ngx_event_t *ev);
+void ngx_event_timer_wheel_flush(void);
+#endif
+
 
 extern ngx_rbtree_t  ngx_event_timer_rbtree;
 
+#if (T_NGX_TIMER_WHEEL)
+extern ngx_event_timer_wheel_t  *ngx_event_timer_wheel;
+#endif
+
 
 static ngx_inline void
 ngx_event_del_timer(ngx_event_t *ev)
@@ -35,7 +71,20 @@ ngx_event_del_timer(ngx_event_t *ev)
                    "event timer del: %d: %M",
                     ngx_event_ident(ev->data), ev->timer.key);
 
+#if (T_NGX_TIMER_WHEEL)
+    if (ev->timer_wheel) {
+        ev->timer.left->right = ev->timer.right;
+        ev->timer.right->left = ev->timer.left;
+
+        ngx_event_timer_wheel->count--;
+        ev->timer_wheel = 0;
+
+    } else {
+        ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+    }
+#else
     ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+#endif
 
 #if (NGX_DEBUG)
     ev->timer.left = NULL;
@@ -81,7 +130,19 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
                    "event timer add: %d: %M:%M",
                     ngx_event_ident(ev->data), timer, ev->timer.key);
 
+#if (T_NGX_TIMER_WHEEL)
+
+    /* the timers that are due soon are kept in the rbtree */
+
+    if (ngx_event_timer_wheel == NULL
+        || ngx_event_timer_wheel_add(ev) != NGX_OK)
+    {
+        ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+    }
+
+#else
     ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+#endif
 
     ev->timer_set = 1;
 }
@@ -31,9 +31,17 @@ typedef struct {
     size_t                         send_window;
     size_t                         recv_window;
     ngx_uint_t                     last_stream_id;
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+    size_t                         stream_window;
+#endif
 } ngx_http_proxy_v2_conn_t;
 
 
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+typedef struct ngx_http_proxy_v2_mux_stream_s  ngx_http_proxy_v2_mux_stream_t;
+#endif
+
+
 typedef struct {
     ngx_http_proxy_ctx_t           ctx;
 
@@ -48,6 +56,10 @@ typedef struct {
 
     ngx_http_proxy_v2_conn_t      *connection;
 
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+    ngx_http_proxy_v2_mux_stream_t  *stream;
+#endif
+
     ngx_uint_t                     id;
 
     ngx_uint_t                     pings;
@@ -110,6 +122,165 @@ typedef struct {
 } ngx_http_proxy_v2_frame_t;
 
 
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+
+/*
+ * With "http2_multiplex" in an upstream block, the requests of a worker
+ * share HTTP/2 connections to each server of the upstream, up to the
+ * number of streams configured and the SETTINGS_MAX_CONCURRENT_STREAMS
+ * of the server.
+ *
+ * A request gets a stream with a connection of its own: the connection
+ * shares the socket with the HTTP/2 connection, its recv() returns the
+ * frames of the stream demultiplexed by the session, its send_chain()
+ * writes to the shared connection.  The request is then processed exactly
+ * as on a connection of its own, without the connection preface, and with
+ * the stream identifier assigned when the headers are sent.
+ *
+ * The session handles the frames of stream 0 and the connection flow
+ * control window, and writes the frames of the streams one stream at
+ * a time, so the frames are never interleaved.
+ */
+
+#define NGX_HTTP_PROXY_V2_MUX_STREAMS          100
+#define NGX_HTTP_PROXY_V2_MUX_MAX_STREAM_ID    0x7fffffff
+#define NGX_HTTP_PROXY_V2_MUX_BUFFER_SIZE      16384
+#define NGX_HTTP_PROXY_V2_MUX_CHUNK_SIZE       4096
+#define NGX_HTTP_PROXY_V2_MUX_FRAME_SIZE       32
+#define NGX_HTTP_PROXY_V2_MUX_MAX_QUEUED       1000
+
+#define NGX_HTTP_PROXY_V2_CANCEL               0x8
+
+#define NGX_HTTP_PROXY_V2_MAX_STREAMS_SETTING  0x3
+#define NGX_HTTP_PROXY_V2_INIT_WINDOW_SETTING  0x4
+
+
+typedef struct ngx_http_proxy_v2_mux_s  ngx_http_proxy_v2_mux_t;
+
+
+typedef struct {
+    ngx_uint_t                     streams;
+    ngx_msec_t                     timeout;
+    size_t                         window;
+
+    ngx_queue_t                    sessions;
+
+    ngx_http_upstream_init_peer_pt original_init_peer;
+} ngx_http_proxy_v2_mux_conf_t;
+
+
+struct ngx_http_proxy_v2_mux_stream_s {
+    ngx_connection_t               connection;
+    ngx_event_t                    read;
+    ngx_event_t                    write;
+
+    ngx_rbtree_node_t              node;
+    ngx_queue_t                    queue;
+    ngx_queue_t                    waiting;
+
+    ngx_http_proxy_v2_mux_t       *mux;
+    ngx_http_proxy_v2_ctx_t       *ctx;
+    ngx_pool_t                    *pool;
+
+    ngx_chain_t                   *in;
+    ngx_chain_t                   *last_in;
+    ngx_chain_t                   *free;
+
+    ngx_chain_t                   *out;
+
+    unsigned                       opened:1;
+    unsigned                       blocked:1;
+    unsigned                       remote_closed:1;
+    unsigned                       closed:1;
+    unsigned                       error:1;
+};
+
+
+struct ngx_http_proxy_v2_mux_s {
+    ngx_queue_t                    queue;
+
+    ngx_http_proxy_v2_mux_conf_t  *conf;
+    ngx_http_upstream_conf_t      *tag;
+    ngx_pool_t                    *pool;
+    ngx_log_t                      log;
+
+    ngx_connection_t              *connection;
+    ngx_peer_connection_t          peer;
+
+    ngx_sockaddr_t                 sockaddr;
+    ngx_str_t                      name;
+    ngx_addr_t                     local;
+
+    ngx_http_proxy_v2_conn_t       conn;
+
+    ngx_uint_t                     max_streams;
+    ngx_uint_t                     nstreams;
+    ngx_uint_t                     next_stream_id;
+
+    ngx_rbtree_t                   streams;
+    ngx_rbtree_node_t              sentinel;
+
+    ngx_queue_t                    attached;
+    ngx_queue_t                    waiting;
+
+    ngx_http_proxy_v2_mux_stream_t  *writer;
+
+    ngx_chain_t                   *out;
+    ngx_chain_t                   *free;
+    ngx_uint_t                     queued;
+
+    ngx_buf_t                     *buffer;
+
+    /* the frame being received */
+
+    u_char                         frame[sizeof(ngx_http_proxy_v2_frame_t)];
+    size_t                         frame_len;
+    size_t                         rest;
+    ngx_uint_t                     type;
+    ngx_uint_t                     flags;
+    ngx_uint_t                     stream_id;
+    ngx_http_proxy_v2_mux_stream_t  *target;
+
+    u_char                         data[8];
+    size_t                         data_len;
+
+    ngx_msec_t                     send_timeout;
+
+#if (NGX_HTTP_SSL)
+    ngx_str_t                      ssl_name;
+    ngx_flag_t                     ssl_verify;
+#endif
+
+    unsigned                       ready:1;
+    unsigned                       settings:1;
+    unsigned                       goaway:1;
+    unsigned                       drain:1;
+    unsigned                       error:1;
+};
+
+
+typedef struct {
+    ngx_http_proxy_v2_mux_conf_t  *conf;
+
+    ngx_http_request_t            *request;
+    ngx_http_proxy_v2_mux_stream_t  *stream;
+
+    void                          *data;
+
+    ngx_event_get_peer_pt          original_get_peer;
+    ngx_event_free_peer_pt         original_free_peer;
+
+#if (NGX_HTTP_SSL)
+    ngx_event_set_peer_session_pt  original_set_session;
+    ngx_event_save_peer_session_pt original_save_session;
+#endif
+
+    ngx_event_notify_peer_pt       original_notify;
+} ngx_http_proxy_v2_mux_peer_data_t;
+
+#endif
+
+
 static ngx_int_t ngx_http_proxy_v2_create_request(ngx_http_request_t *r);
 static ngx_int_t ngx_http_proxy_v2_reinit_request(ngx_http_request_t *r);
 static ngx_int_t ngx_http_proxy_v2_body_output_filter(void *data,
@@ -168,15 +339,115 @@ static void ngx_http_proxy_v2_abort_request(ngx_http_request_t *r);
 static void ngx_http_proxy_v2_finalize_request(ngx_http_request_t *r,
     ngx_int_t rc);
 
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+static ngx_int_t ngx_http_proxy_v2_mux_init_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_proxy_v2_mux_get_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_proxy_v2_mux_free_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+#if (NGX_HTTP_SSL)
+static ngx_int_t ngx_http_proxy_v2_mux_set_session(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_proxy_v2_mux_save_session(ngx_peer_connection_t *pc,
+    void *data);
+#endif
+static void ngx_http_proxy_v2_mux_notify_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t type);
+
+static ngx_int_t ngx_http_proxy_v2_mux_create(
+    ngx_http_proxy_v2_mux_peer_data_t *mp, ngx_peer_connection_t *pc,
+    ngx_http_proxy_v2_mux_t **muxp);
+#if (NGX_HTTP_SSL)
+static ngx_int_t ngx_http_proxy_v2_mux_ssl_init(ngx_http_proxy_v2_mux_t *mux,
+    ngx_http_proxy_v2_mux_peer_data_t *mp, ngx_peer_connection_t *pc);
+static void ngx_http_proxy_v2_mux_ssl_handshake(ngx_connection_t *c);
+#endif
+static void ngx_http_proxy_v2_mux_connect_handler(ngx_event_t *ev);
+static void ngx_http_proxy_v2_mux_init(ngx_http_proxy_v2_mux_t *mux);
+static ngx_http_proxy_v2_mux_stream_t *ngx_http_proxy_v2_mux_attach(
+    ngx_http_proxy_v2_mux_t *mux, ngx_peer_connection_t *pc);
+static void ngx_http_proxy_v2_mux_detach(
+    ngx_http_proxy_v2_mux_stream_t *stream);
+static ngx_int_t ngx_http_proxy_v2_mux_open(ngx_http_request_t *r,
+    ngx_http_proxy_v2_ctx_t *ctx);
+static ngx_http_proxy_v2_mux_stream_t *ngx_http_proxy_v2_mux_find(
+    ngx_http_proxy_v2_mux_t *mux, ngx_uint_t id);
+static void ngx_http_proxy_v2_mux_block(ngx_http_proxy_v2_mux_stream_t *stream);
+static void ngx_http_proxy_v2_mux_wake(ngx_http_proxy_v2_mux_t *mux,
+    ngx_uint_t all);
+
+static void ngx_http_proxy_v2_mux_read_handler(ngx_event_t *rev);
+static void ngx_http_proxy_v2_mux_write_handler(ngx_event_t *wev);
+static void ngx_http_proxy_v2_mux_dummy_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_proxy_v2_mux_process(ngx_http_proxy_v2_mux_t *mux,
+    u_char *pos, u_char *last);
+static ngx_int_t ngx_http_proxy_v2_mux_frame_start(
+    ngx_http_proxy_v2_mux_t *mux);
+static ngx_int_t ngx_http_proxy_v2_mux_frame_payload(
+    ngx_http_proxy_v2_mux_t *mux, u_char *pos, size_t size);
+static ngx_int_t ngx_http_proxy_v2_mux_frame_end(ngx_http_proxy_v2_mux_t *mux);
+static ngx_int_t ngx_http_proxy_v2_mux_setting(ngx_http_proxy_v2_mux_t *mux);
+static void ngx_http_proxy_v2_mux_goaway(ngx_http_proxy_v2_mux_t *mux);
+static ngx_int_t ngx_http_proxy_v2_mux_append(
+    ngx_http_proxy_v2_mux_stream_t *stream, u_char *pos, size_t size);
+
+static ngx_chain_t *ngx_http_proxy_v2_mux_frame(ngx_http_proxy_v2_mux_t *mux,
+    ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid, size_t len);
+static ngx_int_t ngx_http_proxy_v2_mux_send(ngx_http_proxy_v2_mux_t *mux);
+static ngx_int_t ngx_http_proxy_v2_mux_flush(ngx_http_proxy_v2_mux_t *mux);
+static void ngx_http_proxy_v2_mux_idle(ngx_http_proxy_v2_mux_t *mux);
+static void ngx_http_proxy_v2_mux_error(ngx_http_proxy_v2_mux_t *mux);
+static void ngx_http_proxy_v2_mux_close(ngx_http_proxy_v2_mux_t *mux);
+static void ngx_http_proxy_v2_mux_close_connection(ngx_connection_t *c);
+static u_char *ngx_http_proxy_v2_mux_log_error(ngx_log_t *log, u_char *buf,
+    size_t len);
+
+static ssize_t ngx_http_proxy_v2_mux_recv(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ssize_t ngx_http_proxy_v2_mux_recv_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+static ngx_chain_t *ngx_http_proxy_v2_mux_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+
+static void *ngx_http_proxy_v2_mux_create_conf(ngx_conf_t *cf);
+static char *ngx_http_proxy_v2_mux_init_main_conf(ngx_conf_t *cf, void *conf);
+static char *ngx_http_proxy_v2_multiplex(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#endif
+
+
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+
+static ngx_command_t  ngx_http_proxy_v2_commands[] = {
+
+    { ngx_string("http2_multiplex"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_1MORE,
+      ngx_http_proxy_v2_multiplex,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+#endif
+
 
 static ngx_http_module_t  ngx_http_proxy_v2_module_ctx = {
     NULL,                                  /* preconfiguration */
     NULL,                                  /* postconfiguration */
 
     NULL,                                  /* create main configuration */
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+    ngx_http_proxy_v2_mux_init_main_conf,  /* init main configuration */
+
+    ngx_http_proxy_v2_mux_create_conf,     /* create server configuration */
+#else
     NULL,                                  /* init main configuration */
 
     NULL,                                  /* create server configuration */
+#endif
     NULL,                                  /* merge server configuration */
 
     NULL,                                  /* create location configuration */
@@ -187,7 +458,11 @@ static ngx_http_module_t  ngx_http_proxy_v2_module_ctx = {
 ngx_module_t  ngx_http_proxy_v2_module = {
     NGX_MODULE_V1,
     &ngx_http_proxy_v2_module_ctx,         /* module context */
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+    ngx_http_proxy_v2_commands,            /* module directives */
+#else
     NULL,                                  /* module directives */
+#endif
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
@@ -1087,9 +1362,24 @@ ngx_http_proxy_v2_body_output_filter(void *data, ngx_chain_t *in)
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "http proxy output header");
 
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+        if (ctx->stream) {
+            rc = ngx_http_proxy_v2_mux_open(r, ctx);
+
+            if (rc != NGX_OK) {
+                return rc;
+            }
+        }
+#endif
+
         ctx->header_sent = 1;
 
-        if (ctx->id != 1) {
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+        if (ctx->id != 1 || ctx->stream)
+#else
+        if (ctx->id != 1)
+#endif
+        {
             /*
              * keepalive connection: skip connection preface,
              * update stream identifiers
@@ -1401,7 +1691,11 @@ ngx_http_proxy_v2_body_output_filter(void *data, ngx_chain_t *in)
             && ctx->output_closed
             && !ctx->output_blocked
             && !ctx->goaway
-            && ctx->state == ngx_http_proxy_v2_st_start)
+            && ctx->state == ngx_http_proxy_v2_st_start
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+            && ctx->stream == NULL
+#endif
+            )
         {
             u->keepalive = 1;
         }
@@ -1681,7 +1975,11 @@ ngx_http_proxy_v2_process_header(ngx_http_request_t *r)
                     && ctx->output_closed
                     && !ctx->output_blocked
                     && !ctx->goaway
-                    && b->last == b->pos)
+                    && b->last == b->pos
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+                    && ctx->stream == NULL
+#endif
+                    )
                 {
                     u->keepalive = 1;
                 }
@@ -2150,7 +2448,11 @@ ngx_http_proxy_v2_process_frames(ngx_http_request_t *r,
                         && ctx->output_closed
                         && !ctx->output_blocked
                         && !ctx->goaway
-                        && ctx->state == ngx_http_proxy_v2_st_start)
+                        && ctx->state == ngx_http_proxy_v2_st_start
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+                        && ctx->stream == NULL
+#endif
+                        )
                     {
                         u->keepalive = 1;
                     }
@@ -2194,7 +2496,15 @@ ngx_http_proxy_v2_process_frames(ngx_http_request_t *r,
                     return NGX_ERROR;
                 }
 
-                if (ctx->rest > ctx->connection->recv_window) {
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+                /* the window of a shared connection is kept by the session */
+
+                if (ctx->stream == NULL
+                    && ctx->rest > ctx->connection->recv_window)
+#else
+                if (ctx->rest > ctx->connection->recv_window)
+#endif
+                {
                     ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
                                   "upstream violated connection flow control, "
                                   "received %uz data frame with window %uz",
@@ -2203,10 +2513,20 @@ ngx_http_proxy_v2_process_frames(ngx_http_request_t *r,
                 }
 
                 ctx->recv_window -= ctx->rest;
+
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+                if (ctx->stream == NULL) {
+                    ctx->connection->recv_window -= ctx->rest;
+                }
+
+                if (ctx->connection->recv_window < NGX_HTTP_V2_MAX_WINDOW / 4
+                    || ctx->recv_window < ctx->connection->stream_window / 4)
+#else
                 ctx->connection->recv_window -= ctx->rest;
 
                 if (ctx->connection->recv_window < NGX_HTTP_V2_MAX_WINDOW / 4
                     || ctx->recv_window < NGX_HTTP_V2_MAX_WINDOW / 4)
+#endif
                 {
                     if (ngx_http_proxy_v2_send_window_update(r, ctx)
                         != NGX_OK)
@@ -4072,6 +4392,12 @@ ngx_http_proxy_v2_send_window_update(ngx_http_request_t *r,
         return NGX_ERROR;
     }
 
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+    if (ctx->stream) {
+        goto stream;
+    }
+#endif
+
     f = (ngx_http_proxy_v2_frame_t *) cl->buf->last;
     cl->buf->last += sizeof(ngx_http_proxy_v2_frame_t);
 
@@ -4093,6 +4419,10 @@ ngx_http_proxy_v2_send_window_update(ngx_http_request_t *r,
     *cl->buf->last++ = (u_char) ((n >> 8) & 0xff);
     *cl->buf->last++ = (u_char) (n & 0xff);
 
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+stream:
+#endif
+
     f = (ngx_http_proxy_v2_frame_t *) cl->buf->last;
     cl->buf->last += sizeof(ngx_http_proxy_v2_frame_t);
 
@@ -4106,8 +4436,13 @@ ngx_http_proxy_v2_send_window_update(ngx_http_request_t *r,
     f->stream_id_2 = (u_char) ((ctx->id >> 8) & 0xff);
     f->stream_id_3 = (u_char) (ctx->id & 0xff);
 
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+    n = ctx->connection->stream_window - ctx->recv_window;
+    ctx->recv_window = ctx->connection->stream_window;
+#else
     n = NGX_HTTP_V2_MAX_WINDOW - ctx->recv_window;
     ctx->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+#endif
 
     *cl->buf->last++ = (u_char) ((n >> 24) & 0xff);
     *cl->buf->last++ = (u_char) ((n >> 16) & 0xff);
@@ -4202,6 +4537,27 @@ ngx_http_proxy_v2_get_connection_data(ngx_http_request_t *r,
         goto done;
     }
 
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+
+    if (ctx->stream) {
+
+        /*
+         * a stream of a shared connection, the identifier
+         * is assigned when the headers are sent
+         */
+
+        ctx->connection = &ctx->stream->mux->conn;
+
+        ctx->send_window = ctx->connection->init_window;
+        ctx->recv_window = ctx->connection->stream_window;
+
+        ctx->id = 0;
+
+        return NGX_OK;
+    }
+
+#endif
+
     c = pc->connection;
 
     if (pc->cached) {
@@ -4255,6 +4611,10 @@ done:
 
     ctx->connection->last_stream_id = 1;
 
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+    ctx->connection->stream_window = NGX_HTTP_V2_MAX_WINDOW;
+#endif
+
     return NGX_OK;
 }
 
@@ -4297,3 +4657,2358 @@ ngx_http_proxy_v2_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
                    "finalize proxy http2 request");
     return;
 }
+
+
+#if (T_NGX_HTTP_PROXY_V2_MULTIPLEX)
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_init_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_proxy_v2_mux_conf_t       *mcf;
+    ngx_http_proxy_v2_mux_peer_data_t  *mp;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init http2 multiplexed peer");
+
+    mcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_proxy_v2_module);
+
+    mp = ngx_palloc(r->pool, sizeof(ngx_http_proxy_v2_mux_peer_data_t));
+    if (mp == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (mcf->original_init_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    mp->conf = mcf;
+    mp->request = r;
+    mp->stream = NULL;
+    mp->data = r->upstream->peer.data;
+    mp->original_get_peer = r->upstream->peer.get;
+    mp->original_free_peer = r->upstream->peer.free;
+
+    r->upstream->peer.data = mp;
+    r->upstream->peer.get = ngx_http_proxy_v2_mux_get_peer;
+    r->upstream->peer.free = ngx_http_proxy_v2_mux_free_peer;
+
+#if (NGX_HTTP_SSL)
+    mp->original_set_session = r->upstream->peer.set_session;
+    mp->original_save_session = r->upstream->peer.save_session;
+    r->upstream->peer.set_session = ngx_http_proxy_v2_mux_set_session;
+    r->upstream->peer.save_session = ngx_http_proxy_v2_mux_save_session;
+#endif
+
+    if (r->upstream->peer.notify) {
+        mp->original_notify = r->upstream->peer.notify;
+        r->upstream->peer.notify = ngx_http_proxy_v2_mux_notify_peer;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_get_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_proxy_v2_mux_peer_data_t  *mp = data;
+
+    ngx_int_t                        rc;
+    ngx_uint_t                       max;
+    ngx_queue_t                     *q;
+    ngx_http_proxy_v2_ctx_t         *ctx;
+    ngx_http_proxy_v2_mux_t         *mux;
+    ngx_http_proxy_v2_mux_conf_t    *mcf;
+    ngx_http_proxy_v2_mux_stream_t  *stream;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get http2 multiplexed peer");
+
+    rc = mp->original_get_peer(pc, mp->data);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    ctx = ngx_http_get_module_ctx(mp->request, ngx_http_proxy_v2_module);
+
+    /*
+     * the streams are woken up by posting their events, and this
+     * only works with the event methods which do not need to add
+     * events of the connections of the streams
+     */
+
+    if (ctx == NULL || !(ngx_event_flags & NGX_USE_CLEAR_EVENT)) {
+        return NGX_OK;
+    }
+
+    mcf = mp->conf;
+
+    for (q = ngx_queue_head(&mcf->sessions);
+         q != ngx_queue_sentinel(&mcf->sessions);
+         q = ngx_queue_next(q))
+    {
+        mux = ngx_queue_data(q, ngx_http_proxy_v2_mux_t, queue);
+
+        max = ngx_min(mcf->streams, mux->max_streams);
+
+        if (mux->goaway
+            || mux->drain
+            || mux->nstreams >= max
+            || mux->next_stream_id + 2 * mux->nstreams
+               > NGX_HTTP_PROXY_V2_MUX_MAX_STREAM_ID
+            || mux->tag != mp->request->upstream->conf)
+        {
+            continue;
+        }
+
+        if (ngx_memn2cmp((u_char *) &mux->sockaddr, (u_char *) pc->sockaddr,
+                         mux->peer.socklen, pc->socklen)
+            != 0)
+        {
+            continue;
+        }
+
+        if (pc->local == NULL) {
+            if (mux->peer.local) {
+                continue;
+            }
+
+        } else if (mux->peer.local == NULL
+                   || ngx_memn2cmp((u_char *) mux->local.sockaddr,
+                                   (u_char *) pc->local->sockaddr,
+                                   mux->local.socklen, pc->local->socklen)
+                      != 0)
+        {
+            continue;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get http2 multiplexed peer: using session %p, "
+                       "streams: %ui", mux, mux->nstreams);
+
+        goto found;
+    }
+
+    rc = ngx_http_proxy_v2_mux_create(mp, pc, &mux);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+found:
+
+    stream = ngx_http_proxy_v2_mux_attach(mux, pc);
+    if (stream == NULL) {
+        return NGX_ERROR;
+    }
+
+    stream->ctx = ctx;
+    ctx->stream = stream;
+    mp->stream = stream;
+
+    pc->connection = &stream->connection;
+
+    if (mux->ready) {
+        pc->cached = 1;
+        return NGX_DONE;
+    }
+
+    pc->cached = 0;
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_http_proxy_v2_mux_free_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_proxy_v2_mux_peer_data_t  *mp = data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free http2 multiplexed peer");
+
+    if (mp->stream) {
+
+        /* no new streams on a connection which failed a request */
+
+        if (state & NGX_PEER_FAILED) {
+            mp->stream->mux->drain = 1;
+        }
+
+        ngx_http_proxy_v2_mux_detach(mp->stream);
+
+        mp->stream = NULL;
+        pc->connection = NULL;
+    }
+
+    mp->original_free_peer(pc, mp->data, state);
+}
+
+
+#if (NGX_HTTP_SSL)
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_set_session(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_proxy_v2_mux_peer_data_t  *mp = data;
+
+    return mp->original_set_session(pc, mp->data);
+}
+
+
+static void
+ngx_http_proxy_v2_mux_save_session(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_proxy_v2_mux_peer_data_t  *mp = data;
+
+    mp->original_save_session(pc, mp->data);
+}
+
+#endif
+
+
+static void
+ngx_http_proxy_v2_mux_notify_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t type)
+{
+    ngx_http_proxy_v2_mux_peer_data_t  *mp = data;
+
+    mp->original_notify(pc, mp->data, type);
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_create(ngx_http_proxy_v2_mux_peer_data_t *mp,
+    ngx_peer_connection_t *pc, ngx_http_proxy_v2_mux_t **muxp)
+{
+    u_char                   *p;
+    size_t                    window;
+    ngx_int_t                 rc;
+    ngx_buf_t                *b;
+    ngx_pool_t               *pool;
+    ngx_chain_t              *cl;
+    ngx_connection_t         *c;
+    ngx_http_upstream_t      *u;
+    ngx_http_proxy_v2_mux_t  *mux;
+
+    u = mp->request->upstream;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    mux = ngx_pcalloc(pool, sizeof(ngx_http_proxy_v2_mux_t));
+    if (mux == NULL) {
+        goto failed;
+    }
+
+    mux->conf = mp->conf;
+    mux->tag = u->conf;
+    mux->pool = pool;
+
+    mux->log = *ngx_cycle->log;
+    mux->log.handler = ngx_http_proxy_v2_mux_log_error;
+    mux->log.data = mux;
+    mux->log.action = "connecting to upstream";
+
+    pool->log = &mux->log;
+
+    ngx_memcpy(&mux->sockaddr, pc->sockaddr, pc->socklen);
+
+    mux->name.data = ngx_pnalloc(pool, pc->name->len);
+    if (mux->name.data == NULL) {
+        goto failed;
+    }
+
+    ngx_memcpy(mux->name.data, pc->name->data, pc->name->len);
+    mux->name.len = pc->name->len;
+
+    mux->peer.sockaddr = &mux->sockaddr.sockaddr;
+    mux->peer.socklen = pc->socklen;
+    mux->peer.name = &mux->name;
+
+    if (pc->local) {
+        mux->local.sockaddr = ngx_palloc(pool, pc->local->socklen);
+        if (mux->local.sockaddr == NULL) {
+            goto failed;
+        }
+
+        ngx_memcpy(mux->local.sockaddr, pc->local->sockaddr,
+                   pc->local->socklen);
+        mux->local.socklen = pc->local->socklen;
+
+        mux->peer.local = &mux->local;
+    }
+
+    mux->peer.get = ngx_event_get_peer;
+    mux->peer.log = &mux->log;
+    mux->peer.log_error = pc->log_error;
+    mux->peer.type = pc->type;
+    mux->peer.rcvbuf = pc->rcvbuf;
+    mux->peer.sndbuf = pc->sndbuf;
+    mux->peer.so_keepalive = pc->so_keepalive;
+    mux->peer.transparent = pc->transparent;
+    mux->peer.tries = 1;
+    mux->peer.start_time = ngx_current_msec;
+
+    mux->send_timeout = u->conf->send_timeout;
+
+    mux->conn.init_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    mux->conn.send_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    mux->conn.recv_window = NGX_HTTP_V2_MAX_WINDOW;
+    mux->conn.stream_window = mp->conf->window;
+
+    mux->max_streams = NGX_HTTP_PROXY_V2_MUX_STREAMS;
+    mux->next_stream_id = 1;
+
+    ngx_rbtree_init(&mux->streams, &mux->sentinel, ngx_rbtree_insert_value);
+
+    ngx_queue_init(&mux->attached);
+    ngx_queue_init(&mux->waiting);
+
+    mux->buffer = ngx_create_temp_buf(pool, NGX_HTTP_PROXY_V2_MUX_BUFFER_SIZE);
+    if (mux->buffer == NULL) {
+        goto failed;
+    }
+
+    /*
+     * the connection preface as sent with a request on a connection
+     * of its own, with the initial window of the streams configured
+     */
+
+    cl = ngx_alloc_chain_link(pool);
+    if (cl == NULL) {
+        goto failed;
+    }
+
+    b = ngx_create_temp_buf(pool,
+                            sizeof(ngx_http_proxy_v2_connection_start) - 1);
+    if (b == NULL) {
+        goto failed;
+    }
+
+    b->last = ngx_cpymem(b->last, ngx_http_proxy_v2_connection_start,
+                         sizeof(ngx_http_proxy_v2_connection_start) - 1);
+
+    p = b->start + sizeof("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n") - 1
+        + sizeof(ngx_http_proxy_v2_frame_t) + 2 * 6 + 2;
+
+    window = mp->conf->window;
+
+    *p++ = (u_char) ((window >> 24) & 0xff);
+    *p++ = (u_char) ((window >> 16) & 0xff);
+    *p++ = (u_char) ((window >> 8) & 0xff);
+    *p = (u_char) (window & 0xff);
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    mux->out = cl;
+
+    rc = ngx_event_connect_peer(&mux->peer);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "http2 multiplexed connect: %i, session %p", rc, mux);
+
+    if (rc != NGX_OK && rc != NGX_AGAIN) {
+        ngx_destroy_pool(pool);
+        return rc;
+    }
+
+    c = mux->peer.connection;
+
+    mux->connection = c;
+    mux->log.connection = c->number;
+
+    c->data = mux;
+    c->pool = pool;
+
+    c->read->handler = ngx_http_proxy_v2_mux_connect_handler;
+    c->write->handler = ngx_http_proxy_v2_mux_connect_handler;
+
+    ngx_queue_insert_tail(&mp->conf->sessions, &mux->queue);
+
+#if (NGX_HTTP_SSL)
+
+    if (u->ssl && ngx_http_proxy_v2_mux_ssl_init(mux, mp, pc) != NGX_OK) {
+        ngx_http_proxy_v2_mux_close(mux);
+        return NGX_ERROR;
+    }
+
+#endif
+
+    ngx_add_timer(c->write, u->conf->connect_timeout);
+
+    if (rc == NGX_OK) {
+        ngx_post_event(c->write, &ngx_posted_events);
+    }
+
+    *muxp = mux;
+
+    return NGX_OK;
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    return NGX_ERROR;
+}
+
+
+#if (NGX_HTTP_SSL)
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_ssl_init(ngx_http_proxy_v2_mux_t *mux,
+    ngx_http_proxy_v2_mux_peer_data_t *mp, ngx_peer_connection_t *pc)
+{
+    ngx_int_t             rc;
+    ngx_connection_t     *c;
+    ngx_http_request_t   *r;
+    ngx_http_upstream_t  *u;
+
+    c = mux->connection;
+    r = mp->request;
+    u = r->upstream;
+
+    if (ngx_ssl_create_connection(u->conf->ssl, c,
+                                  NGX_SSL_BUFFER|NGX_SSL_CLIENT)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    /*
+     * the server name and the certificate are evaluated for
+     * the request which opens the connection
+     */
+
+    if (u->conf->ssl_server_name || u->conf->ssl_verify) {
+        if (ngx_http_upstream_ssl_name(r, u, c) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        mux->ssl_name.data = ngx_pstrdup(mux->pool, &u->ssl_name);
+        if (mux->ssl_name.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        mux->ssl_name.len = u->ssl_name.len;
+    }
+
+    mux->ssl_verify = u->conf->ssl_verify;
+
+    if (u->conf->ssl_certificate
+        && u->conf->ssl_certificate->value.len
+        && (u->conf->ssl_certificate->lengths
+            || u->conf->ssl_certificate_key->lengths))
+    {
+        if (ngx_http_upstream_ssl_certificate(r, u, c) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+#ifdef TLSEXT_TYPE_application_layer_protocol_negotiation
+
+    if (u->ssl_alpn_protocol.len) {
+        if (SSL_set_alpn_protos(c->ssl->connection, u->ssl_alpn_protocol.data,
+                                u->ssl_alpn_protocol.len)
+            != 0)
+        {
+            ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                          "SSL_set_alpn_protos() failed");
+            return NGX_ERROR;
+        }
+    }
+
+#endif
+
+    /*
+     * a session saved by a connection of its own is reused, the sessions
+     * of the shared connections are not saved: the request which opens
+     * the connection might be gone by the time the handshake is done
+     */
+
+    if (u->conf->ssl_session_reuse) {
+        pc->connection = c;
+        rc = mp->original_set_session(pc, mp->data);
+        pc->connection = NULL;
+
+        if (rc != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_proxy_v2_mux_ssl_handshake(ngx_connection_t *c)
+{
+    long                      rc;
+    ngx_http_proxy_v2_mux_t  *mux;
+
+    mux = c->data;
+
+    if (c->ssl->handshaked) {
+
+        if (mux->ssl_verify) {
+            rc = SSL_get_verify_result(c->ssl->connection);
+
+            if (rc != X509_V_OK) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "upstream SSL certificate verify error: (%l:%s)",
+                              rc, X509_verify_cert_error_string(rc));
+                goto failed;
+            }
+
+            if (ngx_ssl_check_host(c, &mux->ssl_name) != NGX_OK) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "upstream SSL certificate does not match \"%V\"",
+                              &mux->ssl_name);
+                goto failed;
+            }
+        }
+
+        ngx_http_proxy_v2_mux_init(mux);
+        return;
+    }
+
+    if (c->write->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "upstream timed out");
+    }
+
+failed:
+
+    ngx_http_proxy_v2_mux_error(mux);
+}
+
+#endif
+
+
+static void
+ngx_http_proxy_v2_mux_connect_handler(ngx_event_t *ev)
+{
+    int                       err;
+    socklen_t                 len;
+    ngx_connection_t         *c;
+    ngx_http_proxy_v2_mux_t  *mux;
+#if (NGX_HTTP_SSL)
+    ngx_int_t                 rc;
+#endif
+
+    c = ev->data;
+    mux = c->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 multiplexed connect handler, session %p", mux);
+
+    if (ev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "upstream timed out");
+        ngx_http_proxy_v2_mux_error(mux);
+        return;
+    }
+
+    err = 0;
+    len = sizeof(int);
+
+    /*
+     * BSDs and Linux return 0 and set a pending error in err
+     * Solaris returns -1 and sets errno
+     */
+
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len) == -1) {
+        err = ngx_socket_errno;
+    }
+
+    if (err) {
+        (void) ngx_connection_error(c, err, "connect() failed");
+        ngx_http_proxy_v2_mux_error(mux);
+        return;
+    }
+
+#if (NGX_HTTP_SSL)
+
+    if (c->ssl) {
+        mux->log.action = "SSL handshaking to upstream";
+
+        rc = ngx_ssl_handshake(c);
+
+        if (rc == NGX_AGAIN) {
+            c->ssl->handler = ngx_http_proxy_v2_mux_ssl_handshake;
+            return;
+        }
+
+        ngx_http_proxy_v2_mux_ssl_handshake(c);
+        return;
+    }
+
+#endif
+
+    ngx_http_proxy_v2_mux_init(mux);
+}
+
+
+static void
+ngx_http_proxy_v2_mux_init(ngx_http_proxy_v2_mux_t *mux)
+{
+    ngx_queue_t                     *q;
+    ngx_connection_t                *c;
+    ngx_http_proxy_v2_mux_stream_t  *stream;
+
+    c = mux->connection;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 multiplexed session %p established", mux);
+
+    mux->log.action = "processing HTTP/2 connection to upstream";
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    c->read->handler = ngx_http_proxy_v2_mux_read_handler;
+    c->write->handler = ngx_http_proxy_v2_mux_write_handler;
+
+    /* disabled for unix domain sockets by ngx_event_connect_peer() */
+
+    if (ngx_tcp_nodelay(c) != NGX_OK) {
+        ngx_http_proxy_v2_mux_error(mux);
+        return;
+    }
+
+    mux->ready = 1;
+
+    /* the streams attached so far wait for the connection to be ready */
+
+    for (q = ngx_queue_head(&mux->attached);
+         q != ngx_queue_sentinel(&mux->attached);
+         q = ngx_queue_next(q))
+    {
+        stream = ngx_queue_data(q, ngx_http_proxy_v2_mux_stream_t, queue);
+
+        stream->connection.tcp_nodelay = c->tcp_nodelay;
+
+        stream->write.ready = 1;
+        ngx_post_event(&stream->write, &ngx_posted_events);
+    }
+
+    if (ngx_http_proxy_v2_mux_send(mux) == NGX_ERROR) {
+        ngx_http_proxy_v2_mux_error(mux);
+        return;
+    }
+
+    if (mux->nstreams == 0) {
+        ngx_http_proxy_v2_mux_idle(mux);
+        return;
+    }
+
+    ngx_post_event(c->read, &ngx_posted_events);
+}
+
+
+static ngx_http_proxy_v2_mux_stream_t *
+ngx_http_proxy_v2_mux_attach(ngx_http_proxy_v2_mux_t *mux,
+    ngx_peer_connection_t *pc)
+{
+    ngx_pool_t                      *pool;
+    ngx_connection_t                *c, *fc;
+    ngx_http_proxy_v2_mux_stream_t  *stream;
+
+    c = mux->connection;
+
+    pool = ngx_create_pool(1024, pc->log);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    stream = ngx_pcalloc(pool, sizeof(ngx_http_proxy_v2_mux_stream_t));
+    if (stream == NULL) {
+        ngx_destroy_pool(pool);
+        return NULL;
+    }
+
+    stream->mux = mux;
+    stream->pool = pool;
+
+    fc = &stream->connection;
+
+    fc->fd = c->fd;
+    fc->read = &stream->read;
+    fc->write = &stream->write;
+
+    fc->recv = ngx_http_proxy_v2_mux_recv;
+    fc->recv_chain = ngx_http_proxy_v2_mux_recv_chain;
+    fc->send_chain = ngx_http_proxy_v2_mux_send_chain;
+
+    fc->sockaddr = mux->peer.sockaddr;
+    fc->socklen = mux->peer.socklen;
+
+    fc->log = pc->log;
+    fc->pool = pool;
+    fc->type = SOCK_STREAM;
+    fc->number = c->number;
+    fc->start_time = ngx_current_msec;
+
+    fc->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+    fc->tcp_nodelay = c->tcp_nodelay;
+
+#if (NGX_HTTP_SSL)
+    fc->ssl = c->ssl;
+#endif
+
+    /*
+     * the events are never added to the event method,
+     * they are marked as active so nobody tries to
+     */
+
+    stream->read.data = fc;
+    stream->read.log = pc->log;
+    stream->read.active = 1;
+
+    stream->write.data = fc;
+    stream->write.log = pc->log;
+    stream->write.write = 1;
+    stream->write.active = 1;
+    stream->write.ready = mux->ready;
+
+    ngx_queue_insert_tail(&mux->attached, &stream->queue);
+    mux->nstreams++;
+
+    if (c->idle) {
+        c->idle = 0;
+
+        if (c->read->timer_set) {
+            ngx_del_timer(c->read);
+        }
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "http2 multiplexed stream %p attached to %p, streams: %ui",
+                   stream, mux, mux->nstreams);
+
+    return stream;
+}
+
+
+static void
+ngx_http_proxy_v2_mux_detach(ngx_http_proxy_v2_mux_stream_t *stream)
+{
+    u_char                   *p;
+    size_t                    size;
+    ngx_buf_t                *b;
+    ngx_uint_t                closed, failed;
+    ngx_chain_t              *cl, *ln;
+    ngx_http_proxy_v2_mux_t  *mux;
+    ngx_http_proxy_v2_ctx_t  *ctx;
+
+    mux = stream->mux;
+    ctx = stream->ctx;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, stream->connection.log, 0,
+                   "http2 multiplexed stream %p detached, id: %ui",
+                   stream, ctx->id);
+
+    ctx->stream = NULL;
+    ctx->connection = NULL;
+
+    failed = 0;
+
+    if (!mux->error) {
+
+        closed = ctx->output_closed
+                 && ctx->in == NULL
+                 && !ctx->output_blocked
+                 && mux->writer != stream;
+
+        if (mux->writer == stream) {
+
+            /*
+             * the rest of the frame being sent is to be sent anyway,
+             * the request buffers are freed with the request
+             */
+
+            size = 0;
+
+            for (cl = stream->out; cl; cl = cl->next) {
+                size += cl->buf->last - cl->buf->pos;
+            }
+
+            ln = ngx_alloc(sizeof(ngx_chain_t) + sizeof(ngx_buf_t) + size,
+                           mux->connection->log);
+
+            if (ln == NULL) {
+                failed = 1;
+
+            } else {
+                b = (ngx_buf_t *) (ln + 1);
+                ngx_memzero(b, sizeof(ngx_buf_t));
+
+                p = (u_char *) (b + 1);
+
+                b->start = p;
+                b->pos = p;
+
+                for (cl = stream->out; cl; cl = cl->next) {
+                    p = ngx_cpymem(p, cl->buf->pos,
+                                   cl->buf->last - cl->buf->pos);
+                }
+
+                b->last = p;
+                b->end = p;
+                b->temporary = 1;
+                b->tag = (ngx_buf_tag_t) &ngx_http_proxy_v2_mux_detach;
+
+                ln->buf = b;
+                ln->next = mux->out;
+                mux->out = ln;
+            }
+        }
+
+        if (stream->opened && !(stream->remote_closed && closed) && !failed) {
+            cl = ngx_http_proxy_v2_mux_frame(mux,
+                                             NGX_HTTP_V2_RST_STREAM_FRAME,
+                                             0, ctx->id, 4);
+            if (cl == NULL) {
+                failed = 1;
+
+            } else {
+                b = cl->buf;
+
+                *b->last++ = 0;
+                *b->last++ = 0;
+                *b->last++ = 0;
+                *b->last++ = NGX_HTTP_PROXY_V2_CANCEL;
+            }
+        }
+    }
+
+    if (mux->writer == stream) {
+        mux->writer = NULL;
+    }
+
+    if (stream->opened) {
+        ngx_rbtree_delete(&mux->streams, &stream->node);
+    }
+
+    if (stream->blocked) {
+        ngx_queue_remove(&stream->waiting);
+    }
+
+    ngx_queue_remove(&stream->queue);
+    mux->nstreams--;
+
+    if (stream->read.timer_set) {
+        ngx_del_timer(&stream->read);
+    }
+
+    if (stream->write.timer_set) {
+        ngx_del_timer(&stream->write);
+    }
+
+    if (stream->read.posted) {
+        ngx_delete_posted_event(&stream->read);
+    }
+
+    if (stream->write.posted) {
+        ngx_delete_posted_event(&stream->write);
+    }
+
+    ngx_destroy_pool(stream->pool);
+
+    if (mux->error) {
+        if (mux->nstreams == 0) {
+            ngx_http_proxy_v2_mux_close(mux);
+        }
+
+        return;
+    }
+
+    if (failed) {
+        ngx_http_proxy_v2_mux_error(mux);
+        return;
+    }
+
+    if (!mux->ready) {
+        return;
+    }
+
+    if (ngx_http_proxy_v2_mux_send(mux) == NGX_ERROR) {
+        ngx_http_proxy_v2_mux_error(mux);
+        return;
+    }
+
+    if (mux->nstreams == 0) {
+        ngx_http_proxy_v2_mux_idle(mux);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_open(ngx_http_request_t *r, ngx_http_proxy_v2_ctx_t *ctx)
+{
+    ngx_int_t                        rc;
+    ngx_http_proxy_v2_mux_t         *mux;
+    ngx_http_proxy_v2_mux_stream_t  *stream;
+
+    stream = ctx->stream;
+    mux = stream->mux;
+
+    if (stream->closed
+        || mux->goaway
+        || mux->next_stream_id > NGX_HTTP_PROXY_V2_MUX_MAX_STREAM_ID)
+    {
+        return NGX_ERROR;
+    }
+
+    /*
+     * the stream identifier is assigned when the headers can be sent
+     * right away, so the streams are opened in order of identifiers
+     */
+
+    if (!mux->ready || mux->writer) {
+        ngx_http_proxy_v2_mux_block(stream);
+        return NGX_AGAIN;
+    }
+
+    rc = ngx_http_proxy_v2_mux_flush(mux);
+
+    if (rc == NGX_ERROR) {
+        ngx_http_proxy_v2_mux_error(mux);
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_AGAIN) {
+        ngx_http_proxy_v2_mux_block(stream);
+        return NGX_AGAIN;
+    }
+
+    ctx->id = mux->next_stream_id;
+    mux->next_stream_id += 2;
+
+    stream->node.key = ctx->id;
+    ngx_rbtree_insert(&mux->streams, &stream->node);
+
+    stream->opened = 1;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http2 multiplexed stream %p opened, id: %ui",
+                   stream, ctx->id);
+
+    return NGX_OK;
+}
+
+
+static ngx_http_proxy_v2_mux_stream_t *
+ngx_http_proxy_v2_mux_find(ngx_http_proxy_v2_mux_t *mux, ngx_uint_t id)
+{
+    ngx_rbtree_node_t  *node, *sentinel;
+
+    node = mux->streams.root;
+    sentinel = mux->streams.sentinel;
+
+    while (node != sentinel) {
+
+        if (id < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (id > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* id == node->key */
+
+        return ngx_rbtree_data(node, ngx_http_proxy_v2_mux_stream_t, node);
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_proxy_v2_mux_block(ngx_http_proxy_v2_mux_stream_t *stream)
+{
+    if (!stream->blocked) {
+        stream->blocked = 1;
+        ngx_queue_insert_tail(&stream->mux->waiting, &stream->waiting);
+    }
+
+    stream->write.ready = 0;
+}
+
+
+static void
+ngx_http_proxy_v2_mux_wake(ngx_http_proxy_v2_mux_t *mux, ngx_uint_t all)
+{
+    ngx_queue_t                     *q;
+    ngx_http_proxy_v2_mux_stream_t  *stream;
+
+    if (all) {
+
+        /* the streams waiting for the connection to be written */
+
+        while (!ngx_queue_empty(&mux->waiting)) {
+            q = ngx_queue_head(&mux->waiting);
+            ngx_queue_remove(q);
+
+            stream = ngx_queue_data(q, ngx_http_proxy_v2_mux_stream_t,
+                                    waiting);
+
+            stream->blocked = 0;
+            stream->write.ready = 1;
+
+            ngx_post_event(&stream->write, &ngx_posted_events);
+        }
+
+        return;
+    }
+
+    /* the streams waiting for the flow control windows */
+
+    for (q = ngx_queue_head(&mux->attached);
+         q != ngx_queue_sentinel(&mux->attached);
+         q = ngx_queue_next(q))
+    {
+        stream = ngx_queue_data(q, ngx_http_proxy_v2_mux_stream_t, queue);
+
+        if (stream->opened && !stream->blocked && stream->ctx->in) {
+            ngx_post_event(&stream->write, &ngx_posted_events);
+        }
+    }
+}
+
+
+static void
+ngx_http_proxy_v2_mux_read_handler(ngx_event_t *rev)
+{
+    ssize_t                   n;
+    ngx_buf_t                *b;
+    ngx_connection_t         *c;
+    ngx_http_proxy_v2_mux_t  *mux;
+
+    c = rev->data;
+    mux = c->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 multiplexed read handler, session %p", mux);
+
+    /* the timer is only set and the connection is only closed when idle */
+
+    if (c->close || rev->timedout) {
+        ngx_http_proxy_v2_mux_close(mux);
+        return;
+    }
+
+    b = mux->buffer;
+
+    do {
+        n = c->recv(c, b->start, b->end - b->start);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                           "http2 multiplexed session closed: %z", n);
+
+            ngx_http_proxy_v2_mux_error(mux);
+            return;
+        }
+
+        if (ngx_http_proxy_v2_mux_process(mux, b->start, b->start + n)
+            != NGX_OK)
+        {
+            ngx_http_proxy_v2_mux_error(mux);
+            return;
+        }
+
+    } while (rev->ready);
+
+    if (ngx_http_proxy_v2_mux_send(mux) == NGX_ERROR) {
+        ngx_http_proxy_v2_mux_error(mux);
+        return;
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_http_proxy_v2_mux_error(mux);
+        return;
+    }
+
+    if (mux->nstreams == 0 && (mux->goaway || !mux->connection->idle)) {
+        ngx_http_proxy_v2_mux_idle(mux);
+    }
+}
+
+
+static void
+ngx_http_proxy_v2_mux_write_handler(ngx_event_t *wev)
+{
+    ngx_connection_t         *c;
+    ngx_http_proxy_v2_mux_t  *mux;
+
+    c = wev->data;
+    mux = c->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 multiplexed write handler, session %p", mux);
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "upstream timed out");
+        c->timedout = 1;
+        ngx_http_proxy_v2_mux_error(mux);
+        return;
+    }
+
+    if (ngx_http_proxy_v2_mux_send(mux) == NGX_ERROR) {
+        ngx_http_proxy_v2_mux_error(mux);
+    }
+}
+
+
+static void
+ngx_http_proxy_v2_mux_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http2 multiplexed dummy handler");
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_process(ngx_http_proxy_v2_mux_t *mux, u_char *pos,
+    u_char *last)
+{
+    size_t  n;
+
+    while (pos < last) {
+
+        if (mux->frame_len < sizeof(ngx_http_proxy_v2_frame_t)) {
+            n = ngx_min((size_t) (last - pos),
+                        sizeof(ngx_http_proxy_v2_frame_t) - mux->frame_len);
+
+            ngx_memcpy(mux->frame + mux->frame_len, pos, n);
+
+            mux->frame_len += n;
+            pos += n;
+
+            if (mux->frame_len < sizeof(ngx_http_proxy_v2_frame_t)) {
+                break;
+            }
+
+            if (ngx_http_proxy_v2_mux_frame_start(mux) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+        } else {
+            n = ngx_min((size_t) (last - pos), mux->rest);
+
+            if (ngx_http_proxy_v2_mux_frame_payload(mux, pos, n) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            mux->rest -= n;
+            pos += n;
+        }
+
+        if (mux->rest == 0) {
+            if (ngx_http_proxy_v2_mux_frame_end(mux) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_frame_start(ngx_http_proxy_v2_mux_t *mux)
+{
+    size_t                           n;
+    ngx_chain_t                     *cl;
+    ngx_connection_t                *c;
+    ngx_http_proxy_v2_frame_t       *f;
+    ngx_http_proxy_v2_mux_stream_t  *stream;
+
+    c = mux->connection;
+    f = (ngx_http_proxy_v2_frame_t *) mux->frame;
+
+    mux->rest = (f->length_0 << 16) + (f->length_1 << 8) + f->length_2;
+    mux->type = f->type;
+    mux->flags = f->flags;
+    mux->stream_id = ((f->stream_id_0 & 0x7f) << 24)
+                     + (f->stream_id_1 << 16)
+                     + (f->stream_id_2 << 8)
+                     + f->stream_id_3;
+
+    mux->target = NULL;
+    mux->data_len = 0;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 multiplexed frame type:%ui f:%ui l:%uz sid:%ui",
+                   mux->type, mux->flags, mux->rest, mux->stream_id);
+
+    if (mux->rest > NGX_HTTP_V2_DEFAULT_FRAME_SIZE) {
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                      "upstream sent too large http2 frame: %uz", mux->rest);
+        return NGX_ERROR;
+    }
+
+    if (mux->stream_id == 0) {
+
+        switch (mux->type) {
+
+        case NGX_HTTP_V2_SETTINGS_FRAME:
+
+            if (mux->flags & NGX_HTTP_V2_ACK_FLAG) {
+                if (mux->rest != 0) {
+                    ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                                  "upstream sent settings ack "
+                                  "with non-zero length: %uz", mux->rest);
+                    return NGX_ERROR;
+                }
+
+                break;
+            }
+
+            if (mux->rest % 6 != 0) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "upstream sent settings frame "
+                              "with invalid length: %uz", mux->rest);
+                return NGX_ERROR;
+            }
+
+            if (!mux->settings) {
+
+                /* no limit unless the server says otherwise */
+
+                mux->settings = 1;
+                mux->max_streams = NGX_HTTP_PROXY_V2_MUX_MAX_STREAM_ID;
+            }
+
+            break;
+
+        case NGX_HTTP_V2_PING_FRAME:
+
+            if (mux->rest != 8) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "upstream sent ping frame "
+                              "with invalid length: %uz", mux->rest);
+                return NGX_ERROR;
+            }
+
+            break;
+
+        case NGX_HTTP_V2_WINDOW_UPDATE_FRAME:
+
+            if (mux->rest != 4) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "upstream sent window update frame "
+                              "with invalid length: %uz", mux->rest);
+                return NGX_ERROR;
+            }
+
+            break;
+
+        case NGX_HTTP_V2_GOAWAY_FRAME:
+
+            if (mux->rest < 8) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "upstream sent goaway frame "
+                              "with invalid length: %uz", mux->rest);
+                return NGX_ERROR;
+            }
+
+            break;
+
+        case NGX_HTTP_V2_DATA_FRAME:
+        case NGX_HTTP_V2_HEADERS_FRAME:
+        case NGX_HTTP_V2_PRIORITY_FRAME:
+        case NGX_HTTP_V2_RST_STREAM_FRAME:
+        case NGX_HTTP_V2_PUSH_PROMISE_FRAME:
+        case NGX_HTTP_V2_CONTINUATION_FRAME:
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream sent http2 frame %ui for stream 0",
+                          mux->type);
+            return NGX_ERROR;
+
+        default:
+            /* unknown frames are ignored */
+            break;
+        }
+
+        return NGX_OK;
+    }
+
+    if (mux->type == NGX_HTTP_V2_PUSH_PROMISE_FRAME) {
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                      "upstream sent push promise frame");
+        return NGX_ERROR;
+    }
+
+    if (mux->type == NGX_HTTP_V2_DATA_FRAME) {
+
+        /*
+         * the connection window is maintained here for all the streams,
+         * including the ones already closed locally
+         */
+
+        if (mux->rest > mux->conn.recv_window) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream violated connection flow control, "
+                          "received %uz data frame with window %uz",
+                          mux->rest, mux->conn.recv_window);
+            return NGX_ERROR;
+        }
+
+        mux->conn.recv_window -= mux->rest;
+
+        if (mux->conn.recv_window < NGX_HTTP_V2_MAX_WINDOW / 4) {
+            n = NGX_HTTP_V2_MAX_WINDOW - mux->conn.recv_window;
+            mux->conn.recv_window = NGX_HTTP_V2_MAX_WINDOW;
+
+            cl = ngx_http_proxy_v2_mux_frame(mux,
+                                             NGX_HTTP_V2_WINDOW_UPDATE_FRAME,
+                                             0, 0, 4);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            *cl->buf->last++ = (u_char) ((n >> 24) & 0xff);
+            *cl->buf->last++ = (u_char) ((n >> 16) & 0xff);
+            *cl->buf->last++ = (u_char) ((n >> 8) & 0xff);
+            *cl->buf->last++ = (u_char) (n & 0xff);
+        }
+    }
+
+    stream = ngx_http_proxy_v2_mux_find(mux, mux->stream_id);
+
+    if (stream == NULL) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http2 multiplexed frame for unknown stream %ui",
+                       mux->stream_id);
+        return NGX_OK;
+    }
+
+    if (mux->type == NGX_HTTP_V2_RST_STREAM_FRAME
+        || ((mux->type == NGX_HTTP_V2_DATA_FRAME
+             || mux->type == NGX_HTTP_V2_HEADERS_FRAME)
+            && (mux->flags & NGX_HTTP_V2_END_STREAM_FLAG)))
+    {
+        stream->remote_closed = 1;
+    }
+
+    /* the frame is passed to the stream as is */
+
+    if (ngx_http_proxy_v2_mux_append(stream, mux->frame,
+                                     sizeof(ngx_http_proxy_v2_frame_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    mux->target = stream;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_frame_payload(ngx_http_proxy_v2_mux_t *mux, u_char *pos,
+    size_t size)
+{
+    size_t  n;
+
+    if (mux->target) {
+        return ngx_http_proxy_v2_mux_append(mux->target, pos, size);
+    }
+
+    if (mux->stream_id) {
+        return NGX_OK;
+    }
+
+    switch (mux->type) {
+
+    case NGX_HTTP_V2_SETTINGS_FRAME:
+
+        while (size) {
+            n = ngx_min(size, 6 - mux->data_len);
+
+            ngx_memcpy(mux->data + mux->data_len, pos, n);
+
+            mux->data_len += n;
+            pos += n;
+            size -= n;
+
+            if (mux->data_len == 6) {
+                if (ngx_http_proxy_v2_mux_setting(mux) != NGX_OK) {
+                    return NGX_ERROR;
+                }
+
+                mux->data_len = 0;
+            }
+        }
+
+        break;
+
+    case NGX_HTTP_V2_PING_FRAME:
+    case NGX_HTTP_V2_WINDOW_UPDATE_FRAME:
+    case NGX_HTTP_V2_GOAWAY_FRAME:
+
+        /* the fields needed, the debug data of goaway are skipped */
+
+        n = ngx_min(size, 8 - mux->data_len);
+
+        ngx_memcpy(mux->data + mux->data_len, pos, n);
+
+        mux->data_len += n;
+
+        break;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_frame_end(ngx_http_proxy_v2_mux_t *mux)
+{
+    size_t                           n;
+    u_char                          *p;
+    ngx_chain_t                     *cl;
+    ngx_connection_t                *c;
+    ngx_http_proxy_v2_mux_stream_t  *stream;
+
+    c = mux->connection;
+    stream = mux->target;
+
+    mux->frame_len = 0;
+    mux->target = NULL;
+
+    if (stream) {
+        stream->read.ready = 1;
+        ngx_post_event(&stream->read, &ngx_posted_events);
+        return NGX_OK;
+    }
+
+    if (mux->stream_id) {
+        return NGX_OK;
+    }
+
+    p = mux->data;
+
+    switch (mux->type) {
+
+    case NGX_HTTP_V2_SETTINGS_FRAME:
+
+        if (mux->flags & NGX_HTTP_V2_ACK_FLAG) {
+            break;
+        }
+
+        cl = ngx_http_proxy_v2_mux_frame(mux, NGX_HTTP_V2_SETTINGS_FRAME,
+                                         NGX_HTTP_V2_ACK_FLAG, 0, 0);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_http_proxy_v2_mux_wake(mux, 0);
+
+        break;
+
+    case NGX_HTTP_V2_PING_FRAME:
+
+        if (mux->flags & NGX_HTTP_V2_ACK_FLAG) {
+            break;
+        }
+
+        cl = ngx_http_proxy_v2_mux_frame(mux, NGX_HTTP_V2_PING_FRAME,
+                                         NGX_HTTP_V2_ACK_FLAG, 0, 8);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf->last = ngx_cpymem(cl->buf->last, p, 8);
+
+        break;
+
+    case NGX_HTTP_V2_WINDOW_UPDATE_FRAME:
+
+        n = ((p[0] & 0x7f) << 24) + (p[1] << 16) + (p[2] << 8) + p[3];
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http2 multiplexed window update: %uz", n);
+
+        if (n > NGX_HTTP_V2_MAX_WINDOW - mux->conn.send_window) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream sent too large window update");
+            return NGX_ERROR;
+        }
+
+        mux->conn.send_window += n;
+
+        ngx_http_proxy_v2_mux_wake(mux, 0);
+
+        break;
+
+    case NGX_HTTP_V2_GOAWAY_FRAME:
+
+        ngx_http_proxy_v2_mux_goaway(mux);
+
+        break;
+    }
+
+    if (mux->queued > NGX_HTTP_PROXY_V2_MUX_MAX_QUEUED) {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "upstream sent too many control frames");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_setting(ngx_http_proxy_v2_mux_t *mux)
+{
+    u_char                          *p;
+    ssize_t                          window_update;
+    ngx_uint_t                       id, value;
+    ngx_queue_t                     *q;
+    ngx_connection_t                *c;
+    ngx_http_proxy_v2_ctx_t         *ctx;
+    ngx_http_proxy_v2_mux_stream_t  *stream;
+
+    c = mux->connection;
+    p = mux->data;
+
+    id = (p[0] << 8) + p[1];
+    value = ((ngx_uint_t) p[2] << 24) + (p[3] << 16) + (p[4] << 8) + p[5];
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 multiplexed setting: %ui %ui", id, value);
+
+    switch (id) {
+
+    case NGX_HTTP_PROXY_V2_MAX_STREAMS_SETTING:
+
+        mux->max_streams = value;
+        break;
+
+    case NGX_HTTP_PROXY_V2_INIT_WINDOW_SETTING:
+
+        if (value > NGX_HTTP_V2_MAX_WINDOW) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream sent settings frame "
+                          "with too large initial window size: %ui", value);
+            return NGX_ERROR;
+        }
+
+        window_update = value - mux->conn.init_window;
+        mux->conn.init_window = value;
+
+        for (q = ngx_queue_head(&mux->attached);
+             q != ngx_queue_sentinel(&mux->attached);
+             q = ngx_queue_next(q))
+        {
+            stream = ngx_queue_data(q, ngx_http_proxy_v2_mux_stream_t, queue);
+            ctx = stream->ctx;
+
+            if (ctx->connection == NULL) {
+                continue;
+            }
+
+            if (ctx->send_window > 0
+                && window_update > (ssize_t) NGX_HTTP_V2_MAX_WINDOW
+                                   - ctx->send_window)
+            {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "upstream sent settings frame "
+                              "with too large initial window size: %ui",
+                              value);
+                return NGX_ERROR;
+            }
+
+            ctx->send_window += window_update;
+        }
+
+        break;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_proxy_v2_mux_goaway(ngx_http_proxy_v2_mux_t *mux)
+{
+    u_char                          *p;
+    ngx_uint_t                       last, error;
+    ngx_queue_t                     *q;
+    ngx_connection_t                *c;
+    ngx_http_proxy_v2_mux_stream_t  *stream;
+
+    c = mux->connection;
+    p = mux->data;
+
+    last = ((p[0] & 0x7f) << 24) + (p[1] << 16) + (p[2] << 8) + p[3];
+    error = ((ngx_uint_t) p[4] << 24) + (p[5] << 16) + (p[6] << 8) + p[7];
+
+    if (error) {
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                      "upstream sent goaway with error %ui", error);
+
+    } else {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http2 multiplexed goaway, last stream: %ui", last);
+    }
+
+    mux->goaway = 1;
+
+    /*
+     * the streams not processed by the server fail, and are retried
+     * as the ones which could not connect
+     */
+
+    for (q = ngx_queue_head(&mux->attached);
+         q != ngx_queue_sentinel(&mux->attached);
+         q = ngx_queue_next(q))
+    {
+        stream = ngx_queue_data(q, ngx_http_proxy_v2_mux_stream_t, queue);
+
+        if (stream->opened && stream->ctx->id <= last) {
+            continue;
+        }
+
+        stream->closed = 1;
+        stream->error = 1;
+
+        stream->read.ready = 1;
+        stream->write.ready = 1;
+
+        ngx_post_event(&stream->read, &ngx_posted_events);
+        ngx_post_event(&stream->write, &ngx_posted_events);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_append(ngx_http_proxy_v2_mux_stream_t *stream,
+    u_char *pos, size_t size)
+{
+    size_t        n;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    while (size) {
+
+        cl = stream->last_in;
+
+        if (cl == NULL || cl->buf->last == cl->buf->end) {
+
+            cl = stream->free;
+
+            if (cl) {
+                stream->free = cl->next;
+
+                b = cl->buf;
+                b->pos = b->start;
+                b->last = b->start;
+
+            } else {
+                cl = ngx_alloc_chain_link(stream->pool);
+                if (cl == NULL) {
+                    return NGX_ERROR;
+                }
+
+                cl->buf = ngx_create_temp_buf(stream->pool,
+                                              NGX_HTTP_PROXY_V2_MUX_CHUNK_SIZE);
+                if (cl->buf == NULL) {
+                    return NGX_ERROR;
+                }
+            }
+
+            cl->next = NULL;
+
+            if (stream->last_in) {
+                stream->last_in->next = cl;
+
+            } else {
+                stream->in = cl;
+            }
+
+            stream->last_in = cl;
+        }
+
+        b = cl->buf;
+
+        n = ngx_min(size, (size_t) (b->end - b->last));
+
+        b->last = ngx_cpymem(b->last, pos, n);
+
+        pos += n;
+        size -= n;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_chain_t *
+ngx_http_proxy_v2_mux_frame(ngx_http_proxy_v2_mux_t *mux, ngx_uint_t type,
+    ngx_uint_t flags, ngx_uint_t sid, size_t len)
+{
+    ngx_buf_t                  *b;
+    ngx_chain_t                *cl, **ll;
+    ngx_http_proxy_v2_frame_t  *f;
+
+    cl = mux->free;
+
+    if (cl) {
+        mux->free = cl->next;
+        b = cl->buf;
+
+    } else {
+        cl = ngx_alloc_chain_link(mux->pool);
+        if (cl == NULL) {
+            return NULL;
+        }
+
+        b = ngx_create_temp_buf(mux->pool, NGX_HTTP_PROXY_V2_MUX_FRAME_SIZE);
+        if (b == NULL) {
+            return NULL;
+        }
+
+        b->tag = (ngx_buf_tag_t) &ngx_http_proxy_v2_mux_frame;
+        b->flush = 1;
+
+        cl->buf = b;
+    }
+
+    b->pos = b->start;
+
+    f = (ngx_http_proxy_v2_frame_t *) b->pos;
+
+    f->length_0 = (u_char) ((len >> 16) & 0xff);
+    f->length_1 = (u_char) ((len >> 8) & 0xff);
+    f->length_2 = (u_char) (len & 0xff);
+    f->type = (u_char) type;
+    f->flags = (u_char) flags;
+    f->stream_id_0 = (u_char) ((sid >> 24) & 0xff);
+    f->stream_id_1 = (u_char) ((sid >> 16) & 0xff);
+    f->stream_id_2 = (u_char) ((sid >> 8) & 0xff);
+    f->stream_id_3 = (u_char) (sid & 0xff);
+
+    b->last = b->pos + sizeof(ngx_http_proxy_v2_frame_t);
+
+    for (ll = &mux->out; *ll; ll = &(*ll)->next) { /* void */ }
+
+    cl->next = NULL;
+    *ll = cl;
+
+    mux->queued++;
+
+    return cl;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_send(ngx_http_proxy_v2_mux_t *mux)
+{
+    ngx_int_t                        rc;
+    ngx_http_proxy_v2_mux_stream_t  *writer;
+
+    writer = mux->writer;
+
+    if (writer) {
+
+        /* the rest of a stream frame goes first */
+
+        if (mux->connection->write->ready) {
+            writer->write.ready = 1;
+            ngx_post_event(&writer->write, &ngx_posted_events);
+        }
+
+        return NGX_OK;
+    }
+
+    rc = ngx_http_proxy_v2_mux_flush(mux);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_OK) {
+        ngx_http_proxy_v2_mux_wake(mux, 1);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_flush(ngx_http_proxy_v2_mux_t *mux)
+{
+    ngx_chain_t       *cl, *ln;
+    ngx_connection_t  *c;
+
+    c = mux->connection;
+
+    if (mux->writer) {
+        return NGX_AGAIN;
+    }
+
+    if (mux->out == NULL && !c->buffered) {
+        return NGX_OK;
+    }
+
+    if (!c->write->ready) {
+        return NGX_AGAIN;
+    }
+
+    cl = c->send_chain(c, mux->out, 0);
+
+    if (cl == NGX_CHAIN_ERROR) {
+        c->error = 1;
+        return NGX_ERROR;
+    }
+
+    while (mux->out != cl) {
+        ln = mux->out;
+        mux->out = ln->next;
+
+        if (ln->buf->tag == (ngx_buf_tag_t) &ngx_http_proxy_v2_mux_frame) {
+            ln->next = mux->free;
+            mux->free = ln;
+            mux->queued--;
+
+        } else if (ln->buf->tag
+                   == (ngx_buf_tag_t) &ngx_http_proxy_v2_mux_detach)
+        {
+            ngx_free(ln);
+        }
+    }
+
+    if (cl || c->buffered) {
+        ngx_add_timer(c->write, mux->send_timeout);
+
+        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return NGX_AGAIN;
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_proxy_v2_mux_idle(ngx_http_proxy_v2_mux_t *mux)
+{
+    ngx_connection_t  *c;
+
+    c = mux->connection;
+
+    if (mux->goaway
+        || mux->drain
+        || mux->next_stream_id > NGX_HTTP_PROXY_V2_MUX_MAX_STREAM_ID
+                                 - 2 * mux->conf->streams
+        || ngx_terminate
+        || ngx_exiting)
+    {
+        ngx_http_proxy_v2_mux_close(mux);
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 multiplexed session %p idle", mux);
+
+    c->idle = 1;
+
+    ngx_add_timer(c->read, mux->conf->timeout);
+}
+
+
+static void
+ngx_http_proxy_v2_mux_error(ngx_http_proxy_v2_mux_t *mux)
+{
+    ngx_queue_t                     *q;
+    ngx_connection_t                *c;
+    ngx_http_proxy_v2_mux_stream_t  *stream;
+
+    c = mux->connection;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 multiplexed session %p failed, streams: %ui",
+                   mux, mux->nstreams);
+
+    if (!mux->error) {
+        mux->error = 1;
+        ngx_queue_remove(&mux->queue);
+    }
+
+    /*
+     * the streams see the connection closed, or an error,
+     * the connection is closed with the last one of them
+     */
+
+    for (q = ngx_queue_head(&mux->attached);
+         q != ngx_queue_sentinel(&mux->attached);
+         q = ngx_queue_next(q))
+    {
+        stream = ngx_queue_data(q, ngx_http_proxy_v2_mux_stream_t, queue);
+
+        stream->closed = 1;
+        stream->error = !c->read->eof;
+
+        stream->read.ready = 1;
+        stream->write.ready = 1;
+
+        ngx_post_event(&stream->read, &ngx_posted_events);
+        ngx_post_event(&stream->write, &ngx_posted_events);
+    }
+
+    if (mux->nstreams == 0) {
+        ngx_http_proxy_v2_mux_close(mux);
+        return;
+    }
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    c->read->handler = ngx_http_proxy_v2_mux_dummy_handler;
+    c->write->handler = ngx_http_proxy_v2_mux_dummy_handler;
+}
+
+
+static void
+ngx_http_proxy_v2_mux_close(ngx_http_proxy_v2_mux_t *mux)
+{
+    ngx_chain_t  *cl, *ln;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, mux->connection->log, 0,
+                   "close http2 multiplexed session %p", mux);
+
+    if (!mux->error) {
+        mux->error = 1;
+        ngx_queue_remove(&mux->queue);
+    }
+
+    for (cl = mux->out; cl; cl = ln) {
+        ln = cl->next;
+
+        if (cl->buf->tag == (ngx_buf_tag_t) &ngx_http_proxy_v2_mux_detach) {
+            ngx_free(cl);
+        }
+    }
+
+    mux->out = NULL;
+
+    ngx_http_proxy_v2_mux_close_connection(mux->connection);
+}
+
+
+static void
+ngx_http_proxy_v2_mux_close_connection(ngx_connection_t *c)
+{
+    ngx_pool_t  *pool;
+
+#if (NGX_HTTP_SSL)
+
+    if (c->ssl) {
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+
+        if (ngx_ssl_shutdown(c) == NGX_AGAIN) {
+            c->ssl->handler = ngx_http_proxy_v2_mux_close_connection;
+            return;
+        }
+    }
+
+#endif
+
+    /* the log of the connection is in the pool */
+
+    pool = c->pool;
+    pool->log = ngx_cycle->log;
+
+    ngx_close_connection(c);
+    ngx_destroy_pool(pool);
+}
+
+
+static u_char *
+ngx_http_proxy_v2_mux_log_error(ngx_log_t *log, u_char *buf, size_t len)
+{
+    u_char                   *p;
+    ngx_http_proxy_v2_mux_t  *mux;
+
+    p = buf;
+
+    if (log->action) {
+        p = ngx_snprintf(buf, len, " while %s", log->action);
+        len -= p - buf;
+        buf = p;
+    }
+
+    mux = log->data;
+
+    return ngx_snprintf(buf, len, ", upstream: \"%V\"", &mux->name);
+}
+
+
+static ssize_t
+ngx_http_proxy_v2_mux_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    size_t                           n, len;
+    ngx_buf_t                       *b;
+    ngx_chain_t                     *cl;
+    ngx_http_proxy_v2_mux_stream_t  *stream;
+
+    stream = (ngx_http_proxy_v2_mux_stream_t *) c;
+
+    n = 0;
+
+    while (stream->in && size) {
+        cl = stream->in;
+        b = cl->buf;
+
+        len = ngx_min(size, (size_t) (b->last - b->pos));
+
+        buf = ngx_cpymem(buf, b->pos, len);
+        b->pos += len;
+
+        n += len;
+        size -= len;
+
+        if (b->pos == b->last) {
+            stream->in = cl->next;
+
+            if (stream->in == NULL) {
+                stream->last_in = NULL;
+            }
+
+            cl->next = stream->free;
+            stream->free = cl;
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 multiplexed recv: %uz, closed: %d",
+                   n, stream->closed);
+
+    if (n) {
+        c->read->ready = (stream->in || stream->closed);
+        return n;
+    }
+
+    if (stream->closed) {
+        if (stream->error) {
+            c->read->error = 1;
+            return NGX_ERROR;
+        }
+
+        c->read->eof = 1;
+        return 0;
+    }
+
+    c->read->ready = 0;
+
+    return NGX_AGAIN;
+}
+
+
+static ssize_t
+ngx_http_proxy_v2_mux_recv_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit)
+{
+    size_t      size;
+    ssize_t     n, total;
+    ngx_buf_t  *b;
+
+    total = 0;
+
+    for ( /* void */ ; in; in = in->next) {
+        b = in->buf;
+
+        size = b->end - b->last;
+
+        if (limit) {
+            if (total >= limit) {
+                break;
+            }
+
+            if ((off_t) size > limit - total) {
+                size = (size_t) (limit - total);
+            }
+        }
+
+        n = ngx_http_proxy_v2_mux_recv(c, b->last, size);
+
+        if (n == NGX_AGAIN || n == NGX_ERROR || n == 0) {
+            return total ? total : n;
+        }
+
+        total += n;
+
+        if ((size_t) n < size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+
+static ngx_chain_t *
+ngx_http_proxy_v2_mux_send_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit)
+{
+    off_t                            sent;
+    ngx_int_t                        rc;
+    ngx_chain_t                     *cl;
+    ngx_connection_t                *mc;
+    ngx_http_proxy_v2_mux_t         *mux;
+    ngx_http_proxy_v2_mux_stream_t  *stream;
+
+    stream = (ngx_http_proxy_v2_mux_stream_t *) c;
+    mux = stream->mux;
+
+    if (stream->closed) {
+        c->write->error = 1;
+        return NGX_CHAIN_ERROR;
+    }
+
+    if (mux->writer != stream) {
+
+        if (mux->writer) {
+            ngx_http_proxy_v2_mux_block(stream);
+            return in;
+        }
+
+        rc = ngx_http_proxy_v2_mux_flush(mux);
+
+        if (rc == NGX_ERROR) {
+            ngx_http_proxy_v2_mux_error(mux);
+            return NGX_CHAIN_ERROR;
+        }
+
+        if (rc == NGX_AGAIN) {
+            ngx_http_proxy_v2_mux_block(stream);
+            return in;
+        }
+    }
+
+    mc = mux->connection;
+
+    sent = mc->sent;
+
+    cl = mc->send_chain(mc, in, limit);
+
+    c->sent += mc->sent - sent;
+
+    if (cl == NGX_CHAIN_ERROR) {
+        mc->error = 1;
+        ngx_http_proxy_v2_mux_error(mux);
+        return NGX_CHAIN_ERROR;
+    }
+
+    if (cl) {
+
+        /* nothing else can be sent till the rest of the frames is */
+
+        mux->writer = stream;
+        stream->out = cl;
+
+        if (!mc->write->ready) {
+            c->write->ready = 0;
+
+            ngx_add_timer(mc->write, mux->send_timeout);
+
+            if (ngx_handle_write_event(mc->write, 0) != NGX_OK) {
+                ngx_http_proxy_v2_mux_error(mux);
+                return NGX_CHAIN_ERROR;
+            }
+
+        } else if (mc->write->timer_set) {
+            ngx_del_timer(mc->write);
+        }
+
+        return cl;
+    }
+
+    if (mux->writer == stream) {
+        mux->writer = NULL;
+        stream->out = NULL;
+    }
+
+    if (ngx_http_proxy_v2_mux_send(mux) == NGX_ERROR) {
+        ngx_http_proxy_v2_mux_error(mux);
+        return NGX_CHAIN_ERROR;
+    }
+
+    return NULL;
+}
+
+
+static void *
+ngx_http_proxy_v2_mux_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_proxy_v2_mux_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_proxy_v2_mux_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->original_init_peer = NULL;
+     */
+
+    conf->streams = NGX_CONF_UNSET_UINT;
+    conf->timeout = NGX_CONF_UNSET_MSEC;
+    conf->window = NGX_CONF_UNSET_SIZE;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_proxy_v2_mux_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_uint_t                       i;
+    ngx_http_proxy_v2_mux_conf_t    *mcf;
+    ngx_http_upstream_srv_conf_t   **uscfp;
+    ngx_http_upstream_main_conf_t   *umcf;
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        /* skip implicit upstreams */
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        mcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                              ngx_http_proxy_v2_module);
+
+        if (mcf->streams == NGX_CONF_UNSET_UINT) {
+            continue;
+        }
+
+        ngx_conf_init_msec_value(mcf->timeout, 60000);
+        ngx_conf_init_size_value(mcf->window, 256 * 1024);
+
+        ngx_queue_init(&mcf->sessions);
+
+        mcf->original_init_peer = uscfp[i]->peer.init;
+
+        uscfp[i]->peer.init = ngx_http_proxy_v2_mux_init_peer;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_proxy_v2_multiplex(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_proxy_v2_mux_conf_t  *mcf = conf;
+
+    ngx_int_t    n;
+    ngx_str_t   *value, s;
+    ngx_uint_t   i;
+    ngx_msec_t   timeout;
+
+    if (mcf->streams != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    mcf->streams = n;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            timeout = ngx_parse_time(&s, 0);
+
+            if (timeout == (ngx_msec_t) NGX_ERROR || timeout == 0) {
+                goto invalid;
+            }
+
+            mcf->timeout = timeout;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "window=", 7) == 0) {
+
+            s.len = value[i].len - 7;
+            s.data = value[i].data + 7;
+
+            n = ngx_parse_size(&s);
+
+            if (n == NGX_ERROR
+                || n < NGX_HTTP_V2_DEFAULT_WINDOW
+                || n > NGX_HTTP_V2_MAX_WINDOW)
+            {
+                goto invalid;
+            }
+
+            mcf->window = n;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+#endif
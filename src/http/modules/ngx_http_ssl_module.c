@@ -370,6 +370,15 @@ static ngx_command_t  ngx_http_ssl_commands[] = {
       offsetof(ngx_http_ssl_srv_conf_t, reject_handshake),
       NULL },
 
+#if (T_NGX_SSL_KTLS)
+    { ngx_string("ssl_ktls"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_ssl_srv_conf_t, ktls),
+      NULL },
+#endif
+
       ngx_null_command
 };
 
@@ -499,6 +508,11 @@ static ngx_http_variable_t  ngx_http_ssl_vars[] = {
     { ngx_string("ssl_client_sigalg"), NULL, ngx_http_ssl_variable,
       (uintptr_t) ngx_ssl_get_client_sigalg, NGX_HTTP_VAR_CHANGEABLE, 0 },
 
+#if (T_NGX_SSL_KTLS)
+    { ngx_string("ssl_ktls"), NULL, ngx_http_ssl_variable,
+      (uintptr_t) ngx_ssl_get_ktls, NGX_HTTP_VAR_CHANGEABLE, 0 },
+#endif
+
 #if (T_NGX_SSL_HANDSHAKE_TIME)
     /* $ssl_shandshakd_time deprecated and will be removed in the next release */
     { ngx_string("ssl_handshakd_time"), NULL, ngx_http_ssl_variable,
@@ -711,6 +725,9 @@ ngx_http_ssl_create_srv_conf(ngx_conf_t *cf)
     sscf->certificate_compression = NGX_CONF_UNSET;
     sscf->early_data = NGX_CONF_UNSET;
     sscf->reject_handshake = NGX_CONF_UNSET;
+#if (T_NGX_SSL_KTLS)
+    sscf->ktls = NGX_CONF_UNSET;
+#endif
     sscf->buffer_size = NGX_CONF_UNSET_SIZE;
     sscf->verify = NGX_CONF_UNSET_UINT;
     sscf->verify_depth = NGX_CONF_UNSET_UINT;
@@ -780,6 +797,9 @@ ngx_http_ssl_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_value(conf->early_data, prev->early_data, 0);
     ngx_conf_merge_value(conf->reject_handshake, prev->reject_handshake, 0);
+#if (T_NGX_SSL_KTLS)
+    ngx_conf_merge_value(conf->ktls, prev->ktls, 0);
+#endif
 
     ngx_conf_merge_bitmask_value(conf->protocols, prev->protocols,
                          (NGX_CONF_BITMASK_SET|NGX_SSL_DEFAULT_PROTOCOLS));
@@ -1125,6 +1145,12 @@ ngx_http_ssl_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
         return NGX_CONF_ERROR;
     }
 
+#if (T_NGX_SSL_KTLS)
+    if (ngx_ssl_ktls(cf, &conf->ssl, conf->ktls) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+#endif
+
     if (ngx_ssl_conf_commands(cf, &conf->ssl, conf->conf_commands) != NGX_OK) {
         return NGX_CONF_ERROR;
     }
@@ -26,6 +26,9 @@ typedef struct {
     ngx_flag_t                      certificate_compression;
     ngx_flag_t                      early_data;
     ngx_flag_t                      reject_handshake;
+#if (T_NGX_SSL_KTLS)
+    ngx_flag_t                      ktls;
+#endif
 
     ngx_uint_t                      protocols;
 
@@ -31,6 +31,7 @@ typedef struct {
     ngx_uint_t                          config;
 #endif
     ngx_http_upstream_chash_points_t   *points;
+    ngx_maglev_t                       *maglev;
 } ngx_http_upstream_hash_srv_conf_t;
 
 
@@ -66,6 +67,19 @@ static ngx_int_t ngx_http_upstream_init_chash_peer(ngx_http_request_t *r,
 static ngx_int_t ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc,
     void *data);
 
+static ngx_int_t ngx_http_upstream_init_maglev(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_maglev_t *ngx_http_upstream_create_maglev(ngx_pool_t *pool,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_uint_t ngx_http_upstream_maglev_skip(ngx_maglev_t *mg,
+    ngx_uint_t i, void *data);
+static ngx_uint_t ngx_http_upstream_maglev_peer_down(
+    ngx_http_upstream_rr_peer_t *peer, time_t now);
+static ngx_int_t ngx_http_upstream_init_maglev_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_maglev_peer(ngx_peer_connection_t *pc,
+    void *data);
+
 static void *ngx_http_upstream_hash_create_conf(ngx_conf_t *cf);
 static char *ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -732,6 +746,347 @@ found:
 }
 
 
+static ngx_int_t
+ngx_http_upstream_init_maglev(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_maglev_t                       *mg;
+    ngx_http_upstream_hash_srv_conf_t  *hcf;
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_maglev_peer;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (us->shm_zone) {
+        return NGX_OK;
+    }
+#endif
+
+    mg = ngx_http_upstream_create_maglev(cf->pool, us);
+    if (mg == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_maglev_populate(mg) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
+    hcf->maglev = mg;
+
+    return NGX_OK;
+}
+
+
+static ngx_maglev_t *
+ngx_http_upstream_create_maglev(ngx_pool_t *pool,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_uint_t                     i, n;
+    ngx_maglev_t                  *mg;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    peers = us->peer.data;
+    n = peers->number;
+
+    mg = ngx_maglev_create(pool, n, ngx_maglev_size(n), 1);
+    if (mg == NULL) {
+        return NULL;
+    }
+
+    for (peer = peers->peer, i = 0; peer; peer = peer->next, i++) {
+        ngx_maglev_set(mg, i, peer,
+                       ngx_crc32_long(peer->server.data, peer->server.len),
+                       ngx_murmur_hash2(peer->server.data, peer->server.len),
+                       peer->weight);
+    }
+
+    return mg;
+}
+
+
+/* the peers which cannot be used for this request */
+
+static ngx_uint_t
+ngx_http_upstream_maglev_skip(ngx_maglev_t *mg, ngx_uint_t i, void *data)
+{
+    ngx_http_upstream_rr_peer_data_t *rrp = data;
+
+    uintptr_t                     m;
+    ngx_uint_t                    n;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    n = i / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+    if (rrp->tried[n] & m) {
+        return 1;
+    }
+
+    peer = mg->data[i];
+
+    if (ngx_http_upstream_maglev_peer_down(peer, ngx_time())) {
+        return 1;
+    }
+
+    if (peer->max_conns && peer->conns >= peer->max_conns) {
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_maglev_peer_down(ngx_http_upstream_rr_peer_t *peer,
+    time_t now)
+{
+    if (peer->down) {
+        return 1;
+    }
+
+#if (NGX_HTTP_UPSTREAM_CHECK)
+    if (ngx_http_upstream_check_peer_down(peer->check_index)) {
+        return 1;
+    }
+#endif
+
+    if (peer->max_fails
+        && peer->fails >= peer->max_fails
+        && now - peer->checked <= peer->fail_timeout)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_maglev_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                           config;
+    ngx_maglev_t                        *mg;
+#endif
+    ngx_http_upstream_hash_srv_conf_t   *hcf;
+    ngx_http_upstream_hash_peer_data_t  *hp;
+
+    if (ngx_http_upstream_init_hash_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.get = ngx_http_upstream_get_maglev_peer;
+
+    hp = r->upstream->peer.data;
+    hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
+
+    hp->hash = ngx_crc32_long(hp->key.data, hp->key.len);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_http_upstream_rr_peers_rlock(hp->rrp.peers);
+
+    if (hp->rrp.peers->config == NULL
+        || (hcf->maglev && hcf->config == *hp->rrp.peers->config))
+    {
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+        return NGX_OK;
+    }
+
+    config = *hp->rrp.peers->config;
+    mg = ngx_http_upstream_create_maglev(NULL, us);
+
+    ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+
+    if (mg == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* the peers are saved in the table, which is populated without the lock */
+
+    if (ngx_maglev_populate(mg) != NGX_OK) {
+        ngx_free(mg);
+        return NGX_ERROR;
+    }
+
+    if (hcf->maglev) {
+        ngx_free(hcf->maglev);
+    }
+
+    hcf->maglev = mg;
+    hcf->config = config;
+#endif
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_maglev_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_hash_peer_data_t  *hp = data;
+
+    time_t                        now;
+    uint32_t                      slot, i;
+    uintptr_t                     m;
+    ngx_uint_t                    n, changed;
+    ngx_maglev_t                 *mg;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get maglev hash peer, try: %ui", pc->tries);
+
+    ngx_http_upstream_rr_peers_wlock(hp->rrp.peers);
+
+    if (hp->tries > 20 || hp->rrp.peers->single || hp->key.len == 0) {
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+        return hp->get_rr_peer(pc, &hp->rrp);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    if (hp->rrp.peers->number == 0) {
+        pc->name = hp->rrp.peers->name;
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+        return NGX_BUSY;
+    }
+
+again:
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (hp->rrp.peers->config && hp->rrp.config != *hp->rrp.peers->config) {
+        pc->name = hp->rrp.peers->name;
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+        return NGX_BUSY;
+    }
+#endif
+
+    now = ngx_time();
+    mg = hp->conf->maglev;
+
+#if (NGX_HTTP_UPSTREAM_SID)
+    peer = ngx_http_upstream_get_rr_peer_by_sid(&hp->rrp, pc->hint, &n, 0);
+
+    if (peer) {
+        i = (uint32_t) n;
+        goto found;
+    }
+#endif
+
+    changed = 0;
+
+    /* once a second, take back the peers which are up again */
+
+    if (mg->ndown && mg->checked != now) {
+        mg->checked = now;
+
+        for (i = 0; i < mg->number; i++) {
+            if (mg->down[i]
+                && !ngx_http_upstream_maglev_peer_down(mg->data[i], now))
+            {
+                mg->down[i] = 0;
+                mg->ndown--;
+                changed = 1;
+            }
+        }
+    }
+
+    slot = hp->hash % mg->size;
+
+    i = mg->table[slot];
+    peer = mg->data[i];
+
+    if (!mg->down[i] && ngx_http_upstream_maglev_peer_down(peer, now)) {
+
+        /* the peer went down, move its slots to the other peers */
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "maglev hash peer down: \"%V\"", &peer->name);
+
+        mg->down[i] = 1;
+        mg->ndown++;
+        changed = 1;
+    }
+
+    if (changed) {
+
+        /*
+         * the table is private to the worker process, and is rebuilt
+         * from the weights saved in it without holding the peers lock
+         */
+
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+
+        ngx_maglev_rebuild(mg);
+
+        ngx_http_upstream_rr_peers_wlock(hp->rrp.peers);
+
+        goto again;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "maglev hash peer, value:%uD, slot:%uD, peer:%uD",
+                   hp->hash, slot, i);
+
+    n = i / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+    if (mg->down[i]
+        || (hp->rrp.tried[n] & m)
+        || (peer->max_conns && peer->conns >= peer->max_conns))
+    {
+        /* all down, or the peer cannot be used for this request */
+
+        i = ngx_maglev_choose(mg, slot, ngx_http_upstream_maglev_skip,
+                              &hp->rrp);
+
+        if (i == NGX_MAGLEV_NONE) {
+            ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+            return hp->get_rr_peer(pc, &hp->rrp);
+        }
+
+        peer = mg->data[i];
+    }
+
+#if (NGX_HTTP_UPSTREAM_SID)
+found:
+#endif
+
+    hp->tries++;
+
+    hp->rrp.current = peer;
+    ngx_http_upstream_rr_peer_ref(hp->rrp.peers, peer);
+
+    pc->sockaddr = peer->sockaddr;
+    pc->socklen = peer->socklen;
+    pc->name = &peer->name;
+
+#if (NGX_HTTP_UPSTREAM_SID)
+    pc->sid = &peer->sid;
+#endif
+
+    peer->conns++;
+
+    if (now - peer->checked > peer->fail_timeout) {
+        peer->checked = now;
+    }
+
+    ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+
+    n = i / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+    hp->rrp.tried[n] |= m;
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_http_upstream_hash_create_conf(ngx_conf_t *cf)
 {
@@ -743,6 +1098,7 @@ ngx_http_upstream_hash_create_conf(ngx_conf_t *cf)
     }
 
     conf->points = NULL;
+    conf->maglev = NULL;
 
     return conf;
 }
@@ -790,6 +1146,9 @@ ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     } else if (ngx_strcmp(value[2].data, "consistent") == 0) {
         uscf->peer.init_upstream = ngx_http_upstream_init_chash;
 
+    } else if (ngx_strcmp(value[2].data, "maglev") == 0) {
+        uscf->peer.init_upstream = ngx_http_upstream_init_maglev;
+
     } else {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[2]);
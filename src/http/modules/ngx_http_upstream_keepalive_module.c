@@ -10,6 +10,80 @@
 #include <ngx_http.h>
 
 
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+
+/*
+ * With "keepalive_shared", the idle connections cached by a worker are also
+ * recorded in a shared memory zone, indexed by the upstream name and the
+ * address of the server.  A worker without a suitable connection of its own
+ * takes one from another worker instead of connecting: the descriptor is
+ * duplicated with pidfd_getfd(), and the record is removed, with the zone
+ * locked.
+ *
+ * The owner removes the record before it closes or reuses the connection.
+ * If the record is already gone, the connection was taken, and the owner
+ * only deletes its duplicate from epoll and closes it: close() does not
+ * shut the connection down, and the socket stays open in the other worker.
+ */
+
+typedef struct ngx_http_upstream_keepalive_node_s
+    ngx_http_upstream_keepalive_node_t;
+
+
+typedef struct {
+    ngx_queue_t                        queue;
+    ngx_http_upstream_keepalive_node_t  *node;
+
+    ngx_uint_t                         id;
+    ngx_uint_t                         generation;
+    ngx_pid_t                          pid;
+    ngx_int_t                          slot;
+    ngx_socket_t                       fd;
+    uintptr_t                          tag;
+
+    ngx_msec_t                         start_time;
+    ngx_msec_t                         time;
+    ngx_uint_t                         requests;
+} ngx_http_upstream_keepalive_idle_t;
+
+
+struct ngx_http_upstream_keepalive_node_s {
+    ngx_rbtree_node_t                  node;
+    ngx_queue_t                        idle;
+    ngx_uint_t                         count;
+    socklen_t                          socklen;
+    u_short                            len;
+    u_char                             data[1];
+};
+
+
+typedef struct {
+    ngx_rbtree_t                       rbtree;
+    ngx_rbtree_node_t                  sentinel;
+
+    /* the idle records are never freed, so their ids stay valid */
+    ngx_queue_t                        free;
+
+    ngx_uint_t                         id;
+    ngx_uint_t                         generation;
+} ngx_http_upstream_keepalive_shctx_t;
+
+
+typedef struct {
+    ngx_http_upstream_keepalive_shctx_t  *sh;
+    ngx_slab_pool_t                   *shpool;
+    ngx_uint_t                         generation;
+} ngx_http_upstream_keepalive_zone_t;
+
+
+typedef struct {
+    ngx_pid_t                          pid;
+    ngx_fd_t                           fd;
+} ngx_http_upstream_keepalive_pidfd_t;
+
+#endif
+
+
 typedef struct {
     ngx_uint_t                         max_cached;
     ngx_uint_t                         requests;
@@ -23,6 +97,12 @@ typedef struct {
 
     ngx_uint_t                         local; /* unsigned  local:1; */
 
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+    ngx_shm_zone_t                    *shm_zone;
+    ngx_uint_t                         max_shared;
+    ngx_str_t                          name;
+#endif
+
 } ngx_http_upstream_keepalive_srv_conf_t;
 
 
@@ -37,6 +117,11 @@ typedef struct {
 
     ngx_http_upstream_conf_t          *tag;
 
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+    ngx_http_upstream_keepalive_idle_t  *idle;
+    ngx_uint_t                         id;
+#endif
+
 } ngx_http_upstream_keepalive_cache_t;
 
 
@@ -81,6 +166,35 @@ static void ngx_http_upstream_keepalive_save_session(ngx_peer_connection_t *pc,
 static void ngx_http_upstream_notify_keepalive_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t type);
 
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+static ngx_int_t ngx_http_upstream_keepalive_steal(ngx_peer_connection_t *pc,
+    ngx_http_upstream_keepalive_peer_data_t *kp);
+static ngx_int_t ngx_http_upstream_keepalive_getfd(
+    ngx_http_upstream_keepalive_idle_t *idle, ngx_socket_t *s, ngx_log_t *log);
+static void ngx_http_upstream_keepalive_publish(ngx_peer_connection_t *pc,
+    ngx_http_upstream_keepalive_cache_t *item);
+static ngx_int_t ngx_http_upstream_keepalive_unpublish(
+    ngx_http_upstream_keepalive_cache_t *item);
+static ngx_http_upstream_keepalive_node_t *ngx_http_upstream_keepalive_lookup(
+    ngx_http_upstream_keepalive_zone_t *zone, ngx_str_t *name,
+    struct sockaddr *sockaddr, socklen_t socklen, uint32_t hash);
+static void ngx_http_upstream_keepalive_remove(
+    ngx_http_upstream_keepalive_zone_t *zone,
+    ngx_http_upstream_keepalive_idle_t *idle);
+static ngx_int_t ngx_http_upstream_keepalive_cmp(
+    ngx_http_upstream_keepalive_node_t *kn, u_char *name, size_t len,
+    u_char *sockaddr, socklen_t socklen);
+static void ngx_http_upstream_keepalive_rbtree_insert_value(
+    ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_upstream_keepalive_init_zone(
+    ngx_shm_zone_t *shm_zone, void *data);
+static ngx_int_t ngx_http_upstream_keepalive_init_process(ngx_cycle_t *cycle);
+static void ngx_http_upstream_keepalive_exit_process(ngx_cycle_t *cycle);
+static char *ngx_http_upstream_keepalive_shared(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+#endif
+
 static void *ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf);
 static char *ngx_http_upstream_keepalive_init_main_conf(ngx_conf_t *cf,
     void *conf);
@@ -118,6 +232,17 @@ static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
       offsetof(ngx_http_upstream_keepalive_srv_conf_t, requests),
       NULL },
 
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+
+    { ngx_string("keepalive_shared"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_keepalive_shared,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+#endif
+
       ngx_null_command
 };
 
@@ -144,15 +269,33 @@ ngx_module_t  ngx_http_upstream_keepalive_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+    ngx_http_upstream_keepalive_init_process, /* init process */
+#else
     NULL,                                  /* init process */
+#endif
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+    ngx_http_upstream_keepalive_exit_process, /* exit process */
+#else
     NULL,                                  /* exit process */
+#endif
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
 
 
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+
+static ngx_http_upstream_keepalive_pidfd_t
+    ngx_http_upstream_keepalive_pidfds[NGX_MAX_PROCESSES];
+
+static ngx_uint_t  ngx_http_upstream_keepalive_no_pidfd;
+
+#endif
+
+
 static ngx_int_t
 ngx_http_upstream_init_keepalive_peer(ngx_http_request_t *r,
     ngx_http_upstream_srv_conf_t *us)
@@ -226,6 +369,10 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
 
     cache = &kp->conf->cache;
 
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+again:
+#endif
+
     for (q = ngx_queue_head(cache);
          q != ngx_queue_sentinel(cache);
          q = ngx_queue_next(q))
@@ -244,10 +391,23 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
             ngx_queue_remove(q);
             ngx_queue_insert_head(&kp->conf->free, q);
 
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+            if (ngx_http_upstream_keepalive_unpublish(item) != NGX_OK) {
+                ngx_http_upstream_keepalive_close(c);
+                goto again;
+            }
+#endif
+
             goto found;
         }
     }
 
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+    if (kp->conf->shm_zone) {
+        return ngx_http_upstream_keepalive_steal(pc, kp);
+    }
+#endif
+
     return NGX_OK;
 
 found:
@@ -338,6 +498,10 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
 
         item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
 
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+        (void) ngx_http_upstream_keepalive_unpublish(item);
+#endif
+
         ngx_http_upstream_keepalive_close(item->connection);
 
     } else {
@@ -374,6 +538,21 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     item->socklen = pc->socklen;
     ngx_memcpy(&item->sockaddr, pc->sockaddr, pc->socklen);
 
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+
+    /* the state of SSL connections cannot be shared */
+
+    if (kp->conf->shm_zone
+#if (NGX_HTTP_SSL)
+        && c->ssl == NULL
+#endif
+       )
+    {
+        ngx_http_upstream_keepalive_publish(pc, item);
+    }
+
+#endif
+
     if (c->read->ready) {
         ngx_http_upstream_keepalive_close_handler(c->read);
     }
@@ -428,6 +607,10 @@ close:
     item = c->data;
     conf = item->conf;
 
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+    (void) ngx_http_upstream_keepalive_unpublish(item);
+#endif
+
     ngx_http_upstream_keepalive_close(c);
 
     ngx_queue_remove(&item->queue);
@@ -491,6 +674,767 @@ ngx_http_upstream_notify_keepalive_peer(ngx_peer_connection_t *pc, void *data,
 }
 
 
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+
+static ngx_int_t
+ngx_http_upstream_keepalive_steal(ngx_peer_connection_t *pc,
+    ngx_http_upstream_keepalive_peer_data_t *kp)
+{
+    uint32_t                                 hash;
+    ngx_int_t                                rc;
+    ngx_uint_t                               requests, last;
+    ngx_msec_t                               start_time;
+    ngx_queue_t                             *q, *next;
+    ngx_socket_t                             s;
+    ngx_process_t                           *p;
+    ngx_connection_t                        *c;
+    ngx_http_upstream_keepalive_node_t      *kn;
+    ngx_http_upstream_keepalive_idle_t      *idle;
+    ngx_http_upstream_keepalive_zone_t      *zone;
+    ngx_http_upstream_keepalive_srv_conf_t  *conf;
+
+    if (ngx_http_upstream_keepalive_no_pidfd) {
+        return NGX_OK;
+    }
+
+    conf = kp->conf;
+    zone = conf->shm_zone->data;
+
+    ngx_crc32_init(hash);
+    ngx_crc32_update(&hash, conf->name.data, conf->name.len);
+    ngx_crc32_update(&hash, (u_char *) pc->sockaddr, pc->socklen);
+    ngx_crc32_final(hash);
+
+    s = (ngx_socket_t) -1;
+    requests = 0;
+    start_time = 0;
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    kn = ngx_http_upstream_keepalive_lookup(zone, &conf->name, pc->sockaddr,
+                                            pc->socklen, hash);
+    if (kn == NULL) {
+        ngx_shmtx_unlock(&zone->shpool->mutex);
+        return NGX_OK;
+    }
+
+    for (q = ngx_queue_head(&kn->idle);
+         q != ngx_queue_sentinel(&kn->idle);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+        idle = ngx_queue_data(q, ngx_http_upstream_keepalive_idle_t, queue);
+
+        if (idle->pid == ngx_pid || idle->generation != zone->generation) {
+            continue;
+        }
+
+        if (conf->local && idle->tag != (uintptr_t) kp->upstream->conf) {
+            continue;
+        }
+
+        /* the owner is about to close the connection */
+
+        if (ngx_current_msec - idle->time >= conf->timeout
+            || ngx_current_msec - idle->start_time > conf->time)
+        {
+            continue;
+        }
+
+        last = (kn->count == 1);
+
+        p = &ngx_processes[idle->slot];
+
+        if (p->pid != idle->pid || p->channel[0] == -1) {
+            rc = NGX_DECLINED;
+
+        } else {
+            rc = ngx_http_upstream_keepalive_getfd(idle, &s, pc->log);
+        }
+
+        if (rc == NGX_ERROR) {
+            break;
+        }
+
+        if (rc == NGX_OK) {
+            requests = idle->requests;
+            start_time = idle->start_time;
+        }
+
+        /* the connection is taken, or its worker has exited */
+
+        ngx_http_upstream_keepalive_remove(zone, idle);
+
+        if (rc == NGX_OK || last) {
+            break;
+        }
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    if (s == (ngx_socket_t) -1) {
+        return NGX_OK;
+    }
+
+    c = ngx_get_connection(s, pc->log);
+
+    if (c == NULL) {
+        if (ngx_close_socket(s) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, pc->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+
+        return NGX_OK;
+    }
+
+    c->type = SOCK_STREAM;
+
+    c->recv = ngx_recv;
+    c->send = ngx_send;
+    c->recv_chain = ngx_recv_chain;
+    c->send_chain = ngx_send_chain;
+
+    c->sendfile = 1;
+
+    if (pc->sockaddr->sa_family == AF_UNIX) {
+        c->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+        c->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
+    }
+
+    c->log_error = pc->log_error;
+
+    c->read->log = pc->log;
+    c->write->log = pc->log;
+
+    c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+
+    c->requests = requests;
+    c->start_time = start_time;
+
+    if (ngx_add_conn) {
+        if (ngx_add_conn(c) == NGX_ERROR) {
+            goto failed;
+        }
+
+    } else {
+        if (ngx_add_event(c->read, NGX_READ_EVENT, NGX_LEVEL_EVENT)
+            != NGX_OK)
+        {
+            goto failed;
+        }
+    }
+
+    c->write->ready = 1;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get keepalive peer: using shared connection %p, fd:%d",
+                   c, s);
+
+    pc->connection = c;
+    pc->cached = 1;
+
+    return NGX_DONE;
+
+failed:
+
+    ngx_close_connection(c);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_getfd(ngx_http_upstream_keepalive_idle_t *idle,
+    ngx_socket_t *s, ngx_log_t *log)
+{
+    int                                   fd;
+    ngx_err_t                             err;
+    ngx_http_upstream_keepalive_pidfd_t  *pidfd;
+
+    pidfd = &ngx_http_upstream_keepalive_pidfds[idle->slot];
+
+    if (pidfd->pid != idle->pid) {
+
+        if (pidfd->fd != NGX_INVALID_FILE) {
+            (void) close(pidfd->fd);
+        }
+
+        pidfd->pid = idle->pid;
+        pidfd->fd = syscall(SYS_pidfd_open, idle->pid, 0);
+
+        if (pidfd->fd == NGX_INVALID_FILE) {
+            err = ngx_errno;
+            pidfd->pid = 0;
+
+            if (err == NGX_ESRCH) {
+                return NGX_DECLINED;
+            }
+
+            goto failed;
+        }
+    }
+
+    fd = syscall(SYS_pidfd_getfd, pidfd->fd, idle->fd, 0);
+
+    if (fd == -1) {
+        err = ngx_errno;
+
+        if (err == NGX_ESRCH || err == NGX_EBADF) {
+            return NGX_DECLINED;
+        }
+
+        goto failed;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "keepalive fd:%d of process %P is fd:%d",
+                   idle->fd, idle->pid, fd);
+
+    *s = fd;
+
+    return NGX_OK;
+
+failed:
+
+    ngx_log_error(NGX_LOG_NOTICE, log, err,
+                  "pidfd_getfd() failed, connections cached by "
+                  "other worker processes will not be used");
+
+    ngx_http_upstream_keepalive_no_pidfd = 1;
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_http_upstream_keepalive_publish(ngx_peer_connection_t *pc,
+    ngx_http_upstream_keepalive_cache_t *item)
+{
+    size_t                                   n;
+    uint32_t                                 hash;
+    ngx_queue_t                             *q;
+    ngx_connection_t                        *c;
+    ngx_http_upstream_keepalive_node_t      *kn;
+    ngx_http_upstream_keepalive_idle_t      *idle;
+    ngx_http_upstream_keepalive_zone_t      *zone;
+    ngx_http_upstream_keepalive_srv_conf_t  *conf;
+
+    conf = item->conf;
+    zone = conf->shm_zone->data;
+    c = item->connection;
+
+    ngx_crc32_init(hash);
+    ngx_crc32_update(&hash, conf->name.data, conf->name.len);
+    ngx_crc32_update(&hash, (u_char *) pc->sockaddr, pc->socklen);
+    ngx_crc32_final(hash);
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    kn = ngx_http_upstream_keepalive_lookup(zone, &conf->name, pc->sockaddr,
+                                            pc->socklen, hash);
+
+    if (kn == NULL) {
+        n = offsetof(ngx_http_upstream_keepalive_node_t, data)
+            + conf->name.len + pc->socklen;
+
+        kn = ngx_slab_alloc_locked(zone->shpool, n);
+        if (kn == NULL) {
+            goto done;
+        }
+
+        kn->node.key = hash;
+        kn->count = 0;
+        kn->socklen = pc->socklen;
+        kn->len = (u_short) conf->name.len;
+
+        ngx_memcpy(ngx_cpymem(kn->data, conf->name.data, conf->name.len),
+                   pc->sockaddr, pc->socklen);
+
+        ngx_queue_init(&kn->idle);
+
+        ngx_rbtree_insert(&zone->sh->rbtree, &kn->node);
+
+    } else if (conf->max_shared && kn->count >= conf->max_shared) {
+        goto done;
+    }
+
+    if (!ngx_queue_empty(&zone->sh->free)) {
+        q = ngx_queue_head(&zone->sh->free);
+        ngx_queue_remove(q);
+
+        idle = ngx_queue_data(q, ngx_http_upstream_keepalive_idle_t, queue);
+
+    } else {
+        idle = ngx_slab_alloc_locked(zone->shpool,
+                                  sizeof(ngx_http_upstream_keepalive_idle_t));
+        if (idle == NULL) {
+
+            if (kn->count == 0) {
+                ngx_rbtree_delete(&zone->sh->rbtree, &kn->node);
+                ngx_slab_free_locked(zone->shpool, kn);
+            }
+
+            goto done;
+        }
+    }
+
+    if (++zone->sh->id == 0) {
+        zone->sh->id = 1;
+    }
+
+    idle->node = kn;
+    idle->id = zone->sh->id;
+    idle->generation = zone->generation;
+    idle->pid = ngx_pid;
+    idle->slot = ngx_process_slot;
+    idle->fd = c->fd;
+    idle->tag = (uintptr_t) item->tag;
+    idle->start_time = c->start_time;
+    idle->time = ngx_current_msec;
+    idle->requests = c->requests;
+
+    ngx_queue_insert_head(&kn->idle, &idle->queue);
+    kn->count++;
+
+    item->idle = idle;
+    item->id = idle->id;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free keepalive peer: shared connection %p, id:%ui",
+                   c, idle->id);
+
+done:
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_unpublish(ngx_http_upstream_keepalive_cache_t *item)
+{
+    ngx_int_t                            rc;
+    ngx_connection_t                    *c;
+    ngx_http_upstream_keepalive_idle_t  *idle;
+    ngx_http_upstream_keepalive_zone_t  *zone;
+
+    idle = item->idle;
+
+    if (idle == NULL) {
+        return NGX_OK;
+    }
+
+    item->idle = NULL;
+
+    zone = item->conf->shm_zone->data;
+    c = item->connection;
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    if (idle->id == item->id) {
+        ngx_http_upstream_keepalive_remove(zone, idle);
+        rc = NGX_OK;
+
+    } else {
+        rc = NGX_DECLINED;
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    if (rc == NGX_OK) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "keepalive connection %p taken by another worker", c);
+
+    /*
+     * the socket is still open in the other worker,
+     * so epoll will not delete it on close()
+     */
+
+    if (ngx_del_conn) {
+        (void) ngx_del_conn(c, 0);
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_http_upstream_keepalive_node_t *
+ngx_http_upstream_keepalive_lookup(ngx_http_upstream_keepalive_zone_t *zone,
+    ngx_str_t *name, struct sockaddr *sockaddr, socklen_t socklen,
+    uint32_t hash)
+{
+    ngx_int_t                            rc;
+    ngx_rbtree_node_t                   *node, *sentinel;
+    ngx_http_upstream_keepalive_node_t  *kn;
+
+    node = zone->sh->rbtree.root;
+    sentinel = zone->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        kn = (ngx_http_upstream_keepalive_node_t *) node;
+
+        rc = ngx_http_upstream_keepalive_cmp(kn, name->data, name->len,
+                                             (u_char *) sockaddr, socklen);
+
+        if (rc == 0) {
+            return kn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_upstream_keepalive_remove(ngx_http_upstream_keepalive_zone_t *zone,
+    ngx_http_upstream_keepalive_idle_t *idle)
+{
+    ngx_http_upstream_keepalive_node_t  *kn;
+
+    kn = idle->node;
+
+    ngx_queue_remove(&idle->queue);
+    ngx_queue_insert_head(&zone->sh->free, &idle->queue);
+
+    idle->id = 0;
+    idle->node = NULL;
+
+    if (--kn->count == 0) {
+        ngx_rbtree_delete(&zone->sh->rbtree, &kn->node);
+        ngx_slab_free_locked(zone->shpool, kn);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_cmp(ngx_http_upstream_keepalive_node_t *kn,
+    u_char *name, size_t len, u_char *sockaddr, socklen_t socklen)
+{
+    ngx_int_t  rc;
+
+    rc = ngx_memn2cmp(name, kn->data, len, kn->len);
+
+    if (rc != 0) {
+        return rc;
+    }
+
+    return ngx_memn2cmp(sockaddr, kn->data + kn->len, socklen, kn->socklen);
+}
+
+
+static void
+ngx_http_upstream_keepalive_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t                   **p;
+    ngx_http_upstream_keepalive_node_t   *kn, *knt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            kn = (ngx_http_upstream_keepalive_node_t *) node;
+            knt = (ngx_http_upstream_keepalive_node_t *) temp;
+
+            p = (ngx_http_upstream_keepalive_cmp(knt, kn->data, kn->len,
+                                                 kn->data + kn->len,
+                                                 kn->socklen)
+                 < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_upstream_keepalive_zone_t  *ozone = data;
+
+    size_t                               len;
+    ngx_http_upstream_keepalive_zone_t  *zone;
+
+    zone = shm_zone->data;
+
+    if (ozone) {
+        zone->sh = ozone->sh;
+        zone->shpool = ozone->shpool;
+
+        /* the connections of the old workers use the old configuration */
+
+        zone->generation = ++zone->sh->generation;
+
+        return NGX_OK;
+    }
+
+    zone->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        zone->sh = zone->shpool->data;
+        zone->generation = ++zone->sh->generation;
+
+        return NGX_OK;
+    }
+
+    zone->sh = ngx_slab_alloc(zone->shpool,
+                              sizeof(ngx_http_upstream_keepalive_shctx_t));
+    if (zone->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    zone->shpool->data = zone->sh;
+
+    ngx_rbtree_init(&zone->sh->rbtree, &zone->sh->sentinel,
+                    ngx_http_upstream_keepalive_rbtree_insert_value);
+
+    ngx_queue_init(&zone->sh->free);
+
+    zone->sh->id = 0;
+    zone->sh->generation = 1;
+    zone->generation = 1;
+
+    len = sizeof(" in keepalive_shared zone \"\"") + shm_zone->shm.name.len;
+
+    zone->shpool->log_ctx = ngx_slab_alloc(zone->shpool, len);
+    if (zone->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(zone->shpool->log_ctx, " in keepalive_shared zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* when the zone is full, connections are just not shared */
+
+    zone->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < NGX_MAX_PROCESSES; i++) {
+        ngx_http_upstream_keepalive_pidfds[i].pid = 0;
+        ngx_http_upstream_keepalive_pidfds[i].fd = NGX_INVALID_FILE;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_keepalive_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                                i;
+    ngx_queue_t                              *q, *cache;
+    ngx_http_upstream_srv_conf_t            **uscfp;
+    ngx_http_upstream_main_conf_t            *umcf;
+    ngx_http_upstream_keepalive_cache_t      *item;
+    ngx_http_upstream_keepalive_srv_conf_t   *kcf;
+
+    for (i = 0; i < NGX_MAX_PROCESSES; i++) {
+        if (ngx_http_upstream_keepalive_pidfds[i].fd != NGX_INVALID_FILE) {
+            (void) close(ngx_http_upstream_keepalive_pidfds[i].fd);
+            ngx_http_upstream_keepalive_pidfds[i].fd = NGX_INVALID_FILE;
+        }
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return;
+    }
+
+    /* the connections are not taken once the worker has exited */
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        kcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                            ngx_http_upstream_keepalive_module);
+
+        if (kcf->shm_zone == NULL || kcf->max_cached == 0) {
+            continue;
+        }
+
+        cache = &kcf->cache;
+
+        for (q = ngx_queue_head(cache);
+             q != ngx_queue_sentinel(cache);
+             q = ngx_queue_next(q))
+        {
+            item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t,
+                                  queue);
+
+            (void) ngx_http_upstream_keepalive_unpublish(item);
+        }
+    }
+}
+
+
+static char *
+ngx_http_upstream_keepalive_shared(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf = conf;
+
+    u_char                              *p;
+    ssize_t                              size;
+    ngx_int_t                            n;
+    ngx_str_t                           *value, name, s;
+    ngx_uint_t                           i;
+    ngx_shm_zone_t                      *shm_zone;
+    ngx_http_upstream_keepalive_zone_t  *zone;
+
+    if (kcf->shm_zone) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    ngx_str_null(&name);
+    size = 0;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p) {
+                *p = '\0';
+
+                name.len = p - name.data;
+
+                s.data = p + 1;
+                s.len = value[i].data + value[i].len - s.data;
+
+                size = ngx_parse_size(&s);
+
+                if (size == NGX_ERROR) {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "invalid zone size \"%V\"", &value[i]);
+                    return NGX_CONF_ERROR;
+                }
+
+                if (size < (ssize_t) (8 * ngx_pagesize)) {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "zone \"%V\" is too small", &value[i]);
+                    return NGX_CONF_ERROR;
+                }
+
+            } else {
+                name.len = value[i].len - 5;
+            }
+
+            if (name.len == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone name \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max=", 4) == 0) {
+
+            n = ngx_atoi(value[i].data + 4, value[i].len - 4);
+
+            if (n == NGX_ERROR || n == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid max value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            kcf->max_shared = n;
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_upstream_keepalive_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data == NULL) {
+        zone = ngx_pcalloc(cf->pool,
+                           sizeof(ngx_http_upstream_keepalive_zone_t));
+        if (zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        shm_zone->init = ngx_http_upstream_keepalive_init_zone;
+        shm_zone->data = zone;
+    }
+
+    kcf->shm_zone = shm_zone;
+
+    return NGX_CONF_OK;
+}
+
+#endif
+
+
 static void *
 ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
 {
@@ -507,6 +1451,8 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
      *
      *     conf->original_init_peer = NULL;
      *     conf->local = 0;
+     *     conf->shm_zone = NULL;
+     *     conf->max_shared = 0;
      */
 
     conf->time = NGX_CONF_UNSET_MSEC;
@@ -556,6 +1502,10 @@ ngx_http_upstream_keepalive_init_main_conf(ngx_conf_t *cf, void *conf)
 
         kcf->original_init_peer = uscfp[i]->peer.init;
 
+#if (T_NGX_HTTP_UPSTREAM_KEEPALIVE_SHARED)
+        kcf->name = uscfp[i]->host;
+#endif
+
         uscfp[i]->peer.init = ngx_http_upstream_init_keepalive_peer;
 
         /* allocate cache items and add to free queue */
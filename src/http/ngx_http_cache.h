@@ -51,13 +51,22 @@ typedef struct {
     unsigned                         updating:1;
     unsigned                         deleting:1;
     unsigned                         purged:1;
-                                     /* 10 unused bits */
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+    unsigned                         indexed:1;
+#endif
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+    unsigned                         referenced:1;
+#endif
+                                     /* 8 to 10 unused bits */
 
     ngx_file_uniq_t                  uniq;
     time_t                           expire;
     time_t                           valid_sec;
     size_t                           body_start;
     off_t                            fs_size;
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+    time_t                           index_expire;
+#endif
     ngx_msec_t                       lock_time;
 } ngx_http_file_cache_node_t;
 
@@ -144,6 +153,33 @@ typedef struct {
 } ngx_http_file_cache_header_t;
 
 
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+
+typedef struct {
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_file_uniq_t                  uniq;
+    off_t                            fs_size;
+    time_t                           expire;
+    time_t                           valid_sec;
+    u_short                          body_start;
+    u_short                          valid_msec;
+    u_char                           op;
+    u_char                           reserved[3];
+} ngx_http_file_cache_index_rec_t;
+
+#endif
+
+
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+
+typedef struct {
+    uint32_t                         tag;
+    uint32_t                         node;
+} ngx_http_file_cache_slot_t;
+
+#endif
+
+
 typedef struct {
     ngx_rbtree_t                     rbtree;
     ngx_rbtree_node_t                sentinel;
@@ -153,6 +189,37 @@ typedef struct {
     off_t                            size;
     ngx_uint_t                       count;
     ngx_uint_t                       watermark;
+
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+    ngx_http_file_cache_index_rec_t *index;
+    ngx_uint_t                       index_size;
+    ngx_uint_t                       index_head;
+    ngx_uint_t                       index_count;
+    ngx_uint_t                       index_records;
+    ngx_uint_t                       index_generation;
+    ngx_atomic_t                     index_lock;
+    off_t                            index_offset;
+    off_t                            index_end;
+    time_t                           index_time;
+    ngx_uint_t                       index_state;
+
+    unsigned                         index_lost:1;
+    unsigned                         index_reset:1;
+    unsigned                         index_clean:1;
+    unsigned                         index_partial:1;
+    unsigned                         index_complete:1;
+    unsigned                         index_checkpoint:1;
+#endif
+
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+    ngx_http_file_cache_slot_t      *hash;
+    ngx_uint_t                       hash_mask;
+    ngx_uint_t                       hash_zeroed;
+    u_char                           hash_last[NGX_HTTP_CACHE_KEY_LEN];
+
+    unsigned                         hash_walk:1;
+    unsigned                         hash_ready:1;
+#endif
 } ngx_http_file_cache_sh_t;
 
 
@@ -184,6 +251,19 @@ struct ngx_http_file_cache_s {
 
     ngx_uint_t                       use_temp_path;
                                      /* unsigned use_temp_path:1 */
+
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+    ngx_str_t                        index;
+    ngx_str_t                        index_temp;
+    ngx_fd_t                         index_fd;
+    ngx_uint_t                       index_generation;
+    ngx_http_file_cache_index_rec_t *index_buf;
+    ngx_event_t                      index_event;
+#endif
+
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+    ngx_flag_t                       keys_hash;
+#endif
 };
 
 
@@ -197,6 +277,9 @@ void ngx_http_file_cache_update_header(ngx_http_request_t *r);
 ngx_int_t ngx_http_cache_send(ngx_http_request_t *);
 void ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf);
 time_t ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status);
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+void ngx_http_file_cache_index_exit(ngx_cycle_t *cycle);
+#endif
 
 char *ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
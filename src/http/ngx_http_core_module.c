@@ -69,6 +69,11 @@ static char *ngx_http_core_error_page(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+static char *ngx_http_core_open_file_cache_shared(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_http_core_init_process(ngx_cycle_t *cycle);
+#endif
 static char *ngx_http_core_error_log(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -445,6 +450,17 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_loc_conf_t, sendfile_max_chunk),
       NULL },
 
+#if (T_NGX_SEND_ZEROCOPY)
+
+    { ngx_string("send_zerocopy"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, send_zerocopy),
+      NULL },
+
+#endif
+
     { ngx_string("subrequest_output_buffer_size"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_size_slot,
@@ -796,6 +812,15 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_loc_conf_t, open_file_cache_events),
       NULL },
 
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+    { ngx_string("open_file_cache_shared"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      ngx_http_core_open_file_cache_shared,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+#endif
+
     { ngx_string("resolver"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
       ngx_http_core_resolver,
@@ -904,7 +929,11 @@ ngx_module_t  ngx_http_core_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+    ngx_http_core_init_process,            /* init process */
+#else
     NULL,                                  /* init process */
+#endif
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -3917,6 +3946,9 @@ ngx_http_core_create_loc_conf(ngx_conf_t *cf)
     clcf->internal = NGX_CONF_UNSET;
     clcf->sendfile = NGX_CONF_UNSET;
     clcf->sendfile_max_chunk = NGX_CONF_UNSET_SIZE;
+#if (T_NGX_SEND_ZEROCOPY)
+    clcf->send_zerocopy = NGX_CONF_UNSET;
+#endif
     clcf->subrequest_output_buffer_size = NGX_CONF_UNSET_SIZE;
     clcf->aio = NGX_CONF_UNSET;
     clcf->aio_write = NGX_CONF_UNSET;
@@ -4017,6 +4049,9 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_uint_t        i;
     ngx_hash_key_t   *type;
     ngx_hash_init_t   types_hash;
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+    ngx_http_core_main_conf_t  *cmcf;
+#endif
 
     if (conf->root.data == NULL) {
 
@@ -4218,6 +4253,9 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->sendfile, prev->sendfile, 0);
     ngx_conf_merge_size_value(conf->sendfile_max_chunk,
                               prev->sendfile_max_chunk, 2 * 1024 * 1024);
+#if (T_NGX_SEND_ZEROCOPY)
+    ngx_conf_merge_value(conf->send_zerocopy, prev->send_zerocopy, 0);
+#endif
     ngx_conf_merge_size_value(conf->subrequest_output_buffer_size,
                               prev->subrequest_output_buffer_size,
                               (size_t) ngx_pagesize);
@@ -4342,6 +4380,13 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_sec_value(conf->open_file_cache_events,
                               prev->open_file_cache_events, 0);
+
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+    if (conf->open_file_cache) {
+        cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+        conf->open_file_cache->shared = cmcf->open_file_shared;
+    }
+#endif
 #if (NGX_HTTP_GZIP)
 
     ngx_conf_merge_value(conf->gzip_vary, prev->gzip_vary, 0);
@@ -5451,6 +5496,86 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+
+static char *
+ngx_http_core_open_file_cache_shared(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_core_main_conf_t *cmcf = conf;
+
+    time_t      valid;
+    ssize_t     size;
+    ngx_str_t  *value, s;
+
+    static ngx_str_t  name = ngx_string("open_file_cache_shared");
+
+    if (cmcf->open_file_shared) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    size = ngx_parse_size(&value[1]);
+
+    if (size == NGX_ERROR || size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid \"open_file_cache_shared\" size \"%V\"",
+                           &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    valid = 60;
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "valid=", 6) != 0) {
+            goto invalid;
+        }
+
+        s.len = value[2].len - 6;
+        s.data = value[2].data + 6;
+
+        valid = ngx_parse_time(&s, 1);
+        if (valid == (time_t) NGX_ERROR || valid == 0) {
+            goto invalid;
+        }
+    }
+
+    cmcf->open_file_shared = ngx_open_file_shared_add(cf, &name, size, valid,
+                                                      &ngx_http_core_module);
+    if (cmcf->open_file_shared == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid \"open_file_cache_shared\" parameter \"%V\"",
+                       &value[2]);
+    return NGX_CONF_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_core_init_process(ngx_cycle_t *cycle)
+{
+    ngx_http_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_core_module);
+
+    if (cmcf == NULL || cmcf->open_file_shared == NULL) {
+        return NGX_OK;
+    }
+
+    return ngx_open_file_shared_init_process(cycle, cmcf->open_file_shared);
+}
+
+#endif
+
+
 static char *
 ngx_http_core_error_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
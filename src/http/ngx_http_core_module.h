@@ -190,6 +190,10 @@ typedef struct {
 
     ngx_array_t               *ports;
 
+#if (T_NGX_OPEN_FILE_CACHE_SHARED)
+    ngx_open_file_shared_t    *open_file_shared;
+#endif
+
     ngx_http_phase_t           phases[NGX_HTTP_LOG_PHASE + 1];
 } ngx_http_core_main_conf_t;
 
@@ -438,6 +442,9 @@ struct ngx_http_core_loc_conf_s {
 #endif
     ngx_flag_t    internal;                /* internal */
     ngx_flag_t    sendfile;                /* sendfile */
+#if (T_NGX_SEND_ZEROCOPY)
+    ngx_flag_t    send_zerocopy;           /* send_zerocopy */
+#endif
     ngx_flag_t    aio;                     /* aio */
     ngx_flag_t    aio_write;               /* aio_write */
     ngx_flag_t    tcp_nopush;              /* tcp_nopush */
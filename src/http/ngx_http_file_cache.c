@@ -63,6 +63,120 @@ static ngx_int_t ngx_http_file_cache_add(ngx_http_file_cache_t *cache,
 static ngx_int_t ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
 static void ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache);
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+static ngx_int_t ngx_http_file_cache_index_init(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_t *ocache);
+static ngx_uint_t ngx_http_file_cache_index_empty(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_loader_handler(ngx_event_t *ev);
+static void ngx_http_file_cache_index_log(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, ngx_uint_t op);
+static void ngx_http_file_cache_index_fill(ngx_http_file_cache_index_rec_t *rec,
+    ngx_http_file_cache_node_t *fcn, ngx_uint_t op);
+static ngx_int_t ngx_http_file_cache_index_manage(ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_index_lock(ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_index_open(ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_index_lock_file(
+    ngx_http_file_cache_t *cache, ngx_fd_t fd);
+static ngx_int_t ngx_http_file_cache_index_check(ngx_http_file_cache_t *cache,
+    ngx_fd_t fd);
+static ngx_int_t ngx_http_file_cache_index_replay(
+    ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_index_apply(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_index_rec_t *rec, time_t shift);
+static ngx_int_t ngx_http_file_cache_index_flush(ngx_http_file_cache_t *cache,
+    ngx_fd_t fd, u_char *name, ngx_uint_t *lost);
+static ngx_int_t ngx_http_file_cache_index_checkpoint(
+    ngx_http_file_cache_t *cache);
+static ngx_rbtree_node_t *ngx_http_file_cache_index_next(
+    ngx_http_file_cache_t *cache, u_char *key);
+static ngx_int_t ngx_http_file_cache_index_header(ngx_http_file_cache_t *cache,
+    ngx_fd_t fd, u_char *name);
+static ngx_int_t ngx_http_file_cache_index_mark(ngx_fd_t fd, u_char *name,
+    ngx_uint_t op);
+static ngx_int_t ngx_http_file_cache_index_write(ngx_fd_t fd, u_char *name,
+    u_char *buf, size_t size);
+static ngx_int_t ngx_http_file_cache_index_buf(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_index_close(ngx_fd_t fd, u_char *name);
+
+
+#define NGX_HTTP_FILE_CACHE_INDEX_VERSION   1
+
+#define NGX_HTTP_FILE_CACHE_INDEX_ADD       1
+#define NGX_HTTP_FILE_CACHE_INDEX_DEL       2
+#define NGX_HTTP_FILE_CACHE_INDEX_CLEAN     3
+#define NGX_HTTP_FILE_CACHE_INDEX_LOST      4
+
+#define NGX_HTTP_FILE_CACHE_INDEX_REPLAY    1
+#define NGX_HTTP_FILE_CACHE_INDEX_WALK      2
+
+#define NGX_HTTP_FILE_CACHE_INDEX_RECORDS   4096
+
+#define NGX_HTTP_FILE_CACHE_INDEX_MODE      (NGX_FILE_RDWR|O_APPEND)
+
+/*
+ * files modified this long before the index was last written are assumed
+ * to be in the index when the directory walk completes an unclean index
+ */
+
+#define NGX_HTTP_FILE_CACHE_INDEX_SLACK     60
+
+
+typedef struct {
+    u_char                           magic[8];
+    ngx_uint_t                       version;
+    size_t                           record_size;
+    size_t                           bsize;
+    u_char                           levels[NGX_MAX_PATH_LEVEL];
+    u_char                           reserved[5];
+} ngx_http_file_cache_index_header_t;
+
+
+static u_char  ngx_http_file_cache_index_magic[] = "NGXCIDX";
+
+#endif
+
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+static ngx_int_t ngx_http_file_cache_hash_init(ngx_http_file_cache_t *cache,
+    ngx_uint_t reuse);
+static ngx_int_t ngx_http_file_cache_hash_build(ngx_http_file_cache_t *cache);
+static ngx_rbtree_node_t *ngx_http_file_cache_hash_walk(
+    ngx_http_file_cache_t *cache);
+static ngx_queue_t *ngx_http_file_cache_expire_scan(
+    ngx_http_file_cache_t *cache, ngx_queue_t *q, time_t now,
+    ngx_uint_t *sweep);
+static ngx_http_file_cache_node_t *ngx_http_file_cache_hash_lookup(
+    ngx_http_file_cache_t *cache, u_char *key);
+static void ngx_http_file_cache_hash_insert(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static void ngx_http_file_cache_hash_delete(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+
+
+/*
+ * the number of entries moved to the head of the inactive queue
+ * for a second chance while the zone mutex is held
+ */
+
+#define NGX_HTTP_FILE_CACHE_SWEEP           1000
+
+/*
+ * the number of slots zeroed and of nodes added to the keys hash
+ * built by the cache manager while the zone mutex is held
+ */
+
+#define NGX_HTTP_FILE_CACHE_HASH_ZERO       65536
+#define NGX_HTTP_FILE_CACHE_HASH_WALK       4096
+
+#define ngx_http_file_cache_hash_node(cache, n)                               \
+    ((ngx_http_file_cache_node_t *) ((u_char *) (cache)->shpool               \
+                                     + ((size_t) (n) << 3)))
+
+/* the slots are zeroed, and nodes are added to and deleted from the table */
+
+#define ngx_http_file_cache_hash_active(sh)                                   \
+    ((sh)->hash && (sh)->hash_zeroed > (sh)->hash_mask)
+
+#endif
 
 
 ngx_str_t  ngx_http_cache_status[] = {
@@ -121,6 +235,20 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
             cache->path->loader = NULL;
         }
 
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+        if (ngx_http_file_cache_hash_init(cache, 1) != NGX_OK) {
+            return NGX_ERROR;
+        }
+#endif
+
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+        if (cache->index.len
+            && ngx_http_file_cache_index_init(cache, ocache) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+#endif
+
         return NGX_OK;
     }
 
@@ -152,6 +280,19 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
     cache->sh->count = 0;
     cache->sh->watermark = (ngx_uint_t) -1;
 
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+    ngx_memzero(&cache->sh->index, sizeof(ngx_http_file_cache_sh_t)
+                                   - offsetof(ngx_http_file_cache_sh_t, index));
+#endif
+
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+    cache->sh->hash = NULL;
+    cache->sh->hash_mask = 0;
+    cache->sh->hash_zeroed = 0;
+    cache->sh->hash_walk = 0;
+    cache->sh->hash_ready = 0;
+#endif
+
     cache->bsize = ngx_fs_bsize(cache->path->name.data);
 
     cache->max_size /= cache->bsize;
@@ -168,6 +309,20 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     cache->shpool->log_nomem = 0;
 
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+    if (ngx_http_file_cache_hash_init(cache, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+#endif
+
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+    if (cache->index.len
+        && ngx_http_file_cache_index_init(cache, NULL) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+#endif
+
     return NGX_OK;
 }
 
@@ -644,6 +799,11 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
             c->node->fs_size = c->fs_size;
 
             cache->sh->size += c->fs_size;
+
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+            ngx_http_file_cache_index_log(cache, c->node,
+                                          NGX_HTTP_FILE_CACHE_INDEX_ADD);
+#endif
         }
 
         ngx_shmtx_unlock(&cache->shpool->mutex);
@@ -882,6 +1042,11 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
     ngx_int_t                    rc;
     ngx_http_file_cache_node_t  *fcn;
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+    ngx_uint_t                   queued;
+
+    queued = 0;
+#endif
 
     ngx_shmtx_lock(&cache->shpool->mutex);
 
@@ -892,7 +1057,23 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
     }
 
     if (fcn) {
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+        if (cache->sh->hash) {
+
+            /*
+             * the entry is left in place and moved to the head of
+             * the inactive queue once it reaches the tail
+             */
+
+            fcn->referenced = 1;
+            queued = 1;
+
+        } else {
+            ngx_queue_remove(&fcn->queue);
+        }
+#else
         ngx_queue_remove(&fcn->queue);
+#endif
 
         if (c->node == NULL) {
             fcn->uses++;
@@ -957,6 +1138,10 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 
     ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
 
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+    ngx_http_file_cache_hash_insert(cache, fcn);
+#endif
+
     fcn->uses = 1;
     fcn->count = 1;
 
@@ -976,7 +1161,26 @@ done:
 
     fcn->expire = ngx_time() + cache->inactive;
 
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+
+    /* the time a node is kept for is journaled once it moved notably */
+
+    if (fcn->exists && !fcn->deleting
+        && fcn->expire - fcn->index_expire > cache->inactive / 4)
+    {
+        ngx_http_file_cache_index_log(cache, fcn,
+                                      NGX_HTTP_FILE_CACHE_INDEX_ADD);
+    }
+
+#endif
+
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+    if (!queued) {
+        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    }
+#else
     ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+#endif
 
     c->uniq = fcn->uniq;
     c->error = fcn->error;
@@ -1033,6 +1237,12 @@ ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
     ngx_rbtree_node_t           *node, *sentinel;
     ngx_http_file_cache_node_t  *fcn;
 
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+    if (cache->sh->hash_ready) {
+        return ngx_http_file_cache_hash_lookup(cache, key);
+    }
+#endif
+
     ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
 
     node = cache->sh->rbtree.root;
@@ -1481,8 +1691,17 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 
     if (rc == NGX_OK) {
         c->node->exists = 1;
+
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+        ngx_http_file_cache_index_log(cache, c->node,
+                                      NGX_HTTP_FILE_CACHE_INDEX_ADD);
+#endif
     }
 
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+    c->node->indexed = 0;
+#endif
+
     c->node->updating = 0;
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
@@ -1498,6 +1717,9 @@ ngx_http_file_cache_update_header(ngx_http_request_t *r)
     ngx_file_info_t                fi;
     ngx_http_cache_t              *c;
     ngx_http_file_cache_header_t   h;
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+    ngx_http_file_cache_t         *cache;
+#endif
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http file cache update header");
@@ -1609,8 +1831,31 @@ ngx_http_file_cache_update_header(ngx_http_request_t *r)
         ngx_memcpy(h.variant, c->variant, NGX_HTTP_CACHE_KEY_LEN);
     }
 
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+
+    n = ngx_write_file(&file, (u_char *) &h,
+                       sizeof(ngx_http_file_cache_header_t), 0);
+
+    if (n == sizeof(ngx_http_file_cache_header_t) && c->node) {
+        cache = c->file_cache;
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        if (c->node->exists) {
+            c->node->valid_sec = c->valid_sec;
+            c->node->valid_msec = c->valid_msec;
+
+            ngx_http_file_cache_index_log(cache, c->node,
+                                          NGX_HTTP_FILE_CACHE_INDEX_ADD);
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+    }
+
+#else
     (void) ngx_write_file(&file, (u_char *) &h,
                           sizeof(ngx_http_file_cache_header_t), 0);
+#endif
 
 done:
 
@@ -1706,6 +1951,9 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
     } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
         ngx_queue_remove(&fcn->queue);
         ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+        ngx_http_file_cache_hash_delete(cache, fcn);
+#endif
         ngx_slab_free_locked(cache->shpool, fcn);
         cache->sh->count--;
         c->node = NULL;
@@ -1768,6 +2016,11 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
     ngx_queue_t                 *q, *sentinel;
     ngx_http_file_cache_node_t  *fcn;
     u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+    ngx_uint_t                   sweep;
+
+    sweep = 0;
+#endif
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                    "http file cache forced expire");
@@ -1801,6 +2054,18 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
 
         fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+        if (fcn->referenced) {
+            fcn->referenced = 0;
+
+            if (sweep++ < NGX_HTTP_FILE_CACHE_SWEEP) {
+                ngx_queue_remove(q);
+                ngx_queue_insert_head(&cache->sh->queue, q);
+                continue;
+            }
+        }
+#endif
+
         ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                   "http file cache forced expire: #%d %d %02xd%02xd%02xd%02xd",
                   fcn->count, fcn->exists,
@@ -1867,6 +2132,11 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
     ngx_queue_t                 *q;
     ngx_http_file_cache_node_t  *fcn;
     u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+    ngx_uint_t                   sweep;
+
+    sweep = 0;
+#endif
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                    "http file cache expire");
@@ -1901,9 +2171,37 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 
         fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+        if (fcn->referenced) {
+            fcn->referenced = 0;
+
+            ngx_queue_remove(q);
+            ngx_queue_insert_head(&cache->sh->queue, q);
+
+            if (++sweep < NGX_HTTP_FILE_CACHE_SWEEP) {
+                continue;
+            }
+
+            wait = 0;
+            break;
+        }
+#endif
+
         wait = fcn->expire - now;
 
         if (wait > 0) {
+
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+            if (cache->sh->hash) {
+                q = ngx_http_file_cache_expire_scan(cache, q, now, &sweep);
+
+                if (q) {
+                    ngx_http_file_cache_delete(cache, q, name);
+                    goto next;
+                }
+            }
+#endif
+
             wait = wait > 10 ? 10 : wait;
             break;
         }
@@ -1967,6 +2265,48 @@ next:
 }
 
 
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+
+static ngx_queue_t *
+ngx_http_file_cache_expire_scan(ngx_http_file_cache_t *cache, ngx_queue_t *q,
+    time_t now, ngx_uint_t *sweep)
+{
+    ngx_http_file_cache_node_t  *fcn;
+
+    /*
+     * an entry used is left in place and keeps the time it was last
+     * used when moved to the head of the inactive queue, so the queue
+     * is not ordered by the expiration time, and expired entries may
+     * follow the tail one which is not yet expired: up to
+     * NGX_HTTP_FILE_CACHE_SWEEP more entries are looked at, and
+     * the ones further in the queue are removed once they get closer
+     * to the tail, at most "inactive" later
+     */
+
+    for (q = ngx_queue_prev(q);
+         q != ngx_queue_sentinel(&cache->sh->queue);
+         q = ngx_queue_prev(q))
+    {
+        if ((*sweep)++ >= NGX_HTTP_FILE_CACHE_SWEEP) {
+            return NULL;
+        }
+
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        if (fcn->expire <= now
+            && fcn->count == 0
+            && !fcn->referenced)
+        {
+            return q;
+        }
+    }
+
+    return NULL;
+}
+
+#endif
+
+
 static void
 ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
     u_char *name)
@@ -2007,11 +2347,19 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
         ngx_shmtx_lock(&cache->shpool->mutex);
         fcn->count--;
         fcn->deleting = 0;
+
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+        ngx_http_file_cache_index_log(cache, fcn,
+                                      NGX_HTTP_FILE_CACHE_INDEX_DEL);
+#endif
     }
 
     if (fcn->count == 0) {
         ngx_queue_remove(q);
         ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+        ngx_http_file_cache_hash_delete(cache, fcn);
+#endif
         ngx_slab_free_locked(cache->shpool, fcn);
         cache->sh->count--;
     }
@@ -2027,10 +2375,28 @@ ngx_http_file_cache_manager(void *data)
     time_t      wait;
     ngx_msec_t  elapsed, next;
     ngx_uint_t  count, watermark;
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+    ngx_int_t   rc;
+#endif
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+    ngx_int_t   hrc;
+#endif
 
     cache->last = ngx_current_msec;
     cache->files = 0;
 
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+    rc = NGX_OK;
+
+    if (cache->index.len) {
+        rc = ngx_http_file_cache_index_manage(cache);
+    }
+#endif
+
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+    hrc = ngx_http_file_cache_hash_build(cache);
+#endif
+
     next = (ngx_msec_t) ngx_http_file_cache_expire(cache) * 1000;
 
     if (next == 0) {
@@ -2095,6 +2461,18 @@ ngx_http_file_cache_manager(void *data)
 
 done:
 
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+    if (rc == NGX_AGAIN && next > cache->manager_sleep) {
+        next = cache->manager_sleep;
+    }
+#endif
+
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+    if (hrc == NGX_AGAIN && next > cache->manager_sleep) {
+        next = cache->manager_sleep;
+    }
+#endif
+
     elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
 
     ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
@@ -2112,6 +2490,21 @@ ngx_http_file_cache_loader(void *data)
 
     ngx_tree_ctx_t  tree;
 
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+
+    /* the cache manager replays the index first */
+
+    if (cache->sh->index_state == NGX_HTTP_FILE_CACHE_INDEX_REPLAY) {
+        cache->index_event.handler = ngx_http_file_cache_loader_handler;
+        cache->index_event.data = cache;
+        cache->index_event.log = ngx_cycle->log;
+
+        ngx_add_timer(&cache->index_event, 100);
+        return;
+    }
+
+#endif
+
     if (!cache->sh->cold || cache->sh->loading) {
         return;
     }
@@ -2140,6 +2533,11 @@ ngx_http_file_cache_loader(void *data)
         return;
     }
 
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+    cache->sh->index_state = 0;
+    cache->sh->index_checkpoint = 1;
+#endif
+
     cache->sh->cold = 0;
     cache->sh->loading = 0;
 
@@ -2151,6 +2549,21 @@ ngx_http_file_cache_loader(void *data)
 }
 
 
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+
+static void
+ngx_http_file_cache_loader_handler(ngx_event_t *ev)
+{
+    if (ngx_quit || ngx_terminate) {
+        return;
+    }
+
+    ngx_http_file_cache_loader(ev->data);
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
 {
@@ -2224,6 +2637,33 @@ ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
     ngx_http_cache_t        c;
     ngx_http_file_cache_t  *cache;
 
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+
+    cache = ctx->data;
+
+    if (cache->index.len) {
+
+        if ((name->len == cache->index.len
+             && ngx_strncmp(name->data, cache->index.data, name->len) == 0)
+            || (name->len == cache->index_temp.len
+                && ngx_strncmp(name->data, cache->index_temp.data, name->len)
+                   == 0))
+        {
+            return NGX_OK;
+        }
+
+        /* the files in the replayed index */
+
+        if (cache->sh->index_state == NGX_HTTP_FILE_CACHE_INDEX_WALK
+            && ctx->mtime < cache->sh->index_time
+                            - NGX_HTTP_FILE_CACHE_INDEX_SLACK)
+        {
+            return NGX_OK;
+        }
+    }
+
+#endif
+
     if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
         return NGX_ERROR;
     }
@@ -2304,6 +2744,10 @@ ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 
         ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
 
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+        ngx_http_file_cache_hash_insert(cache, fcn);
+#endif
+
         fcn->uses = 1;
         fcn->exists = 1;
         fcn->fs_size = c->fs_size;
@@ -2349,69 +2793,1626 @@ ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache)
 }
 
 
-time_t
-ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status)
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+
+static ngx_int_t
+ngx_http_file_cache_index_init(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_t *ocache)
 {
-    ngx_uint_t               i;
-    ngx_http_cache_valid_t  *valid;
+    size_t                     n;
+    ngx_file_info_t            fi;
+    ngx_http_file_cache_sh_t  *sh;
 
-    if (cache_valid == NULL) {
-        return 0;
+    /*
+     * the index may be written by the running cache manager,
+     * it is only opened and checked by the cache manager
+     * under the index file lock
+     */
+
+    if (ngx_test_config) {
+        return NGX_OK;
     }
 
-    valid = cache_valid->elts;
-    for (i = 0; i < cache_valid->nelts; i++) {
+    sh = cache->sh;
 
-        if (valid[i].status == 0) {
-            return valid[i].valid;
-        }
+    if (sh->index == NULL) {
+        n = cache->shm_zone->shm.size / 32
+            / sizeof(ngx_http_file_cache_index_rec_t);
+        n = ngx_min(n, NGX_HTTP_FILE_CACHE_INDEX_RECORDS);
 
-        if (valid[i].status == status) {
-            return valid[i].valid;
+        sh->index = ngx_slab_alloc(cache->shpool,
+                                   n * sizeof(ngx_http_file_cache_index_rec_t));
+        if (sh->index == NULL) {
+            return NGX_ERROR;
         }
+
+        sh->index_size = n;
     }
 
-    return 0;
-}
+    if (ocache) {
 
+        if (ocache->index.len
+            && ngx_strcmp(cache->index.data, ocache->index.data) == 0)
+        {
+            return NGX_OK;
+        }
 
-char *
-ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
-{
-    char  *confp = conf;
+        /* the index is started anew, as it misses the nodes added so far */
 
-    off_t                   max_size, min_free;
-    u_char                 *last, *p;
-    time_t                  inactive;
-    ssize_t                 size;
-    ngx_str_t               s, name, *value;
-    ngx_int_t               loader_files, manager_files;
-    ngx_msec_t              loader_sleep, manager_sleep, loader_threshold,
-                            manager_threshold;
-    ngx_uint_t              i, n, use_temp_path;
-    ngx_array_t            *caches;
-    ngx_http_file_cache_t  *cache, **ce;
+        if (sh->index_state == NGX_HTTP_FILE_CACHE_INDEX_REPLAY) {
+            sh->index_state = 0;
+        }
 
-    cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_file_cache_t));
-    if (cache == NULL) {
-        return NGX_CONF_ERROR;
-    }
+        sh->index_complete = 0;
+        sh->index_reset = 1;
 
-    cache->path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
-    if (cache->path == NULL) {
-        return NGX_CONF_ERROR;
+        return NGX_OK;
     }
 
-    use_temp_path = 1;
+    sh->index_reset = 1;
 
-    inactive = 600;
+    if (ngx_file_info(cache->index.data, &fi) == NGX_FILE_ERROR) {
 
-    loader_files = 100;
-    loader_sleep = 50;
-    loader_threshold = 200;
+        if (ngx_errno != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, cache->shm_zone->shm.log, ngx_errno,
+                          ngx_file_info_n " \"%s\" failed", cache->index.data);
+            return NGX_OK;
+        }
 
-    manager_files = 100;
-    manager_sleep = 50;
+        /* an empty cache is indexed from the start */
+
+        if (ngx_http_file_cache_index_empty(cache)) {
+            sh->index_state = NGX_HTTP_FILE_CACHE_INDEX_REPLAY;
+            sh->index_clean = 1;
+            sh->index_complete = 1;
+        }
+
+        return NGX_OK;
+    }
+
+    /* the replay starts once the cache manager has checked the index */
+
+    sh->index_state = NGX_HTTP_FILE_CACHE_INDEX_REPLAY;
+    sh->index_reset = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_index_empty(ngx_http_file_cache_t *cache)
+{
+    size_t       len;
+    u_char      *name;
+    ngx_str_t   *path;
+    ngx_dir_t    dir;
+    ngx_uint_t   empty;
+
+    path = &cache->path->name;
+
+    if (ngx_open_dir(path, &dir) == NGX_ERROR) {
+        return ngx_errno == NGX_ENOENT;
+    }
+
+    empty = 1;
+
+    for ( ;; ) {
+        ngx_set_errno(0);
+
+        if (ngx_read_dir(&dir) == NGX_ERROR) {
+
+            if (ngx_errno != NGX_ENOMOREFILES) {
+                empty = 0;
+            }
+
+            break;
+        }
+
+        name = ngx_de_name(&dir);
+        len = ngx_de_namelen(&dir);
+
+        if (name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.'))) {
+            continue;
+        }
+
+        if (len == 4 && ngx_strncmp(name, "temp", 4) == 0) {
+            continue;
+        }
+
+        if (cache->index.len == path->len + 1 + len
+            && ngx_strncmp(cache->index.data, path->data, path->len) == 0
+            && cache->index.data[path->len] == '/'
+            && ngx_strncmp(cache->index.data + path->len + 1, name, len) == 0)
+        {
+            continue;
+        }
+
+        empty = 0;
+        break;
+    }
+
+    if (ngx_close_dir(&dir) == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cache->shm_zone->shm.log, ngx_errno,
+                      ngx_close_dir_n " \"%V\" failed", path);
+    }
+
+    return empty;
+}
+
+
+static void
+ngx_http_file_cache_index_log(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, ngx_uint_t op)
+{
+    ngx_http_file_cache_sh_t  *sh;
+
+    if (cache->index.len == 0) {
+        return;
+    }
+
+    sh = cache->sh;
+
+    if (sh->index_count == sh->index_size) {
+        sh->index_lost = 1;
+        return;
+    }
+
+    ngx_http_file_cache_index_fill(
+        &sh->index[(sh->index_head + sh->index_count) % sh->index_size],
+        fcn, op);
+
+    sh->index_count++;
+}
+
+
+static void
+ngx_http_file_cache_index_fill(ngx_http_file_cache_index_rec_t *rec,
+    ngx_http_file_cache_node_t *fcn, ngx_uint_t op)
+{
+    ngx_memcpy(rec->key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(&rec->key[sizeof(ngx_rbtree_key_t)], fcn->key,
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    rec->uniq = fcn->uniq;
+    rec->fs_size = fcn->fs_size;
+    rec->expire = fcn->expire;
+    rec->valid_sec = fcn->valid_sec;
+    rec->body_start = (u_short) fcn->body_start;
+    rec->valid_msec = (u_short) fcn->valid_msec;
+    rec->op = (u_char) op;
+    ngx_memzero(rec->reserved, sizeof(rec->reserved));
+
+    fcn->index_expire = fcn->expire;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_manage(ngx_http_file_cache_t *cache)
+{
+    ngx_int_t                  rc;
+    ngx_uint_t                 lost;
+    ngx_http_file_cache_sh_t  *sh;
+
+    sh = cache->sh;
+
+    if (ngx_http_file_cache_index_lock(cache) != NGX_OK) {
+        return NGX_OK;
+    }
+
+    rc = ngx_http_file_cache_index_open(cache);
+
+    if (rc != NGX_OK) {
+
+        if (sh->index_state == NGX_HTTP_FILE_CACHE_INDEX_REPLAY) {
+
+            if (rc == NGX_BUSY) {
+                /* the index is still written by the previous cache manager */
+                rc = NGX_AGAIN;
+
+            } else {
+                /* the cache loader walks the whole cache */
+                sh->index_state = 0;
+                rc = NGX_OK;
+            }
+
+        } else {
+            rc = NGX_OK;
+        }
+
+        goto done;
+    }
+
+    if (sh->index_state == NGX_HTTP_FILE_CACHE_INDEX_REPLAY) {
+        rc = ngx_http_file_cache_index_replay(cache);
+    }
+
+    if (ngx_http_file_cache_index_flush(cache, cache->index_fd,
+                                        cache->index.data, &lost)
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    if (lost) {
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "cache index \"%s\" lost updates",
+                      cache->index.data);
+
+        sh->index_complete = 0;
+
+        if (sh->cold) {
+            if (ngx_http_file_cache_index_mark(cache->index_fd,
+                                               cache->index.data,
+                                               NGX_HTTP_FILE_CACHE_INDEX_LOST)
+                != NGX_OK)
+            {
+                goto failed;
+            }
+
+        } else {
+            sh->index_checkpoint = 1;
+        }
+    }
+
+    if (!sh->cold
+        && (sh->index_checkpoint
+            || sh->index_records > ngx_max(sh->count, sh->index_size)))
+    {
+        (void) ngx_http_file_cache_index_checkpoint(cache);
+    }
+
+    goto done;
+
+failed:
+
+    ngx_http_file_cache_index_close(cache->index_fd, cache->index.data);
+    cache->index_fd = NGX_INVALID_FILE;
+
+    sh->index_complete = 0;
+    sh->index_reset = 1;
+
+done:
+
+    ngx_unlock(&sh->index_lock);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_lock(ngx_http_file_cache_t *cache)
+{
+    ngx_pid_t  pid;
+
+    pid = (ngx_pid_t) cache->sh->index_lock;
+
+    /* the lock of an exited process is taken over */
+
+    if (pid != 0 && (kill(pid, 0) == 0 || ngx_errno != NGX_ESRCH)) {
+        return NGX_BUSY;
+    }
+
+    if (!ngx_atomic_cmp_set(&cache->sh->index_lock, (ngx_atomic_uint_t) pid,
+                            (ngx_atomic_uint_t) ngx_pid))
+    {
+        return NGX_BUSY;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_open(ngx_http_file_cache_t *cache)
+{
+    ngx_fd_t                   fd;
+    ngx_int_t                  rc;
+    ngx_http_file_cache_sh_t  *sh;
+
+    sh = cache->sh;
+
+    if (cache->index_fd != NGX_INVALID_FILE) {
+
+        if (!sh->index_reset
+            && cache->index_generation == sh->index_generation)
+        {
+            return NGX_OK;
+        }
+
+        /* the index was replaced by another cache manager */
+
+        ngx_http_file_cache_index_close(cache->index_fd, cache->index.data);
+        cache->index_fd = NGX_INVALID_FILE;
+    }
+
+    fd = ngx_open_file(cache->index.data, NGX_HTTP_FILE_CACHE_INDEX_MODE,
+                       NGX_FILE_CREATE_OR_OPEN, NGX_FILE_DEFAULT_ACCESS);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", cache->index.data);
+        return NGX_ERROR;
+    }
+
+    rc = ngx_http_file_cache_index_lock_file(cache, fd);
+
+    if (rc != NGX_OK) {
+        ngx_http_file_cache_index_close(fd, cache->index.data);
+        return rc;
+    }
+
+    if (!sh->index_reset) {
+        rc = ngx_http_file_cache_index_check(cache, fd);
+
+        if (rc == NGX_OK) {
+            cache->index_fd = fd;
+            cache->index_generation = sh->index_generation;
+            return NGX_OK;
+        }
+
+        if (rc == NGX_ERROR) {
+            ngx_http_file_cache_index_close(fd, cache->index.data);
+            return NGX_ERROR;
+        }
+
+        sh->index_complete = 0;
+    }
+
+    if (ftruncate(fd, 0) == -1) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      "ftruncate() \"%s\" failed", cache->index.data);
+        ngx_http_file_cache_index_close(fd, cache->index.data);
+        return NGX_ERROR;
+    }
+
+    /*
+     * a new index which does not list all the files in the cache
+     * makes the next start walk the cache directory
+     */
+
+    if (ngx_http_file_cache_index_header(cache, fd, cache->index.data)
+        != NGX_OK
+        || (!sh->index_complete
+            && ngx_http_file_cache_index_mark(fd, cache->index.data,
+                                              NGX_HTTP_FILE_CACHE_INDEX_LOST)
+               != NGX_OK))
+    {
+        ngx_http_file_cache_index_close(fd, cache->index.data);
+        return NGX_ERROR;
+    }
+
+    sh->index_reset = 0;
+    sh->index_records = 0;
+    sh->index_generation++;
+
+    cache->index_fd = fd;
+    cache->index_generation = sh->index_generation;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_lock_file(ngx_http_file_cache_t *cache, ngx_fd_t fd)
+{
+    ngx_err_t        err;
+    ngx_file_info_t  fi, cfi;
+
+    /*
+     * the index is written by a single process, a cache manager
+     * of another keys zone generation may still have it open
+     */
+
+    err = ngx_trylock_fd(fd);
+
+    if (err == NGX_EAGAIN || err == NGX_EACCES) {
+        return NGX_BUSY;
+    }
+
+    if (err) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                      ngx_trylock_fd_n " \"%s\" failed", cache->index.data);
+        return NGX_ERROR;
+    }
+
+    /* the index may have been replaced before it was locked */
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", cache->index.data);
+        return NGX_ERROR;
+    }
+
+    if (ngx_file_info(cache->index.data, &cfi) == NGX_FILE_ERROR
+        || ngx_file_uniq(&fi) != ngx_file_uniq(&cfi))
+    {
+        return NGX_BUSY;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_check(ngx_http_file_cache_t *cache, ngx_fd_t fd)
+{
+    off_t                                size, end;
+    ssize_t                              n;
+    ngx_file_t                           file;
+    ngx_file_info_t                      fi;
+    ngx_http_file_cache_sh_t            *sh;
+    ngx_http_file_cache_index_rec_t      rec;
+    ngx_http_file_cache_index_header_t   h;
+
+    sh = cache->sh;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.fd = fd;
+    file.name = cache->index;
+    file.log = ngx_cycle->log;
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", cache->index.data);
+        return NGX_ERROR;
+    }
+
+    size = ngx_file_size(&fi);
+
+    if (size == 0) {
+        return NGX_DECLINED;
+    }
+
+    n = ngx_read_file(&file, (u_char *) &h, sizeof(h), 0);
+
+    if (n == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (n != sizeof(h)
+        || ngx_memcmp(h.magic, ngx_http_file_cache_index_magic,
+                      sizeof(ngx_http_file_cache_index_magic)) != 0
+        || h.version != NGX_HTTP_FILE_CACHE_INDEX_VERSION
+        || h.record_size != sizeof(ngx_http_file_cache_index_rec_t)
+        || h.bsize != cache->bsize
+        || ngx_memcmp(h.levels, cache->path->level, NGX_MAX_PATH_LEVEL) != 0)
+    {
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "cache index \"%s\" is invalid, ignored",
+                      cache->index.data);
+        return NGX_DECLINED;
+    }
+
+    end = sizeof(h) + (size - sizeof(h)) / sizeof(rec) * sizeof(rec);
+
+    /* a record partially written is removed before new ones are appended */
+
+    if (end != size && ftruncate(fd, end) == -1) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      "ftruncate() \"%s\" failed", cache->index.data);
+        return NGX_ERROR;
+    }
+
+    if (sh->index_state != NGX_HTTP_FILE_CACHE_INDEX_REPLAY
+        || sh->index_end != 0)
+    {
+        return NGX_OK;
+    }
+
+    /*
+     * the index is replayed as it was found on start,
+     * and it is complete if it was closed when nginx exited
+     */
+
+    sh->index_offset = sizeof(h);
+    sh->index_end = end;
+    sh->index_records = (end - sizeof(h)) / sizeof(rec);
+    sh->index_time = ngx_file_mtime(&fi);
+
+    if (end == size && end > (off_t) sizeof(h)) {
+
+        n = ngx_read_file(&file, (u_char *) &rec, sizeof(rec),
+                          end - sizeof(rec));
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (n == sizeof(rec) && rec.op == NGX_HTTP_FILE_CACHE_INDEX_CLEAN) {
+            sh->index_time = rec.expire;
+            sh->index_clean = 1;
+            sh->index_complete = 1;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_replay(ngx_http_file_cache_t *cache)
+{
+    off_t                             size;
+    time_t                            shift;
+    ssize_t                           n;
+    ngx_int_t                         rc;
+    ngx_uint_t                        i;
+    ngx_msec_t                        elapsed;
+    ngx_file_t                        file;
+    ngx_http_file_cache_sh_t         *sh;
+    ngx_http_file_cache_index_rec_t  *rec;
+
+    sh = cache->sh;
+
+    if (sh->index_offset == sh->index_end) {
+        rc = NGX_OK;
+        goto done;
+    }
+
+    if (ngx_http_file_cache_index_buf(cache) != NGX_OK) {
+        return NGX_AGAIN;
+    }
+
+    /*
+     * the records are read with the descriptor the index is locked with,
+     * as closing any other one would release the lock
+     */
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.fd = cache->index_fd;
+    file.name = cache->index;
+    file.log = ngx_cycle->log;
+
+    /* the nodes keep the time they had left when the index was written */
+
+    shift = ngx_time() - sh->index_time;
+
+    if (shift < 0) {
+        shift = 0;
+    }
+
+    rc = NGX_OK;
+
+    while (sh->index_offset < sh->index_end) {
+
+        size = ngx_min(sh->index_end - sh->index_offset,
+                       (off_t) (sh->index_size * sizeof(*rec)));
+
+        n = ngx_read_file(&file, (u_char *) cache->index_buf, (size_t) size,
+                          sh->index_offset);
+
+        if (n == NGX_ERROR) {
+            rc = NGX_ERROR;
+            break;
+        }
+
+        if (n != size) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, 0,
+                          ngx_read_file_n " read only %z of %O from \"%s\"",
+                          n, size, cache->index.data);
+            rc = NGX_ERROR;
+            break;
+        }
+
+        rec = cache->index_buf;
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        for (i = 0; i < (ngx_uint_t) n / sizeof(*rec); i++) {
+            rc = ngx_http_file_cache_index_apply(cache, &rec[i], shift);
+
+            if (rc == NGX_ERROR) {
+                break;
+            }
+
+            if (rc == NGX_DECLINED) {
+                sh->index_partial = 1;
+                rc = NGX_OK;
+            }
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        if (rc == NGX_ERROR) {
+            break;
+        }
+
+        sh->index_offset += n;
+
+        if (ngx_quit || ngx_terminate) {
+            break;
+        }
+
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        if (elapsed >= cache->manager_threshold) {
+            break;
+        }
+    }
+
+    if (rc == NGX_OK && sh->index_offset < sh->index_end) {
+        return NGX_AGAIN;
+    }
+
+done:
+
+    if (rc == NGX_ERROR) {
+
+        /* the cache loader walks the whole cache */
+
+        sh->index_state = 0;
+        return NGX_OK;
+    }
+
+    if (sh->index_clean && !sh->index_partial) {
+        sh->index_state = 0;
+        sh->cold = 0;
+
+        ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                      "http file cache: %V %.3fM, bsize: %uz, index: \"%V\"",
+                      &cache->path->name,
+                      ((double) sh->size * cache->bsize) / (1024 * 1024),
+                      cache->bsize, &cache->index);
+
+        return NGX_OK;
+    }
+
+    sh->index_state = sh->index_partial ? 0 : NGX_HTTP_FILE_CACHE_INDEX_WALK;
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache: %V %.3fM replayed from index \"%V\", "
+                  "walking the cache",
+                  &cache->path->name,
+                  ((double) sh->size * cache->bsize) / (1024 * 1024),
+                  &cache->index);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_apply(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_index_rec_t *rec, time_t shift)
+{
+    ngx_http_file_cache_node_t  *fcn;
+
+    switch (rec->op) {
+
+    case NGX_HTTP_FILE_CACHE_INDEX_ADD:
+
+        fcn = ngx_http_file_cache_lookup(cache, rec->key);
+
+        if (fcn == NULL) {
+
+            fcn = ngx_slab_calloc_locked(cache->shpool,
+                                         sizeof(ngx_http_file_cache_node_t));
+            if (fcn == NULL) {
+                ngx_http_file_cache_set_watermark(cache);
+
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                              "could not allocate node%s",
+                              cache->shpool->log_ctx);
+                return NGX_ERROR;
+            }
+
+            cache->sh->count++;
+
+            ngx_memcpy((u_char *) &fcn->node.key, rec->key,
+                       sizeof(ngx_rbtree_key_t));
+
+            ngx_memcpy(fcn->key, &rec->key[sizeof(ngx_rbtree_key_t)],
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+            ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+            ngx_http_file_cache_hash_insert(cache, fcn);
+#endif
+
+            fcn->uses = 1;
+            fcn->indexed = 1;
+
+        } else if (fcn->indexed) {
+            ngx_queue_remove(&fcn->queue);
+            cache->sh->size -= fcn->fs_size;
+
+        } else {
+
+            /* the node was updated after the start */
+
+            return NGX_OK;
+        }
+
+        fcn->exists = 1;
+        fcn->uniq = rec->uniq;
+        fcn->fs_size = rec->fs_size;
+        fcn->expire = rec->expire + shift;
+        fcn->index_expire = fcn->expire;
+        fcn->valid_sec = rec->valid_sec;
+        fcn->valid_msec = rec->valid_msec;
+        fcn->body_start = rec->body_start;
+
+        cache->sh->size += fcn->fs_size;
+
+        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+
+        return NGX_OK;
+
+    case NGX_HTTP_FILE_CACHE_INDEX_DEL:
+
+        fcn = ngx_http_file_cache_lookup(cache, rec->key);
+
+        if (fcn == NULL || !fcn->indexed) {
+            return NGX_OK;
+        }
+
+        if (fcn->exists) {
+            cache->sh->size -= fcn->fs_size;
+            fcn->exists = 0;
+            fcn->fs_size = 0;
+        }
+
+        if (fcn->count == 0) {
+            ngx_queue_remove(&fcn->queue);
+            ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+            ngx_http_file_cache_hash_delete(cache, fcn);
+#endif
+            ngx_slab_free_locked(cache->shpool, fcn);
+            cache->sh->count--;
+        }
+
+        return NGX_OK;
+
+    case NGX_HTTP_FILE_CACHE_INDEX_LOST:
+        return NGX_DECLINED;
+
+    default: /* NGX_HTTP_FILE_CACHE_INDEX_CLEAN */
+        return NGX_OK;
+    }
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_flush(ngx_http_file_cache_t *cache, ngx_fd_t fd,
+    u_char *name, ngx_uint_t *lost)
+{
+    ngx_uint_t                 n, m;
+    ngx_http_file_cache_sh_t  *sh;
+
+    sh = cache->sh;
+
+    *lost = 0;
+
+    if (ngx_http_file_cache_index_buf(cache) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    n = sh->index_count;
+    m = ngx_min(n, sh->index_size - sh->index_head);
+
+    ngx_memcpy(cache->index_buf, &sh->index[sh->index_head],
+               m * sizeof(ngx_http_file_cache_index_rec_t));
+    ngx_memcpy(&cache->index_buf[m], sh->index,
+               (n - m) * sizeof(ngx_http_file_cache_index_rec_t));
+
+    sh->index_head = (sh->index_head + n) % sh->index_size;
+    sh->index_count = 0;
+
+    *lost = sh->index_lost;
+    sh->index_lost = 0;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (n == 0) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache index: %ui records to \"%s\"", n, name);
+
+    if (ngx_http_file_cache_index_write(fd, name, (u_char *) cache->index_buf,
+                                   n * sizeof(ngx_http_file_cache_index_rec_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    sh->index_records += n;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_checkpoint(ngx_http_file_cache_t *cache)
+{
+    u_char                            key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_fd_t                          fd;
+    ngx_err_t                         err;
+    ngx_uint_t                        n, lost, records;
+    ngx_rbtree_node_t                *node;
+    ngx_http_file_cache_sh_t         *sh;
+    ngx_http_file_cache_node_t       *fcn;
+
+    sh = cache->sh;
+
+    if (ngx_http_file_cache_index_buf(cache) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache index checkpoint: \"%s\"",
+                   cache->index_temp.data);
+
+    fd = ngx_open_file(cache->index_temp.data, NGX_HTTP_FILE_CACHE_INDEX_MODE,
+                       NGX_FILE_TRUNCATE, NGX_FILE_DEFAULT_ACCESS);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed",
+                      cache->index_temp.data);
+        return NGX_ERROR;
+    }
+
+    /* the new index is locked before it replaces the current one */
+
+    err = ngx_trylock_fd(fd);
+
+    if (err) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                      ngx_trylock_fd_n " \"%s\" failed",
+                      cache->index_temp.data);
+        ngx_http_file_cache_index_close(fd, cache->index_temp.data);
+        return NGX_ERROR;
+    }
+
+    /*
+     * the records drained into the new index are missing from the current
+     * one until the new index replaces it
+     */
+
+    sh->index_complete = 0;
+
+    if (ngx_http_file_cache_index_header(cache, fd, cache->index_temp.data)
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    /*
+     * the nodes are written in the order of their keys, a chunk at a time,
+     * along with the records of the nodes changed meanwhile
+     */
+
+    ngx_memzero(key, NGX_HTTP_CACHE_KEY_LEN);
+
+    records = 0;
+
+    do {
+        n = 0;
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        node = ngx_http_file_cache_index_next(cache, key);
+
+        while (node && n < sh->index_size) {
+            fcn = (ngx_http_file_cache_node_t *) node;
+
+            if (fcn->exists && !fcn->deleting) {
+                ngx_http_file_cache_index_fill(&cache->index_buf[n++], fcn,
+                                               NGX_HTTP_FILE_CACHE_INDEX_ADD);
+            }
+
+            node = ngx_rbtree_next(&sh->rbtree, node);
+        }
+
+        if (node) {
+            fcn = (ngx_http_file_cache_node_t *) node;
+
+            ngx_memcpy(key, &node->key, sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        if (ngx_http_file_cache_index_write(fd, cache->index_temp.data,
+                                   (u_char *) cache->index_buf,
+                                   n * sizeof(ngx_http_file_cache_index_rec_t))
+            != NGX_OK)
+        {
+            goto failed;
+        }
+
+        records += n;
+
+        if (ngx_http_file_cache_index_flush(cache, fd, cache->index_temp.data,
+                                            &lost)
+            != NGX_OK
+            || lost)
+        {
+            goto failed;
+        }
+
+    } while (node);
+
+    if (ngx_rename_file(cache->index_temp.data, cache->index.data)
+        == NGX_FILE_ERROR)
+    {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      cache->index_temp.data, cache->index.data);
+        goto failed;
+    }
+
+    ngx_http_file_cache_index_close(cache->index_fd, cache->index.data);
+
+    sh->index_records = records;
+    sh->index_checkpoint = 0;
+    sh->index_complete = 1;
+    sh->index_generation++;
+
+    cache->index_fd = fd;
+    cache->index_generation = sh->index_generation;
+
+    return NGX_OK;
+
+failed:
+
+    ngx_http_file_cache_index_close(fd, cache->index_temp.data);
+
+    if (ngx_delete_file(cache->index_temp.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed",
+                      cache->index_temp.data);
+    }
+
+    sh->index_checkpoint = 1;
+
+    if (ngx_http_file_cache_index_mark(cache->index_fd, cache->index.data,
+                                       NGX_HTTP_FILE_CACHE_INDEX_LOST)
+        != NGX_OK)
+    {
+        sh->index_reset = 1;
+    }
+
+    return NGX_ERROR;
+}
+
+
+static ngx_rbtree_node_t *
+ngx_http_file_cache_index_next(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_key_t             node_key;
+    ngx_rbtree_node_t           *node, *sentinel, *next;
+    ngx_http_file_cache_node_t  *fcn;
+
+    /* the first node with a key not less than the given one */
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    next = NULL;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            rc = -1;
+
+        } else if (node_key > node->key) {
+            rc = 1;
+
+        } else {
+            fcn = (ngx_http_file_cache_node_t *) node;
+
+            rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+        }
+
+        if (rc == 0) {
+            return node;
+        }
+
+        if (rc < 0) {
+            next = node;
+            node = node->left;
+
+        } else {
+            node = node->right;
+        }
+    }
+
+    return next;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_header(ngx_http_file_cache_t *cache, ngx_fd_t fd,
+    u_char *name)
+{
+    ngx_http_file_cache_index_header_t  h;
+
+    ngx_memzero(&h, sizeof(ngx_http_file_cache_index_header_t));
+
+    ngx_memcpy(h.magic, ngx_http_file_cache_index_magic,
+               sizeof(ngx_http_file_cache_index_magic));
+    h.version = NGX_HTTP_FILE_CACHE_INDEX_VERSION;
+    h.record_size = sizeof(ngx_http_file_cache_index_rec_t);
+    h.bsize = cache->bsize;
+    ngx_memcpy(h.levels, cache->path->level, NGX_MAX_PATH_LEVEL);
+
+    return ngx_http_file_cache_index_write(fd, name, (u_char *) &h, sizeof(h));
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_mark(ngx_fd_t fd, u_char *name, ngx_uint_t op)
+{
+    ngx_http_file_cache_index_rec_t  rec;
+
+    ngx_memzero(&rec, sizeof(ngx_http_file_cache_index_rec_t));
+
+    rec.op = (u_char) op;
+    rec.expire = ngx_time();
+
+    return ngx_http_file_cache_index_write(fd, name, (u_char *) &rec,
+                                           sizeof(rec));
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_write(ngx_fd_t fd, u_char *name, u_char *buf,
+    size_t size)
+{
+    ssize_t  n;
+
+    if (size == 0) {
+        return NGX_OK;
+    }
+
+    n = ngx_write_fd(fd, buf, size);
+
+    if (n == -1) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_write_fd_n " to \"%s\" failed", name);
+        return NGX_ERROR;
+    }
+
+    if ((size_t) n != size) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, 0,
+                      ngx_write_fd_n " has written only %z of %uz to \"%s\"",
+                      n, size, name);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_buf(ngx_http_file_cache_t *cache)
+{
+    if (cache->index_buf) {
+        return NGX_OK;
+    }
+
+    cache->index_buf = ngx_alloc(cache->sh->index_size
+                                 * sizeof(ngx_http_file_cache_index_rec_t),
+                                 ngx_cycle->log);
+    if (cache->index_buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_index_close(ngx_fd_t fd, u_char *name)
+{
+    if (fd == NGX_INVALID_FILE) {
+        return;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+}
+
+
+void
+ngx_http_file_cache_index_exit(ngx_cycle_t *cycle)
+{
+    ngx_fd_t                   fd;
+    ngx_uint_t                 i, lost;
+    ngx_path_t               **path;
+    ngx_http_file_cache_t     *cache;
+    ngx_http_file_cache_sh_t  *sh;
+
+    /*
+     * all the other processes have exited, the records left are written
+     * and the index is closed if it lists all the files in the cache
+     */
+
+    path = cycle->paths.elts;
+
+    for (i = 0; i < cycle->paths.nelts; i++) {
+
+        if (path[i]->manager != ngx_http_file_cache_manager) {
+            continue;
+        }
+
+        cache = path[i]->data;
+        sh = cache->sh;
+
+        if (cache->index.len == 0 || sh == NULL || sh->index_reset) {
+            continue;
+        }
+
+        fd = ngx_open_file(cache->index.data, NGX_FILE_APPEND, NGX_FILE_OPEN,
+                           0);
+
+        if (fd == NGX_INVALID_FILE) {
+            ngx_log_error(NGX_LOG_CRIT, cycle->log, ngx_errno,
+                          ngx_open_file_n " \"%s\" failed", cache->index.data);
+            continue;
+        }
+
+        if (ngx_http_file_cache_index_lock_file(cache, fd) == NGX_OK
+            && ngx_http_file_cache_index_flush(cache, fd, cache->index.data,
+                                               &lost)
+               == NGX_OK)
+        {
+            /* a cache manager exited while it was writing the index */
+
+            if (sh->index_lock || lost) {
+                (void) ngx_http_file_cache_index_mark(fd, cache->index.data,
+                                                NGX_HTTP_FILE_CACHE_INDEX_LOST);
+
+            } else if (sh->index_complete) {
+                (void) ngx_http_file_cache_index_mark(fd, cache->index.data,
+                                               NGX_HTTP_FILE_CACHE_INDEX_CLEAN);
+            }
+        }
+
+        ngx_http_file_cache_index_close(fd, cache->index.data);
+    }
+}
+
+#endif
+
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+
+static ngx_int_t
+ngx_http_file_cache_hash_init(ngx_http_file_cache_t *cache, ngx_uint_t reuse)
+{
+    size_t                       size;
+    ngx_uint_t                   n;
+    ngx_http_file_cache_sh_t    *sh;
+    ngx_http_file_cache_slot_t  *hash;
+
+    sh = cache->sh;
+
+    if (!cache->keys_hash) {
+
+        if (sh->hash) {
+            ngx_shmtx_lock(&cache->shpool->mutex);
+
+            ngx_slab_free_locked(cache->shpool, sh->hash);
+            sh->hash = NULL;
+            sh->hash_mask = 0;
+            sh->hash_zeroed = 0;
+            sh->hash_walk = 0;
+            sh->hash_ready = 0;
+
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+        }
+
+        return NGX_OK;
+    }
+
+    if (sh->hash) {
+        return NGX_OK;
+    }
+
+#if (NGX_PTR_SIZE == 8)
+    if (cache->shm_zone->shm.size >> 3 > 0xffffffff) {
+        ngx_log_error(NGX_LOG_EMERG, cache->shm_zone->shm.log, 0,
+                      "cache keys zone \"%V\" is too large for \"keys_hash\"",
+                      &cache->shm_zone->shm.name);
+        return NGX_ERROR;
+    }
+#endif
+
+    /*
+     * no more nodes than this fit into the zone, so the table
+     * always has free slots and is at most 3/4 full
+     */
+
+    n = cache->shm_zone->shm.size / sizeof(ngx_http_file_cache_node_t);
+
+    for (size = 1; size < n; size <<= 1) { /* void */ }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    /*
+     * the table of a new zone is zeroed at once, while the table
+     * of a zone used by the previous configuration is zeroed and
+     * filled by the cache manager in ngx_http_file_cache_hash_build(),
+     * and the keys are looked up in the tree until it is complete
+     */
+
+    if (reuse) {
+        hash = ngx_slab_alloc_locked(cache->shpool,
+                                     size * sizeof(ngx_http_file_cache_slot_t));
+
+    } else {
+        hash = ngx_slab_calloc_locked(cache->shpool,
+                                      size * sizeof(ngx_http_file_cache_slot_t));
+    }
+
+    if (hash == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_error(NGX_LOG_EMERG, cache->shm_zone->shm.log, 0,
+                      "could not allocate keys hash of %uz entries "
+                      "in cache keys zone \"%V\"",
+                      size, &cache->shm_zone->shm.name);
+        return NGX_ERROR;
+    }
+
+    sh->hash = hash;
+    sh->hash_mask = size - 1;
+    sh->hash_zeroed = reuse ? 0 : size;
+    sh->hash_walk = 0;
+    sh->hash_ready = !reuse;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_hash_build(ngx_http_file_cache_t *cache)
+{
+    ngx_uint_t                   n;
+    ngx_msec_t                   elapsed;
+    ngx_rbtree_node_t           *node, *last;
+    ngx_http_file_cache_sh_t    *sh;
+    ngx_http_file_cache_node_t  *fcn;
+
+    sh = cache->sh;
+
+    for ( ;; ) {
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        if (sh->hash == NULL || sh->hash_ready) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return NGX_OK;
+        }
+
+        if (sh->hash_zeroed <= sh->hash_mask) {
+            n = ngx_min(sh->hash_mask + 1 - sh->hash_zeroed,
+                        NGX_HTTP_FILE_CACHE_HASH_ZERO);
+
+            ngx_memzero(&sh->hash[sh->hash_zeroed],
+                        n * sizeof(ngx_http_file_cache_slot_t));
+
+            sh->hash_zeroed += n;
+
+        } else {
+
+            /*
+             * the nodes added since the slots were zeroed are already
+             * in the table, and the tree is walked in the order of keys
+             * from the last node added here, as nodes may have been
+             * added and deleted while the mutex was released
+             */
+
+            node = ngx_http_file_cache_hash_walk(cache);
+            last = NULL;
+
+            for (n = 0; node && n < NGX_HTTP_FILE_CACHE_HASH_WALK; n++) {
+                ngx_http_file_cache_hash_insert(cache,
+                                          (ngx_http_file_cache_node_t *) node);
+                last = node;
+                node = ngx_rbtree_next(&sh->rbtree, node);
+            }
+
+            if (node == NULL) {
+                sh->hash_ready = 1;
+                ngx_shmtx_unlock(&cache->shpool->mutex);
+
+                ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                               "http file cache keys hash built: %ui",
+                               sh->hash_mask + 1);
+
+                return NGX_OK;
+            }
+
+            fcn = (ngx_http_file_cache_node_t *) last;
+
+            ngx_memcpy(sh->hash_last, &fcn->node.key,
+                       sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&sh->hash_last[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+            sh->hash_walk = 1;
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        if (ngx_quit || ngx_terminate) {
+            return NGX_AGAIN;
+        }
+
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        if (elapsed >= cache->manager_threshold) {
+            return NGX_AGAIN;
+        }
+    }
+}
+
+
+static ngx_rbtree_node_t *
+ngx_http_file_cache_hash_walk(ngx_http_file_cache_t *cache)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_key_t             node_key;
+    ngx_rbtree_node_t           *node, *next, *root, *sentinel;
+    ngx_http_file_cache_sh_t    *sh;
+    ngx_http_file_cache_node_t  *fcn;
+
+    sh = cache->sh;
+
+    root = sh->rbtree.root;
+    sentinel = sh->rbtree.sentinel;
+
+    if (root == sentinel) {
+        return NULL;
+    }
+
+    if (!sh->hash_walk) {
+        return ngx_rbtree_min(root, sentinel);
+    }
+
+    /* the first node after the last one added */
+
+    ngx_memcpy((u_char *) &node_key, sh->hash_last, sizeof(ngx_rbtree_key_t));
+
+    node = root;
+    next = NULL;
+
+    while (node != sentinel) {
+
+        if (node_key != node->key) {
+            rc = (node_key < node->key) ? -1 : 1;
+
+        } else {
+            fcn = (ngx_http_file_cache_node_t *) node;
+
+            rc = ngx_memcmp(&sh->hash_last[sizeof(ngx_rbtree_key_t)], fcn->key,
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+        }
+
+        if (rc < 0) {
+            next = node;
+            node = node->left;
+
+        } else {
+            node = node->right;
+        }
+    }
+
+    return next;
+}
+
+
+static ngx_http_file_cache_node_t *
+ngx_http_file_cache_hash_lookup(ngx_http_file_cache_t *cache, u_char *key)
+{
+    uint32_t                     tag;
+    ngx_uint_t                   i, mask;
+    ngx_rbtree_key_t             node_key;
+    ngx_http_file_cache_slot_t  *hash;
+    ngx_http_file_cache_node_t  *fcn;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(&tag, &key[8], sizeof(uint32_t));
+
+    hash = cache->sh->hash;
+    mask = cache->sh->hash_mask;
+
+    for (i = node_key & mask; hash[i].node; i = (i + 1) & mask) {
+
+        if (hash[i].tag != tag) {
+            continue;
+        }
+
+        fcn = ngx_http_file_cache_hash_node(cache, hash[i].node);
+
+        if (fcn->node.key == node_key
+            && ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                          NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t))
+               == 0)
+        {
+            return fcn;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_file_cache_hash_insert(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    uint32_t                     n;
+    ngx_uint_t                   i, mask;
+    ngx_http_file_cache_slot_t  *hash;
+
+    if (!ngx_http_file_cache_hash_active(cache->sh)) {
+        return;
+    }
+
+    hash = cache->sh->hash;
+    mask = cache->sh->hash_mask;
+
+    n = (uint32_t) (((u_char *) fcn - (u_char *) cache->shpool) >> 3);
+
+    /* a node added while the table is built may be already there */
+
+    for (i = fcn->node.key & mask; hash[i].node; i = (i + 1) & mask) {
+        if (hash[i].node == n) {
+            return;
+        }
+    }
+
+    ngx_memcpy(&hash[i].tag, &fcn->key[8 - sizeof(ngx_rbtree_key_t)],
+               sizeof(uint32_t));
+
+    hash[i].node = n;
+}
+
+
+static void
+ngx_http_file_cache_hash_delete(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    uint32_t                     n;
+    ngx_uint_t                   i, j, home, mask;
+    ngx_http_file_cache_slot_t  *hash;
+
+    if (!ngx_http_file_cache_hash_active(cache->sh)) {
+        return;
+    }
+
+    hash = cache->sh->hash;
+    mask = cache->sh->hash_mask;
+
+    n = (uint32_t) (((u_char *) fcn - (u_char *) cache->shpool) >> 3);
+
+    /* a node not yet added while the table is built is not there */
+
+    for (i = fcn->node.key & mask; hash[i].node != n; i = (i + 1) & mask) {
+        if (hash[i].node == 0) {
+            return;
+        }
+    }
+
+    /*
+     * the slots following the freed one are shifted back,
+     * unless this moves them before their home slots
+     */
+
+    for ( ;; ) {
+        hash[i].node = 0;
+
+        j = i;
+
+        for ( ;; ) {
+            j = (j + 1) & mask;
+
+            if (hash[j].node == 0) {
+                return;
+            }
+
+            home = ngx_http_file_cache_hash_node(cache, hash[j].node)->node.key
+                   & mask;
+
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                break;
+            }
+        }
+
+        hash[i] = hash[j];
+        i = j;
+    }
+}
+
+#endif
+
+
+time_t
+ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status)
+{
+    ngx_uint_t               i;
+    ngx_http_cache_valid_t  *valid;
+
+    if (cache_valid == NULL) {
+        return 0;
+    }
+
+    valid = cache_valid->elts;
+    for (i = 0; i < cache_valid->nelts; i++) {
+
+        if (valid[i].status == 0) {
+            return valid[i].valid;
+        }
+
+        if (valid[i].status == status) {
+            return valid[i].valid;
+        }
+    }
+
+    return 0;
+}
+
+
+char *
+ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    char  *confp = conf;
+
+    off_t                   max_size, min_free;
+    u_char                 *last, *p;
+    time_t                  inactive;
+    ssize_t                 size;
+    ngx_str_t               s, name, *value;
+    ngx_int_t               loader_files, manager_files;
+    ngx_msec_t              loader_sleep, manager_sleep, loader_threshold,
+                            manager_threshold;
+    ngx_uint_t              i, n, use_temp_path;
+    ngx_array_t            *caches;
+    ngx_http_file_cache_t  *cache, **ce;
+
+    cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_file_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cache->path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
+    if (cache->path == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    use_temp_path = 1;
+
+    inactive = 600;
+
+    loader_files = 100;
+    loader_sleep = 50;
+    loader_threshold = 200;
+
+    manager_files = 100;
+    manager_sleep = 50;
     manager_threshold = 200;
 
     name.len = 0;
@@ -2618,6 +4619,51 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+
+        if (ngx_strncmp(value[i].data, "index=", 6) == 0) {
+
+            cache->index.len = value[i].len - 6;
+            cache->index.data = value[i].data + 6;
+
+            if (cache->index.len == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid index \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (ngx_conf_full_name(cf->cycle, &cache->index, 0) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+#endif
+
+#if (T_NGX_HTTP_FILE_CACHE_HASH)
+
+        if (ngx_strncmp(value[i].data, "keys_hash=", 10) == 0) {
+
+            if (ngx_strcmp(&value[i].data[10], "on") == 0) {
+                cache->keys_hash = 1;
+
+            } else if (ngx_strcmp(&value[i].data[10], "off") == 0) {
+                cache->keys_hash = 0;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid keys_hash value \"%V\", "
+                                   "it must be \"on\" or \"off\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+#endif
+
         if (ngx_strncmp(value[i].data, "manager_files=", 14) == 0) {
 
             manager_files = ngx_atoi(value[i].data + 14, value[i].len - 14);
@@ -2684,6 +4730,24 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->manager_sleep = manager_sleep;
     cache->manager_threshold = manager_threshold;
 
+#if (T_NGX_HTTP_FILE_CACHE_INDEX)
+
+    cache->index_fd = NGX_INVALID_FILE;
+
+    if (cache->index.len) {
+        cache->index_temp.len = cache->index.len + sizeof(".tmp") - 1;
+
+        cache->index_temp.data = ngx_pnalloc(cf->pool,
+                                             cache->index_temp.len + 1);
+        if (cache->index_temp.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_sprintf(cache->index_temp.data, "%V.tmp%Z", &cache->index);
+    }
+
+#endif
+
     if (ngx_add_path(cf, &cache->path) != NGX_OK) {
         return NGX_CONF_ERROR;
     }
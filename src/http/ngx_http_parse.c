@@ -14,6 +14,35 @@ static ngx_table_elt_t *ngx_http_parse_multi_header_lines_internal(
     ngx_http_request_t *r, ngx_table_elt_t *headers, ngx_str_t *name,
     ngx_str_t *value, u_char sep);
 
+#if (T_NGX_HTTP_PARSE_SIMD && NGX_HAVE_GCC_SSE42)
+
+#include <nmmintrin.h>
+
+#define NGX_HTTP_PARSE_SIMD  1
+
+static u_char *ngx_http_parse_find_sse42(u_char *p, u_char *last,
+    const char *ranges, int n) __attribute__ ((target ("sse4.2")));
+static ngx_uint_t ngx_http_parse_name_sse42(u_char *p, u_char *lc)
+    __attribute__ ((target ("sse4.2")));
+
+
+/*
+ * the byte ranges that stop a scan, as pairs of the first and the last
+ * byte; the arrays are padded to 16 bytes to be loaded at once
+ */
+
+/* the bytes that are not "usual" in URI, see usual[] below */
+static const char  ngx_http_parse_uri_ranges[16] =
+    "\0\040" "##" "%%" "++" "./" "??" "\177\177";
+
+/* the bytes that end URI with arguments */
+static const char  ngx_http_parse_args_ranges[16] = "\0\040" "##" "\177\177";
+
+/* the bytes that end header value */
+static const char  ngx_http_parse_value_ranges[16] = "\0\0" "\n\n" "\r\r";
+
+#endif
+
 static uint32_t  usual[] = {
     0x00000000, /* 0000 0000 0000 0000  0000 0000 0000 0000 */
 
@@ -701,6 +730,17 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         /* check "/", "%" and "\" (Win32) in URI */
         case sw_check_uri:
 
+#if (NGX_HTTP_PARSE_SIMD)
+            if (b->last - p >= 16 && (ngx_cpu_features & NGX_CPU_SSE42)) {
+                m = ngx_http_parse_find_sse42(p, b->last,
+                                              ngx_http_parse_uri_ranges, 14);
+                if (m > p) {
+                    p = m - 1;
+                    break;
+                }
+            }
+#endif
+
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
                 break;
             }
@@ -765,6 +805,17 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         /* URI */
         case sw_uri:
 
+#if (NGX_HTTP_PARSE_SIMD)
+            if (b->last - p >= 16 && (ngx_cpu_features & NGX_CPU_SSE42)) {
+                m = ngx_http_parse_find_sse42(p, b->last,
+                                              ngx_http_parse_args_ranges, 6);
+                if (m > p) {
+                    p = m - 1;
+                    break;
+                }
+            }
+#endif
+
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
                 break;
             }
@@ -992,6 +1043,10 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 {
     u_char      c, ch, *p;
     ngx_uint_t  hash, i;
+#if (NGX_HTTP_PARSE_SIMD)
+    u_char     *m, *e, lc[16];
+    ngx_uint_t  n, k;
+#endif
     enum {
         sw_start = 0,
         sw_name,
@@ -1080,6 +1135,24 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 
         /* header name */
         case sw_name:
+
+#if (NGX_HTTP_PARSE_SIMD)
+            if (b->last - p >= 16 && (ngx_cpu_features & NGX_CPU_SSE42)) {
+                n = ngx_http_parse_name_sse42(p, lc);
+
+                if (n) {
+                    for (k = 0; k < n; k++) {
+                        hash = ngx_hash(hash, lc[k]);
+                        r->lowcase_header[i++] = lc[k];
+                        i &= (NGX_HTTP_LC_HEADER_LEN - 1);
+                    }
+
+                    p += n - 1;
+                    break;
+                }
+            }
+#endif
+
             c = lowcase[ch];
 
             if (c) {
@@ -1168,6 +1241,28 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 
         /* header value */
         case sw_value:
+
+#if (NGX_HTTP_PARSE_SIMD)
+            if (b->last - p >= 16 && (ngx_cpu_features & NGX_CPU_SSE42)) {
+                m = ngx_http_parse_find_sse42(p, b->last,
+                                              ngx_http_parse_value_ranges, 6);
+                if (m > p) {
+
+                    /* the spaces before the end of line are not in value */
+
+                    for (e = m; e > p && e[-1] == ' '; e--) { /* void */ }
+
+                    if (e < m) {
+                        r->header_end = e;
+                        state = sw_space_after_value;
+                    }
+
+                    p = m - 1;
+                    break;
+                }
+            }
+#endif
+
             switch (ch) {
             case ' ':
                 r->header_end = p;
@@ -2659,3 +2754,74 @@ ngx_http_header_out(ngx_http_request_t *r, u_char *name, size_t len,
 }
 #endif
 
+
+#if (NGX_HTTP_PARSE_SIMD)
+
+/*
+ * The fast paths of the parsers skip runs of bytes that do not change
+ * the parser state in blocks of 16 bytes, and the state machine continues
+ * from the first byte that needs it.  They are only used with at least
+ * 16 bytes left in the buffer, which is never read beyond its last byte.
+ */
+
+/* the first byte within the ranges, or the start of the last short block */
+
+static u_char *
+ngx_http_parse_find_sse42(u_char *p, u_char *last, const char *ranges, int n)
+{
+    int      i;
+    __m128i  r, b;
+
+    r = _mm_loadu_si128((const __m128i *) ranges);
+
+    while (last - p >= 16) {
+        b = _mm_loadu_si128((const __m128i *) p);
+
+        i = _mm_cmpestri(r, n, b, 16,
+                         _SIDD_UBYTE_OPS|_SIDD_CMP_RANGES
+                         |_SIDD_LEAST_SIGNIFICANT);
+
+        if (i != 16) {
+            return p + i;
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+
+/*
+ * the number of leading letters, digits and dashes in the 16 bytes,
+ * the bytes are copied to lc in lower case
+ */
+
+static ngx_uint_t
+ngx_http_parse_name_sse42(u_char *p, u_char *lc)
+{
+    int      n;
+    __m128i  r, b, m;
+
+    static const char  ranges[16] = "--" "09" "AZ" "az";
+
+    r = _mm_loadu_si128((const __m128i *) ranges);
+    b = _mm_loadu_si128((const __m128i *) p);
+
+    n = _mm_cmpestri(r, 8, b, 16,
+                     _SIDD_UBYTE_OPS|_SIDD_CMP_RANGES
+                     |_SIDD_NEGATIVE_POLARITY|_SIDD_LEAST_SIGNIFICANT);
+
+    /* the bytes above 0x7f are negative, and are not within 'A'..'Z' */
+
+    m = _mm_and_si128(_mm_cmpgt_epi8(b, _mm_set1_epi8('A' - 1)),
+                      _mm_cmplt_epi8(b, _mm_set1_epi8('Z' + 1)));
+
+    b = _mm_or_si128(b, _mm_and_si128(m, _mm_set1_epi8(0x20)));
+
+    _mm_storeu_si128((__m128i *) lc, b);
+
+    return n;
+}
+
+#endif
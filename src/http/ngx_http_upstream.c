@@ -227,10 +227,6 @@ static void ngx_http_upstream_ssl_handshake_handler(ngx_connection_t *c);
 static void ngx_http_upstream_ssl_handshake(ngx_http_request_t *,
     ngx_http_upstream_t *u, ngx_connection_t *c);
 static void ngx_http_upstream_ssl_save_session(ngx_connection_t *c);
-static ngx_int_t ngx_http_upstream_ssl_name(ngx_http_request_t *r,
-    ngx_http_upstream_t *u, ngx_connection_t *c);
-static ngx_int_t ngx_http_upstream_ssl_certificate(ngx_http_request_t *r,
-    ngx_http_upstream_t *u, ngx_connection_t *c);
 #endif
 
 #if (NGX_HTTP_UPSTREAM_RBTREE)
@@ -461,7 +457,11 @@ ngx_module_t  ngx_http_upstream_module = {
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
+#if (NGX_HTTP_CACHE && T_NGX_HTTP_FILE_CACHE_INDEX)
+    ngx_http_file_cache_index_exit,        /* exit master */
+#else
     NULL,                                  /* exit master */
+#endif
     NGX_MODULE_V1_PADDING
 };
 
@@ -2200,7 +2200,7 @@ ngx_http_upstream_ssl_save_session(ngx_connection_t *c)
 }
 
 
-static ngx_int_t
+ngx_int_t
 ngx_http_upstream_ssl_name(ngx_http_request_t *r, ngx_http_upstream_t *u,
     ngx_connection_t *c)
 {
@@ -2294,7 +2294,7 @@ done:
 }
 
 
-static ngx_int_t
+ngx_int_t
 ngx_http_upstream_ssl_certificate(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_connection_t *c)
 {
@@ -3924,6 +3924,31 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
     p->send_timeout = clcf->send_timeout;
     p->send_lowat = clcf->send_lowat;
 
+#if (T_NGX_SEND_ZEROCOPY)
+
+    /* the raw bufs may be sent in place to a plain connection */
+
+    if (clcf->send_zerocopy
+        && !p->cacheable
+        && c->send_chain == ngx_send_chain)
+    {
+        switch (ngx_linux_zerocopy_enable(c)) {
+
+        case NGX_OK:
+            p->zerocopy = 1;
+            break;
+
+        case NGX_ERROR:
+            ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+            return;
+
+        default: /* NGX_DECLINED */
+            break;
+        }
+    }
+
+#endif
+
     p->length = -1;
 
     if (u->input_filter_init
@@ -272,6 +272,15 @@ ngx_http_v2_init(ngx_event_t *rev)
         return;
     }
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+    if (h2scf->hpack_encoder
+        && ngx_http_v2_encoder_init(h2c, h2scf->hpack_table_size) != NGX_OK)
+    {
+        ngx_http_close_connection(c);
+        return;
+    }
+#endif
+
     if (ngx_http_v2_send_settings(h2c) == NGX_ERROR) {
         ngx_http_close_connection(c);
         return;
@@ -2271,6 +2280,12 @@ ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
 
         case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+            if (h2c->encoder) {
+                ngx_http_v2_encoder_size(h2c, value);
+            }
+#endif
+
             h2c->table_update = 1;
             break;
 
@@ -67,6 +67,10 @@ typedef struct {
     ngx_uint_t                       concurrent_streams;
     size_t                           preread_size;
     ngx_uint_t                       streams_index_mask;
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+    ngx_flag_t                       hpack_encoder;
+    size_t                           hpack_table_size;
+#endif
 } ngx_http_v2_srv_conf_t;
 
 
@@ -122,6 +126,23 @@ typedef struct {
 } ngx_http_v2_hpack_t;
 
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+
+typedef struct {
+    ngx_queue_t                      entries;
+    ngx_queue_t                     *buckets;
+
+    ngx_uint_t                       added;
+
+    size_t                           size;
+    size_t                           min_size;
+    size_t                           used;
+    size_t                           max_size;
+} ngx_http_v2_encoder_t;
+
+#endif
+
+
 struct ngx_http_v2_connection_s {
     ngx_connection_t                *connection;
     ngx_http_connection_t           *http_connection;
@@ -148,6 +169,10 @@ struct ngx_http_v2_connection_s {
 
     ngx_http_v2_hpack_t              hpack;
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+    ngx_http_v2_encoder_t           *encoder;
+#endif
+
     ngx_pool_t                      *pool;
 
     ngx_http_v2_out_frame_t         *free_frames;
@@ -214,6 +239,10 @@ struct ngx_http_v2_stream_s {
 
     ngx_pool_t                      *pool;
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+    ssize_t                          header_saved;
+#endif
+
     unsigned                         initialized:1;
     unsigned                         waiting:1;
     unsigned                         blocked:1;
@@ -313,6 +342,16 @@ ngx_int_t ngx_http_v2_add_header(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_header_t *header);
 ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+ngx_int_t ngx_http_v2_encoder_init(ngx_http_v2_connection_t *h2c,
+    size_t size);
+void ngx_http_v2_encoder_size(ngx_http_v2_connection_t *h2c, size_t size);
+u_char *ngx_http_v2_encode_table_size(ngx_http_v2_connection_t *h2c,
+    u_char *pos);
+u_char *ngx_http_v2_encode_header(ngx_http_v2_stream_t *stream, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, u_char *tmp);
+#endif
+
 
 #define ngx_http_v2_prefix(bits)  ((1 << (bits)) - 1)
 
@@ -416,6 +455,10 @@ ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 
 u_char *ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len,
     u_char *tmp, ngx_uint_t lower);
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+u_char *ngx_http_v2_integer_encode(u_char *dst, ngx_uint_t prefix,
+    ngx_uint_t value);
+#endif
 
 
 extern ngx_module_t  ngx_http_v2_module;
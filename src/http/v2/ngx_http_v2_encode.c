@@ -40,6 +40,17 @@ ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len, u_char *tmp,
 }
 
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+
+u_char *
+ngx_http_v2_integer_encode(u_char *dst, ngx_uint_t prefix, ngx_uint_t value)
+{
+    return ngx_http_v2_write_int(dst, prefix, value);
+}
+
+#endif
+
+
 static u_char *
 ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix, ngx_uint_t value)
 {
@@ -119,6 +119,10 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
     u_char                     addr[NGX_SOCKADDR_STRLEN];
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+    ngx_str_t                  value;
+    u_char                     buf[sizeof("Wed, 31 Dec 1986 18:00:00 GMT")];
+#endif
 
 #if (T_NGX_SERVER_INFO)
     static const u_char nginx[6] = "\x85\xde\x5a\xa6\x35\x45";
@@ -231,6 +235,13 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
     len = h2c->table_update ? 1 : 0;
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+    if (h2c->encoder) {
+        /* two longer table size updates, and indices of the fields below */
+        len += 2 * NGX_HTTP_V2_INT_OCTETS + 8 * 2;
+    }
+#endif
+
     len += status ? 1 : 1 + ngx_http_v2_literal_size("418");
 
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
@@ -445,9 +456,18 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     start = pos;
 
     if (h2c->table_update) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 table size update: 0");
-        *pos++ = (1 << 5) | 0;
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+        if (h2c->encoder) {
+            pos = ngx_http_v2_encode_table_size(h2c, pos);
+
+        } else
+#endif
+        {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                           "http2 table size update: 0");
+            *pos++ = (1 << 5) | 0;
+        }
+
         h2c->table_update = 0;
     }
 
@@ -458,6 +478,15 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     if (status) {
         *pos++ = status;
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+    } else if (h2c->encoder) {
+        value.data = buf;
+        value.len = ngx_sprintf(buf, "%03ui", r->headers_out.status) - buf;
+
+        pos = ngx_http_v2_encode_header(stream, pos, NGX_HTTP_V2_STATUS_INDEX,
+                                        NULL, &value, tmp);
+#endif
+
     } else {
         *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_STATUS_INDEX);
         *pos++ = NGX_HTTP_V2_ENCODE_RAW | 3;
@@ -474,9 +503,52 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                            "http2 output header: \"server: %V\"",
                            &clcf->server_tag);
 
-            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
-            pos = ngx_http_v2_write_value(pos, clcf->server_tag.data,
-                                          clcf->server_tag.len, tmp);
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+            if (h2c->encoder) {
+                pos = ngx_http_v2_encode_header(stream, pos,
+                                                NGX_HTTP_V2_SERVER_INDEX, NULL,
+                                                &clcf->server_tag, tmp);
+
+            } else
+#endif
+            {
+                *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
+                pos = ngx_http_v2_write_value(pos, clcf->server_tag.data,
+                                              clcf->server_tag.len, tmp);
+            }
+
+        } else
+#endif
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+        if (h2c->encoder) {
+            if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
+#if (T_NGX_SERVER_INFO)
+                ngx_str_set(&value, TENGINE_VER);
+#else
+                ngx_str_set(&value, NGINX_VER);
+#endif
+
+            } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
+#if (T_NGX_SERVER_INFO)
+                ngx_str_set(&value, TENGINE_VER_BUILD);
+#else
+                ngx_str_set(&value, NGINX_VER_BUILD);
+#endif
+
+            } else {
+#if (T_NGX_SERVER_INFO)
+                ngx_str_set(&value, TENGINE);
+#else
+                ngx_str_set(&value, "nginx");
+#endif
+            }
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                           "http2 output header: \"server: %V\"", &value);
+
+            pos = ngx_http_v2_encode_header(stream, pos,
+                                            NGX_HTTP_V2_SERVER_INDEX, NULL,
+                                            &value, tmp);
 
         } else
 #endif
@@ -539,13 +611,24 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"date: %V\"",
                        &ngx_cached_http_time);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_DATE_INDEX);
-        pos = ngx_http_v2_write_value(pos, ngx_cached_http_time.data,
-                                      ngx_cached_http_time.len, tmp);
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+        if (h2c->encoder) {
+            value.len = ngx_cached_http_time.len;
+            value.data = ngx_cached_http_time.data;
+
+            pos = ngx_http_v2_encode_header(stream, pos, NGX_HTTP_V2_DATE_INDEX,
+                                            NULL, &value, tmp);
+
+        } else
+#endif
+        {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_DATE_INDEX);
+            pos = ngx_http_v2_write_value(pos, ngx_cached_http_time.data,
+                                          ngx_cached_http_time.len, tmp);
+        }
     }
 
     if (r->headers_out.content_type.len) {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_TYPE_INDEX);
 
         if (r->headers_out.content_type_len == r->headers_out.content_type.len
             && r->headers_out.charset.len)
@@ -576,8 +659,22 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-type: %V\"",
                        &r->headers_out.content_type);
 
-        pos = ngx_http_v2_write_value(pos, r->headers_out.content_type.data,
-                                      r->headers_out.content_type.len, tmp);
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+        if (h2c->encoder) {
+            pos = ngx_http_v2_encode_header(stream, pos,
+                                            NGX_HTTP_V2_CONTENT_TYPE_INDEX,
+                                            NULL, &r->headers_out.content_type,
+                                            tmp);
+
+        } else
+#endif
+        {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_TYPE_INDEX);
+            pos = ngx_http_v2_write_value(pos,
+                                          r->headers_out.content_type.data,
+                                          r->headers_out.content_type.len,
+                                          tmp);
+        }
     }
 
     if (r->headers_out.content_length == NULL
@@ -587,30 +684,63 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-length: %O\"",
                        r->headers_out.content_length_n);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+        if (h2c->encoder) {
+            value.data = buf;
+            value.len = ngx_sprintf(buf, "%O", r->headers_out.content_length_n)
+                        - buf;
+
+            pos = ngx_http_v2_encode_header(stream, pos,
+                                            NGX_HTTP_V2_CONTENT_LENGTH_INDEX,
+                                            NULL, &value, tmp);
+
+        } else
+#endif
+        {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
 
-        p = pos;
-        pos = ngx_sprintf(pos + 1, "%O", r->headers_out.content_length_n);
-        *p = NGX_HTTP_V2_ENCODE_RAW | (u_char) (pos - p - 1);
+            p = pos;
+            pos = ngx_sprintf(pos + 1, "%O", r->headers_out.content_length_n);
+            *p = NGX_HTTP_V2_ENCODE_RAW | (u_char) (pos - p - 1);
+        }
     }
 
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LAST_MODIFIED_INDEX);
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+        if (h2c->encoder) {
+            value.data = buf;
+            value.len = ngx_http_time(buf, r->headers_out.last_modified_time)
+                        - buf;
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                           "http2 output header: \"last-modified: %V\"",
+                           &value);
+
+            pos = ngx_http_v2_encode_header(stream, pos,
+                                            NGX_HTTP_V2_LAST_MODIFIED_INDEX,
+                                            NULL, &value, tmp);
+
+        } else
+#endif
+        {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LAST_MODIFIED_INDEX);
 
-        ngx_http_time(pos, r->headers_out.last_modified_time);
-        len = sizeof("Wed, 31 Dec 1986 18:00:00 GMT") - 1;
+            ngx_http_time(pos, r->headers_out.last_modified_time);
+            len = sizeof("Wed, 31 Dec 1986 18:00:00 GMT") - 1;
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 output header: \"last-modified: %*s\"",
-                       len, pos);
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                           "http2 output header: \"last-modified: %*s\"",
+                           len, pos);
 
-        /*
-         * Date will always be encoded using huffman in the temporary buffer,
-         * so it's safe here to use src and dst pointing to the same address.
-         */
-        pos = ngx_http_v2_write_value(pos, pos, len, tmp);
+            /*
+             * Date will always be encoded using huffman in the temporary
+             * buffer, so it's safe here to use src and dst pointing to
+             * the same address.
+             */
+            pos = ngx_http_v2_write_value(pos, pos, len, tmp);
+        }
     }
 
     if (r->headers_out.location && r->headers_out.location->value.len) {
@@ -618,9 +748,22 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"location: %V\"",
                        &r->headers_out.location->value);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LOCATION_INDEX);
-        pos = ngx_http_v2_write_value(pos, r->headers_out.location->value.data,
-                                      r->headers_out.location->value.len, tmp);
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+        if (h2c->encoder) {
+            pos = ngx_http_v2_encode_header(stream, pos,
+                                            NGX_HTTP_V2_LOCATION_INDEX, NULL,
+                                            &r->headers_out.location->value,
+                                            tmp);
+
+        } else
+#endif
+        {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LOCATION_INDEX);
+            pos = ngx_http_v2_write_value(pos,
+                                          r->headers_out.location->value.data,
+                                          r->headers_out.location->value.len,
+                                          tmp);
+        }
     }
 
 #if (NGX_HTTP_GZIP)
@@ -628,8 +771,19 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                        "http2 output header: \"vary: Accept-Encoding\"");
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
-        pos = ngx_cpymem(pos, accept_encoding, sizeof(accept_encoding));
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+        if (h2c->encoder) {
+            ngx_str_set(&value, "Accept-Encoding");
+
+            pos = ngx_http_v2_encode_header(stream, pos, NGX_HTTP_V2_VARY_INDEX,
+                                            NULL, &value, tmp);
+
+        } else
+#endif
+        {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
+            pos = ngx_cpymem(pos, accept_encoding, sizeof(accept_encoding));
+        }
     }
 #endif
 
@@ -662,6 +816,14 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
 #endif
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+        if (h2c->encoder) {
+            pos = ngx_http_v2_encode_header(stream, pos, 0, &header[i].key,
+                                            &header[i].value, tmp);
+            continue;
+        }
+#endif
+
         *pos++ = 0;
 
         pos = ngx_http_v2_write_name(pos, header[i].key.data,
@@ -775,6 +937,12 @@ ngx_http_v2_early_hints_filter(ngx_http_request_t *r)
     h2c = stream->connection;
 
     len += h2c->table_update ? 1 : 0;
+
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+    if (h2c->encoder) {
+        len += 2 * NGX_HTTP_V2_INT_OCTETS;
+    }
+#endif
     len += 1 + ngx_http_v2_literal_size("418");
 
     tmp = ngx_palloc(r->pool, tmp_len);
@@ -787,9 +955,18 @@ ngx_http_v2_early_hints_filter(ngx_http_request_t *r)
     start = pos;
 
     if (h2c->table_update) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 table size update: 0");
-        *pos++ = (1 << 5) | 0;
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+        if (h2c->encoder) {
+            pos = ngx_http_v2_encode_table_size(h2c, pos);
+
+        } else
+#endif
+        {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                           "http2 table size update: 0");
+            *pos++ = (1 << 5) | 0;
+        }
+
         h2c->table_update = 0;
     }
 
@@ -797,7 +974,17 @@ ngx_http_v2_early_hints_filter(ngx_http_request_t *r)
                    "http2 output header: \":status: %03ui\"",
                    (ngx_uint_t) NGX_HTTP_EARLY_HINTS);
 
-    *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_STATUS_INDEX);
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+    if (h2c->encoder) {
+        /* literal without indexing, the dynamic table is left intact */
+        *pos++ = NGX_HTTP_V2_STATUS_INDEX;
+
+    } else
+#endif
+    {
+        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_STATUS_INDEX);
+    }
+
     *pos++ = NGX_HTTP_V2_ENCODE_RAW | 3;
     pos = ngx_sprintf(pos, "%03ui", (ngx_uint_t) NGX_HTTP_EARLY_HINTS);
 
@@ -15,6 +15,10 @@ static ngx_int_t ngx_http_v2_add_variables(ngx_conf_t *cf);
 
 static ngx_int_t ngx_http_v2_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+static ngx_int_t ngx_http_v2_header_saved_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+#endif
 
 static ngx_int_t ngx_http_v2_module_init(ngx_cycle_t *cycle);
 
@@ -34,6 +38,10 @@ static char *ngx_http_v2_preread_size(ngx_conf_t *cf, void *post, void *data);
 static char *ngx_http_v2_streams_index_mask(ngx_conf_t *cf, void *post,
     void *data);
 static char *ngx_http_v2_chunk_size(ngx_conf_t *cf, void *post, void *data);
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+static char *ngx_http_v2_hpack_table_size(ngx_conf_t *cf, void *post,
+    void *data);
+#endif
 static char *ngx_http_v2_obsolete(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 
@@ -69,6 +77,10 @@ static ngx_conf_post_t  ngx_http_v2_streams_index_mask_post =
     { ngx_http_v2_streams_index_mask };
 static ngx_conf_post_t  ngx_http_v2_chunk_size_post =
     { ngx_http_v2_chunk_size };
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+static ngx_conf_post_t  ngx_http_v2_hpack_table_size_post =
+    { ngx_http_v2_hpack_table_size };
+#endif
 
 
 static ngx_command_t  ngx_http_v2_commands[] = {
@@ -180,6 +192,21 @@ static ngx_command_t  ngx_http_v2_commands[] = {
       0,
       NULL },
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+    { ngx_string("http2_hpack_encoder"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, hpack_encoder),
+      NULL },
+
+    { ngx_string("http2_hpack_table_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, hpack_table_size),
+      &ngx_http_v2_hpack_table_size_post },
+#endif
 
 #if (T_NGX_HTTP2_SRV_ENABLE)
     { ngx_string("http2"),
@@ -230,6 +257,11 @@ static ngx_http_variable_t  ngx_http_v2_vars[] = {
     { ngx_string("http2"), NULL,
       ngx_http_v2_variable, 0, 0, 0 },
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+    { ngx_string("http2_header_saved"), NULL,
+      ngx_http_v2_header_saved_variable, 0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+#endif
+
       ngx_http_null_variable
 };
 
@@ -287,6 +319,36 @@ ngx_http_v2_variable(ngx_http_request_t *r,
 }
 
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+
+static ngx_int_t
+ngx_http_v2_header_saved_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char  *p;
+
+    if (r->stream == NULL || r->stream->connection->encoder == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_OFF_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%z", r->stream->header_saved) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_v2_module_init(ngx_cycle_t *cycle)
 {
@@ -341,6 +403,11 @@ ngx_http_v2_create_srv_conf(ngx_conf_t *cf)
 
     h2scf->streams_index_mask = NGX_CONF_UNSET_UINT;
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+    h2scf->hpack_encoder = NGX_CONF_UNSET;
+    h2scf->hpack_table_size = NGX_CONF_UNSET_SIZE;
+#endif
+
     return h2scf;
 }
 
@@ -361,6 +428,12 @@ ngx_http_v2_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_uint_value(conf->streams_index_mask,
                               prev->streams_index_mask, 32 - 1);
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+    ngx_conf_merge_value(conf->hpack_encoder, prev->hpack_encoder, 0);
+    ngx_conf_merge_size_value(conf->hpack_table_size, prev->hpack_table_size,
+                              4096);
+#endif
+
 #if (T_NGX_HTTP2_SRV_ENABLE)
     if (conf->enable == NGX_CONF_UNSET) {
         conf->enable = prev->enable;
@@ -495,6 +568,26 @@ ngx_http_v2_chunk_size(ngx_conf_t *cf, void *post, void *data)
 }
 
 
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+
+static char *
+ngx_http_v2_hpack_table_size(ngx_conf_t *cf, void *post, void *data)
+{
+    size_t *sp = data;
+
+    if (*sp > 65536) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the maximum hpack table size is 64k");
+
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+#endif
+
+
 static char *
 ngx_http_v2_obsolete(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
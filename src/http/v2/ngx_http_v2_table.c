@@ -361,3 +361,429 @@ ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size)
 
     return NGX_OK;
 }
+
+
+#if (T_NGX_HTTP_V2_HPACK_ENCODER)
+
+/*
+ * The encoder mirrors the dynamic table of the client decoder: entries are
+ * looked up by name through a small hash, and evicted in the order they
+ * were added, as the decoder does.  Sensitive headers are never indexed,
+ * headers which change on every response are sent without indexing, and
+ * a name already indexed with NGX_HTTP_V2_ENCODER_VALUES different values
+ * is not indexed again, so that unique identifiers do not flush the table.
+ */
+
+#define NGX_HTTP_V2_ENCODER_BUCKETS      64
+#define NGX_HTTP_V2_ENCODER_VALUES       2
+
+#define NGX_HTTP_V2_ENCODE_INDEX         0
+#define NGX_HTTP_V2_ENCODE_NOT_INDEX     1
+#define NGX_HTTP_V2_ENCODE_NEVER_INDEX   2
+
+
+typedef struct {
+    ngx_queue_t                      queue;
+    ngx_queue_t                      bucket;
+
+    ngx_uint_t                       hash;
+    ngx_uint_t                       seq;
+
+    ngx_str_t                        name;
+    ngx_str_t                        value;
+
+    /* sizes of the name and value literals */
+    size_t                           name_size;
+    size_t                           value_size;
+} ngx_http_v2_encoder_entry_t;
+
+
+typedef struct {
+    ngx_str_t                        name;
+    ngx_uint_t                       policy;
+} ngx_http_v2_encoder_policy_t;
+
+
+static ngx_uint_t ngx_http_v2_encoder_policy(ngx_str_t *name);
+static ngx_uint_t ngx_http_v2_static_name_index(ngx_str_t *name);
+static size_t ngx_http_v2_encoder_name_size(ngx_str_t *name,
+    u_char *tmp);
+static void ngx_http_v2_encoder_evict(ngx_http_v2_encoder_t *encoder,
+    size_t size);
+static void ngx_http_v2_encoder_cleanup(void *data);
+
+
+static ngx_http_v2_encoder_policy_t  ngx_http_v2_encoder_policies[] = {
+    { ngx_string("set-cookie"), NGX_HTTP_V2_ENCODE_NEVER_INDEX },
+    { ngx_string("cookie"), NGX_HTTP_V2_ENCODE_NEVER_INDEX },
+    { ngx_string("authorization"), NGX_HTTP_V2_ENCODE_NEVER_INDEX },
+    { ngx_string("proxy-authorization"), NGX_HTTP_V2_ENCODE_NEVER_INDEX },
+    { ngx_string("date"), NGX_HTTP_V2_ENCODE_NOT_INDEX },
+    { ngx_string("content-length"), NGX_HTTP_V2_ENCODE_NOT_INDEX },
+    { ngx_string("content-range"), NGX_HTTP_V2_ENCODE_NOT_INDEX },
+    { ngx_string("last-modified"), NGX_HTTP_V2_ENCODE_NOT_INDEX },
+    { ngx_string("etag"), NGX_HTTP_V2_ENCODE_NOT_INDEX },
+    { ngx_string("expires"), NGX_HTTP_V2_ENCODE_NOT_INDEX },
+    { ngx_string("age"), NGX_HTTP_V2_ENCODE_NOT_INDEX },
+    { ngx_null_string, 0 }
+};
+
+
+ngx_int_t
+ngx_http_v2_encoder_init(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    ngx_uint_t              i;
+    ngx_pool_cleanup_t     *cln;
+    ngx_http_v2_encoder_t  *encoder;
+
+    encoder = ngx_palloc(h2c->connection->pool, sizeof(ngx_http_v2_encoder_t));
+    if (encoder == NULL) {
+        return NGX_ERROR;
+    }
+
+    encoder->buckets = ngx_palloc(h2c->connection->pool,
+                                  sizeof(ngx_queue_t)
+                                  * NGX_HTTP_V2_ENCODER_BUCKETS);
+    if (encoder->buckets == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < NGX_HTTP_V2_ENCODER_BUCKETS; i++) {
+        ngx_queue_init(&encoder->buckets[i]);
+    }
+
+    ngx_queue_init(&encoder->entries);
+
+    encoder->added = 0;
+    encoder->used = 0;
+    encoder->max_size = size;
+    encoder->size = ngx_min(size, NGX_HTTP_V2_TABLE_SIZE);
+    encoder->min_size = encoder->size;
+
+    cln = ngx_pool_cleanup_add(h2c->connection->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_v2_encoder_cleanup;
+    cln->data = encoder;
+
+    h2c->encoder = encoder;
+
+    if (encoder->size != NGX_HTTP_V2_TABLE_SIZE) {
+        h2c->table_update = 1;
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_v2_encoder_size(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    ngx_http_v2_encoder_t  *encoder;
+
+    encoder = h2c->encoder;
+
+    size = ngx_min(size, encoder->max_size);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 encoder table size: %uz was:%uz",
+                   size, encoder->size);
+
+    ngx_http_v2_encoder_evict(encoder, size);
+
+    encoder->size = size;
+
+    /*
+     * the smallest size since the last header block is sent first if
+     * the size changes several times, see RFC 7541, Section 4.2
+     */
+
+    if (size < encoder->min_size) {
+        encoder->min_size = size;
+    }
+}
+
+
+u_char *
+ngx_http_v2_encode_table_size(ngx_http_v2_connection_t *h2c, u_char *pos)
+{
+    ngx_http_v2_encoder_t  *encoder;
+
+    encoder = h2c->encoder;
+
+    if (encoder->min_size < encoder->size) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 table size update: %uz", encoder->min_size);
+
+        *pos = (1 << 5);
+        pos = ngx_http_v2_integer_encode(pos, ngx_http_v2_prefix(5),
+                                         encoder->min_size);
+    }
+
+    encoder->min_size = encoder->size;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 table size update: %uz", encoder->size);
+
+    *pos = (1 << 5);
+
+    return ngx_http_v2_integer_encode(pos, ngx_http_v2_prefix(5),
+                                      encoder->size);
+}
+
+
+u_char *
+ngx_http_v2_encode_header(ngx_http_v2_stream_t *stream, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, u_char *tmp)
+{
+    u_char                       *start, *p;
+    size_t                        size, name_size, value_size;
+    ngx_uint_t                    hash, policy, values, n;
+    ngx_queue_t                  *bucket, *q;
+    ngx_http_v2_encoder_t        *encoder;
+    ngx_http_v2_encoder_entry_t  *entry, *found, *named;
+
+    encoder = stream->connection->encoder;
+
+    if (name == NULL) {
+        name = ngx_http_v2_get_static_name(index);
+    }
+
+    start = pos;
+
+    policy = ngx_http_v2_encoder_policy(name);
+
+    hash = ngx_hash_key_lc(name->data, name->len);
+    bucket = &encoder->buckets[hash % NGX_HTTP_V2_ENCODER_BUCKETS];
+
+    found = NULL;
+    named = NULL;
+    values = 0;
+
+    for (q = ngx_queue_head(bucket);
+         q != ngx_queue_sentinel(bucket);
+         q = ngx_queue_next(q))
+    {
+        entry = ngx_queue_data(q, ngx_http_v2_encoder_entry_t, bucket);
+
+        if (entry->hash != hash
+            || entry->name.len != name->len
+            || ngx_strncasecmp(entry->name.data, name->data, name->len) != 0)
+        {
+            continue;
+        }
+
+        if (entry->value.len == value->len
+            && ngx_strncmp(entry->value.data, value->data, value->len) == 0)
+        {
+            found = entry;
+            break;
+        }
+
+        named = entry;
+        values++;
+    }
+
+    if (found) {
+        n = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + encoder->added - found->seq;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, stream->request->connection->log, 0,
+                       "http2 hpack indexed: %ui", n);
+
+        *pos = 0x80;
+        pos = ngx_http_v2_integer_encode(pos, ngx_http_v2_prefix(7), n);
+
+        stream->header_saved += 1 + (index ? 0 : found->name_size)
+                               + found->value_size - (pos - start);
+
+        return pos;
+    }
+
+    n = index;
+
+    if (n == 0) {
+        n = ngx_http_v2_static_name_index(name);
+    }
+
+    if (n == 0 && named) {
+        n = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + encoder->added - named->seq;
+    }
+
+    size = 32 + name->len + value->len;
+    entry = NULL;
+
+    if (policy == NGX_HTTP_V2_ENCODE_INDEX
+        && values < NGX_HTTP_V2_ENCODER_VALUES
+        && size <= encoder->size / 4)
+    {
+        entry = ngx_alloc(sizeof(ngx_http_v2_encoder_entry_t)
+                          + name->len + value->len,
+                          stream->request->connection->log);
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, stream->request->connection->log, 0,
+                   "http2 hpack literal: %ui policy:%ui indexing:%d",
+                   n, policy, entry != NULL);
+
+    if (entry) {
+        *pos = 0x40;
+        pos = ngx_http_v2_integer_encode(pos, ngx_http_v2_prefix(6), n);
+
+    } else {
+        *pos = (policy == NGX_HTTP_V2_ENCODE_NEVER_INDEX) ? 0x10 : 0;
+        pos = ngx_http_v2_integer_encode(pos, ngx_http_v2_prefix(4), n);
+    }
+
+    if (n == 0) {
+        p = pos;
+        pos = ngx_http_v2_write_name(pos, name->data, name->len, tmp);
+        name_size = pos - p;
+
+    } else if (index) {
+        name_size = 0;
+
+    } else if (named && n > NGX_HTTP_V2_STATIC_TABLE_ENTRIES) {
+        name_size = named->name_size;
+
+    } else {
+        name_size = ngx_http_v2_encoder_name_size(name, tmp);
+    }
+
+    p = pos;
+    pos = ngx_http_v2_write_value(pos, value->data, value->len, tmp);
+    value_size = pos - p;
+
+    stream->header_saved += 1 + (index ? 0 : name_size) + value_size
+                           - (pos - start);
+
+    if (entry == NULL) {
+        return pos;
+    }
+
+    if (name_size == 0) {
+        name_size = ngx_http_v2_encoder_name_size(name, tmp);
+    }
+
+    ngx_http_v2_encoder_evict(encoder, encoder->size - size);
+
+    entry->name.len = name->len;
+    entry->name.data = (u_char *) &entry[1];
+    ngx_strlow(entry->name.data, name->data, name->len);
+
+    entry->value.len = value->len;
+    entry->value.data = entry->name.data + name->len;
+    ngx_memcpy(entry->value.data, value->data, value->len);
+
+    entry->hash = hash;
+    entry->seq = encoder->added++;
+    entry->name_size = name_size;
+    entry->value_size = value_size;
+
+    ngx_queue_insert_tail(&encoder->entries, &entry->queue);
+    ngx_queue_insert_tail(bucket, &entry->bucket);
+
+    encoder->used += size;
+
+    return pos;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_encoder_policy(ngx_str_t *name)
+{
+    ngx_http_v2_encoder_policy_t  *p;
+
+    for (p = ngx_http_v2_encoder_policies; p->name.len; p++) {
+
+        if (p->name.len == name->len
+            && ngx_strncasecmp(p->name.data, name->data, name->len) == 0)
+        {
+            return p->policy;
+        }
+    }
+
+    return NGX_HTTP_V2_ENCODE_INDEX;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_static_name_index(ngx_str_t *name)
+{
+    ngx_uint_t             i;
+    ngx_http_v2_header_t  *header;
+
+    /* pseudo-header fields are not looked up */
+
+    for (i = NGX_HTTP_V2_STATUS_500_INDEX;
+         i < NGX_HTTP_V2_STATIC_TABLE_ENTRIES;
+         i++)
+    {
+        header = &ngx_http_v2_static_table[i];
+
+        if (header->name.len == name->len
+            && ngx_strncasecmp(header->name.data, name->data, name->len) == 0)
+        {
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static size_t
+ngx_http_v2_encoder_name_size(ngx_str_t *name, u_char *tmp)
+{
+    size_t  len, size;
+
+    len = ngx_http_huff_encode(name->data, name->len, tmp, 1);
+
+    if (len == 0) {
+        len = name->len;
+    }
+
+    size = len + 1;
+
+    if (len >= 127) {
+        for (len -= 127; len >= 128; len /= 128) {
+            size++;
+        }
+
+        size++;
+    }
+
+    return size;
+}
+
+
+static void
+ngx_http_v2_encoder_evict(ngx_http_v2_encoder_t *encoder, size_t size)
+{
+    ngx_queue_t                  *q;
+    ngx_http_v2_encoder_entry_t  *entry;
+
+    while (encoder->used > size) {
+        q = ngx_queue_head(&encoder->entries);
+        entry = ngx_queue_data(q, ngx_http_v2_encoder_entry_t, queue);
+
+        ngx_queue_remove(&entry->queue);
+        ngx_queue_remove(&entry->bucket);
+
+        encoder->used -= 32 + entry->name.len + entry->value.len;
+
+        ngx_free(entry);
+    }
+}
+
+
+static void
+ngx_http_v2_encoder_cleanup(void *data)
+{
+    ngx_http_v2_encoder_t  *encoder = data;
+
+    ngx_http_v2_encoder_evict(encoder, 0);
+}
+
+#endif
@@ -13,4 +13,34 @@ ngx_chain_t *ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in,
     off_t limit);
 
 
+#if (T_NGX_SEND_ZEROCOPY)
+
+/* the smaller sends are copied, pinning the pages costs more */
+#define NGX_ZEROCOPY_MIN_SIZE  16384
+
+/* the zero-copy sends not completed yet, the data are copied above it */
+#define NGX_ZEROCOPY_PENDING   64
+
+
+struct ngx_zerocopy_s {
+    uint32_t               sent;       /* zero-copy sends done */
+    uint32_t               done;       /* the sends before it are completed */
+
+    /* the completions received out of order, a bit per send after "done" */
+    uint64_t               completed;
+
+    unsigned               disabled:1;
+};
+
+
+#define ngx_zerocopy_done(zc, seq)  ((int32_t) ((zc)->done - (seq)) >= 0)
+
+
+ngx_int_t ngx_linux_zerocopy_enable(ngx_connection_t *c);
+ssize_t ngx_linux_zerocopy_send(ngx_connection_t *c, ngx_iovec_t *vec);
+void ngx_linux_zerocopy_complete(ngx_connection_t *c);
+
+#endif
+
+
 #endif /* _NGX_LINUX_H_INCLUDED_ */
@@ -96,6 +96,13 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #if (NGX_HAVE_SYS_EVENTFD_H)
 #include <sys/eventfd.h>
 #endif
+
+#if (NGX_HAVE_INOTIFY)
+#include <sys/inotify.h>
+#endif
+#if (NGX_HAVE_MSG_ZEROCOPY)
+#include <linux/errqueue.h>
+#endif
 #include <sys/syscall.h>
 #if (NGX_HAVE_FILE_AIO)
 #include <linux/aio_abi.h>
@@ -107,7 +114,7 @@ typedef struct iocb  ngx_aiocb_t;
 #include <linux/capability.h>
 #endif
 
-#if (NGX_HAVE_UDP_SEGMENT)
+#if (NGX_HAVE_UDP_SEGMENT || NGX_HAVE_UDP_GRO)
 #include <netinet/udp.h>
 #endif
 
@@ -0,0 +1,267 @@
+
+/*
+ * Copyright (C) 2010-2026 Alibaba Group Holding Limited
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * With MSG_ZEROCOPY the kernel sends the user pages in place instead of
+ * copying them into the socket buffer.  The pages must not be changed until
+ * the kernel has released them: a notification with a range of the numbers
+ * of the zero-copy sends is queued to the socket error queue once the data
+ * are acknowledged, and the socket is reported with EPOLLERR.
+ *
+ * The sends are numbered by the kernel from zero, zc->sent follows it, and
+ * zc->done is the number of the first send not completed yet.  The ranges
+ * may be completed out of order, so at most NGX_ZEROCOPY_PENDING sends are
+ * not completed at a time, each of them has a bit in zc->completed, and the
+ * data are copied as usual while the limit is reached.
+ */
+
+
+/* the extended error and the address of the origin, not used */
+
+#define NGX_ZEROCOPY_CONTROL_SIZE                                            \
+    (CMSG_SPACE(sizeof(struct sock_extended_err))                            \
+     + CMSG_SPACE(sizeof(struct sockaddr_in6)))
+
+
+static void ngx_linux_zerocopy_range(ngx_connection_t *c, ngx_zerocopy_t *zc,
+    uint32_t lo, uint32_t hi);
+
+
+ngx_int_t
+ngx_linux_zerocopy_enable(ngx_connection_t *c)
+{
+    int              zerocopy;
+    ngx_zerocopy_t  *zc;
+
+    if (c->zerocopy) {
+        return c->zerocopy->disabled ? NGX_DECLINED : NGX_OK;
+    }
+
+    zc = ngx_pcalloc(c->pool, sizeof(ngx_zerocopy_t));
+    if (zc == NULL) {
+        return NGX_ERROR;
+    }
+
+    c->zerocopy = zc;
+
+    zerocopy = 1;
+
+    if (setsockopt(c->fd, SOL_SOCKET, SO_ZEROCOPY,
+                   (const void *) &zerocopy, sizeof(int))
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_INFO, c->log, ngx_socket_errno,
+                      "setsockopt(SO_ZEROCOPY) failed, ignored");
+
+        zc->disabled = 1;
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0, "zerocopy enabled");
+
+    return NGX_OK;
+}
+
+
+ssize_t
+ngx_linux_zerocopy_send(ngx_connection_t *c, ngx_iovec_t *vec)
+{
+    ssize_t          n;
+    ngx_err_t        err;
+    struct msghdr    msg;
+    ngx_zerocopy_t  *zc;
+
+    zc = c->zerocopy;
+
+    if (zc->disabled || vec->size < NGX_ZEROCOPY_MIN_SIZE) {
+        return NGX_DECLINED;
+    }
+
+    if (zc->sent - zc->done >= NGX_ZEROCOPY_PENDING) {
+        ngx_linux_zerocopy_complete(c);
+
+        if (zc->sent - zc->done >= NGX_ZEROCOPY_PENDING) {
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "zerocopy pending #%uD, copied", zc->done);
+            return NGX_DECLINED;
+        }
+    }
+
+    ngx_memzero(&msg, sizeof(struct msghdr));
+
+    msg.msg_iov = vec->iovs;
+    msg.msg_iovlen = vec->count;
+
+eintr:
+
+    n = sendmsg(c->fd, &msg, MSG_ZEROCOPY);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "sendmsg(MSG_ZEROCOPY): %z of %uz #%uD",
+                   n, vec->size, zc->sent);
+
+    if (n == -1) {
+        err = ngx_errno;
+
+        switch (err) {
+        case NGX_EAGAIN:
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmsg() not ready");
+            return NGX_AGAIN;
+
+        case NGX_EINTR:
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmsg() was interrupted");
+            goto eintr;
+
+        case NGX_ENOBUFS:
+
+            /*
+             * the notifications not read yet are charged to the socket
+             * option memory, the data are copied this time
+             */
+
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmsg(MSG_ZEROCOPY) no buffers");
+
+            ngx_linux_zerocopy_complete(c);
+            return NGX_DECLINED;
+
+        default:
+            c->write->error = 1;
+            ngx_connection_error(c, err, "sendmsg(MSG_ZEROCOPY) failed");
+            return NGX_ERROR;
+        }
+    }
+
+    zc->sent++;
+
+    return n;
+}
+
+
+void
+ngx_linux_zerocopy_complete(ngx_connection_t *c)
+{
+    u_char                     control[NGX_ZEROCOPY_CONTROL_SIZE];
+    ssize_t                    n;
+    ngx_err_t                  err;
+    ngx_zerocopy_t            *zc;
+    struct msghdr              msg;
+    struct cmsghdr            *cmsg;
+    struct sock_extended_err  *serr;
+
+    zc = c->zerocopy;
+
+    if (zc == NULL || zc->done == zc->sent) {
+        return;
+    }
+
+    for ( ;; ) {
+        ngx_memzero(&msg, sizeof(struct msghdr));
+
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        n = recvmsg(c->fd, &msg, MSG_ERRQUEUE|MSG_DONTWAIT);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            if (err != NGX_EAGAIN) {
+                ngx_log_error(NGX_LOG_ALERT, c->log, err,
+                              "recvmsg(MSG_ERRQUEUE) failed");
+            }
+
+            return;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg);
+             cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!(cmsg->cmsg_level == SOL_IP
+                  && cmsg->cmsg_type == IP_RECVERR)
+                && !(cmsg->cmsg_level == SOL_IPV6
+                     && cmsg->cmsg_type == IPV6_RECVERR))
+            {
+                continue;
+            }
+
+            serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY
+                || serr->ee_errno != 0)
+            {
+                continue;
+            }
+
+            ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "zerocopy completed #%uD-%uD%s",
+                           serr->ee_info, serr->ee_data,
+                           (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                           ? " copied" : "");
+
+            /*
+             * the kernel copies the data anyway for the loopback and for
+             * the devices without the scatter-gather support, the pinning
+             * of the pages is only a waste then
+             */
+
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                zc->disabled = 1;
+            }
+
+            ngx_linux_zerocopy_range(c, zc, serr->ee_info, serr->ee_data);
+        }
+
+        if (zc->done == zc->sent) {
+            return;
+        }
+    }
+}
+
+
+static void
+ngx_linux_zerocopy_range(ngx_connection_t *c, ngx_zerocopy_t *zc,
+    uint32_t lo, uint32_t hi)
+{
+    uint32_t  n;
+
+    if ((int32_t) (hi - zc->done) < 0) {
+        return;
+    }
+
+    if ((int32_t) (lo - zc->done) < 0) {
+        lo = zc->done;
+    }
+
+    if (hi - zc->done >= NGX_ZEROCOPY_PENDING) {
+        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                      "unexpected zerocopy completion #%uD-%uD of #%uD-%uD",
+                      lo, hi, zc->done, zc->sent);
+
+        hi = zc->done + NGX_ZEROCOPY_PENDING - 1;
+    }
+
+    for (n = lo - zc->done; n <= hi - zc->done; n++) {
+        zc->completed |= (uint64_t) 1 << n;
+    }
+
+    while (zc->completed & 1) {
+        zc->completed >>= 1;
+        zc->done++;
+    }
+}
@@ -66,6 +66,9 @@ typedef struct {
     ngx_uint_t     count;
     size_t         size;
     ngx_uint_t     nalloc;
+#if (T_NGX_SEND_ZEROCOPY)
+    ngx_uint_t     zerocopy;       /* all the bufs may be sent in place */
+#endif
 } ngx_iovec_t;
 
 ngx_chain_t *ngx_output_chain_to_iovec(ngx_iovec_t *vec, ngx_chain_t *in,
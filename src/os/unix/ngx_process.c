@@ -624,6 +624,14 @@ ngx_unlock_mutexes(ngx_pid_t pid)
                           "shared memory zone \"%V\" was locked by %P",
                           &shm_zone[i].shm.name, pid);
         }
+
+#if (T_NGX_SLAB_MAGAZINE)
+        if (ngx_slab_magazines_force_unlock(sp, pid)) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                          "slab magazine of shared memory zone \"%V\" "
+                          "was locked by %P", &shm_zone[i].shm.name, pid);
+        }
+#endif
     }
 }
 
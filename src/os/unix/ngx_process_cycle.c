@@ -806,6 +806,10 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
                 ngx_exiting = 1;
                 ngx_set_shutdown_timer(cycle);
                 ngx_close_listening_sockets(cycle);
+#if (T_NGX_TIMER_WHEEL)
+                /* the idle handlers may walk over the timer rbtree */
+                ngx_event_timer_wheel_flush();
+#endif
                 ngx_close_idle_connections(cycle);
                 ngx_event_process_posted(cycle, &ngx_posted_events);
             }
@@ -1229,6 +1233,13 @@ ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
         }
 
         ngx_process_events_and_timers(cycle);
+
+        if (ctx->handler == ngx_cache_loader_process_handler
+            && !ev.timer_set
+            && ngx_event_no_timers_left() == NGX_OK)
+        {
+            exit(0);
+        }
     }
 }
 
@@ -1284,7 +1295,11 @@ ngx_cache_loader_process_handler(ngx_event_t *ev)
         }
     }
 
-    exit(0);
+    /* a loader may wait with a timer until the cache can be loaded */
+
+    if (ngx_event_no_timers_left() == NGX_OK) {
+        exit(0);
+    }
 }
 
 #if (T_NGX_HAVE_XUDP)
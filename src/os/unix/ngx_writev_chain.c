@@ -118,6 +118,10 @@ ngx_output_chain_to_iovec(ngx_iovec_t *vec, ngx_chain_t *in, size_t limit,
     total = 0;
     n = 0;
 
+#if (T_NGX_SEND_ZEROCOPY)
+    vec->zerocopy = 1;
+#endif
+
     for ( /* void */ ; in && total < limit; in = in->next) {
 
         if (ngx_buf_special(in->buf)) {
@@ -153,6 +157,12 @@ ngx_output_chain_to_iovec(ngx_iovec_t *vec, ngx_chain_t *in, size_t limit,
             size = limit - total;
         }
 
+#if (T_NGX_SEND_ZEROCOPY)
+        if (!in->buf->zerocopy) {
+            vec->zerocopy = 0;
+        }
+#endif
+
         if (prev == in->buf->pos) {
             iov->iov_len += size;
 
@@ -184,6 +194,18 @@ ngx_writev(ngx_connection_t *c, ngx_iovec_t *vec)
     ssize_t    n;
     ngx_err_t  err;
 
+#if (T_NGX_SEND_ZEROCOPY)
+
+    if (c->zerocopy && vec->zerocopy) {
+        n = ngx_linux_zerocopy_send(c, vec);
+
+        if (n != NGX_DECLINED) {
+            return n;
+        }
+    }
+
+#endif
+
 eintr:
 
     n = writev(c->fd, vec->iovs, vec->count);
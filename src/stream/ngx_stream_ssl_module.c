@@ -359,6 +359,15 @@ static ngx_command_t  ngx_stream_ssl_commands[] = {
       offsetof(ngx_stream_ssl_srv_conf_t, reject_handshake),
       NULL },
 
+#if (T_NGX_SSL_KTLS)
+    { ngx_string("ssl_ktls"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_ssl_srv_conf_t, ktls),
+      NULL },
+#endif
+
     { ngx_string("ssl_alpn"),
       NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_1MORE,
       ngx_stream_ssl_alpn,
@@ -487,6 +496,11 @@ static ngx_stream_variable_t  ngx_stream_ssl_vars[] = {
     { ngx_string("ssl_client_sigalg"), NULL, ngx_stream_ssl_variable,
       (uintptr_t) ngx_ssl_get_client_sigalg, NGX_STREAM_VAR_CHANGEABLE, 0 },
 
+#if (T_NGX_SSL_KTLS)
+    { ngx_string("ssl_ktls"), NULL, ngx_stream_ssl_variable,
+      (uintptr_t) ngx_ssl_get_ktls, NGX_STREAM_VAR_CHANGEABLE, 0 },
+#endif
+
 #if (T_NGX_SSL_HANDSHAKE_TIME)
     /* $ssl_shandshakd_time deprecated and will be removed in the next release */
     { ngx_string("ssl_handshakd_time"), NULL, ngx_stream_ssl_variable,
@@ -1040,6 +1054,9 @@ ngx_stream_ssl_create_srv_conf(ngx_conf_t *cf)
     sscf->prefer_server_ciphers = NGX_CONF_UNSET;
     sscf->certificate_compression = NGX_CONF_UNSET;
     sscf->reject_handshake = NGX_CONF_UNSET;
+#if (T_NGX_SSL_KTLS)
+    sscf->ktls = NGX_CONF_UNSET;
+#endif
     sscf->verify = NGX_CONF_UNSET_UINT;
     sscf->verify_depth = NGX_CONF_UNSET_UINT;
     sscf->builtin_session_cache = NGX_CONF_UNSET;
@@ -1084,6 +1101,9 @@ ngx_stream_ssl_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
                          prev->certificate_compression, 0);
 
     ngx_conf_merge_value(conf->reject_handshake, prev->reject_handshake, 0);
+#if (T_NGX_SSL_KTLS)
+    ngx_conf_merge_value(conf->ktls, prev->ktls, 0);
+#endif
 
     ngx_conf_merge_bitmask_value(conf->protocols, prev->protocols,
                          (NGX_CONF_BITMASK_SET|NGX_SSL_DEFAULT_PROTOCOLS));
@@ -1414,6 +1434,12 @@ ngx_stream_ssl_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
         }
     }
 
+#if (T_NGX_SSL_KTLS)
+    if (ngx_ssl_ktls(cf, &conf->ssl, conf->ktls) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+#endif
+
     if (ngx_ssl_conf_commands(cf, &conf->ssl, conf->conf_commands) != NGX_OK) {
         return NGX_CONF_ERROR;
     }
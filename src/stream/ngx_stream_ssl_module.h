@@ -20,6 +20,9 @@ typedef struct {
     ngx_flag_t        prefer_server_ciphers;
     ngx_flag_t        certificate_compression;
     ngx_flag_t        reject_handshake;
+#if (T_NGX_SSL_KTLS)
+    ngx_flag_t        ktls;
+#endif
 
     ngx_ssl_t         ssl;
 
@@ -824,7 +824,7 @@ sub hunpack {
 			next;
 		}
 
-		if (substr($ib, 0, 4) eq '0000') {
+		if (substr($ib, 0, 3) eq '000') {
 			($index, $skip) = iunpack(4, $data, $skip);
 			$name = $table->[$index][0];
 
@@ -0,0 +1,176 @@
+#!/usr/bin/perl
+
+# Tests for the bounded load and the maglev table of consistent_hash.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+use IO::Socket::INET;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy/)->plan(6)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+worker_processes 2;
+
+events {
+    accept_mutex off;
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    upstream bounded {
+        consistent_hash $arg_k bounded=1.25;
+        server 127.0.0.1:8081 max_fails=100;
+        server 127.0.0.1:8082;
+    }
+
+    upstream maglev {
+        consistent_hash $arg_k maglev;
+        server 127.0.0.1:8082;
+        server 127.0.0.1:8083;
+        server 127.0.0.1:8084;
+        server 127.0.0.1:8085;
+    }
+
+    upstream maglev_down {
+        consistent_hash $arg_k maglev;
+        server 127.0.0.1:8082;
+        server 127.0.0.1:8083 down;
+        server 127.0.0.1:8084;
+        server 127.0.0.1:8085;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass http://bounded;
+            proxy_next_upstream off;
+            proxy_read_timeout 5s;
+        }
+
+        location /probe {
+            proxy_pass http://bounded;
+            proxy_next_upstream off;
+            proxy_read_timeout 300ms;
+        }
+
+        location /maglev {
+            proxy_pass http://maglev;
+        }
+
+        location /down {
+            proxy_pass http://maglev_down;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8082;
+        listen       127.0.0.1:8083;
+        listen       127.0.0.1:8084;
+        listen       127.0.0.1:8085;
+        server_name  localhost;
+
+        location / {
+            return 200 $server_port;
+        }
+    }
+}
+
+EOF
+
+# the backend on 8081 accepts connections, but never answers
+
+my $hold = IO::Socket::INET->new(
+	Proto => 'tcp',
+	LocalAddr => '127.0.0.1:8081',
+	Listen => 16,
+	Reuse => 1
+)
+	or die "Can't create listening socket: $!\n";
+
+$t->run();
+
+###############################################################################
+
+# a key that goes to the silent backend while there is no load
+
+my $key;
+
+for my $k (1 .. 30) {
+	if (http_get("/probe?k=$k") =~ /504 Gateway/) {
+		$key = $k;
+		last;
+	}
+}
+
+ok(defined $key, 'key on the silent backend');
+$key = 1 unless defined $key;
+
+# with two requests in flight on it, from any worker, the silent backend
+# is over 1.25 of the average load, and the next request spills over
+
+my @s = map { http_get("/?k=$key", start => 1) } 1 .. 2;
+
+select undef, undef, undef, 0.3;
+
+is(http_get_body("/?k=$key"), '8082', 'spilled over');
+
+close $_ for @s;
+
+select undef, undef, undef, 0.5;
+
+like(http_get("/probe?k=$key"), qr/504 Gateway/, 'load released');
+
+my %ports = ();
+my $same = 1;
+
+for my $k (1 .. 40) {
+	my $port = http_get_body("/maglev?k=$k") || 'failed';
+	$same = 0 unless (http_get_body("/maglev?k=$k") || '') eq $port;
+	$ports{$port} += 1;
+}
+
+ok($same, 'maglev consistent');
+is(join(' ', sort keys %ports), '8082 8083 8084 8085', 'maglev spread');
+
+%ports = ();
+$ports{http_get_body("/down?k=$_") || 'failed'} += 1 for 1 .. 40;
+
+ok(!$ports{'8083'} && !$ports{'failed'}, 'maglev with a down server');
+
+###############################################################################
+
+sub http_get_body {
+	my ($uri) = @_;
+
+	my $r = http_get($uri);
+
+	return undef unless defined $r && $r =~ /200 OK/;
+
+	$r =~ /\x0d\x0a\x0d\x0a(.*)/ms;
+
+	return $1;
+}
+
+###############################################################################
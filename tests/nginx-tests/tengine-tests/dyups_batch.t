@@ -0,0 +1,206 @@
+#!/usr/bin/perl
+
+# Tests for the batch interface of dyups.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy upstream_zone dyups/)->plan(14)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+worker_processes 4;
+
+events {
+    accept_mutex off;
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    dyups_shared_peers on;
+    dyups_read_msg_timeout 100ms;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass http://$host;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+            dyups_interface;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8082;
+        listen       127.0.0.1:8083;
+        server_name  localhost;
+
+        location / {
+            return 200 $server_port;
+        }
+    }
+}
+
+EOF
+
+$t->run();
+
+###############################################################################
+
+my $r = dyups_post('/batch', <<'EOF');
+# a comment, with a brace }
+upstream a {
+    server 127.0.0.1:8082;
+}
+upstream b { ip_hash; server 127.0.0.1:8083; }
+upstream c {
+    server 127.0.0.1:8082 weight=2;  # }
+    server 127.0.0.1:8083;
+}
+EOF
+
+like($r, qr/200 OK/, 'batch');
+like($r, qr/^a 200 success\nb 200 success\nc 200 success\n/m,
+	'batch results');
+
+# the first read of messages is delayed up to a second in each worker
+
+select undef, undef, undef, 1.5;
+
+is(all('a'), '8082', 'upstream a in all workers');
+is(all('b'), '8083', 'upstream b in all workers');
+ok(defined all('c', qr/^808[23]$/), 'upstream c in all workers');
+
+$r = dyups_post('/batch', <<'EOF');
+upstream d { server 127.0.0.1:8083; }
+delete x;
+EOF
+
+like($r, qr/404 Not Found/, 'batch with unknown upstream');
+like($r, qr/^d 200 not applied\nx 404 not found uptream\n/m,
+	'batch not applied');
+unlike(dyups_get('/list'), qr/^d$/m, 'nothing applied');
+
+$r = dyups_post('/batch', <<'EOF');
+upstream e { server 127.0.0.1:8083 weight=invalid; }
+EOF
+
+like($r, qr/^e 500 add server failed\n/m, 'batch with invalid upstream');
+
+like(dyups_post('/batch', "upstream f { server 127.0.0.1:8083;\n"),
+	qr/400 Bad Request.*invalid batch at \d+\n\z/s, 'unterminated block');
+
+$r = dyups_post('/batch', <<'EOF');
+delete a;
+upstream b { server 127.0.0.1:8082; }
+upstream d { server 127.0.0.1:8083; }
+delete d;
+EOF
+
+like($r, qr/^a 200 success\nb 200 success\nd 200 success\nd 200 success\n/m,
+	'batch with deletes');
+
+select undef, undef, undef, 0.5;
+
+is(all('b'), '8082', 'upstream b updated in all workers');
+is(join(' ', sort split /\n/, dyups_get('/list')), 'b c',
+	'upstreams after deletes');
+
+$t->stop();
+
+like($t->read_file('error.log'), qr/sync batch add: b rv: success/,
+	'synced in one message');
+
+###############################################################################
+
+# the body of the responses from all the workers, if the same
+
+sub all {
+	my ($host, $re) = @_;
+	my %bodies;
+
+	for (1 .. 20) {
+		my $b = get_body($host);
+		$b = 'matched' if defined $re && defined $b && $b =~ $re;
+		$bodies{defined $b ? $b : 'failed'} = 1;
+	}
+
+	my @b = keys %bodies;
+
+	return @b == 1 && $b[0] ne 'failed' ? $b[0] : undef;
+}
+
+sub sock {
+	my ($port) = @_;
+
+	return IO::Socket::INET->new(
+		Proto => 'tcp',
+		PeerAddr => "127.0.0.1:$port"
+	);
+}
+
+sub get_body {
+	my ($host) = @_;
+
+	my $r = http(<<EOF);
+GET / HTTP/1.0
+Host: $host
+
+EOF
+
+	return undef unless defined $r && $r =~ /200 OK/;
+
+	$r =~ /\x0d\x0a\x0d\x0a(.*)/ms;
+
+	return $1;
+}
+
+sub dyups_get {
+	my ($uri) = @_;
+
+	my $r = http_get($uri, socket => sock(8081));
+
+	$r =~ /\x0d\x0a\x0d\x0a(.*)/ms;
+
+	return $1;
+}
+
+sub dyups_post {
+	my ($uri, $body) = @_;
+	my $len = length($body);
+
+	return http(<<EOF . $body, socket => sock(8081));
+POST $uri HTTP/1.0
+Host: localhost
+Content-Length: $len
+
+EOF
+}
+
+###############################################################################
@@ -0,0 +1,203 @@
+#!/usr/bin/perl
+
+# Tests for dyups upstreams shared by all the workers.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy upstream_zone dyups/)->plan(13)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+worker_processes 4;
+
+events {
+    accept_mutex off;
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    dyups_shared_peers on;
+    dyups_read_msg_timeout 100ms;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass http://$host;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+            dyups_interface;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8082;
+        listen       127.0.0.1:8083;
+        server_name  localhost;
+
+        location / {
+            return 200 $server_port;
+        }
+    }
+}
+
+EOF
+
+$t->run();
+
+###############################################################################
+
+like(dyups_post('/upstream/dyhost', 'server 127.0.0.1:8082;'), qr/success/,
+	'add upstream');
+
+# the first read of messages is delayed up to a second in each worker
+
+select undef, undef, undef, 1.5;
+
+my %ports = ();
+$ports{get_body('dyhost') || 'failed'} += 1 for 1 .. 20;
+
+is($ports{'8082'}, 20, 'all workers use the upstream');
+
+like(dyups_post('/upstream/dyhost',
+	'server 127.0.0.1:8082; server 127.0.0.1:8083;'), qr/success/,
+	'update upstream');
+
+select undef, undef, undef, 0.5;
+
+%ports = ();
+$ports{get_body('dyhost') || 'failed'} += 1 for 1 .. 20;
+
+ok($ports{'8082'} && $ports{'8083'}, 'all workers use the new peers');
+is(($ports{'8082'} || 0) + ($ports{'8083'} || 0), 20, 'no failed requests');
+
+like(http_get('/detail', socket => sock(8081)),
+	qr/dyhost\nserver 127.0.0.1:8082 weight=1 .*\nserver 127.0.0.1:8083 weight=1 /,
+	'detail of shared upstream');
+
+like(dyups_post('/upstream/hashed', 'ip_hash; server 127.0.0.1:8083;'),
+	qr/success/, 'add upstream with another balancer');
+
+select undef, undef, undef, 0.5;
+
+is(get_body('hashed'), '8083', 'upstream built by every worker');
+
+# the references of a worker killed while it uses the set are dropped
+# by the worker started in its place
+
+my ($pid) = $t->read_file('error.log') =~ /start worker process (\d+)/;
+kill 'KILL', $pid;
+
+for (1 .. 30) {
+	last if $t->read_file('error.log') =~ /release shared peers/;
+	select undef, undef, undef, 0.1;
+}
+
+like($t->read_file('error.log'),
+	qr/release shared peers version 2 of exited process $pid/,
+	'references of killed worker released');
+
+# the set is freed once the other workers moved to a newer one
+
+like(dyups_post('/upstream/dyhost', 'server 127.0.0.1:8083;'), qr/success/,
+	'update upstream again');
+
+for (1 .. 30) {
+	last if $t->read_file('error.log') =~ /free shared peers version 2/;
+	select undef, undef, undef, 0.1;
+}
+
+like($t->read_file('error.log'), qr/free shared peers version 2/, 'set freed');
+
+like(dyups_delete('/upstream/dyhost'), qr/success/, 'delete upstream');
+
+select undef, undef, undef, 0.5;
+
+$t->stop();
+
+my $log = $t->read_file('error.log');
+
+like($log, qr/sync flip: dyhost version: 2/, 'workers flipped to the set');
+
+# the alerts of the killed worker are expected
+
+$log =~ s/.+\[alert\].+(exited on signal 9|start after abnormal exits).*\n//g;
+$t->write_file('error.log', $log);
+
+###############################################################################
+
+sub sock {
+	my ($port) = @_;
+
+	return IO::Socket::INET->new(
+		Proto => 'tcp',
+		PeerAddr => "127.0.0.1:$port"
+	);
+}
+
+sub get_body {
+	my ($host) = @_;
+
+	my $r = http(<<EOF);
+GET / HTTP/1.0
+Host: $host
+
+EOF
+
+	return undef unless defined $r;
+
+	$r =~ /\x0d\x0a\x0d\x0a(.*)/ms;
+
+	return $1;
+}
+
+sub dyups_post {
+	my ($uri, $body) = @_;
+	my $len = length($body);
+
+	return http(<<EOF, socket => sock(8081));
+POST $uri HTTP/1.0
+Host: localhost
+Content-Length: $len
+
+$body
+EOF
+}
+
+sub dyups_delete {
+	my ($uri) = @_;
+
+	return http(<<EOF, socket => sock(8081));
+DELETE $uri HTTP/1.0
+Host: localhost
+
+EOF
+}
+
+###############################################################################
@@ -0,0 +1,186 @@
+#!/usr/bin/perl
+
+# Copyright (C) 2010-2026 Alibaba Group Holding Limited
+
+# Tests for http2_hpack_encoder: response headers are encoded with
+# the HPACK dynamic table, and the bytes saved are reported in
+# the $http2_header_saved variable.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+use Test::Nginx::HTTP2;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http http_v2 rewrite/)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    log_format  saved  $uri:$http2_header_saved;
+
+    add_header  Cache-Control  "public, max-age=60";
+    add_header  Set-Cookie     "session=secret";
+    add_header  X-Trace        $request_id;
+    add_header  X-Uri          $uri;
+
+    server {
+        listen       127.0.0.1:8080 http2;
+        server_name  localhost;
+
+        http2_hpack_encoder  on;
+
+        access_log  %%TESTDIR%%/saved.log  saved;
+
+        location / {
+            return 200 body;
+        }
+
+        location /redirect {
+            return 302 /;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081 http2;
+        server_name  localhost;
+
+        http2_hpack_encoder     on;
+        http2_hpack_table_size  256;
+
+        location / {
+            add_header  X-Uri  $uri;
+            add_header  X-A    a;
+            add_header  X-B    b;
+            add_header  X-C    c;
+            add_header  X-D    d;
+            add_header  X-E    e;
+            add_header  X-F    f;
+
+            return 200 body;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8082 http2;
+        server_name  localhost;
+
+        access_log  %%TESTDIR%%/saved.log  saved;
+
+        location / {
+            return 200 body;
+        }
+    }
+}
+
+EOF
+
+$t->try_run('no http2_hpack_encoder')->plan(20);
+
+###############################################################################
+
+my $s = Test::Nginx::HTTP2->new();
+
+my ($h1, $len1) = get($s, '/first');
+my ($h2, $len2) = get($s, '/second');
+
+is($h1->{':status'}, 200, 'status');
+is($h1->{'cache-control'}, 'public, max-age=60', 'header');
+is($h2->{'cache-control'}, 'public, max-age=60', 'indexed header');
+is($h2->{'content-type'}, 'text/plain', 'indexed content type');
+is($h2->{'set-cookie'}, 'session=secret', 'never indexed header');
+is($h2->{'x-uri'}, '/second', 'header with new value');
+like($h2->{'x-trace'}, qr/^[0-9a-f]{32}$/, 'header with unique value');
+isnt($h1->{'x-trace'}, $h2->{'x-trace'}, 'unique values');
+cmp_ok($len2, '<', $len1 - 30, 'header block size');
+
+# "set-cookie" with the static name index and the never indexed flag
+
+like($s->{headers}, qr/\x1f\x28/, 'never indexed representation');
+
+($h1) = get($s, '/redirect');
+($h2) = get($s, '/redirect');
+
+is($h1->{':status'}, 302, 'status literal');
+is($h2->{':status'}, 302, 'status indexed');
+like($h2->{'location'}, qr!^http://localhost:\d+/$!, 'location indexed');
+
+# table size set by the client
+
+$s = Test::Nginx::HTTP2->new();
+$s->h2_settings(0, 0x1 => 0);
+
+get($s, '/first');
+($h2) = get($s, '/second');
+
+is($h2->{'cache-control'}, 'public, max-age=60', 'no table');
+
+# "cache-control" with the static name index, without indexing
+
+like($s->{headers}, qr/\x0f\x09/, 'no table - not indexed');
+
+# table size changed twice before a header block, the smallest size
+# is sent first
+
+$s = Test::Nginx::HTTP2->new();
+$s->h2_settings(0, 0x1 => 0, 0x1 => 4096);
+
+get($s, '/first');
+
+like($s->{headers}, qr/^\x20\x3f\xe1\x1f/, 'smallest table size first');
+
+($h2) = get($s, '/second');
+
+is($h2->{'cache-control'}, 'public, max-age=60', 'table size restored');
+
+# entries evicted from a small table
+
+$s = Test::Nginx::HTTP2->new(port(8081));
+
+is(join(' ', map { join ':', @{(get($s, "/$_"))[0]}{qw/x-uri x-a x-f/} }
+	1 .. 10), join(' ', map { "/$_:a:f" } 1 .. 10), 'eviction');
+
+# the variable
+
+get(Test::Nginx::HTTP2->new(port(8082)), '/off');
+
+$t->stop();
+
+my $log = $t->read_file('saved.log');
+
+like($log, qr!^/second:[1-9]\d+$!m, 'saved variable');
+like($log, qr!^/off:-$!m, 'saved variable - disabled');
+
+###############################################################################
+
+sub get {
+	my ($s, $path) = @_;
+
+	my $sid = $s->new_stream({ path => $path });
+	my $frames = $s->read(all => [{ sid => $sid, fin => 1 }]);
+
+	my ($frame) = grep { $_->{type} eq "HEADERS" } @$frames;
+	return ($frame->{headers}, $frame->{length});
+}
+
+###############################################################################
@@ -0,0 +1,156 @@
+#!/usr/bin/perl
+
+# Tests for the hash cache file: the sizes of the hashes are reused by the
+# next configuration.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http map/)->plan(10);
+
+write_conf($t, 2000);
+
+$t->run();
+
+###############################################################################
+
+ok(-s $t->testdir() . '/hash.cache', 'cache file');
+
+like(http_host('m0001.example.com'), qr/value:1$/, 'map');
+like(http_host('m1999.example.com'), qr/value:1999$/, 'map last');
+like(http_host('h0777.example.com'), qr/named/, 'server name');
+
+# the same keys, all the sizes are reused
+
+$t->write_file('error.log', '');
+$t->reload();
+
+my $log = reloaded($t);
+
+ok($log =~ /hash cache .* (\d+) of (\d+) sizes reused/ && $1 == $2 && $1 > 0,
+	'sizes reused');
+
+# one more key in the map, its hash is searched again
+
+write_conf($t, 2001);
+
+$t->write_file('error.log', '');
+$t->reload();
+
+$log = reloaded($t);
+
+ok($log =~ /hash cache .* (\d+) of (\d+) sizes reused/ && $1 == $2 - 1,
+	'sizes partially reused');
+
+like(http_host('m2000.example.com'), qr/value:2000$/, 'map changed');
+
+# the file is read by "nginx -t", but is not written
+
+my $cache = $t->read_file('hash.cache');
+
+write_conf($t, 2002);
+
+like($t->dump_config(), qr/test is successful/, 'config test');
+is($t->read_file('hash.cache'), $cache, 'not written by config test');
+
+# a broken cache file is ignored
+
+$t->write_file('hash.cache', 'garbage');
+$t->write_file('error.log', '');
+$t->reload();
+
+like(reloaded($t), qr/hash cache .* is invalid, ignored/, 'invalid file');
+
+###############################################################################
+
+sub write_conf {
+	my ($t, $n) = @_;
+
+	my $map = join "\n", map { sprintf "        m%04d.example.com %d;", $_, $_ }
+		0 .. $n - 1;
+	my $names = join "\n", map { sprintf "    server_name h%04d.example.com;", $_ }
+		0 .. 1999;
+
+	$t->write_file_expand('nginx.conf', <<"EOF");
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+hash_cache_file hash.cache;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    map_hash_max_size 16384;
+    server_names_hash_max_size 16384;
+
+    map \$host \$value {
+$map
+    }
+
+    server {
+        listen       127.0.0.1:8080 default_server;
+        server_name  localhost;
+
+        location / {
+            return 200 "default value:\$value";
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+$names
+
+        location / {
+            return 200 "named value:\$value";
+        }
+    }
+}
+
+EOF
+}
+
+sub http_host {
+	my ($host) = @_;
+
+	return http(<<EOF);
+GET / HTTP/1.0
+Host: $host
+
+EOF
+}
+
+# the log of the new configuration, once the old worker is gone
+
+sub reloaded {
+	my ($t) = @_;
+	my $log = '';
+
+	for (1 .. 50) {
+		$log = $t->read_file('error.log');
+		last if $log =~ /start worker process.*exited with code/s;
+		select undef, undef, undef, 0.1;
+	}
+
+	return $log;
+}
+
+###############################################################################
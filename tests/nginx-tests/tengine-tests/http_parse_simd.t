@@ -0,0 +1,118 @@
+#!/usr/bin/perl
+
+# Tests for the fast paths of the request line and header parsers: runs of
+# bytes longer than a block, the block boundaries, and the bytes which stop
+# a run.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx qw/ :DEFAULT http_end /;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http/)->plan(13)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    client_header_buffer_size 128;
+    large_client_header_buffers 4 4k;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            return 200 "uri:$uri args:$args x:[$http_x_foo]
+                        long:[$http_x_a_very_long_header_name_longer_than_32]
+                        ua:[$http_user_agent]";
+        }
+    }
+}
+
+EOF
+
+$t->run();
+
+###############################################################################
+
+my $long = 'a' x 100;
+
+like(get("/$long/b.html?" . 'c=d&' x 30),
+	qr{uri:/$long/b.html args:(c=d&){30} }, 'long uri and args');
+like(get("/$long/./b"), qr{uri:/$long/b }, 'dot segment after a run');
+like(get("/$long%41b"), qr{uri:/${long}Ab }, 'escape after a run');
+like(get("/$long#frag"), qr{uri:/$long }, 'fragment after a run');
+like(get("/$long?a=1#frag"), qr/args:a=1 /, 'fragment in args');
+
+like(get('/', 'X-FOO: ' . 'x' x 100), qr/x:\[x{100}\]/, 'long value');
+like(get('/', 'X-Foo:   value with  spaces' . ' ' x 40),
+	qr/x:\[value with  spaces\]/, 'trailing spaces');
+like(get('/', 'x-foo: ' . 'v' x 40 . "\t" . 'v' x 20 . ' '),
+	qr/x:\[v{40}\tv{20}\]/, 'tab in value');
+like(get('/', 'X-A-VERY-LONG-HEADER-NAME-LONGER-THAN-32: yes'),
+	qr/long:\[yes\]/, 'long name in upper case');
+like(get('/', 'User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36'),
+	qr{ua:\[Mozilla/5.0 \(X11; Linux x86_64\) AppleWebKit/537.36\]},
+	'known header');
+
+like(get('/', 'X-Foo: ' . 'x' x 40 . "\x00" . 'x' x 40), qr/400 Bad/,
+	'zero byte in value');
+like(get("/$long\x01b"), qr/400 Bad/, 'control byte in uri');
+
+# the request in pieces, the runs are split across reads
+
+my $s = IO::Socket::INET->new('127.0.0.1:' . port(8080))
+	or die "Can't connect to nginx: $!\n";
+
+my $req = <<EOF;
+GET /$long?$long HTTP/1.1
+Host: localhost
+X-Foo: ${long}v
+Connection: close
+
+EOF
+
+while ($req =~ s/^(.{1,13})//s) {
+	$s->syswrite($1);
+	select undef, undef, undef, 0.01;
+}
+
+my $r = http_end($s);
+
+like($r, qr/args:$long x:\[${long}v\]/, 'split request');
+
+###############################################################################
+
+sub get {
+	my ($uri, @headers) = @_;
+
+	my $h = join '', map { "$_\r\n" } @headers;
+
+	return http(<<EOF);
+GET $uri HTTP/1.0
+Host: localhost
+$h
+EOF
+}
+
+###############################################################################
@@ -0,0 +1,216 @@
+#!/usr/bin/perl
+
+# Tests for ingress ConfigDelta updates of the two strategy slots.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+use Digest::MD5 qw/ md5_hex /;
+use Fcntl qw/ :flock /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http ngx_ingress_module/)
+	->plan(10);
+
+# the shared memory and its lock file are created by the controller
+
+my $shm = "/ingress_delta_$$";
+my $shm_file = "/dev/shm$shm";
+
+open my $fh, '>', $shm_file or die "Can't create $shm_file: $!";
+truncate $fh, 65536;
+close $fh;
+
+my $lock_file = $t->testdir() . '/ingress.lock';
+
+$t->write_file('ingress.lock', '');
+
+shm_write(1, full(['a.example.com', 'a', '127.0.0.1:8081']));
+
+$t->write_file_expand('nginx.conf', <<"EOF");
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+processes {
+    process strategy {
+        count 1;
+    }
+}
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    ingress_gateway_shm_config gw $shm 64k %%TESTDIR%%/ingress.lock;
+    ingress_gateway_update_interval gw 1s;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            ingress_gateway gw;
+            return 200 "target:\$ingress_route_target";
+        }
+    }
+}
+
+EOF
+
+$t->run();
+
+###############################################################################
+
+like(target('a.example.com'), qr/target:127.0.0.1:8081/, 'startup config');
+
+# a full config is applied to one slot; the other slot is behind until the
+# next update, when a delta based on the full config arrives
+
+shm_write(2, full(['b.example.com', 'b', '127.0.0.1:8082']));
+
+ok(wait_target('b.example.com', '127.0.0.1:8082'), 'full config');
+
+shm_write(3, delta(2, ['c.example.com', 'c', '127.0.0.1:8083']));
+
+ok(wait_target('c.example.com', '127.0.0.1:8083'), 'delta after full');
+like(target('b.example.com'), qr/127.0.0.1:8082/, 'delta after full - kept');
+
+shm_write(4, delta(3, ['d.example.com', 'd', '127.0.0.1:8084']));
+
+ok(wait_target('d.example.com', '127.0.0.1:8084'), 'second delta');
+like(target('c.example.com'), qr/127.0.0.1:8083/, 'second delta - kept');
+like(target('b.example.com'), qr/127.0.0.1:8082/, 'second delta - kept full');
+
+# both slots reach the last version, without asking for a full config
+
+ok(wait_log($t, qr/update ingress delta md5\|\w+\|ver=4\|/, 2), 'both slots');
+is(shm_status(), 0, 'status success');
+
+$t->stop();
+
+unlink $shm_file;
+
+unlike($t->read_file('error.log'), qr/needs? full|delta failed/, 'no full');
+
+###############################################################################
+
+sub target {
+	my ($host) = @_;
+	http(<<EOF) =~ /(target:.*)$/m;
+GET / HTTP/1.0
+Host: $host
+
+EOF
+	return $1;
+}
+
+sub wait_target {
+	my ($host, $target) = @_;
+
+	for (1 .. 50) {
+		return 1 if (target($host) || '') eq "target:$target";
+		select undef, undef, undef, 0.1;
+	}
+
+	return 0;
+}
+
+sub wait_log {
+	my ($t, $re, $n) = @_;
+
+	for (1 .. 50) {
+		my @m = $t->read_file('error.log') =~ /$re/g;
+		return 1 if @m >= $n;
+		select undef, undef, undef, 0.1;
+	}
+
+	return 0;
+}
+
+# protobuf encoding of the few messages used
+
+sub varint {
+	my ($v) = @_;
+	my $s = '';
+
+	while ($v >= 0x80) {
+		$s .= chr(($v & 0x7f) | 0x80);
+		$v >>= 7;
+	}
+
+	return $s . chr($v);
+}
+
+sub field {
+	my ($n, $data) = @_;
+	return varint($n << 3 | 2) . varint(length $data) . $data;
+}
+
+sub route {
+	my ($host, $service, $target) = @_;
+
+	my $router = field(1, field(1, $host) . field(2, $service));
+	my $vs = field(1, $service)
+		. field(2, field(1, $target) . varint(2 << 3) . varint(100));
+
+	return ($router, $vs);
+}
+
+sub full {
+	my ($router, $vs) = route(@{$_[0]});
+	return (1, field(1, $router) . field(2, $vs));
+}
+
+sub delta {
+	my ($base, $route) = @_;
+	my ($router, $vs) = route(@$route);
+	return (3, varint(1 << 3) . varint($base)
+		. field(2, $router) . field(3, $vs));
+}
+
+# status, version, type, md5, length and the config, in network order
+
+sub shm_write {
+	my ($version, $type, $pb) = @_;
+
+	my $data = pack('nnNNN', 0xffff, 0xffff, $version >> 32, $version, $type)
+		. md5_hex($pb) . pack('N', length $pb) . $pb;
+
+	open my $lock, '<', $lock_file or die "Can't open $lock_file: $!";
+	flock($lock, LOCK_EX) or die "$!";
+
+	open my $fh, '+<', $shm_file or die "Can't open $shm_file: $!";
+	binmode $fh;
+	syswrite($fh, $data) == length $data or die "$!";
+	close $fh;
+
+	close $lock;
+}
+
+sub shm_status {
+	open my $fh, '<', $shm_file or die "Can't open $shm_file: $!";
+	binmode $fh;
+	sysread($fh, my $status, 2);
+	close $fh;
+
+	return unpack('n', $status);
+}
+
+###############################################################################
@@ -0,0 +1,150 @@
+#!/usr/bin/perl
+
+# Tests for the io_uring event module.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx qw/ :DEFAULT http_end /;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy upstream_keepalive/)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+worker_processes 2;
+
+thread_pool default threads=2;
+
+events {
+    use io_uring;
+    io_uring_entries 8;
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    upstream u {
+        server 127.0.0.1:8081;
+        keepalive 4;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+        }
+
+        location /aio/ {
+            alias %%TESTDIR%%/;
+            aio on;
+            output_buffers 2 64k;
+        }
+
+        location /threads/ {
+            alias %%TESTDIR%%/;
+            aio threads;
+        }
+
+        location /proxy/ {
+            proxy_pass http://u/;
+            proxy_http_version 1.1;
+            proxy_set_header Connection "";
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+            return 200 "backend $request_uri";
+        }
+    }
+}
+
+EOF
+
+$t->write_file('small', 'SEE-THIS');
+$t->write_file('large', join('', map { sprintf "%08d\n", $_ } 1 .. 100000));
+
+$t->try_run('no io_uring')->plan(9);
+
+###############################################################################
+
+like(http_get('/small'), qr/200 OK.*SEE-THIS$/s, 'small file');
+
+my $large = $t->read_file('large');
+
+is(body('/aio/large'), $large, 'large file, aio');
+is(body('/threads/large'), $large, 'large file, aio threads');
+is(body('/proxy/x'), 'backend /x', 'proxy');
+
+# more connections than the submission queue entries
+
+my @s = map { http_get('/small', start => 1) } 1 .. 32;
+my $ok = grep { (http_end($_) || '') =~ /SEE-THIS/ } @s;
+
+is($ok, 32, 'many connections');
+
+$ok = 0;
+
+for (1 .. 20) {
+	$ok++ if body("/proxy/$_") eq "backend /$_";
+}
+
+is($ok, 20, 'proxy with keepalive');
+
+# the connection is closed once the response is sent,
+# the poll does not keep the socket open
+
+my $s = http_get('/small', start => 1);
+my $r = http_end($s);
+
+like($r, qr/SEE-THIS$/, 'closed');
+
+# connections are accepted through the ring, the accepts of the old
+# workers are cancelled on reload, so they exit
+
+$t->reload();
+
+for (1 .. 50) {
+	last if (() = $t->read_file('error.log') =~ /exited with code 0/g) == 2;
+	select undef, undef, undef, 0.1;
+}
+
+my $n = () = $t->read_file('error.log') =~ /exited with code 0/g;
+
+is($n, 2, 'old workers exited');
+like(http_get('/small'), qr/200 OK.*SEE-THIS$/s, 'after reload');
+
+###############################################################################
+
+sub body {
+	my ($uri) = @_;
+
+	my $r = http_get($uri) || '';
+
+	return '' unless $r =~ /200 OK/;
+
+	$r =~ /\x0d\x0a\x0d\x0a(.*)/ms;
+
+	return $1;
+}
+
+###############################################################################
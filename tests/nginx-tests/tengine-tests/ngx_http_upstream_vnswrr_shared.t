@@ -0,0 +1,128 @@
+#!/usr/bin/perl
+
+# Copyright (C) 2010-2019 Alibaba Group Holding Limited
+
+# Tests for upstream vnswrr balancer module, shared mode.
+
+###############################################################################
+
+use warnings;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy upstream_zone vnswrr/)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+worker_processes 4;
+
+events {
+    accept_mutex off;
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    upstream w {
+        vnswrr shared;
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082 weight=2;
+        server 127.0.0.1:8083 weight=4;
+    }
+
+    upstream zone {
+        zone zone 64k;
+        vnswrr max_init=1 shared;
+        server 127.0.0.1:8081 weight=3;
+        server 127.0.0.1:8082 weight=6;
+    }
+
+    upstream b {
+        vnswrr shared;
+        server 127.0.0.1:8081 down;
+        server 127.0.0.1:8082 backup;
+        server 127.0.0.1:8083 backup weight=2;
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        listen       127.0.0.1:8082;
+        listen       127.0.0.1:8083;
+        server_name  localhost;
+
+        location / {
+            return 200 $server_port;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location /w {
+            proxy_pass http://w;
+        }
+
+        location /zone {
+            proxy_pass http://zone;
+        }
+
+        location /b {
+            proxy_pass http://b;
+        }
+    }
+}
+
+EOF
+
+$t->try_run('no upstream vnswrr shared')->plan(7);
+
+###############################################################################
+
+my %list = ();
+
+# one sequence for all the workers, whichever worker gets the request
+
+$list{http_get_body('/w')} += 1 for 1 .. 14;
+
+is($list{'8081'}, 2, 'shared weight 1');
+is($list{'8082'}, 4, 'shared weight 2');
+is($list{'8083'}, 8, 'shared weight 4');
+
+%list = ();
+$list{http_get_body('/zone')} += 1 for 1 .. 6;
+
+is($list{'8081'}, 2, 'shared zone weight 3');
+is($list{'8082'}, 4, 'shared zone weight 6');
+
+%list = ();
+$list{http_get_body('/b')} += 1 for 1 .. 3;
+
+is($list{'8082'}, 1, 'shared backup weight 1');
+is($list{'8083'}, 2, 'shared backup weight 2');
+
+###############################################################################
+
+sub http_get_body {
+        my ($uri) = @_;
+
+        return undef if !defined $uri;
+
+        http_get($uri) =~ /(.*?)\x0d\x0a?\x0d\x0a?(.*)/ms;
+
+        return $2;
+}
+
+###############################################################################
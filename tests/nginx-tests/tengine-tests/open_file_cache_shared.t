@@ -0,0 +1,173 @@
+#!/usr/bin/perl
+
+# Tests for the shared open file cache: the changes of files and of the
+# directories on their path are seen at once, not after the validity time.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http/)->plan(9)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+worker_processes 2;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    open_file_cache_shared 1m;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        open_file_cache max=100 inactive=60s;
+        open_file_cache_valid 60s;
+        open_file_cache_errors on;
+
+        location / {
+            root %%TESTDIR%%/docroot;
+        }
+
+        location /try/ {
+            root %%TESTDIR%%/docroot;
+            try_files $uri /index.html;
+            open_file_cache_valid 1s;
+        }
+    }
+}
+
+EOF
+
+my $d = $t->testdir();
+
+mkdir "$d/r1";
+mkdir "$d/r1/dir";
+mkdir "$d/r2";
+mkdir "$d/r2/dir";
+mkdir "$d/r2/try";
+
+$t->write_file('r1/dir/file.html', 'release one');
+$t->write_file('r2/dir/file.html', 'release two');
+$t->write_file('r2/index.html', 'index');
+
+symlink "$d/r1", "$d/docroot" or die "Can't create symlink: $!";
+
+$t->run();
+
+###############################################################################
+
+like(get('/dir/file.html'), qr/release one$/, 'file');
+
+# in place change of a cached file, the same inode
+
+watched();
+$t->write_file('r1/dir/file.html', 'release one, changed');
+changed();
+
+like(get('/dir/file.html'), qr/release one, changed$/, 'changed in place');
+
+# removed and created again
+
+watched();
+unlink "$d/r1/dir/file.html";
+changed();
+
+like(get('/dir/file.html'), qr/404 Not Found/, 'removed');
+
+watched();
+$t->write_file('r1/dir/file.html', 'release one, again');
+changed();
+
+like(get('/dir/file.html'), qr/release one, again$/, 'created');
+
+# the symbolic link on the path replaced
+
+watched();
+symlink "$d/r2", "$d/docroot.new" or die "Can't create symlink: $!";
+rename "$d/docroot.new", "$d/docroot" or die "Can't rename: $!";
+changed();
+
+like(get('/dir/file.html'), qr/release two$/, 'symlink on path replaced');
+
+# a directory on the path renamed
+
+watched();
+rename "$d/r2/dir", "$d/r2/old" or die "Can't rename: $!";
+changed();
+
+like(get('/dir/file.html'), qr/404 Not Found/, 'directory renamed');
+
+# existence tests of try_files, not tested again after the validity time
+# of the worker once trusted
+
+like(get('/try/x.html'), qr/^index$/m, 'try_files');
+
+watched();
+select undef, undef, undef, 1.1;
+
+SKIP: {
+skip 'no --with-debug', 1 unless $t->has_module('--with-debug');
+
+my $n = length $t->read_file('error.log');
+
+get('/try/x.html');
+get('/try/x.html');
+
+my $log = substr $t->read_file('error.log'), $n;
+
+ok($log =~ /trying to use file: "\/try\/x.html"/
+	&& $log !~ /retest open file: .*\/try\/x.html/, 'try_files not retested');
+
+}
+
+watched();
+$t->write_file('r2/try/x.html', 'created');
+changed();
+
+like(get('/try/x.html'), qr/^created$/m, 'try_files created');
+
+###############################################################################
+
+sub get {
+	my ($uri) = @_;
+
+	return http(<<EOF);
+GET $uri HTTP/1.0
+Host: localhost
+
+EOF
+}
+
+# the requested files are checked by the watcher periodically, and its
+# events are handled along with the requests
+
+sub watched {
+	select undef, undef, undef, 0.3;
+}
+
+sub changed {
+	select undef, undef, undef, 0.1;
+}
+
+###############################################################################
@@ -0,0 +1,132 @@
+#!/usr/bin/perl
+
+# Copyright (C) 2010-2026 Alibaba Group Holding Limited
+
+# Tests for the "keys_hash" parameter of proxy_cache_path: cache keys are
+# looked up in a hash table, and entries used are given a second chance
+# before they are removed from the cache.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy cache/)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    proxy_cache_path   %%TESTDIR%%/cache  levels=1:2  keys_zone=NAME:1m
+                       keys_hash=on;
+
+    proxy_cache_path   %%TESTDIR%%/small  keys_zone=SMALL:32k
+                       keys_hash=on;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        proxy_cache_valid   any   1h;
+
+        add_header X-Cache-Status $upstream_cache_status;
+
+        location / {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+        }
+
+        location /small/ {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   SMALL;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+            return 200 "SEE-THIS";
+        }
+    }
+}
+
+EOF
+
+$t->try_run('no proxy_cache_path keys_hash')->plan(9);
+
+###############################################################################
+
+like(http_get('/t'), qr/MISS.*SEE-THIS/s, 'miss');
+like(http_get('/t'), qr/HIT.*SEE-THIS/s, 'hit');
+like(http_get('/t2'), qr/MISS.*SEE-THIS/s, 'miss other key');
+
+# entries used are kept when the keys zone is full
+
+my $hits = 0;
+
+http_get('/small/0');
+
+for my $n (1 .. 200) {
+	http_get("/small/$n");
+	$hits++ if http_get('/small/0') =~ /HIT/;
+}
+
+is($hits, 200, 'used entry kept');
+like(http_get('/small/200'), qr/HIT/, 'last entry kept');
+like(http_get('/small/1'), qr/MISS/, 'unused entry removed');
+
+# the hash table is freed on reload, and built again by the cache manager,
+# with keys looked up in the tree until it is built
+
+reload($t, 'off');
+like(http_get('/t'), qr/HIT.*SEE-THIS/s, 'hit without keys hash');
+
+reload($t, 'on');
+like(http_get('/t2'), qr/HIT.*SEE-THIS/s, 'hit while keys hash built');
+
+select undef, undef, undef, 0.5;
+
+like(http_get('/t'), qr/HIT.*SEE-THIS/s, 'hit after keys hash built');
+
+###############################################################################
+
+sub reload {
+	my ($t, $hash) = @_;
+
+	my $conf = $t->read_file('nginx.conf');
+	$conf =~ s/(NAME:1m\s+keys_hash=)\w+/$1$hash/;
+	$t->write_file('nginx.conf', $conf);
+
+	my $n = () = $t->read_file('error.log') =~ /worker process \d+ exited/g;
+
+	$t->reload();
+
+	for (1 .. 50) {
+		last if (() = $t->read_file('error.log')
+			=~ /worker process \d+ exited/g) > $n;
+		select undef, undef, undef, 0.1;
+	}
+}
+
+###############################################################################
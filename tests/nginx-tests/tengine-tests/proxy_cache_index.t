@@ -0,0 +1,131 @@
+#!/usr/bin/perl
+
+# Copyright (C) 2010-2026 Alibaba Group Holding Limited
+
+# Tests for the "index" parameter of proxy_cache_path: the cache is loaded
+# from the index on start instead of walking the cache directory.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy cache/)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    proxy_cache_path   %%TESTDIR%%/cache  levels=1:2  keys_zone=NAME:1m
+                       index=%%TESTDIR%%/cache/index;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass    http://127.0.0.1:8081;
+
+            proxy_cache   NAME;
+
+            proxy_cache_valid   any   1h;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+            return 200 "SEE-THIS";
+        }
+    }
+}
+
+EOF
+
+$t->try_run('no proxy_cache_path index')->plan(10);
+
+###############################################################################
+
+like(http_get('/t'), qr/MISS.*SEE-THIS/s, 'miss');
+like(http_get('/t'), qr/HIT.*SEE-THIS/s, 'hit');
+
+http_get('/t2');
+
+like(wait_log($t, qr/index: "/), qr/ 0\.000M, bsize: \d+, index: "/,
+	'empty cache loaded from index');
+
+$t->stop();
+
+ok(-s $t->testdir() . '/cache/index', 'index written');
+
+# a clean stop makes the index complete
+
+$t->write_file('error.log', '');
+$t->run();
+
+like(wait_log($t, qr/index: "/), qr/ 0\.\d*[1-9]\d*M, bsize: \d+, index: "/,
+	'loaded from index');
+like(http_get('/t'), qr/HIT.*SEE-THIS/s, 'hit after start');
+like(http_get('/t3'), qr/MISS.*SEE-THIS/s, 'miss after start');
+
+# a record partially written is ignored, and the cache is walked as well
+
+$t->stop();
+
+$t->write_file('cache/index', $t->read_file('cache/index') . 'x');
+
+# the index is left intact by configuration testing
+
+my $size = -s $t->testdir() . '/cache/index';
+
+system($Test::Nginx::NGINX, '-p', $t->testdir() . '/', '-c', 'nginx.conf',
+	'-e', 'error.log', '-t', '-q');
+
+is(-s $t->testdir() . '/cache/index', $size, 'index intact after -t');
+
+$t->write_file('error.log', '');
+$t->run();
+
+like(wait_log($t, qr/replayed/), qr/replayed from index/,
+	'replayed from index');
+like(http_get('/t3'), qr/HIT.*SEE-THIS/s, 'hit after replay');
+
+###############################################################################
+
+sub wait_log {
+	my ($t, $re) = @_;
+
+	for (1 .. 50) {
+		my @lines = grep { $_ =~ $re }
+			split /\n/, $t->read_file('error.log');
+		return $lines[-1] if @lines;
+		select undef, undef, undef, 0.1;
+	}
+
+	return '';
+}
+
+###############################################################################
@@ -0,0 +1,164 @@
+#!/usr/bin/perl
+
+# Copyright (C) 2010-2026 Alibaba Group Holding Limited
+
+# Tests for http2_multiplex: requests proxied to an HTTP/2 upstream share
+# one connection to the server, sequential as well as concurrent ones.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx qw/ :DEFAULT http_end /;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http http_v2 proxy/)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    upstream u {
+        server 127.0.0.1:8081;
+        http2_multiplex 10 window=64k;
+    }
+
+    upstream u2 {
+        server 127.0.0.1:8081;
+        http2_multiplex 10 timeout=1s;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        proxy_http_version 2;
+
+        location / {
+            proxy_pass http://u;
+        }
+
+        location /idle {
+            proxy_pass http://u2/;
+        }
+
+        location /plain {
+            proxy_pass http://127.0.0.1:8081/;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081 http2;
+        server_name  localhost;
+
+        add_header X-Conn $connection always;
+
+        location / {
+            root %%TESTDIR%%;
+        }
+
+        location /slow {
+            alias %%TESTDIR%%/big;
+            limit_rate 100k;
+        }
+
+        location /body {
+            add_header X-Conn $connection always;
+            add_header X-Body $request_body always;
+            proxy_pass http://127.0.0.1:8082/;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8082;
+        server_name  localhost;
+
+        location / {
+            return 200 "body";
+        }
+    }
+}
+
+EOF
+
+$t->write_file('t', 'SEE-THIS');
+$t->write_file('big', 'x' x 200000);
+
+$t->try_run('no http2_multiplex')->plan(11);
+
+###############################################################################
+
+my ($r1, $r2, $r3);
+
+$r1 = http_get('/t');
+$r2 = http_get('/t');
+
+like($r1, qr/SEE-THIS/, 'request');
+is(conn($r1), conn($r2), 'sequential requests share connection');
+
+isnt(conn(http_get('/plain/t')), conn(http_get('/plain/t')),
+	'connections not shared without multiplex');
+
+is(body_length(http_get('/big')), 200000, 'response larger than window');
+
+# concurrent requests
+
+my @s = map { http_get('/slow', start => 1) } 1 .. 3;
+my @r = map { http_end($_) } @s;
+
+is(scalar(grep { body_length($_) == 200000 } @r), 3, 'concurrent responses');
+is(conn($r[0]), conn($r1), 'concurrent request 1 shares connection');
+is(conn($r[1]), conn($r1), 'concurrent request 2 shares connection');
+is(conn($r[2]), conn($r1), 'concurrent request 3 shares connection');
+
+# request body
+
+$r3 = http(<<EOF);
+POST /body HTTP/1.0
+Host: localhost
+Content-Length: 10
+
+0123456789
+EOF
+
+like($r3, qr/X-Body: 0123456789/i, 'request body');
+is(conn($r3), conn($r1), 'request body shares connection');
+
+# the idle connection is closed
+
+$r1 = http_get('/idle/t');
+select undef, undef, undef, 1.5;
+$r2 = http_get('/idle/t');
+
+isnt(conn($r1), conn($r2), 'idle timeout');
+
+###############################################################################
+
+sub conn {
+	my ($r) = @_;
+	return $r =~ /X-Conn: (\d+)/i ? $1 : 'none';
+}
+
+sub body_length {
+	my ($r) = @_;
+	return $r =~ /\x0d\x0a\x0d\x0a(.*)/s ? length($1) : 0;
+}
+
+###############################################################################
@@ -0,0 +1,133 @@
+#!/usr/bin/perl
+
+# Tests for request statistics counted per worker.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http reqstat/)->plan(5)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+worker_processes 4;
+
+events {
+    accept_mutex off;
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    req_status_zone shared "$host" 1M;
+    req_status_zone sharded "$host" 1M;
+    req_status_zone_per_worker sharded;
+    req_status_zone_add_indicator sharded $arg_v;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location /shared {
+            req_status_show shared;
+            req_status_show_field req_total http_2xx http_404;
+        }
+
+        location /sharded {
+            req_status_show sharded;
+            req_status_show_field req_total http_2xx http_404 $arg_v;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  a b;
+
+        req_status shared sharded;
+
+        location / {
+            return 200;
+        }
+
+        location /404 {
+            return 404;
+        }
+    }
+}
+
+EOF
+
+$t->run();
+
+###############################################################################
+
+for (1 .. 40) {
+	http(<<EOF, socket => IO::Socket::INET->new('127.0.0.1:8081'));
+GET /?v=2 HTTP/1.0
+Host: a
+
+EOF
+}
+
+for (1 .. 10) {
+	http(<<EOF, socket => IO::Socket::INET->new('127.0.0.1:8081'));
+GET /404 HTTP/1.0
+Host: a
+
+EOF
+}
+
+for (1 .. 5) {
+	http(<<EOF, socket => IO::Socket::INET->new('127.0.0.1:8081'));
+GET / HTTP/1.0
+Host: b
+
+EOF
+}
+
+my $shared = get_body('/shared');
+my $sharded = get_body('/sharded');
+
+like($shared, qr/^a,50,40,10$/m, 'shared counters');
+like($sharded, qr/^a,50,40,10,80$/m, 'per worker counters');
+like($sharded, qr/^b,5,5,0,0$/m, 'per worker counters, another key');
+is(join("\n", sort split /\n/, $shared),
+	join("\n", sort map { s/,\d+$//r } split /\n/, $sharded),
+	'same as shared');
+
+# the counters of the workers are summed up, whichever worker shows them
+
+my %seen;
+$seen{get_body('/sharded')} = 1 for 1 .. 10;
+
+is(scalar keys %seen, 1, 'same from all workers');
+
+###############################################################################
+
+sub get_body {
+	my ($uri) = @_;
+
+	my $r = http_get($uri);
+
+	$r =~ /\x0d\x0a\x0d\x0a(.*)/ms;
+
+	return $1;
+}
+
+###############################################################################
@@ -0,0 +1,123 @@
+#!/usr/bin/perl
+
+# Tests for send_zerocopy: the proxied responses are sent with MSG_ZEROCOPY,
+# and the buffers are reused only after the kernel has sent them.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+use Digest::MD5 qw/ md5_hex /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx qw/ :DEFAULT http_end /;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy/)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        send_zerocopy on;
+
+        location / {
+            proxy_pass http://127.0.0.1:8081;
+            proxy_buffers 4 64k;
+            proxy_busy_buffers_size 64k;
+            proxy_max_temp_file_size 0;
+        }
+
+        location /off/ {
+            proxy_pass http://127.0.0.1:8081/;
+            send_zerocopy off;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+        }
+    }
+}
+
+EOF
+
+my $body = join '', map { sprintf "%08d\n", $_ } 1 .. 400000;
+
+$t->write_file('big.html', $body);
+$t->try_run('no send_zerocopy')->plan(5);
+
+###############################################################################
+
+my $md5 = md5_hex($body);
+
+is(md5_hex(content(get('/big.html'))), $md5, 'response');
+is(md5_hex(content(get('/big.html', 1))), $md5, 'slow client');
+is(md5_hex(content(get('/off/big.html'))), $md5, 'off');
+
+SKIP: {
+skip 'no --with-debug', 2 unless $t->has_module('--with-debug');
+
+my $log = $t->read_file('error.log');
+
+like($log, qr/sendmsg\(MSG_ZEROCOPY\): \d+ of/, 'zerocopy send');
+like($log, qr/zerocopy completed #0-/, 'zerocopy completion');
+
+}
+
+###############################################################################
+
+sub get {
+	my ($uri, $slow) = @_;
+
+	my $s = http(<<EOF, start => 1);
+GET $uri HTTP/1.0
+Host: localhost
+
+EOF
+
+	return http_end($s) unless $slow;
+
+	# the socket buffers are filled up, and the buffers sent by nginx
+	# are not released by the kernel until the client reads
+
+	my ($r, $buf) = ('');
+
+	while ($s->sysread($buf, 65536)) {
+		$r .= $buf;
+		select undef, undef, undef, 0.01;
+	}
+
+	return $r;
+}
+
+sub content {
+	my ($r) = @_;
+	$r =~ s/.*?\x0d\x0a\x0d\x0a//s;
+	return $r;
+}
+
+###############################################################################
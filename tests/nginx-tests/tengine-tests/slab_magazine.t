@@ -0,0 +1,139 @@
+#!/usr/bin/perl
+
+# Tests for the slab magazines of the shared memory zones.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http limit_req/)->plan(8)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+worker_processes 2;
+
+slab_magazine 16;
+
+events {
+    accept_mutex off;
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    limit_req_zone $arg_k zone=one:32k rate=1000r/s;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            limit_req zone=one burst=100;
+        }
+
+        location /stat {
+            slab_stat;
+        }
+    }
+}
+
+EOF
+
+$t->write_file('index.html', 'SEE-THIS');
+$t->run();
+
+###############################################################################
+
+like(http_get('/?k=a'), qr/200 OK.*SEE-THIS$/s, 'request');
+
+# the same keys again, the nodes are allocated from the magazines
+
+my $ok = 0;
+
+for (1 .. 2) {
+	for my $k (1 .. 50) {
+		$ok++ if http_get("/?k=$k") =~ /200 OK/;
+	}
+}
+
+is($ok, 100, 'requests');
+
+my $stat = http_get('/stat');
+
+like($stat, qr/^magazine:\s+\d+\(Bytes\) cached:\s+\d+ hits:\s+[1-9]/m,
+	'magazine hits');
+
+# each of the two workers caches up to 16 chunks of a size
+
+my @cached = $stat =~ /^magazine:.* cached:\s+(\d+) /mg;
+
+ok(@cached && !grep({ $_ > 32 } @cached), 'magazine capacity');
+
+# more keys than the zone can keep, the old nodes are evicted, and the
+# chunks cached by the workers are returned to the zone when it is full
+
+$ok = 0;
+
+for my $k (1 .. 1000) {
+	$ok++ if http_get(sprintf("/?k=key-%08d", $k)) =~ /200 OK/;
+}
+
+is($ok, 1000, 'zone exhausted');
+
+# the size is changed on reload, 0 returns the cached chunks to the zone
+
+reload($t, 0);
+
+http_get("/?k=$_") for 1 .. 50;
+
+@cached = http_get('/stat') =~ /^magazine:.* cached:\s+(\d+) /mg;
+
+ok(!grep({ $_ > 0 } @cached), 'disabled on reload');
+
+reload($t, 2);
+
+http_get("/?k=$_") for 1 .. 50;
+
+@cached = http_get('/stat') =~ /^magazine:.* cached:\s+(\d+) /mg;
+
+ok(@cached && !grep({ $_ > 4 } @cached), 'size changed on reload');
+
+$t->stop();
+
+unlike($t->read_file('error.log'), qr/\[(alert|emerg|crit)\]/, 'no errors');#
+
+sub reload {
+	my ($t, $size) = @_;
+
+	my $conf = $t->read_file('nginx.conf');
+	$conf =~ s/slab_magazine \d+;/slab_magazine $size;/;
+	$t->write_file('nginx.conf', $conf);
+
+	my $n = () = $t->read_file('error.log') =~ /exited with code/g;
+
+	$t->reload();
+
+	for (1 .. 50) {
+		last if (() = $t->read_file('error.log') =~ /exited with code/g)
+			>= $n + 2;
+		select undef, undef, undef, 0.1;
+	}
+}
+
+###############################################################################
@@ -0,0 +1,206 @@
+#!/usr/bin/perl
+
+# Copyright (C) 2010-2026 Alibaba Group Holding Limited
+
+# Tests for ssl_ktls: the kernel TLS offload for http and stream ssl, and
+# the $ssl_ktls variable.  Whether the kernel TLS is used depends on the
+# kernel and the OpenSSL library, so the responses are checked either way.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+use Digest::MD5 qw/ md5_hex /;
+use IPC::Open2;
+use Time::HiRes qw/ time /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()
+	->has(qw/http http_ssl proxy stream stream_ssl stream_return/)
+	->has_daemon('openssl')->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    ssl_certificate_key localhost.key;
+    ssl_certificate localhost.crt;
+
+    ssl_ktls on;
+
+    server {
+        listen       127.0.0.1:8443 ssl;
+        server_name  localhost;
+
+        sendfile on;
+
+        add_header X-KTLS $ssl_ktls;
+
+        location / {
+        }
+
+        location /proxy/ {
+            proxy_pass http://127.0.0.1:8081/;
+        }
+
+        location /limit/ {
+            proxy_pass http://127.0.0.1:8081/;
+            limit_rate 2m;
+        }
+
+        location /limit/file/ {
+            alias %%TESTDIR%%/;
+            limit_rate 2m;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8444 ssl;
+        server_name  localhost;
+
+        ssl_ktls off;
+
+        location / {
+            return 200 $ssl_ktls;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+        }
+    }
+}
+
+stream {
+    %%TEST_GLOBALS_STREAM%%
+
+    server {
+        listen       127.0.0.1:8445 ssl;
+
+        ssl_certificate_key localhost.key;
+        ssl_certificate localhost.crt;
+
+        ssl_ktls on;
+
+        return $ssl_ktls;
+    }
+}
+
+EOF
+
+$t->write_file('openssl.conf', <<EOF);
+[ req ]
+default_bits = 2048
+encrypt_key = no
+distinguished_name = req_distinguished_name
+[ req_distinguished_name ]
+EOF
+
+my $d = $t->testdir();
+
+foreach my $name ('localhost') {
+	system('openssl req -x509 -new '
+		. "-config $d/openssl.conf -subj /CN=$name/ "
+		. "-out $d/$name.crt -keyout $d/$name.key "
+		. ">>$d/openssl.out 2>&1") == 0
+		or die "Can't create certificate for $name: $!\n";
+}
+
+my $body = join '', map { sprintf "%08d\n", $_ } 1 .. 400000;
+
+$t->write_file('big.html', $body);
+$t->try_run('no ssl_ktls')->plan(8);
+
+###############################################################################
+
+my $md5 = md5_hex($body);
+
+my $r = get('/big.html');
+my ($ktls) = $r =~ /X-KTLS: (.*)\x0d/;
+
+like($ktls, qr/^(off|send|recv|send,recv)$/, 'ktls variable');
+is(md5_hex(content($r)), $md5, 'static file');
+is(md5_hex(content(get('/proxy/big.html'))), $md5, 'proxied');
+
+is(content(get('/', 8444)), 'off', 'ktls off');
+
+# 3.6M at 2m per second, with the kernel tls or not
+
+my $start = time();
+get('/limit/big.html');
+cmp_ok(time() - $start, '>=', 1, 'limit rate');
+
+$start = time();
+get('/limit/file/big.html');
+cmp_ok(time() - $start, '>=', 1, 'limit rate sendfile');
+
+like(stream_get(), qr/^(off|send|recv|send,recv)$/, 'stream ktls variable');
+
+SKIP: {
+skip 'no kernel tls', 1 unless $ktls =~ /send/;
+skip 'no --with-debug', 1 unless $t->has_module('--with-debug');
+
+like($t->read_file('error.log'), qr/SSL_sendfile: \d+/, 'ssl sendfile');
+
+}
+
+###############################################################################
+
+# IO::Socket::SSL is not required, openssl s_client is used as the client
+
+sub get {
+	my ($uri, $port) = @_;
+
+	return ssl_get("GET $uri HTTP/1.0\r\nHost: localhost\r\n\r\n",
+		$port || 8443);
+}
+
+sub stream_get {
+	return ssl_get('', 8445);
+}
+
+sub ssl_get {
+	my ($request, $port) = @_;
+
+	my $pid = open2(my $out, my $in, 'openssl s_client -quiet -connect '
+		. '127.0.0.1:' . port($port) . ' 2>/dev/null');
+
+	print $in $request;
+	close $in;
+
+	local $/;
+	my $r = <$out>;
+
+	waitpid($pid, 0);
+
+	return $r;
+}
+
+sub content {
+	my ($r) = @_;
+	$r =~ s/.*?\x0d\x0a\x0d\x0a//s;
+	return $r;
+}
+
+###############################################################################
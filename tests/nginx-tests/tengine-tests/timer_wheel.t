@@ -0,0 +1,170 @@
+#!/usr/bin/perl
+
+# Tests for the timer wheel.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+use IO::Select;
+use Time::HiRes qw/ time /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy/)->plan(6)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+    timer_wheel on;
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        keepalive_timeout  3s;
+
+        location / {
+            return 200 OK;
+        }
+
+        location /proxy {
+            proxy_pass http://127.0.0.1:8082;
+            proxy_read_timeout 1500ms;
+        }
+
+        location /rate {
+            limit_rate 20k;
+            alias %%TESTDIR%%/file;
+        }
+    }
+
+    # the timers above the first level of the wheel
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        keepalive_timeout  10s;
+
+        location / {
+            return 200 OK;
+        }
+    }
+}
+
+EOF
+
+$t->write_file('file', 'x' x 40000);
+$t->run();
+
+###############################################################################
+
+# the backend accepts the connection, but never responds
+
+my $backend = IO::Socket::INET->new(
+	Proto => 'tcp',
+	LocalAddr => '127.0.0.1:' . port(8082),
+	Listen => 5,
+	Reuse => 1
+)
+	or die "Can't create listening socket: $!\n";
+
+my %start;
+my $start = time();
+
+my $short = keepalive(8080);
+my $long = keepalive(8081);
+
+my $r = http_get('/proxy');
+my $elapsed = time() - $start;
+
+ok($r =~ /504 Gateway/ && $elapsed > 1.4 && $elapsed < 3, 'proxy read timeout')
+	or diag("elapsed $elapsed");
+
+$start = time();
+like(http_get('/rate'), qr/x{40000}$/, 'limit rate');
+$elapsed = time() - $start;
+
+ok($elapsed > 1 && $elapsed < 3, 'limit rate timers') or diag("elapsed $elapsed");
+
+$elapsed = closed($short, 10);
+ok($elapsed > 2.5 && $elapsed < 4.5, 'keepalive timeout') or diag("elapsed $elapsed");
+
+$elapsed = closed($long, 15);
+ok($elapsed > 9.5 && $elapsed < 11.5, 'keepalive timeout cascaded')
+	or diag("elapsed $elapsed");
+
+# the timers are reset lazily on every request
+
+my $s = keepalive(8080);
+
+for (1 .. 5) {
+	select undef, undef, undef, 0.5;
+	http(<<EOF, socket => $s, start => 1);
+GET / HTTP/1.1
+Host: localhost
+
+EOF
+	$s->sysread(my $buf, 4096);
+}
+
+$elapsed = closed($s, 10);
+ok($elapsed > 5 && $elapsed < 7, 'keepalive timeout reset')
+	or diag("elapsed $elapsed");
+
+###############################################################################
+
+# a keepalive connection after the response, the time is counted from it
+
+sub keepalive {
+	my ($port) = @_;
+
+	my $s = IO::Socket::INET->new('127.0.0.1:' . port($port))
+		or die "Can't connect to nginx: $!\n";
+
+	http(<<EOF, socket => $s, start => 1);
+GET / HTTP/1.1
+Host: localhost
+
+EOF
+
+	IO::Select->new($s)->can_read(5);
+	$s->sysread(my $buf, 4096);
+
+	$start{$s} = time();
+
+	return $s;
+}
+
+sub closed {
+	my ($s, $timeout) = @_;
+
+	my $sel = IO::Select->new($s);
+
+	while ($sel->can_read($timeout)) {
+		last unless $s->sysread(my $buf, 4096);
+	}
+
+	return time() - $start{$s};
+}
+
+###############################################################################
@@ -0,0 +1,101 @@
+#!/usr/bin/perl
+
+# Tests for upstream check done by the "upstream_check" process.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy rewrite/)->plan(5)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+worker_processes 2;
+
+events {
+}
+
+processes {
+    process upstream_check {
+        count 1;
+        delay_start 0s;
+    }
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    upstream backend {
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+
+        check interval=300 rise=1 fall=1 timeout=1000 type=http;
+        check_http_send "GET / HTTP/1.0\r\n\r\n";
+        check_http_expect_alive http_2xx;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass http://backend;
+        }
+
+        location /status {
+            check_status csv;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+            return 200 "backend";
+        }
+    }
+}
+
+EOF
+
+$t->run();
+
+###############################################################################
+
+my $status;
+
+for (1 .. 50) {
+	$status = http_get('/status');
+	last if $status =~ /8081,up/;
+	select undef, undef, undef, 0.1;
+}
+
+like($status, qr/127.0.0.1:8081,up/, 'checked peer up');
+like($status, qr/127.0.0.1:8082,down/, 'checked peer down');
+
+like(http_get('/'), qr/backend/, 'request 1');
+like(http_get('/'), qr/backend/, 'request 2');
+
+$t->stop();
+
+like($t->read_file('error.log'), qr/is done by the "upstream_check" process/,
+	'no check timers in workers');
+
+###############################################################################
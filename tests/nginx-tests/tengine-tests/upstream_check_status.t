@@ -0,0 +1,118 @@
+#!/usr/bin/perl
+
+# Tests for the probe statistics of the upstream check status page, and for
+# the probes started in batches.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy rewrite/)->plan(8)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+worker_processes 2;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    check_batch 1;
+
+    upstream backend {
+        server 127.0.0.1:8081;
+
+        check interval=200 rise=1 fall=1 timeout=1000 type=http;
+        check_keepalive_requests 100;
+        check_http_send "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        check_http_expect_alive http_2xx;
+    }
+
+    upstream batch {
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+        server 127.0.0.1:8083;
+
+        check interval=200 rise=1 fall=1 timeout=1000 type=tcp;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location /status {
+            check_status json;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+            return 200 "backend";
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8082;
+        listen       127.0.0.1:8083;
+        server_name  localhost;
+    }
+}
+
+EOF
+
+$t->run();
+
+###############################################################################
+
+my $json;
+
+for (1 .. 50) {
+	$json = http_get('/status');
+	last if $json =~ /"probes": [3-9]/;
+	select undef, undef, undef, 0.1;
+}
+
+like($json, qr/"probes": [3-9]/, 'json probes');
+like($json, qr/"connects": 1,/, 'json keepalive connection reused');
+
+for (1 .. 50) {
+	$json = http_get('/status');
+	last if $json !~ /"upstream": "batch".*"probes": 0,/;
+	select undef, undef, undef, 0.1;
+}
+
+unlike($json, qr/"upstream": "batch".*"probes": 0,/, 'batched probes');
+like($json, qr/"latency": \{"1": \d+, .*"\+Inf": [3-9]\}/, 'json histogram');
+
+my $prom = http_get('/status?format=prometheus');
+
+like($prom, qr/^# TYPE nginx_upstream_server_probe_latency_ms histogram$/m,
+	'prometheus histogram type');
+like($prom, qr/^nginx_upstream_server_probe_latency_ms_bucket\{.*le="5000"\} \d+$/m,
+	'prometheus bucket');
+like($prom, qr/^nginx_upstream_server_probe_latency_ms_count\{.*\} \d+$/m,
+	'prometheus count');
+like($prom, qr/^nginx_upstream_server_probe_connects\{.*\} 1$/m,
+	'prometheus connects');
+
+###############################################################################
@@ -0,0 +1,235 @@
+#!/usr/bin/perl
+
+# Tests for the maglev method of the upstream hash module.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()
+	->has(qw/http proxy upstream_hash upstream_zone stream stream_upstream_hash/)
+	->plan(8)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    upstream u {
+        hash $arg_k maglev;
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+        server 127.0.0.1:8083;
+    }
+
+    upstream zone {
+        zone z 64k;
+        hash $arg_k maglev;
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+        server 127.0.0.1:8083;
+    }
+
+    upstream fail {
+        zone f 64k;
+        hash $arg_k maglev;
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+        server 127.0.0.1:8085 max_fails=1 fail_timeout=60s;
+    }
+
+    upstream down {
+        hash $arg_k maglev;
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+        server 127.0.0.1:8083 down;
+    }
+
+    upstream weight {
+        hash $arg_k maglev;
+        server 127.0.0.1:8081 weight=3;
+        server 127.0.0.1:8082;
+    }
+
+    upstream check {
+        hash $arg_k maglev;
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8084;
+
+        check interval=100 rise=1 fall=1 timeout=300 type=tcp;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        proxy_next_upstream off;
+
+        location /u {
+            proxy_pass http://u;
+        }
+
+        location /zone {
+            proxy_pass http://zone;
+        }
+
+        location /fail {
+            proxy_pass http://fail;
+            proxy_next_upstream error;
+        }
+
+        location /down {
+            proxy_pass http://down;
+        }
+
+        location /weight {
+            proxy_pass http://weight;
+        }
+
+        location /check {
+            proxy_pass http://check;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        listen       127.0.0.1:8082;
+        listen       127.0.0.1:8083;
+        server_name  localhost;
+
+        location / {
+            return 200 $server_port;
+        }
+    }
+}
+
+stream {
+    upstream s {
+        hash $remote_addr maglev;
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+        server 127.0.0.1:8083;
+    }
+
+    server {
+        listen      127.0.0.1:8090;
+        proxy_pass  s;
+    }
+}
+
+EOF
+
+$t->run();
+
+###############################################################################
+
+my (%ports, %before);
+my $same = 1;
+
+for my $k (1 .. 60) {
+	my $port = get_body("/u?k=$k");
+	$same = 0 unless get_body("/u?k=$k") eq $port;
+	$before{$k} = $port;
+	$ports{$port} += 1;
+}
+
+ok($same, 'consistent');
+is(join(' ', sort keys %ports), '8081 8082 8083', 'spread');
+
+# the table of an upstream in a shared zone is built by workers
+
+$same = 1;
+
+for my $k (1 .. 60) {
+	$same = 0 unless get_body("/zone?k=$k") eq $before{$k};
+}
+
+ok($same, 'zone');
+
+# the keys of a failed server go to the others, and stay there
+
+my $failed = 0;
+
+for my $k (1 .. 60) {
+	my $port = get_body("/fail?k=$k");
+	$failed++ if $port eq 'failed' || $port ne get_body("/fail?k=$k");
+}
+
+is($failed, 0, 'failed server');
+
+# only the keys of the down server move
+
+my $moved = 0;
+
+for my $k (1 .. 60) {
+	my $port = get_body("/down?k=$k");
+	$moved++ if $port eq '8083' || $port eq 'failed'
+		|| ($before{$k} ne '8083' && $port ne $before{$k});
+}
+
+is($moved, 0, 'down server');
+
+%ports = ();
+$ports{get_body("/weight?k=$_")} += 1 for 1 .. 200;
+
+ok(($ports{'8081'} || 0) > 2 * ($ports{'8082'} || 0), 'weight')
+	or diag(explain(\%ports));
+
+# the checker marks 8084 down, its keys go to 8081
+
+select undef, undef, undef, 1;
+
+%ports = ();
+$ports{get_body("/check?k=$_")} += 1 for 1 .. 20;
+
+is($ports{'8081'}, 20, 'check down');
+
+%ports = ();
+$ports{stream_body()} += 1 for 1 .. 5;
+
+is(join(' ', values %ports), '5', 'stream');
+
+###############################################################################
+
+sub get_body {
+	my ($uri) = @_;
+
+	my $r = http_get($uri);
+
+	return 'failed' unless defined $r && $r =~ /200 OK/;
+
+	$r =~ /\x0d\x0a\x0d\x0a(.*)/ms;
+
+	return $1;
+}
+
+sub stream_body {
+	my $r = http_get('/', socket => IO::Socket::INET->new('127.0.0.1:8090'));
+
+	return 'failed' unless defined $r && $r =~ /200 OK/;
+
+	$r =~ /\x0d\x0a\x0d\x0a(.*)/ms;
+
+	return $1;
+}
+
+###############################################################################
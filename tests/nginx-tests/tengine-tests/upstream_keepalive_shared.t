@@ -0,0 +1,154 @@
+#!/usr/bin/perl
+
+# Copyright (C) 2010-2026 Alibaba Group Holding Limited
+
+# Tests for keepalive_shared: an idle upstream connection cached by one
+# worker process is used by the other worker processes.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy upstream_keepalive/)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+worker_processes 2;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    upstream shared {
+        server 127.0.0.1:8081;
+        keepalive 8;
+        keepalive_shared zone=ka:64k;
+    }
+
+    upstream max {
+        server 127.0.0.1:8081;
+        keepalive 8;
+        keepalive_shared zone=ka max=1;
+    }
+
+    upstream local {
+        server 127.0.0.1:8081;
+        keepalive 8;
+    }
+
+    server {
+        listen       127.0.0.1:8080 reuseport;
+        server_name  localhost;
+
+        proxy_http_version 1.1;
+        proxy_set_header Connection "";
+
+        add_header X-Worker $pid;
+
+        location /shared {
+            proxy_pass http://shared;
+        }
+
+        location /max {
+            proxy_pass http://max;
+        }
+
+        location /local {
+            proxy_pass http://local;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+            add_header X-Conn $connection;
+            return 200 "body";
+        }
+    }
+}
+
+EOF
+
+$t->try_run('no keepalive_shared')->plan(5);
+
+###############################################################################
+
+my (%workers, %conns);
+
+for (1 .. 30) {
+	my $r = http_get('/shared');
+	$workers{$1} = 1 if $r =~ /X-Worker: (\d+)/;
+	$conns{$1} = 1 if $r =~ /X-Conn: (\d+)/;
+}
+
+my $log = $t->read_file('error.log');
+
+SKIP: {
+skip 'requests served by one worker', 5 if keys %workers < 2;
+skip 'pidfd_getfd() not permitted', 5 if $log =~ /pidfd_getfd\(\) failed/;
+
+is(keys %conns, 1, 'connection shared by workers');
+
+like(http_get('/shared'), qr/body$/, 'request');
+
+%workers = (); %conns = ();
+
+for (1 .. 30) {
+	my $r = http_get('/local');
+	$workers{$1} = 1 if $r =~ /X-Worker: (\d+)/;
+	$conns{$1} = 1 if $r =~ /X-Conn: (\d+)/;
+}
+
+cmp_ok(keys %conns, '>=', keys %workers, 'connections not shared');
+
+%conns = ();
+
+for (1 .. 30) {
+	my $r = http_get('/max');
+	$conns{$1} = 1 if $r =~ /X-Conn: (\d+)/;
+}
+
+is(keys %conns, 1, 'connection shared with max');
+
+# workers of the old configuration do not share with the new ones
+
+$t->reload();
+
+for (1 .. 50) {
+	last if (() = $t->read_file('error.log')
+		=~ /worker process \d+ exited/g) >= 2;
+	select undef, undef, undef, 0.1;
+}
+
+%conns = ();
+
+for (1 .. 30) {
+	my $r = http_get('/shared');
+	$conns{$1} = 1 if $r =~ /X-Conn: (\d+)/;
+}
+
+is(keys %conns, 1, 'connection shared after reload');
+
+}
+
+###############################################################################
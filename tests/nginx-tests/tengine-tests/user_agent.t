@@ -0,0 +1,116 @@
+#!/usr/bin/perl
+
+# Tests for the user_agent module.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http/)->plan(11);
+
+# many keywords with common suffixes, the search clues of the nodes are
+# built breadth-first for all of them
+
+my $many = join "\n", map { sprintf "        App%04dBrowser  1.0+  app%d;", $_, $_ }
+	1 .. 3000;
+
+$t->write_file_expand('nginx.conf', <<"EOF");
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    user_agent \$browser {
+        default                         unknown;
+
+        greedy                          Safari;
+
+        Chrome      18.0+               chrome18;
+        Chrome      17.0~17.9999        chrome17;
+        Chrome      5.0-                chrome_low;
+        Firefox     5.0+                firefox;
+        MSIE        9.0                 msie9;
+
+        MSafari/                        msafari;
+    }
+
+    user_agent \$app {
+        default                         none;
+$many
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            return 200 "browser:\$browser app:\$app";
+        }
+    }
+}
+
+EOF
+
+$t->run();
+
+###############################################################################
+
+like(ua('Mozilla/5.0 (Windows NT 6.1) AppleWebKit/535.19 (KHTML, like Gecko) '
+	. 'Chrome/18.0.1025.162 Safari/535.19'), qr/browser:chrome18 /,
+	'greedy keyword skipped');
+like(ua('Mozilla/5.0 AppleWebKit/535.11 Chrome/17.0.963.56 Safari/535.11'),
+	qr/browser:chrome17 /, 'interval');
+like(ua('Mozilla/5.0 Chrome/4.0.249.0 Safari/532.5'), qr/browser:chrome_low /,
+	'less or equal');
+like(ua('Mozilla/5.0 (X11; Linux i686; rv:6.0) Gecko/20100101 Firefox/6.0'),
+	qr/browser:firefox /, 'greater or equal');
+like(ua('Mozilla/5.0 (compatible; MSIE 9.0; Windows NT 6.1; Trident/5.0)'),
+	qr/browser:msie9 /, 'exact');
+like(ua('Mozilla/5.0 (compatible; MSIE 8.0; Windows NT 6.1)'),
+	qr/browser:unknown /, 'no version');
+like(ua('Mozilla/5.0 AppleWebKit/534.46 Version/5.1 Safari/7534.48.3'),
+	qr/browser:unknown /, 'greedy keyword only');
+
+# a keyword inside a longer one, the search goes on from the clue of a leaf
+
+like(ua('Mozilla/5.0 XSafari/5.0'), qr/200 OK/, 'clue to a leaf');
+like(ua('Mozilla/5.0 MSafari/5.0'), qr/browser:msafari /, 'longer keyword');
+
+like(ua('Mozilla/5.0 App0001Browser/2.0 App2999Browser/1.0'),
+	qr/app:app2999$/, 'many keywords');
+like(ua('Mozilla/5.0 App3001Browser/2.0'), qr/app:none$/,
+	'many keywords default');
+
+###############################################################################
+
+sub ua {
+	my ($ua) = @_;
+
+	return http(<<EOF);
+GET / HTTP/1.0
+Host: localhost
+User-Agent: $ua
+
+EOF
+}
+
+###############################################################################